@@ -84,17 +84,36 @@ function handleTabUpdated(tabId, changeInfo, tab) {
     return;
   }
 
-  let scoreLabels = window.filters
-    .filter(f => inBloom(f, tab_url.toString()))
-    .map(f => f.threshold);
+  // Pages are often revisited or reloaded, so the result for each URL is
+  // cached until any of the filters change
+  let url = tab_url.toString();
+  let cached = getCachedScore(url);
+  let score = cached.score;
+  if (score === null) {
+    let scoreLabels = window.filters
+      .filter(f => inBloom(f, url))
+      .map(f => f.threshold);
+
+    // Also check stories learned locally since the filters were downloaded
+    let local = inLocal(window.local, url);
+    if (local >= 0 && local < window.filters.length) {
+      scoreLabels.push(window.filters[local].threshold);
+    }
+
+    score = scoreLabels.reduce((a, b) => Math.max(a, b), -1);
 
-  if (scoreLabels.length == 0) {
+    // Lookups in a filter that is being stored always miss, so don't cache
+    // their results
+    if (!window.filters.some(f => f.currently_storing)) {
+      cacheScore(cached.fingerprint, score);
+    }
+  }
+
+  if (score < 0) {
     deactivateBadge(tab.id);
     return;
   }
 
-  let score = scoreLabels.reduce((a, b) => Math.max(a, b));
-
   // TODO: Add bloom filter results to the tablist
   activateBadge({points: (score ? `${score}+` : "")}, tabId);
   return;
@@ -102,12 +121,35 @@ function handleTabUpdated(tabId, changeInfo, tab) {
 
 
 /***
- * Open the Hacker News Discussion when the action is clicked. Do it in a new
- * Window if the Shift key is pressed when the click happens. If any other
- * modifier keys or the middle mouse button are clicked, open in a new tab.
- * Otherwise, open in the current tab.
+ * Open the discussion for a Hacker News item. Do it in a new window if the
+ * Shift key is pressed when the click happens. If any other modifier keys or
+ * the middle mouse button are clicked, open in a new tab. Otherwise, open in
+ * the current tab.
+ */
+function openDiscussion(tab, onClickData, hn_id) {
+  let hn_url = `https://news.ycombinator.com/item?id=${hn_id}`;
+  if (onClickData.button == 0 && onClickData.modifiers.length == 0) {
+    browser.tabs.update(tab.id, {url: hn_url});
+  } else if (onClickData.modifiers.includes("Shift")) {
+    browser.windows.create({url: hn_url});
+  } else {
+    browser.tabs.create({url: hn_url});
+  }
+}
+
+
+/***
+ * Open the Hacker News Discussion when the action is clicked.
  */
 function handleActionClicked(tab, onClickData) {
+  // Stories in the item map are found without a round trip to Algolia, which
+  // is only searched for stories too new to be in it
+  let local_id = lookupItemId(tab.url);
+  if (local_id) {
+    openDiscussion(tab, onClickData, local_id);
+    return;
+  }
+
   // Algolia doesn't work well with URLs like:
   // https://www.youtube.com/watch?v=-pdSjBPH3zM
   // I suspect the "=-" leads to treating "-" as an exclusion operator somehow
@@ -145,18 +187,26 @@ function handleActionClicked(tab, onClickData) {
                  || (url.pathname !== "/" && hit_url.pathname !== "/")));
       });
 
+      // Prefer stories from the same section of the site as the page, such
+      // as the same blog or repository, if the prefix filter knows of any.
+      // The prefix must end at a path segment, so that //example.com/blog
+      // does not match //example.com/blogroll.
+      let prefix = longestPrefix(tab.url);
+      if (prefix) {
+        let under = stories.filter(hit => {
+          let canonical = canonicalizeUrl(hit.url);
+          return canonical.startsWith(prefix)
+            && /^([/?]|$)/.test(canonical.slice(prefix.length));
+        });
+        if (under.length > 0) {
+          stories = under;
+        }
+      }
+
       // If a story matched, go to the discussion for the one Algolia picked as
       // the "top" result
       if (stories.length > 0) {
-        let hn_id = stories[0].objectID;
-        let hn_url = `https://news.ycombinator.com/item?id=${hn_id}`;
-        if (onClickData.button == 0 && onClickData.modifiers.length == 0) {
-          browser.tabs.update(tab.id, {url: hn_url});
-        } else if (onClickData.modifiers.includes("Shift")) {
-          browser.windows.create({url: hn_url});
-        } else {
-          browser.tabs.create({url: hn_url});
-        }
+        openDiscussion(tab, onClickData, stories[0].objectID);
         return;
       }
 
@@ -167,8 +217,8 @@ function handleActionClicked(tab, onClickData) {
 
 
 /***
- * Add Hacker News story URLs from browsed pages to the Bloom filter. Re-adding
- * URLs that are already there doesn't cost much, nor does it cause harm, so we
+ * Add Hacker News story URLs from browsed pages to the local cuckoo filter.
+ * Re-adding URLs that are already there updates their score threshold, so we
  * don't even bother detecting it.
  *
  * This function is called when a content script runs on news.ycombinator.com
@@ -179,12 +229,26 @@ function addLatest(message) {
     return;
   }
 
-  for (let i = 0; i < window.filters.length; i++) {
-    f = window.filters[i];
-    message.stories
-      .filter(u => u.score >= f.threshold)
-      .forEach(u => addBloom(f, u.url));
-  }
+  message.stories.forEach(u => {
+    // Find the index of the highest threshold the story meets
+    let best = -1;
+    window.filters.forEach((f, i) => {
+      if (u.score >= f.threshold
+          && (best < 0 || f.threshold > window.filters[best].threshold)) {
+        best = i;
+      }
+    });
+    if (best < 0) {
+      return;
+    }
+
+    // Fall back to adding to each Bloom filter if the local filter is full
+    if (!addLocal(window.local, u.url, best)) {
+      window.filters
+        .filter(f => u.score >= f.threshold)
+        .forEach(f => addBloom(f, u.url));
+    }
+  });
 
   // Save the updated Bloom filter
   // TODO: Maybe re-enable this someday? Still it takes a couple seconds of
@@ -207,6 +271,7 @@ async function reloadSettings(message) {
   }
 
   await loadSettings();
+  invalidateCachedScores();
 }
 
 
@@ -257,6 +322,13 @@ async function resetBloom(message) {
   // Every 10 minutes, check if the Bloom filter is outdated, and update if so
   setInterval(updateBloom, 10 * 60 * 1000);
 
+  // In debug mode, print filter statistics just as often
+  setInterval(() => {
+    if (window.settings.debug_mode) {
+      console.debug("Bloom filter statistics: ", getStats());
+    }
+  }, 10 * 60 * 1000);
+
   // Style the browser action button
   browser.browserAction.disable();
   browser.browserAction.setBadgeText({text: ""});
@@ -0,0 +1,433 @@
+/* bench/bloom-bench.c
+ *
+ * Measure the performance of the Murmur3 and Bloom filter implementations, and
+ * the empirical false positive rate of Bloom filters against the theoretical
+ * one. Results are printed to standard output as JSON so that they can be
+ * compared against a stored baseline with bench/compare-bench.py.
+ */
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom-file.h"
+#include "murmur.h"
+#include "prefix-filter.h"
+
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+// Filter size and number of keys used by the extension. Lookups are timed on
+// a subset of the keys, since the cost of each one does not depend on how
+// many are checked.
+#define FILTER_BITS 27
+#define NUM_KEYS (1 << 22)
+#define NUM_LOOKUPS (1 << 20)
+
+// Every measurement is repeated, and the fastest run is reported, since
+// slower runs are slower because of noise rather than because of the code
+#define REPEATS 3
+
+// Keys are stored in fixed-size slots so they can be generated up-front
+#define KEY_SLOT 48
+
+#define MURMUR_BYTES (1 << 26)
+
+// Prefix filters are sized like the ones published, and hold the prefixes of
+// URLs on fewer sites than keys, so that sites share prefixes
+#define PREFIX_FILTER_BITS 25
+#define PREFIX_SITES (1 << 16)
+
+#define FP_BITS 20
+#define FP_TRIALS 1000000
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Return the current time in seconds from a monotonic clock.
+ */
+double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+/***
+ * Print one result as a JSON object. Whether higher or lower values are better
+ * ("higher", "lower", or "none" for informational values) is included so that
+ * baselines can be compared without knowing about each metric.
+ */
+void print_result(char *name, double value, char *unit, char *better) {
+  static int first = 1;
+  printf("%s\n    { \"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\", "
+      "\"better\": \"%s\" }", first ? "" : ",", name, value, unit, better);
+  first = 0;
+}
+
+
+/***
+ * Generate distinct keys that look like canonical URLs into fixed-size slots,
+ * storing the length of each. Keys from different prefixes never collide.
+ */
+void make_keys(char *keys, uint32_t *lengths, int n, char *prefix) {
+  for (int i = 0; i < n; i++) {
+    lengths[i] = sprintf(keys + (size_t)i * KEY_SLOT,
+        "//%s.example.com/item?id=%d", prefix, i);
+  }
+}
+
+
+
+/*******************************************************************************
+ * Benchmarks
+ ******************************************************************************/
+
+/***
+ * Measure murmur3 throughput for keys of several lengths, including the
+ * lengths of typical URLs.
+ */
+void bench_murmur() {
+  uint32_t key_lengths[] = { 8, 16, 32, 64, 128, 1024 };
+  byte *data = (byte *)malloc(MURMUR_BYTES + 1024);
+  for (size_t i = 0; i < MURMUR_BYTES + 1024; i++) {
+    data[i] = (byte)(i * 2654435761u >> 24);
+  }
+
+  for (size_t l = 0; l < sizeof(key_lengths) / sizeof(key_lengths[0]); l++) {
+    uint32_t length = key_lengths[l];
+    size_t n = MURMUR_BYTES / length;
+    double best = INFINITY;
+    volatile uint32_t sink = 0;
+    for (int r = 0; r < REPEATS; r++) {
+      double start = now();
+      uint32_t hash = 0;
+      for (size_t i = 0; i < n; i++) {
+        // Offset keys by one byte each so they are not all aligned
+        hash ^= murmur3(data + i * length + (i & 7), length, 0);
+      }
+      sink ^= hash;
+      double elapsed = now() - start;
+      best = elapsed < best ? elapsed : best;
+    }
+    (void)sink;
+
+    char name[64];
+    sprintf(name, "murmur3_%u_bytes_ns", length);
+    print_result(name, best / n * 1e9, "ns/op", "lower");
+    sprintf(name, "murmur3_%u_bytes_throughput", length);
+    print_result(name, (double)n * length / best / 1e6, "MB/s", "higher");
+  }
+
+  free(data);
+}
+
+
+/***
+ * Measure adding keys to a full-size filter, and checking keys that were
+ * added (hits, which compute every hash) and keys that were not (misses,
+ * which return at the first unset bit).
+ */
+void bench_add_in(byte *bloom) {
+  char *keys = (char *)malloc((size_t)NUM_KEYS * KEY_SLOT);
+  char *others = (char *)malloc((size_t)NUM_KEYS * KEY_SLOT);
+  uint32_t *lengths = (uint32_t *)malloc(NUM_KEYS * sizeof(uint32_t));
+  uint32_t *other_lengths = (uint32_t *)malloc(NUM_KEYS * sizeof(uint32_t));
+  make_keys(keys, lengths, NUM_KEYS, "news");
+  make_keys(others, other_lengths, NUM_KEYS, "other");
+
+  // Filling the filter is only timed once, since it takes several seconds
+  double start = now();
+  for (int i = 0; i < NUM_KEYS; i++) {
+    add_bloom(bloom, FILTER_BITS, (byte *)keys + (size_t)i * KEY_SLOT,
+        lengths[i]);
+  }
+  double best = now() - start;
+  print_result("add_bloom_ns", best / NUM_KEYS * 1e9, "ns/op", "lower");
+
+  char *sets[] = { keys, others };
+  uint32_t *set_lengths[] = { lengths, other_lengths };
+  char *names[] = { "in_bloom_hit_ns", "in_bloom_miss_ns" };
+  for (int s = 0; s < 2; s++) {
+    best = INFINITY;
+    int found = 0;
+    for (int r = 0; r < REPEATS; r++) {
+      found = 0;
+      double start = now();
+      for (int i = 0; i < NUM_LOOKUPS; i++) {
+        found += in_bloom(bloom, FILTER_BITS,
+            (byte *)sets[s] + (size_t)i * KEY_SLOT, set_lengths[s][i]);
+      }
+      double elapsed = now() - start;
+      best = elapsed < best ? elapsed : best;
+    }
+    if (s == 0 && found != NUM_LOOKUPS) {
+      fprintf(stderr, "Only %d of %d added keys were found!\n", found,
+          NUM_LOOKUPS);
+      exit(EXIT_FAILURE);
+    }
+    print_result(names[s], best / NUM_LOOKUPS * 1e9, "ns/op", "lower");
+  }
+
+  // Batched lookups of misses, which are what nearly all page loads are
+  byte **pointers = (byte **)malloc(NUM_LOOKUPS * sizeof(byte *));
+  byte *out_bits = (byte *)malloc(NUM_LOOKUPS / 8);
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    pointers[i] = (byte *)others + (size_t)i * KEY_SLOT;
+  }
+  best = INFINITY;
+  for (int r = 0; r < REPEATS; r++) {
+    double start = now();
+    in_bloom_batch(bloom, FILTER_BITS, pointers, other_lengths, NUM_LOOKUPS,
+        out_bits);
+    double elapsed = now() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  print_result("in_bloom_batch_miss_ns", best / NUM_LOOKUPS * 1e9, "ns/op",
+      "lower");
+
+  free(pointers);
+  free(out_bits);
+  free(keys);
+  free(others);
+  free(lengths);
+  free(other_lengths);
+}
+
+
+/***
+ * Measure finding the longest prefix of URLs in a prefix filter, when every
+ * prefix is found (the most probes) and when not even the host is (the usual
+ * case), and compare the incremental hashes against hashing every prefix
+ * separately.
+ */
+void bench_prefixes() {
+  byte *prefixes = new_bloom(PREFIX_FILTER_BITS);
+  char *keys = (char *)malloc((size_t)NUM_LOOKUPS * KEY_SLOT);
+  char *others = (char *)malloc((size_t)NUM_LOOKUPS * KEY_SLOT);
+  uint32_t *lengths = (uint32_t *)malloc(NUM_LOOKUPS * sizeof(uint32_t));
+  uint32_t *other_lengths = (uint32_t *)malloc(NUM_LOOKUPS * sizeof(uint32_t));
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    lengths[i] = sprintf(keys + (size_t)i * KEY_SLOT,
+        "//site%d.example.com/blog/2021/post-%d", i % PREFIX_SITES, i);
+    other_lengths[i] = sprintf(others + (size_t)i * KEY_SLOT,
+        "//other%d.example.com/blog/2021/post-%d", i % PREFIX_SITES, i);
+    add_url_prefixes(prefixes, PREFIX_FILTER_BITS,
+        (byte *)keys + (size_t)i * KEY_SLOT, lengths[i]);
+  }
+
+  char *sets[] = { keys, others, keys };
+  uint32_t *set_lengths[] = { lengths, other_lengths, lengths };
+  char *names[] = { "longest_prefix_hit_ns", "longest_prefix_miss_ns",
+    "separate_prefixes_hit_ns" };
+  for (int s = 0; s < 3; s++) {
+    double best = INFINITY;
+    volatile uint32_t sink = 0;
+    for (int r = 0; r < REPEATS; r++) {
+      uint32_t total = 0;
+      double start = now();
+      for (int i = 0; i < NUM_LOOKUPS; i++) {
+        byte *url = (byte *)sets[s] + (size_t)i * KEY_SLOT;
+        if (s < 2) {
+          total += longest_url_prefix(prefixes, PREFIX_FILTER_BITS, url,
+              set_lengths[s][i]);
+          continue;
+        }
+        // Hash each prefix from the start, as without incremental hashes
+        uint32_t ends[PREFIX_MAX_DEPTH];
+        int count = url_prefixes(url, set_lengths[s][i], ends);
+        for (int j = 0; j < count && in_prefix_filter(prefixes,
+              PREFIX_FILTER_BITS, url, ends[j]); j++) {
+          total += ends[j];
+        }
+      }
+      sink ^= total;
+      double elapsed = now() - start;
+      best = elapsed < best ? elapsed : best;
+    }
+    (void)sink;
+    print_result(names[s], best / NUM_LOOKUPS * 1e9, "ns/op", "lower");
+  }
+
+  free(keys);
+  free(others);
+  free(lengths);
+  free(other_lengths);
+  free_bloom(prefixes);
+}
+
+
+/***
+ * Measure combining two full-size filters.
+ */
+void bench_combine(byte *bloom) {
+  size_t size = (size_t)1 << (FILTER_BITS - 3);
+  byte *other = new_bloom(FILTER_BITS);
+  memcpy(other, bloom, size);
+
+  double best = INFINITY;
+  for (int r = 0; r < REPEATS; r++) {
+    double start = now();
+    combine_bloom(other, bloom, FILTER_BITS);
+    double elapsed = now() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  print_result("combine_bloom_throughput", size / best / 1e9, "GB/s",
+      "higher");
+
+  free_bloom(other);
+}
+
+
+/***
+ * Measure writing a compressed filter and decompressing it in memory, both
+ * in megabytes of uncompressed filter per second.
+ */
+void bench_compression(byte *bloom) {
+  size_t size = (size_t)1 << (FILTER_BITS - 3);
+
+  // Write to a fresh temporary file so concurrent runs do not collide
+  char tempfile[] = "/tmp/bloom-bench-XXXXXX";
+  int fd;
+  if ((fd = mkstemp(tempfile)) == -1) {
+    perror("Unable to create temporary file");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+
+  double best = INFINITY;
+  for (int r = 0; r < REPEATS; r++) {
+    double start = now();
+    write_compressed_bloom(tempfile, bloom, FILTER_BITS);
+    double elapsed = now() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  print_result("write_compressed_bloom_throughput", size / best / 1e6, "MB/s",
+      "higher");
+
+  size_t compressed_size;
+  byte *compressed = read_whole_file(tempfile, &compressed_size);
+  remove(tempfile);
+  if (compressed == NULL) {
+    fprintf(stderr, "Unable to read compressed filter!\n");
+    exit(EXIT_FAILURE);
+  }
+  print_result("compression_ratio", (double)size / compressed_size, "x",
+      "higher");
+
+  best = INFINITY;
+  for (int r = 0; r < REPEATS; r++) {
+    byte *decompressed = NULL;
+    double start = now();
+    size_t decompressed_size = decompress_bloom(compressed, compressed_size,
+        &decompressed);
+    double elapsed = now() - start;
+    best = elapsed < best ? elapsed : best;
+    if (decompressed_size != size || memcmp(decompressed, bloom, size) != 0) {
+      fprintf(stderr, "Decompressed filter does not match!\n");
+      exit(EXIT_FAILURE);
+    }
+    free(decompressed);
+  }
+  print_result("decompress_bloom_throughput", size / best / 1e6, "MB/s",
+      "higher");
+
+  byte *into = new_bloom(FILTER_BITS);
+  best = INFINITY;
+  for (int r = 0; r < REPEATS; r++) {
+    double start = now();
+    int success = decompress_bloom_into(compressed, compressed_size, into,
+        size);
+    double elapsed = now() - start;
+    best = elapsed < best ? elapsed : best;
+    if (!success) {
+      fprintf(stderr, "Unable to decompress filter!\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  print_result("decompress_bloom_into_throughput", size / best / 1e6, "MB/s",
+      "higher");
+
+  free_bloom(into);
+  free(compressed);
+}
+
+
+/***
+ * Measure the false positive rate of small filters at several loads and
+ * compare it to the theoretical rate (1 - e^(-kn/m))^k. The full-size filter
+ * holding a few million keys has a rate too small to measure in reasonable
+ * time, so the filters here are loaded more heavily.
+ */
+void bench_false_positives() {
+  int loads[] = { 40000, 60000, 80000 };
+  double m = (double)((size_t)1 << FP_BITS);
+  byte *bloom = new_bloom(FP_BITS);
+  char key[KEY_SLOT];
+
+  for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+    int n = loads[l];
+    memset(bloom, 0, (size_t)1 << (FP_BITS - 3));
+    for (int i = 0; i < n; i++) {
+      add_bloom(bloom, FP_BITS, (byte *)key,
+          sprintf(key, "//news.example.com/item?id=%d", i));
+    }
+
+    int false_positives = 0;
+    for (int i = 0; i < FP_TRIALS; i++) {
+      false_positives += in_bloom(bloom, FP_BITS, (byte *)key,
+          sprintf(key, "//other.example.com/item?id=%d", i));
+    }
+    double measured = (double)false_positives / FP_TRIALS;
+    double theoretical = pow(1 - exp(-NUM_HASHES * n / m), NUM_HASHES);
+
+    char name[64];
+    sprintf(name, "false_positive_rate_%d_keys", n);
+    print_result(name, measured, "rate", "lower");
+    sprintf(name, "false_positive_ratio_%d_keys", n);
+    print_result(name, measured / theoretical, "measured/theoretical",
+        "none");
+  }
+
+  free_bloom(bloom);
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  byte *bloom;
+  if ((bloom = new_bloom(FILTER_BITS)) == NULL) {
+    perror("Unable to create Bloom filter");
+    return EXIT_FAILURE;
+  }
+
+  printf("{\n  \"filter_bits\": %d,\n  \"num_keys\": %d,\n  \"num_hashes\": "
+      "%d,\n  \"results\": [", FILTER_BITS, NUM_KEYS, NUM_HASHES);
+  bench_murmur();
+  bench_add_in(bloom);
+  bench_prefixes();
+  bench_combine(bloom);
+  bench_compression(bloom);
+  bench_false_positives();
+  printf("\n  ]\n}\n");
+
+  free_bloom(bloom);
+
+  return EXIT_SUCCESS;
+}
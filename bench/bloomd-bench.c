@@ -0,0 +1,328 @@
+/* bench/bloomd-bench.c
+ *
+ * Generate load against the bloomd lookup server and measure its throughput
+ * and latency, first with a steady filter and then while new versions are
+ * loaded over and over, to show that reloads do not stall lookups. The
+ * server binary is started on a temporary filter and socket, and stopped at
+ * the end. Results are printed to standard output as JSON so that they can be
+ * compared against a stored baseline with bench/compare-bench.py.
+ */
+
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+// The filter is the size used by the extension, so reloads take as long as
+// they would in production
+#define FILTER_BITS 27
+#define NUM_KEYS (1 << 20)
+
+// Each client sends batches of lookups and waits for the answers before
+// sending the next, like bloom-query in a pipeline would
+#define NUM_CLIENTS 4
+#define SERVER_THREADS "4"
+#define BATCH_SIZE 64
+#define SECONDS 2.0
+
+// Time between forced reloads in the second run
+#define RELOAD_NS 50000000
+
+#define KEY_SLOT 48
+#define MAX_SAMPLES (1 << 20)
+
+// The filter and socket go in a fresh temporary directory for each run
+#define TEMPDIR_TEMPLATE "/tmp/bloomd-bench-XXXXXX"
+
+
+
+/*******************************************************************************
+ * Types and global variables
+ ******************************************************************************/
+
+struct client {
+  pthread_t thread;
+  // Latency of each batch in seconds
+  double *samples;
+  int num_samples;
+  long lookups;
+  // Keys in the filter that were answered with 0, which should never happen,
+  // even while it is being reloaded
+  long false_negatives;
+  unsigned int seed;
+};
+
+static volatile int running = 0;
+
+static char tempdir[] = TEMPDIR_TEMPLATE;
+static char tempfile[sizeof(tempdir) + 16];
+static char socket_path[sizeof(tempdir) + 16];
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Return the current time in seconds from a monotonic clock.
+ */
+double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+/***
+ * Print one result as a JSON object, as in bloom-bench.c.
+ */
+void print_result(char *name, double value, char *unit, char *better) {
+  static int first = 1;
+  printf("%s\n    { \"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\", "
+      "\"better\": \"%s\" }", first ? "" : ",", name, value, unit, better);
+  first = 0;
+}
+
+
+/***
+ * Write the key for index i into buffer, returning its length. Keys with
+ * even indices are in the filter, and keys with odd indices are not.
+ */
+int make_key(char *buffer, int i) {
+  return sprintf(buffer, "//news.example.com/item?id=%d", i);
+}
+
+
+/***
+ * Connect to the server, retrying while it starts up. Returns -1 if it never
+ * accepts the connection.
+ */
+int connect_server() {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+  for (int tries = 0; tries < 500; tries++) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address))
+        == 0) {
+      return fd;
+    }
+    close(fd);
+    struct timespec pause = { 0, 10000000 };
+    nanosleep(&pause, NULL);
+  }
+  return -1;
+}
+
+
+/***
+ * Order doubles for qsort.
+ */
+int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+
+/*******************************************************************************
+ * Load generation
+ ******************************************************************************/
+
+/***
+ * Thread entry point for one client, which sends batches of random keys
+ * until the run is over.
+ */
+void *run_client(void *arg) {
+  struct client *c = (struct client *)arg;
+  int fd = connect_server();
+  if (fd < 0) {
+    perror("Unable to connect to bloomd");
+    exit(EXIT_FAILURE);
+  }
+
+  char request[BATCH_SIZE * KEY_SLOT], response[2 * BATCH_SIZE];
+  int indices[BATCH_SIZE];
+  while (__atomic_load_n(&running, __ATOMIC_RELAXED)
+      && c->num_samples < MAX_SAMPLES) {
+    size_t length = 0;
+    for (int i = 0; i < BATCH_SIZE; i++) {
+      indices[i] = rand_r(&c->seed) % (2 * NUM_KEYS);
+      length += make_key(request + length, indices[i]);
+      request[length++] = '\n';
+    }
+
+    double start = now();
+    if (write(fd, request, length) != (ssize_t)length) {
+      perror("Unable to send lookups");
+      exit(EXIT_FAILURE);
+    }
+    size_t received = 0;
+    while (received < sizeof(response)) {
+      ssize_t n = read(fd, response + received, sizeof(response) - received);
+      if (n <= 0) {
+        perror("Unable to receive answers");
+        exit(EXIT_FAILURE);
+      }
+      received += n;
+    }
+    c->samples[c->num_samples++] = now() - start;
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+      if (indices[i] % 2 == 0 && response[2 * i] != '1') {
+        c->false_negatives++;
+      }
+    }
+    c->lookups += BATCH_SIZE;
+  }
+
+  close(fd);
+  return NULL;
+}
+
+
+/***
+ * Run the clients against the server for a while, optionally sending it
+ * SIGHUP to load a new version every RELOAD_NS, and report the results with
+ * names ending in suffix.
+ */
+int bench_load(pid_t server, int reload, char *suffix) {
+  struct client clients[NUM_CLIENTS];
+  memset(clients, 0, sizeof(clients));
+  running = 1;
+  double start = now();
+  for (int i = 0; i < NUM_CLIENTS; i++) {
+    clients[i].seed = i + 1;
+    if ((clients[i].samples = (double *)malloc(MAX_SAMPLES * sizeof(double)))
+        == NULL || pthread_create(&clients[i].thread, NULL, run_client,
+          &clients[i]) != 0) {
+      perror("Unable to start client");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  int reloads = 0;
+  while (now() - start < SECONDS) {
+    struct timespec pause = { 0, RELOAD_NS };
+    nanosleep(&pause, NULL);
+    if (reload) {
+      kill(server, SIGHUP);
+      reloads++;
+    }
+  }
+  __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+
+  // Gather every client's samples to find percentiles over all of them
+  long lookups = 0, false_negatives = 0;
+  int num_samples = 0;
+  double *samples = (double *)malloc(NUM_CLIENTS * MAX_SAMPLES
+      * sizeof(double));
+  for (int i = 0; i < NUM_CLIENTS; i++) {
+    pthread_join(clients[i].thread, NULL);
+    lookups += clients[i].lookups;
+    false_negatives += clients[i].false_negatives;
+    memcpy(samples + num_samples, clients[i].samples,
+        clients[i].num_samples * sizeof(double));
+    num_samples += clients[i].num_samples;
+    free(clients[i].samples);
+  }
+  double elapsed = now() - start;
+  qsort(samples, num_samples, sizeof(double), compare_doubles);
+
+  char name[64];
+  sprintf(name, "bloomd_lookups%s", suffix);
+  print_result(name, lookups / elapsed / 1e6, "M lookups/s", "higher");
+  sprintf(name, "bloomd_batch_p50%s", suffix);
+  print_result(name, samples[num_samples / 2] * 1e6, "us", "lower");
+  sprintf(name, "bloomd_batch_p99%s", suffix);
+  print_result(name, samples[(int)(num_samples * 0.99)] * 1e6, "us", "lower");
+  sprintf(name, "bloomd_batch_max%s", suffix);
+  print_result(name, samples[num_samples - 1] * 1e6, "us", "lower");
+  if (reload) {
+    print_result("bloomd_reloads_sent", reloads, "reloads", "none");
+  }
+  free(samples);
+
+  if (false_negatives > 0) {
+    fprintf(stderr, "Keys in the filter were not found %ld times!\n",
+        false_negatives);
+    return 0;
+  }
+  return 1;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s BLOOMD\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (mkdtemp(tempdir) == NULL) {
+    perror("Unable to create temporary directory");
+    return EXIT_FAILURE;
+  }
+  sprintf(tempfile, "%s/filter.bloom", tempdir);
+  sprintf(socket_path, "%s/bloomd.sock", tempdir);
+
+  // Every even key is in the filter
+  byte *bloom;
+  if ((bloom = new_bloom(FILTER_BITS)) == NULL) {
+    perror("Unable to create Bloom filter");
+    return EXIT_FAILURE;
+  }
+  char key[KEY_SLOT];
+  for (int i = 0; i < 2 * NUM_KEYS; i += 2) {
+    add_bloom(bloom, FILTER_BITS, (byte *)key, make_key(key, i));
+  }
+  write_compressed_bloom(tempfile, bloom, FILTER_BITS);
+  free_bloom(bloom);
+
+  // Only reload when told to, so the first run is not disturbed
+  pid_t server;
+  if ((server = fork()) == 0) {
+    execl(argv[1], argv[1], "-s", socket_path, "-t", SERVER_THREADS, "-i",
+        "1000000000", tempfile, (char *)NULL);
+    perror("Unable to start bloomd");
+    _exit(EXIT_FAILURE);
+  } else if (server < 0) {
+    perror("Unable to start bloomd");
+    return EXIT_FAILURE;
+  }
+
+  printf("{\n  \"filter_bits\": %d,\n  \"clients\": %d,\n  \"batch_size\": "
+      "%d,\n  \"results\": [", FILTER_BITS, NUM_CLIENTS, BATCH_SIZE);
+  int success = bench_load(server, 0, "");
+  success = bench_load(server, 1, "_reloading") && success;
+  printf("\n  ]\n}\n");
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  remove(tempfile);
+  remove(socket_path);
+  rmdir(tempdir);
+
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
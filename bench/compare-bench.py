@@ -0,0 +1,84 @@
+#!/usr/bin/python3
+
+###############################################################################
+###############################################################################
+##
+## compare-bench.py
+##
+## Compare the JSON output of bloom-bench against a stored baseline, printing
+## the change in every result and exiting with an error if any result got
+## worse by more than the tolerance. Results measured on different machines
+## are not comparable, so baselines should come from the same machine.
+##
+## Usage: compare-bench.py BASELINE CURRENT [TOLERANCE]
+##
+###############################################################################
+###############################################################################
+
+
+import json
+import sys
+
+
+###############################################################################
+# Helper functions
+###############################################################################
+
+def load_results(filename):
+    with open(filename, "r") as f:
+        return {r["name"]: r for r in json.load(f)["results"]}
+
+
+def regression(baseline, current):
+    """
+    Return the fractional amount by which a result got worse, or 0 if it did
+    not get worse (or is only informational).
+    """
+    if baseline["value"] == 0:
+        return 0
+    change = (current["value"] - baseline["value"]) / baseline["value"]
+    if current["better"] == "higher":
+        return max(0, -change)
+    elif current["better"] == "lower":
+        return max(0, change)
+    return 0
+
+
+###############################################################################
+# Main function
+###############################################################################
+
+def main():
+    if len(sys.argv) < 3:
+        print(f"Usage: {sys.argv[0]} BASELINE CURRENT [TOLERANCE]",
+              file=sys.stderr)
+        sys.exit(2)
+    baseline = load_results(sys.argv[1])
+    current = load_results(sys.argv[2])
+    # Timings vary by a few percent from run to run, so only larger changes
+    # count as regressions by default
+    tolerance = float(sys.argv[3]) if len(sys.argv) > 3 else 0.10
+
+    regressions = []
+    for name, result in current.items():
+        if name not in baseline:
+            print(f"{name:40} {result['value']:>12.4g} {result['unit']} (new)")
+            continue
+        old = baseline[name]["value"]
+        change = (result["value"] - old) / old * 100 if old else 0
+        worse = regression(baseline[name], result)
+        flag = "  REGRESSION" if worse > tolerance else ""
+        print(f"{name:40} {result['value']:>12.4g} {result['unit']} "
+              f"({change:+.1f}%){flag}")
+        if worse > tolerance:
+            regressions.append(name)
+
+    if regressions:
+        print(f"\n{len(regressions)} result(s) regressed by more than "
+              f"{tolerance * 100:.0f}%: {', '.join(regressions)}",
+              file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,237 @@
+/* bench/wasm-bench.js
+ *
+ * Benchmark the WebAssembly build of the Bloom filter library under Node,
+ * without a browser. The wrapper functions from bloom-wrap.js are loaded and
+ * called exactly as the extension calls them, so the timings include URL
+ * canonicalization, copying strings into scratch memory, and ccall overhead.
+ * Results are printed as JSON in the same format as bin/bloom-bench, so they
+ * can be compared against a baseline with bench/compare-bench.py.
+ *
+ * Usage: node bench/wasm-bench.js bin/wasm-bench.js [NUM_BITS] [NUM_KEYS]
+ *
+ * The default 2^25 bit filter with 2^20 keys has the same fraction of bits
+ * set as the 2^27 bit filter with about 4 million stories used by the
+ * extension, so lookups stop at the first unset bit equally often.
+ */
+
+const fs = require("fs");
+const path = require("path");
+const vm = require("vm");
+const zlib = require("zlib");
+
+
+/*******************************************************************************
+ * Global variables
+ ******************************************************************************/
+
+const NUM_BITS = parseInt(process.argv[3] || "25");
+const NUM_KEYS = parseInt(process.argv[4] || `${1 << 20}`);
+
+// Lookups are timed on a subset of the keys
+const NUM_LOOKUPS = Math.min(NUM_KEYS, 100000);
+
+// Number of times a filter is decompressed and freed, which is what happens
+// each time the extension reloads its filters
+const NUM_RELOADS = 10;
+
+let results = [];
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Record one result. Whether higher or lower values are better is included
+ * so that baselines can be compared without knowing about each metric.
+ */
+function result(name, value, unit, better) {
+  results.push({ name: name, value: value, unit: unit, better: better });
+}
+
+
+/***
+ * Return the time in nanoseconds taken to call f with each of the inputs, one
+ * at a time, sorted so that percentiles can be read off directly.
+ */
+function timeEach(f, inputs) {
+  let times = new Float64Array(inputs.length);
+  for (let i = 0; i < inputs.length; i++) {
+    let start = process.hrtime.bigint();
+    f(inputs[i]);
+    times[i] = Number(process.hrtime.bigint() - start);
+  }
+  return times.sort();
+}
+
+
+/***
+ * Record the mean, median, and 99th percentile of sorted per-call times.
+ */
+function latencies(name, times) {
+  let sum = times.reduce((x, y) => x + y, 0);
+  result(`${name}_mean_ns`, sum / times.length, "ns/op", "lower");
+  result(`${name}_p50_ns`, times[Math.floor(times.length * 0.5)], "ns/op",
+      "lower");
+  result(`${name}_p99_ns`, times[Math.floor(times.length * 0.99)], "ns/op",
+      "lower");
+}
+
+
+/***
+ * Return the time in nanoseconds taken to call f once.
+ */
+function timeOnce(f) {
+  let start = process.hrtime.bigint();
+  f();
+  return Number(process.hrtime.bigint() - start);
+}
+
+
+/***
+ * Return the sizes of the WebAssembly heap and of the memory reserved for
+ * filters and scratch space, in bytes.
+ */
+function heapSizes(Module) {
+  return {
+    heap: Module.HEAPU8.length,
+    filters: Module.ccall("js_filters_reserved", "number", [], []),
+    scratch: Module.ccall("js_scratch_reserved", "number", [], []),
+  };
+}
+
+
+/***
+ * Load bloom-wrap.js in its own context, with just enough of the browser
+ * environment for the wrapper functions to run, and point it at the module.
+ */
+function loadWrapper(Module) {
+  let context = vm.createContext({
+    window: { settings: { debug_mode: false } },
+    console: console,
+    URL: URL,
+    TextEncoder: TextEncoder,
+  });
+  let wrapper = path.join(__dirname, "..", "bloom-wrap.js");
+  vm.runInContext(fs.readFileSync(wrapper, "utf8"), context, {
+    filename: wrapper,
+  });
+  context.Module = Module;
+  return context;
+}
+
+
+/***
+ * Copy a filter out of WebAssembly memory, like storeBloom does.
+ */
+function filterBytes(Module, bloom) {
+  return Module.HEAPU8.slice(bloom.addr,
+      bloom.addr + Math.pow(2, bloom.num_bits - 3));
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+async function main() {
+  if (process.argv.length < 3) {
+    console.error(`Usage: node ${process.argv[1]} bin/wasm-bench.js `
+        + "[NUM_BITS] [NUM_KEYS]");
+    process.exit(2);
+  }
+  let createModule = require(path.resolve(process.argv[2]));
+  let Module = await createModule();
+  let w = loadWrapper(Module);
+  let start_sizes = heapSizes(Module);
+
+  let urls = [];
+  let others = [];
+  for (let i = 0; i < NUM_KEYS; i++) {
+    urls.push(`https://www.news${i % 4096}.example.com/item/${i}/?utm_source=x`);
+  }
+  for (let i = 0; i < NUM_LOOKUPS; i++) {
+    others.push(`https://other${i}.example.org/page/${i}`);
+  }
+
+  // Allocate an empty filter and copy it into WebAssembly memory
+  let bloom = {
+    filter: new Uint8Array(Math.pow(2, NUM_BITS - 3)),
+    num_bits: NUM_BITS,
+    addr: null,
+  };
+  result("newBloom_ms", timeOnce(() => w.newBloom(bloom)) / 1e6, "ms",
+      "lower");
+
+  // Add every URL, then time lookups of URLs that were and were not added
+  let add_ns = timeOnce(() => urls.forEach(u => w.addBloom(bloom, u)));
+  result("addBloom_mean_ns", add_ns / NUM_KEYS, "ns/op", "lower");
+  let hits = 0;
+  latencies("inBloom_hit", timeEach(u => hits += w.inBloom(bloom, u),
+      urls.slice(0, NUM_LOOKUPS)));
+  latencies("inBloom_miss", timeEach(u => w.inBloom(bloom, u), others));
+  if (hits != NUM_LOOKUPS) {
+    console.error(`Only ${hits} of ${NUM_LOOKUPS} added URLs were found!`);
+    process.exit(1);
+  }
+
+  // Canonicalization alone, to separate its cost from that of the lookup
+  latencies("canonicalizeUrl", timeEach(u => w.canonicalizeUrl(u), others));
+
+  // Compress the filter the same way bloom-create does, and decompress it the
+  // way the extension does when it loads or reloads filters
+  let compressed = zlib.gzipSync(filterBytes(Module, bloom), { level: 9 });
+  let size_mb = Math.pow(2, NUM_BITS - 3) / 1e6;
+  let after_first = null;
+  let reload_times = [];
+  for (let i = 0; i < NUM_RELOADS; i++) {
+    let reloaded = { filter: compressed, compressed: true, addr: null };
+    reload_times.push(timeOnce(() => w.decompressBloom(reloaded)));
+    if (reloaded.num_bits != NUM_BITS) {
+      console.error("Decompressed filter is the wrong size!");
+      process.exit(1);
+    }
+    w.freeBloom(reloaded);
+    if (i == 0) {
+      after_first = heapSizes(Module);
+    }
+  }
+  reload_times.sort((x, y) => x - y);
+  result("decompressBloom_ms", reload_times[0] / 1e6, "ms", "lower");
+  result("decompressBloom_throughput", size_mb / (reload_times[0] / 1e9),
+      "MB/s", "higher");
+
+  // Combine a decompressed copy into the original filter
+  let copy = { filter: compressed, compressed: true, addr: null };
+  w.decompressBloom(copy);
+  let combine_times = [];
+  for (let i = 0; i < NUM_RELOADS; i++) {
+    combine_times.push(timeOnce(() => w.combineBloom(bloom, copy)));
+  }
+  combine_times.sort((x, y) => x - y);
+  result("combineBloom_ms", combine_times[0] / 1e6, "ms", "lower");
+  result("combineBloom_throughput", size_mb / (combine_times[0] / 1e9),
+      "MB/s", "higher");
+  w.freeBloom(copy);
+  w.freeBloom(bloom);
+
+  // The heap should only grow while the first filters are allocated, and not
+  // at all across reloads after that
+  let end_sizes = heapSizes(Module);
+  result("heap_start_bytes", start_sizes.heap, "bytes", "lower");
+  result("heap_end_bytes", end_sizes.heap, "bytes", "lower");
+  result("heap_growth_across_reloads_bytes", end_sizes.heap - after_first.heap,
+      "bytes", "lower");
+  result("filters_reserved_bytes", end_sizes.filters, "bytes", "lower");
+  result("scratch_reserved_bytes", end_sizes.scratch, "bytes", "lower");
+
+  console.log(JSON.stringify({
+    filter_bits: NUM_BITS,
+    num_keys: NUM_KEYS,
+    results: results,
+  }, null, 2));
+}
+
+main();
@@ -0,0 +1,255 @@
+/* arena.c
+ *
+ * Implementation of bump-allocated arenas for scratch memory, and regions with
+ * free lists for long-lived blocks.
+ */
+
+
+#include <stdlib.h>
+
+#include "arena.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+// Block headers are padded so that the data after them stays aligned
+#define REGION_HEADER \
+  ((sizeof(region_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+// Free blocks are only split if at least this much would be left over, so that
+// the free list does not fill up with slivers
+#define REGION_MIN_SPLIT 256
+
+static inline size_t align_up(size_t size) {
+  return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+
+/***
+ * Reserve a chunk with at least size bytes of space and push it onto the
+ * arena's list of chunks.
+ */
+static arena_chunk *push_chunk(arena *a, size_t size) {
+  arena_chunk *chunk;
+  if (posix_memalign((void **)&chunk, ARENA_ALIGN, sizeof(arena_chunk) + size)
+      != 0) {
+    return NULL;
+  }
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->live = 0;
+  chunk->next = a->chunks;
+  a->chunks = chunk;
+  return chunk;
+}
+
+
+/***
+ * Turn a region chunk with no blocks in use into one free block spanning all
+ * of it, dropping its old blocks from the free list. The chunk stays reserved,
+ * so the next filters loaded reuse it instead of reserving memory again.
+ */
+static void empty_chunk(region *r, arena_chunk *chunk) {
+  for (region_block **b = &r->free_list; *b != NULL;) {
+    if ((*b)->chunk == chunk) {
+      *b = (*b)->next_free;
+    } else {
+      b = &(*b)->next_free;
+    }
+  }
+
+  region_block *block = (region_block *)chunk->data;
+  chunk->used = chunk->size;
+  block->size = chunk->size - REGION_HEADER;
+  block->chunk = chunk;
+  block->next_free = r->free_list;
+  r->free_list = block;
+}
+
+
+/***
+ * Free every chunk in a list of chunks.
+ */
+static void free_chunks(arena_chunk *chunk) {
+  while (chunk != NULL) {
+    arena_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+arena *new_arena(size_t size) {
+  arena *a;
+  if ((a = (arena *)malloc(sizeof(arena))) == NULL) {
+    return NULL;
+  }
+  a->chunks = NULL;
+  if (push_chunk(a, align_up(size)) == NULL) {
+    free(a);
+    return NULL;
+  }
+  return a;
+}
+
+
+void free_arena(arena *a) {
+  if (a == NULL) {
+    return;
+  }
+  free_chunks(a->chunks);
+  free(a);
+}
+
+
+/***
+ * New chunks are at least double the size of the previous one so that the
+ * number of chunks stays logarithmic in the amount allocated.
+ */
+void *arena_alloc(arena *a, size_t size) {
+  size = align_up(size);
+  arena_chunk *chunk = a->chunks;
+
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    size_t chunk_size = chunk == NULL ? size : 2 * chunk->size;
+    if ((chunk = push_chunk(a, chunk_size > size ? chunk_size : size))
+        == NULL) {
+      return NULL;
+    }
+  }
+
+  void *p = chunk->data + chunk->used;
+  chunk->used += size;
+  return p;
+}
+
+
+/***
+ * The first chunk is the last in the list, since new chunks are pushed onto
+ * the front.
+ */
+void arena_reset(arena *a) {
+  arena_chunk *chunk = a->chunks;
+  if (chunk == NULL) {
+    return;
+  }
+
+  while (chunk->next != NULL) {
+    arena_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  a->chunks = chunk;
+  chunk->used = 0;
+}
+
+
+size_t arena_reserved(arena *a) {
+  size_t total = 0;
+  for (arena_chunk *chunk = a->chunks; chunk != NULL; chunk = chunk->next) {
+    total += chunk->size;
+  }
+  return total;
+}
+
+
+region *new_region(size_t chunk_size) {
+  region *r;
+  if ((r = (region *)malloc(sizeof(region))) == NULL) {
+    return NULL;
+  }
+  r->chunks.chunks = NULL;
+  r->chunk_size = align_up(chunk_size);
+  r->free_list = NULL;
+  return r;
+}
+
+
+void free_region(region *r) {
+  if (r == NULL) {
+    return;
+  }
+  free_chunks(r->chunks.chunks);
+  free(r);
+}
+
+
+/***
+ * Check the free list for the best fit before carving a new block from the
+ * current chunk. A best fit much larger than the request (like a freed URL
+ * filter reused for a host filter) is split so the rest can still be used.
+ */
+void *region_alloc(region *r, size_t size) {
+  size = align_up(size);
+
+  region_block **best = NULL;
+  for (region_block **b = &r->free_list; *b != NULL; b = &(*b)->next_free) {
+    if ((*b)->size >= size && (best == NULL || (*b)->size < (*best)->size)) {
+      best = b;
+    }
+  }
+  if (best != NULL) {
+    region_block *block = *best;
+    *best = block->next_free;
+    if (block->size - size >= REGION_HEADER + REGION_MIN_SPLIT) {
+      region_block *rest = (region_block *)((uint8_t *)block + REGION_HEADER
+          + size);
+      rest->size = block->size - size - REGION_HEADER;
+      rest->chunk = block->chunk;
+      rest->next_free = r->free_list;
+      r->free_list = rest;
+      block->size = size;
+    }
+    block->next_free = NULL;
+    block->chunk->live++;
+    return (uint8_t *)block + REGION_HEADER;
+  }
+
+  // Reserve a new chunk if the current one cannot fit the block. Whatever is
+  // left over at the end of the old chunk goes unused.
+  arena_chunk *chunk = r->chunks.chunks;
+  if (chunk == NULL || chunk->size - chunk->used < REGION_HEADER + size) {
+    size_t chunk_size = REGION_HEADER + size;
+    if (chunk_size < r->chunk_size) {
+      chunk_size = r->chunk_size;
+    }
+    if ((chunk = push_chunk(&r->chunks, chunk_size)) == NULL) {
+      return NULL;
+    }
+  }
+
+  region_block *block = (region_block *)(chunk->data + chunk->used);
+  chunk->used += REGION_HEADER + size;
+  chunk->live++;
+  block->size = size;
+  block->next_free = NULL;
+  block->chunk = chunk;
+  return (uint8_t *)block + REGION_HEADER;
+}
+
+
+void region_free(region *r, void *p) {
+  if (p == NULL) {
+    return;
+  }
+  region_block *block = (region_block *)((uint8_t *)p - REGION_HEADER);
+  if (--block->chunk->live == 0) {
+    empty_chunk(r, block->chunk);
+    return;
+  }
+  block->next_free = r->free_list;
+  r->free_list = block;
+}
+
+
+size_t region_reserved(region *r) {
+  return arena_reserved(&r->chunks);
+}
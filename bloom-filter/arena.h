@@ -0,0 +1,137 @@
+/* arena.h
+ *
+ * Interface for two simple allocators used to keep the wasm heap from
+ * fragmenting and growing more than necessary:
+ *
+ * - An arena is a bump allocator for short-lived scratch memory. Everything
+ *   allocated from it is released at once by resetting it, and memory
+ *   reserved beyond its first chunk for large inputs is returned to the heap.
+ * - A region hands out long-lived blocks (such as Bloom filters) carved from
+ *   large reserved chunks. Freed blocks are kept on a free list and reused for
+ *   later allocations, so repeatedly freeing and re-allocating filters of the
+ *   same size never reserves more memory. Once every block in a chunk is
+ *   freed, the whole chunk becomes one free block, and it stays reserved until
+ *   the region is freed.
+ */
+
+
+#ifndef ARENA_H
+#define ARENA_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// All allocations are aligned (and rounded up) to this many bytes
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk_s {
+  struct arena_chunk_s *next;
+  size_t size;
+  size_t used;
+  // Number of region blocks in use in the chunk, which also keeps the data
+  // that follows aligned to ARENA_ALIGN
+  size_t live;
+  uint8_t data[];
+} arena_chunk;
+
+typedef struct arena_s {
+  // Most recently reserved chunk first
+  arena_chunk *chunks;
+} arena;
+
+typedef struct region_block_s {
+  // Usable size of the block, not including this header
+  size_t size;
+  struct region_block_s *next_free;
+  arena_chunk *chunk;
+} region_block;
+
+typedef struct region_s {
+  arena chunks;
+  // Minimum size of each newly reserved chunk
+  size_t chunk_size;
+  region_block *free_list;
+} region;
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Allocate a new arena with an initial chunk of size bytes.
+ */
+arena *new_arena(size_t size);
+
+
+/***
+ * Free an arena and every chunk it has reserved.
+ */
+void free_arena(arena *a);
+
+
+/***
+ * Allocate size bytes from the arena, reserving a new chunk if the current one
+ * is full. Returns NULL if memory cannot be reserved.
+ */
+void *arena_alloc(arena *a, size_t size);
+
+
+/***
+ * Release everything allocated from the arena. Chunks reserved after the first
+ * one (for inputs larger than it) are freed, so the arena shrinks back to its
+ * initial size after a large input.
+ */
+void arena_reset(arena *a);
+
+
+/***
+ * Return the total number of bytes reserved by the arena.
+ */
+size_t arena_reserved(arena *a);
+
+
+/***
+ * Allocate a new region that reserves chunks of at least chunk_size bytes.
+ */
+region *new_region(size_t chunk_size);
+
+
+/***
+ * Free a region and every chunk it has reserved, including blocks that are
+ * still in use.
+ */
+void free_region(region *r);
+
+
+/***
+ * Allocate a block of size bytes, reusing the smallest free block that fits if
+ * there is one. A free block much larger than size is split, and the rest of
+ * it stays free. Returns NULL if memory cannot be reserved.
+ */
+void *region_alloc(region *r, size_t size);
+
+
+/***
+ * Return a block to the region's free list. Adjacent free blocks are not
+ * coalesced, but once every block in a chunk is free, the whole chunk becomes
+ * a single free block of its reserved size.
+ */
+void region_free(region *r, void *p);
+
+
+/***
+ * Return the total number of bytes reserved by the region.
+ */
+size_t region_reserved(region *r);
+
+
+#endif /* ARENA_H */
@@ -0,0 +1,547 @@
+/* bloom-analyze.c
+ *
+ * Command-line program to measure how a Bloom filter actually behaves: its
+ * false positive rate on keys that were not added, how evenly its bits are
+ * set, and what size and number of hashes would suit the number of keys it
+ * holds.
+ */
+
+
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom-file.h"
+#include "canonicalize.h"
+#include "line-reader.h"
+
+
+
+/*******************************************************************************
+ * Types, structs, and constants
+ ******************************************************************************/
+
+// Number of keys looked up together with in_bloom_batch
+#define KEYS_PER_BATCH 256
+
+// Random keys are formatted into fixed-size slots
+#define RANDOM_KEY_SLOT 64
+
+struct args {
+  char *filter;
+  char *negatives;
+  long long random;
+  int threads;
+  int canonicalize;
+  int block_bits;
+  double target_fpr;
+};
+
+// Each thread checks either a range of complete lines from the negative key
+// file, or a number of random keys, and counts the keys found in the filter
+struct job {
+  struct args *args;
+  byte *bloom;
+  uint8_t num_bits;
+  char *start;
+  char *end;
+  long long num_random;
+  uint64_t seed;
+  long long queries;
+  long long positives;
+  char *canonical;
+  size_t canonical_capacity;
+};
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Print a usage string describing this program's command-line arguments.
+ */
+void print_usage(char *prog_name) {
+  printf("Usage: %s [OPTION]... FILTER\n"
+      "Measure the false positive rate of a Bloom filter (compressed or not)\n"
+      "by checking keys that were never added to it, and report how evenly\n"
+      "its bits are set and the best size and number of hashes for the\n"
+      "number of keys it holds. Results are printed as JSON.\n\n"
+      "Options:\n"
+      " -i, --negatives=IN\tFile of keys that were not added to the filter,\n"
+      "\t\t\tone per line (gzip compressed input is detected)\n"
+      " -r, --random=N\t\tCheck N random keys instead, default is 10000000\n"
+      " -t, --threads=N\tNumber of threads, default is the number of CPUs\n"
+      " -c, --canonicalize\tCanonicalize negative keys before checking them\n"
+      " -B, --block-bits=EXP\tMeasure fill skew over blocks of 2^EXP bits,\n"
+      "\t\t\tdefault is 9 (one 64 byte cache line)\n"
+      " -p, --target-fpr=P\tFalse positive rate to size filters for, default\n"
+      "\t\t\tis the theoretical rate of the current filter\n"
+      " -h, --help\t\tDisplay this help message\n", prog_name);
+}
+
+
+/***
+ * Parse comand line arguments, setting their values in the parsed_args struct.
+ */
+void parse_args(int argc, char *argv[], struct args *parsed_args) {
+  // Set default values
+  parsed_args->negatives = NULL;
+  parsed_args->random = 10000000;
+  parsed_args->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (parsed_args->threads < 1) {
+    parsed_args->threads = 1;
+  }
+  parsed_args->canonicalize = 0;
+  parsed_args->block_bits = 9;
+  parsed_args->target_fpr = 0;
+
+  int c, long_index;
+  struct option opts[] = {
+    { "negatives", required_argument, NULL, 'i' },
+    { "random", required_argument, NULL, 'r' },
+    { "threads", required_argument, NULL, 't' },
+    { "canonicalize", no_argument, NULL, 'c' },
+    { "block-bits", required_argument, NULL, 'B' },
+    { "target-fpr", required_argument, NULL, 'p' },
+    { "help", no_argument, NULL, 'h' },
+    { 0, 0, 0, 0 }
+  };
+  while ((c = getopt_long(argc, argv, "i:r:t:cB:p:h", opts, &long_index))
+      != -1) {
+    switch(c) {
+      case 'i':
+        parsed_args->negatives = optarg;
+        break;
+
+      case 'r':
+        parsed_args->random = atoll(optarg);
+        if (parsed_args->random <= 0) {
+          fprintf(stderr, "%s\n\n", "Must check at least one random key.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 't':
+        parsed_args->threads = atoi(optarg);
+        if (parsed_args->threads <= 0) {
+          fprintf(stderr, "%s\n\n", "Must have at least one thread.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'c':
+        parsed_args->canonicalize = 1;
+        break;
+
+      case 'B':
+        parsed_args->block_bits = atoi(optarg);
+        if (parsed_args->block_bits < 3 || parsed_args->block_bits > 31) {
+          fprintf(stderr, "%s\n\n", "Must have 3 <= block-bits < 32.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'p':
+        parsed_args->target_fpr = atof(optarg);
+        if (!(parsed_args->target_fpr > 0 && parsed_args->target_fpr < 1)) {
+          fprintf(stderr, "%s\n\n", "Must have 0 < target-fpr < 1.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'h':
+        print_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+        break;
+
+      default:
+        // Add a blank line because an error will probably be printed
+        puts("");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+        break;
+    }
+  }
+
+  // Make sure there is a filter
+  if (optind >= argc) {
+    fprintf(stderr, "%s\n\n", "No Bloom filter specified!");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  parsed_args->filter = argv[optind];
+
+  return;
+}
+
+
+/***
+ * Load a Bloom filter in any format, decompressing it on the given number of
+ * threads if it is chunked, and store its size as a power of two. Exit the
+ * program with an error message on failure.
+ */
+byte *load_filter(char *filename, uint8_t *num_bits, int threads) {
+  byte *bloom;
+  if ((bloom = load_bloom_file(filename, num_bits, threads)) == NULL) {
+    fprintf(stderr, "Unable to load Bloom filter %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  return bloom;
+}
+
+
+/***
+ * Print a string as a quoted JSON string, escaping quotes, backslashes, and
+ * control characters.
+ */
+void print_json_string(char *str) {
+  putchar('"');
+  for (unsigned char *c = (unsigned char *)str; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      printf("\\%c", *c);
+    } else if (*c < 0x20) {
+      printf("\\u%04x", *c);
+    } else {
+      putchar(*c);
+    }
+  }
+  putchar('"');
+}
+
+
+/***
+ * Return the next number from a splitmix64 generator, which is plenty random
+ * for making keys that are not in the filter.
+ */
+uint64_t next_random(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+
+/***
+ * Check one batch of keys and count how many are (probably) in the filter.
+ */
+void check_batch(struct job *job, byte **keys, uint32_t *lengths, size_t n) {
+  byte hits[KEYS_PER_BATCH / 8];
+  in_bloom_batch(job->bloom, job->num_bits, keys, lengths, n, hits);
+  for (size_t i = 0; i < n; i++) {
+    job->positives += (hits[i >> 3] >> (7 - (i & 0x7))) & 1;
+  }
+  job->queries += n;
+}
+
+
+/***
+ * Thread entry point for random keys. Keys look like URLs on a reserved
+ * domain, so that no real story could ever have been added with them.
+ */
+void *check_random(void *arg) {
+  struct job *job = (struct job *)arg;
+  char slots[KEYS_PER_BATCH][RANDOM_KEY_SLOT];
+  byte *keys[KEYS_PER_BATCH];
+  uint32_t lengths[KEYS_PER_BATCH];
+  uint64_t state = job->seed;
+
+  long long remaining = job->num_random;
+  while (remaining > 0) {
+    size_t n = remaining < KEYS_PER_BATCH ? remaining : KEYS_PER_BATCH;
+    for (size_t i = 0; i < n; i++) {
+      unsigned long long a = next_random(&state);
+      unsigned long long b = next_random(&state);
+      lengths[i] = sprintf(slots[i], "//random.invalid/%016llx%016llx", a, b);
+      keys[i] = (byte *)slots[i];
+    }
+    check_batch(job, keys, lengths, n);
+    remaining -= n;
+  }
+
+  return NULL;
+}
+
+
+/***
+ * Thread entry point for negative keys: split the job's range into lines and
+ * check them in batches, canonicalizing them first if asked to.
+ */
+void *check_range(void *arg) {
+  struct job *job = (struct job *)arg;
+  char *lines[KEYS_PER_BATCH];
+  byte *keys[KEYS_PER_BATCH];
+  uint32_t lengths[KEYS_PER_BATCH];
+  size_t n = 0;
+
+  char *next = job->start;
+  while (next < job->end) {
+    char *line;
+    size_t length = split_line(&next, job->end, &line);
+    if (length == 0) {
+      continue;
+    }
+    lines[n] = line;
+    lengths[n] = length;
+    if (++n < KEYS_PER_BATCH && next < job->end) {
+      continue;
+    }
+
+    // Canonicalize into a per-thread buffer sized for the whole batch
+    if (job->args->canonicalize) {
+      size_t needed = 0;
+      for (size_t i = 0; i < n; i++) {
+        needed += CANONICAL_MAX(lengths[i]);
+      }
+      if (needed > job->canonical_capacity) {
+        job->canonical_capacity = 2 * needed;
+        free(job->canonical);
+        if ((job->canonical = malloc(job->canonical_capacity)) == NULL) {
+          perror("Unable to allocate canonicalization buffer");
+          exit(EXIT_FAILURE);
+        }
+      }
+      // Each key needs room for its original length, since the canonical URL
+      // may be longer or shorter
+      size_t offset = 0;
+      for (size_t i = 0; i < n; i++) {
+        size_t length = lengths[i];
+        keys[i] = (byte *)job->canonical + offset;
+        lengths[i] = canonicalize_url(lines[i], length,
+            job->canonical + offset);
+        offset += CANONICAL_MAX(length);
+      }
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        keys[i] = (byte *)lines[i];
+      }
+    }
+
+    check_batch(job, keys, lengths, n);
+    n = 0;
+  }
+
+  return NULL;
+}
+
+
+/***
+ * Run every job on its own thread (the first on this one), and add up their
+ * counts of queries and positives.
+ */
+void run_jobs(struct job *jobs, int num_jobs, void *(*check)(void *),
+    long long *queries, long long *positives) {
+  pthread_t threads[num_jobs];
+  for (int i = 1; i < num_jobs; i++) {
+    if (pthread_create(&threads[i], NULL, check, &jobs[i]) != 0) {
+      perror("Unable to start thread");
+      exit(EXIT_FAILURE);
+    }
+  }
+  check(&jobs[0]);
+  for (int i = 1; i < num_jobs; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (int i = 0; i < num_jobs; i++) {
+    *queries += jobs[i].queries;
+    *positives += jobs[i].positives;
+    jobs[i].queries = 0;
+    jobs[i].positives = 0;
+  }
+}
+
+
+/***
+ * Split a block of complete lines evenly (by bytes, on line boundaries) among
+ * the jobs and check them.
+ */
+void check_block(struct job *jobs, int num_jobs, char *start, char *end,
+    long long *queries, long long *positives) {
+  size_t share = (end - start) / num_jobs + 1;
+
+  char *next = start;
+  for (int i = 0; i < num_jobs; i++) {
+    jobs[i].start = next;
+    if (i == num_jobs - 1 || (size_t)(end - next) <= share) {
+      next = end;
+    } else {
+      char *newline = memchr(next + share, '\n', end - next - share);
+      next = newline == NULL ? end : newline + 1;
+    }
+    jobs[i].end = next;
+  }
+
+  run_jobs(jobs, num_jobs, check_range, queries, positives);
+}
+
+
+/***
+ * Return the number of bits set in a range of bytes.
+ */
+uint64_t count_bits(byte *data, size_t length) {
+  uint64_t set = 0;
+  for (size_t i = 0; i < length; i++) {
+    for (byte b = data[i]; b != 0; b &= b - 1) {
+      set++;
+    }
+  }
+  return set;
+}
+
+
+/***
+ * Return the theoretical false positive rate of a filter of m bits with k
+ * hashes holding n keys.
+ */
+double theoretical_fpr(double m, double k, double n) {
+  return pow(1 - exp(-k * n / m), k);
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+  // Parse command-line arguments
+  struct args args;
+  parse_args(argc, argv, &args);
+
+  uint8_t num_bits;
+  byte *bloom = load_filter(args.filter, &num_bits, args.threads);
+  size_t size = (size_t)1 << (num_bits - 3);
+  double m = (double)size * 8;
+  double k = NUM_HASHES;
+
+  // Estimate the number of keys from the fraction of bits set, which is
+  // expected to be 1 - e^(-kn/m)
+  double fill = fill_ratio(bloom, num_bits);
+  double keys = fill < 1 ? -m / k * log(1 - fill) : INFINITY;
+
+  // Check keys that are not in the filter, spread across threads
+  struct job jobs[args.threads];
+  memset(jobs, 0, sizeof(jobs));
+  for (int i = 0; i < args.threads; i++) {
+    jobs[i].args = &args;
+    jobs[i].bloom = bloom;
+    jobs[i].num_bits = num_bits;
+    jobs[i].seed = 0x853c49e6748fea9bull * (i + 1);
+    jobs[i].num_random = args.random / args.threads
+      + (i < args.random % args.threads);
+  }
+
+  long long queries = 0, positives = 0;
+  if (args.negatives != NULL) {
+    line_reader *infile;
+    if ((infile = open_line_reader(args.negatives)) == NULL) {
+      perror("Unable to open negative key file");
+      return EXIT_FAILURE;
+    }
+    char *start, *end;
+    while (next_block(infile, &start, &end)) {
+      check_block(jobs, args.threads, start, end, &queries, &positives);
+    }
+    close_line_reader(infile);
+  } else {
+    run_jobs(jobs, args.threads, check_random, &queries, &positives);
+  }
+  double measured = queries > 0 ? (double)positives / queries : 0;
+
+  // Compare the fill of each block to the binomial distribution expected if
+  // bits were set uniformly at random
+  int block_bits = args.block_bits < num_bits ? args.block_bits : num_bits;
+  size_t block_bytes = (size_t)1 << (block_bits - 3);
+  size_t num_blocks = size / block_bytes;
+  double block_size = (double)block_bytes * 8;
+  double min_fill = 1, max_fill = 0, sum = 0, sum_squares = 0;
+  for (size_t b = 0; b < num_blocks; b++) {
+    double block_fill = count_bits(bloom + b * block_bytes, block_bytes)
+      / block_size;
+    min_fill = block_fill < min_fill ? block_fill : min_fill;
+    max_fill = block_fill > max_fill ? block_fill : max_fill;
+    sum += block_fill;
+    sum_squares += block_fill * block_fill;
+  }
+  double mean_fill = sum / num_blocks;
+  double variance = sum_squares / num_blocks - mean_fill * mean_fill;
+  double stddev = variance > 0 ? sqrt(variance) : 0;
+  double expected_stddev = sqrt(fill * (1 - fill) / block_size);
+
+  // The measured rate should match the fraction of bits set raised to the
+  // number of hashes, and both should match the theoretical rate for the
+  // estimated number of keys. The number of hashes that minimizes false
+  // positives for this size and number of keys is (m / n) ln 2, and the size
+  // needed for a false positive rate p with that many hashes is
+  // -n ln p / (ln 2)^2
+  double current = theoretical_fpr(m, k, keys);
+  double target = args.target_fpr > 0 ? args.target_fpr : current;
+  double optimal_k = keys > 0 ? round(m / keys * log(2)) : k;
+  optimal_k = optimal_k < 1 ? 1 : optimal_k;
+  double optimal_m = -keys * log(target) / (log(2) * log(2));
+  int bits_optimal_k = 3;
+  while (bits_optimal_k < 40 && pow(2, bits_optimal_k) < optimal_m) {
+    bits_optimal_k++;
+  }
+  int bits_current_k = 3;
+  while (bits_current_k < 40
+      && theoretical_fpr(pow(2, bits_current_k), k, keys) > target) {
+    bits_current_k++;
+  }
+
+  printf("{\n  \"filter\": ");
+  print_json_string(args.filter);
+  printf(",\n"
+      "  \"num_bits\": %d,\n"
+      "  \"num_hashes\": %d,\n"
+      "  \"fill_ratio\": %.6g,\n"
+      "  \"estimated_keys\": %.0f,\n"
+      "  \"queries\": %lld,\n"
+      "  \"false_positives\": %lld,\n"
+      "  \"measured_fpr\": %.6g,\n"
+      "  \"expected_fpr\": %.6g,\n"
+      "  \"theoretical_fpr\": %.6g,\n"
+      "  \"block_bits\": %d,\n"
+      "  \"block_fill\": {\n"
+      "    \"min\": %.6g,\n"
+      "    \"max\": %.6g,\n"
+      "    \"mean\": %.6g,\n"
+      "    \"stddev\": %.6g,\n"
+      "    \"expected_stddev\": %.6g,\n"
+      "    \"skew\": %.6g\n"
+      "  },\n"
+      "  \"optimal_hashes\": %.0f,\n"
+      "  \"fpr_with_optimal_hashes\": %.6g,\n"
+      "  \"target_fpr\": %.6g,\n"
+      "  \"optimal_size_bits\": %.0f,\n"
+      "  \"num_bits_for_target_optimal_hashes\": %d,\n"
+      "  \"num_bits_for_target_current_hashes\": %d\n"
+      "}\n",
+      num_bits, NUM_HASHES, fill, keys, queries, positives,
+      measured, pow(fill, k), current, block_bits, min_fill, max_fill,
+      mean_fill, stddev, expected_stddev,
+      expected_stddev > 0 ? stddev / expected_stddev : 0,
+      optimal_k, theoretical_fpr(m, optimal_k, keys), target, optimal_m,
+      bits_optimal_k, bits_current_k);
+
+  // Clean up
+  for (int i = 0; i < args.threads; i++) {
+    free(jobs[i].canonical);
+  }
+  free_bloom(bloom);
+
+  return EXIT_SUCCESS;
+}
@@ -7,14 +7,23 @@
  */
 
 
-#include <assert.h>
 #include <errno.h>
 #include <getopt.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "bloom.h"
+#include "canonicalize.h"
+#include "chunked-bloom.h"
+#include "host-filter.h"
+#include "item-map.h"
+#include "prefix-filter.h"
+#include "record-reader.h"
+#include "scalable-bloom.h"
+#include "sharded-bloom.h"
 
 
 
@@ -22,11 +31,61 @@
  * Types, structs, and constants
  ******************************************************************************/
 
+// Values for options that only have a long form
+enum long_options {
+  OPT_URL_FIELD = 256,
+  OPT_SCORE_FIELD,
+  OPT_TIME_FIELD,
+  OPT_ID_FIELD,
+  OPT_AFTER,
+  OPT_BEFORE,
+  OPT_EMPTY_WINDOWS,
+};
+
 struct args {
   char *infile;
   char *outfile;
   int bloom_bits;
   int use_compression;
+  int scalable;
+  int sharded;
+  int chunked;
+  int jobs;
+  int host_bits;
+  int prefix_bits;
+  int canonicalize;
+  record_format format;
+  char *fields[NUM_FIELDS];
+  int use_threshold;
+  int64_t threshold;
+  int use_after;
+  int64_t after;
+  int use_before;
+  int64_t before;
+  int64_t partition;
+  int empty_windows;
+  char *item_map;
+};
+
+// Lengths of the time windows filters can be partitioned into, in seconds
+#define DAY_SECONDS 86400
+#define WEEK_SECONDS (7 * DAY_SECONDS)
+
+// Weeks start on Monday, and the Unix epoch was on a Thursday
+#define WEEK_OFFSET (4 * DAY_SECONDS)
+
+// When partitioning, every key is spilled to a temporary file along with its
+// time window, and the number of bytes spilled for each window is counted. The
+// file is then sorted by window, so each window's keys are read back once.
+struct partitions {
+  FILE *spill;
+  size_t num_keys;
+  int64_t partition;
+  int64_t first;
+  int64_t last;
+  // Bytes of sorted records (length and key) in each window from first to
+  // last
+  uint64_t *sizes;
 };
 
 
@@ -40,12 +99,48 @@ struct args {
  */
 void print_usage(char *prog_name) {
   printf("Usage: %s [OPTION]... OUTFILE\n"
-      "Create a Bloom filter from a newline-separated list of input strings.\n"
+      "Create a Bloom filter from a newline-separated list of input strings,\n"
+      "or from the URLs of stories in a CSV or JSON Lines export.\n"
       "OUTFILE is where the binary data of the Bloom filter will be stored.\n\n"
       "Options:\n"
-      " -i, --input=IN\t\tInput file to read strings from, default is stdin\n"
+      " -i, --input=IN\t\tInput file to read strings from, default is stdin;\n"
+      "\t\t\tgzip compressed input is detected automatically\n"
       " -b, --bloom-bits=EXP\tUse 2^EXP bits for Bloom filter, default is 27\n"
       " -c, --no-compress\tTurn off gzip output compression, on by default\n"
+      " -s, --scalable\t\tCreate a scalable Bloom filter that grows as needed,\n"
+      "\t\t\tstarting with 2^EXP bits (requires compression)\n"
+      " -S, --sharded\t\tSplit the filter into separately compressed shards\n"
+      "\t\t\tthat can be loaded on demand (requires compression)\n"
+      " -k, --chunked\t\tCompress the filter in independent 1MB chunks that\n"
+      "\t\t\tcan be compressed and decompressed in parallel\n"
+      " -j, --jobs=N\t\tNumber of threads compressing chunks, default is\n"
+      "\t\t\tthe number of CPUs\n"
+      " -H, --host-bits=EXP\tAlso write a filter of the hosts of all URLs with\n"
+      "\t\t\t2^EXP bits to OUTFILE with -hosts inserted before the\n"
+      "\t\t\textension, like hn-hosts.bloom, off by default\n"
+      " -P, --prefix-bits=EXP\tAlso write a filter of the path prefixes of all\n"
+      "\t\t\tURLs with 2^EXP bits to OUTFILE with -prefixes\n"
+      "\t\t\tinserted before the extension, off by default\n"
+      " -C, --canonicalize\tCanonicalize URLs before adding them\n"
+      " -f, --format=FMT\tRead input as FMT, one of lines (the default), csv\n"
+      "\t\t\t(with a header row), or jsonl (one object per line)\n"
+      " --url-field=NAME\tCSV column or JSON key of URLs, default is url\n"
+      " --score-field=NAME\tCSV column or JSON key of scores, default is score\n"
+      " --time-field=NAME\tCSV column or JSON key of times, default is time\n"
+      " --id-field=NAME\tCSV column or JSON key of item ids, default is id\n"
+      " -t, --threshold=N\tOnly add stories with a score of at least N\n"
+      " --after=TIME\t\tOnly add stories submitted after TIME, given in\n"
+      "\t\t\tUnix seconds or as a UTC date like 2021-01-31 12:00\n"
+      " --before=TIME\t\tOnly add stories submitted before TIME\n"
+      " -p, --partition-by=UNIT\n"
+      "\t\t\tCreate one filter for each day or week (UNIT) of\n"
+      "\t\t\tsubmissions, inserting the first date of each window\n"
+      "\t\t\tinto OUTFILE, like hn-2021-01-04.bloom\n"
+      " --empty-windows\tAlso write empty filters for windows without\n"
+      "\t\t\tstories between the first and last ones\n"
+      " -m, --item-map=FILE\tAlso write a map from the URL of every story that\n"
+      "\t\t\tmeets the score and time limits to its item id to\n"
+      "\t\t\tFILE, for finding discussions without a search\n"
       " -h, --help\t\tDisplay this help message\n"
       "\nCreated by Jacob Strieb in January 2021.\n", prog_name);
 }
@@ -62,16 +157,57 @@ void parse_args(int argc, char *argv[], struct args *parsed_args) {
   // Calculated for 3-10M entries using: https://hur.st/bloomfilter
   parsed_args->bloom_bits = 27;
   parsed_args->use_compression = 1;
+  parsed_args->scalable = 0;
+  parsed_args->sharded = 0;
+  parsed_args->chunked = 0;
+  parsed_args->jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (parsed_args->jobs < 1) {
+    parsed_args->jobs = 1;
+  }
+  parsed_args->host_bits = 0;
+  parsed_args->prefix_bits = 0;
+  parsed_args->canonicalize = 0;
+  parsed_args->format = FORMAT_LINES;
+  parsed_args->fields[FIELD_URL] = "url";
+  parsed_args->fields[FIELD_SCORE] = "score";
+  parsed_args->fields[FIELD_TIME] = "time";
+  parsed_args->fields[FIELD_ID] = "id";
+  parsed_args->use_threshold = 0;
+  parsed_args->use_after = 0;
+  parsed_args->use_before = 0;
+  parsed_args->partition = 0;
+  parsed_args->empty_windows = 0;
+  parsed_args->item_map = NULL;
 
   int c, long_index;
+  char *end;
   struct option opts[] = {
     { "input", required_argument, NULL, 'i' },
     { "bloom-bits", required_argument, NULL, 'b' },
     { "no-compress", no_argument, NULL, 'c' },
+    { "scalable", no_argument, NULL, 's' },
+    { "sharded", no_argument, NULL, 'S' },
+    { "chunked", no_argument, NULL, 'k' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "host-bits", required_argument, NULL, 'H' },
+    { "prefix-bits", required_argument, NULL, 'P' },
+    { "canonicalize", no_argument, NULL, 'C' },
+    { "format", required_argument, NULL, 'f' },
+    { "url-field", required_argument, NULL, OPT_URL_FIELD },
+    { "score-field", required_argument, NULL, OPT_SCORE_FIELD },
+    { "time-field", required_argument, NULL, OPT_TIME_FIELD },
+    { "id-field", required_argument, NULL, OPT_ID_FIELD },
+    { "threshold", required_argument, NULL, 't' },
+    { "after", required_argument, NULL, OPT_AFTER },
+    { "before", required_argument, NULL, OPT_BEFORE },
+    { "partition-by", required_argument, NULL, 'p' },
+    { "empty-windows", no_argument, NULL, OPT_EMPTY_WINDOWS },
+    { "item-map", required_argument, NULL, 'm' },
     { "help", no_argument, NULL, 'h' },
     { 0, 0, 0, 0 }
   };
-  while ((c = getopt_long(argc, argv, "i:b:ch", opts, &long_index)) != -1) {
+  while ((c = getopt_long(argc, argv, "i:b:csSkj:H:P:Cf:t:p:m:h", opts,
+          &long_index)) != -1) {
     switch(c) {
       case 'i':
         // According to GDB this just points into argv, so we don't have to
@@ -93,6 +229,131 @@ void parse_args(int argc, char *argv[], struct args *parsed_args) {
         parsed_args->use_compression = 0;
         break;
 
+      case 's':
+        parsed_args->scalable = 1;
+        break;
+
+      case 'S':
+        parsed_args->sharded = 1;
+        break;
+
+      case 'k':
+        parsed_args->chunked = 1;
+        break;
+
+      case 'j':
+        parsed_args->jobs = atoi(optarg);
+        if (parsed_args->jobs <= 0) {
+          fprintf(stderr, "%s\n\n", "Must have at least one job.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'H':
+        parsed_args->host_bits = atoi(optarg);
+        if (parsed_args->host_bits > 31
+            || parsed_args->host_bits < HOST_BLOCK_BITS) {
+          fprintf(stderr, "Must have %d <= host-bits < 32.\n\n",
+              HOST_BLOCK_BITS);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'P':
+        parsed_args->prefix_bits = atoi(optarg);
+        if (parsed_args->prefix_bits > 31
+            || parsed_args->prefix_bits < PREFIX_BLOCK_BITS) {
+          fprintf(stderr, "Must have %d <= prefix-bits < 32.\n\n",
+              PREFIX_BLOCK_BITS);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'C':
+        parsed_args->canonicalize = 1;
+        break;
+
+      case 'f':
+        if (strcmp(optarg, "lines") == 0) {
+          parsed_args->format = FORMAT_LINES;
+        } else if (strcmp(optarg, "csv") == 0) {
+          parsed_args->format = FORMAT_CSV;
+        } else if (strcmp(optarg, "jsonl") == 0) {
+          parsed_args->format = FORMAT_JSONL;
+        } else {
+          fprintf(stderr, "Unknown input format %s.\n\n", optarg);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case OPT_URL_FIELD:
+        parsed_args->fields[FIELD_URL] = optarg;
+        break;
+
+      case OPT_SCORE_FIELD:
+        parsed_args->fields[FIELD_SCORE] = optarg;
+        break;
+
+      case OPT_TIME_FIELD:
+        parsed_args->fields[FIELD_TIME] = optarg;
+        break;
+
+      case OPT_ID_FIELD:
+        parsed_args->fields[FIELD_ID] = optarg;
+        break;
+
+      case 't':
+        parsed_args->use_threshold = 1;
+        parsed_args->threshold = strtoll(optarg, &end, 10);
+        if (end == optarg || *end != '\0') {
+          fprintf(stderr, "Invalid threshold %s.\n\n", optarg);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case OPT_AFTER:
+        parsed_args->use_after = 1;
+        if (!parse_time(optarg, strlen(optarg), &parsed_args->after)) {
+          fprintf(stderr, "Invalid time %s.\n\n", optarg);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case OPT_BEFORE:
+        parsed_args->use_before = 1;
+        if (!parse_time(optarg, strlen(optarg), &parsed_args->before)) {
+          fprintf(stderr, "Invalid time %s.\n\n", optarg);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'p':
+        if (strcmp(optarg, "day") == 0) {
+          parsed_args->partition = DAY_SECONDS;
+        } else if (strcmp(optarg, "week") == 0) {
+          parsed_args->partition = WEEK_SECONDS;
+        } else {
+          fprintf(stderr, "Unknown partition unit %s.\n\n", optarg);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case OPT_EMPTY_WINDOWS:
+        parsed_args->empty_windows = 1;
+        break;
+
+      case 'm':
+        parsed_args->item_map = optarg;
+        break;
+
       case 'h':
         print_usage(argv[0]);
         exit(EXIT_SUCCESS);
@@ -116,9 +377,436 @@ void parse_args(int argc, char *argv[], struct args *parsed_args) {
 
   parsed_args->outfile = argv[optind];
 
+  if (parsed_args->scalable && !parsed_args->use_compression) {
+    fprintf(stderr, "%s\n\n", "Scalable filters are always compressed.");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (parsed_args->sharded && (!parsed_args->use_compression
+        || parsed_args->scalable
+        || parsed_args->bloom_bits < SHARD_BITS + 3)) {
+    fprintf(stderr, "Sharded filters must be compressed, cannot be scalable, "
+        "and need at least %d bloom-bits.\n\n", SHARD_BITS + 3);
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (parsed_args->chunked && (!parsed_args->use_compression
+        || parsed_args->scalable || parsed_args->sharded)) {
+    fprintf(stderr, "%s\n\n", "Chunked filters must be compressed, and "
+        "cannot be scalable or sharded.");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (parsed_args->format == FORMAT_LINES && (parsed_args->use_threshold
+        || parsed_args->use_after || parsed_args->use_before
+        || parsed_args->partition)) {
+    fprintf(stderr, "%s\n\n", "Filtering or partitioning by score or time "
+        "requires CSV or JSON Lines input.");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (parsed_args->format == FORMAT_LINES && parsed_args->item_map != NULL) {
+    fprintf(stderr, "%s\n\n", "Item maps require CSV or JSON Lines input "
+        "with item ids.");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // Windows are merged with combine_bloom, so they must all be the same size
+  if (parsed_args->partition && parsed_args->scalable) {
+    fprintf(stderr, "%s\n\n", "Partitioned filters cannot be scalable.");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
   return;
 }
 
+
+/***
+ * Return whether a story should be added to the filter given its score and
+ * time, or -1 if its score is not a number. Missing values count as zero, like
+ * SQLite casts NULL.
+ */
+int keep_record(struct args *args, record *r) {
+  if (r->fields[FIELD_URL] == NULL) {
+    return 0;
+  }
+
+  if (args->use_threshold) {
+    int64_t score = 0;
+    if (r->fields[FIELD_SCORE] != NULL && r->lengths[FIELD_SCORE] > 0
+        && !parse_score(r->fields[FIELD_SCORE], r->lengths[FIELD_SCORE],
+          &score)) {
+      return -1;
+    }
+    if (score < args->threshold) {
+      return 0;
+    }
+  }
+
+  if (args->use_after || args->use_before) {
+    int64_t time = 0;
+    if (r->fields[FIELD_TIME] != NULL) {
+      parse_time(r->fields[FIELD_TIME], r->lengths[FIELD_TIME], &time);
+    }
+    if ((args->use_after && time <= args->after)
+        || (args->use_before && time >= args->before)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+
+
+/***
+ * Return a pointer to the extension of a file name, or to its end if it does
+ * not have one.
+ */
+char *extension(char *filename) {
+  char *slash = strrchr(filename, '/');
+  char *dot = strrchr(filename, '.');
+  if (dot == NULL || (slash != NULL && dot < slash) || dot == filename
+      || dot[-1] == '/') {
+    dot = filename + strlen(filename);
+  }
+  return dot;
+}
+
+
+/***
+ * Write a host or prefix filter of 2^num_bits bits out next to the URL filter
+ * in filename, with suffix inserted before the extension, compressed unless
+ * turned off. Return 0 on failure.
+ */
+int write_side_filter(struct args *args, char *filename, char *suffix,
+    byte *filter, int num_bits) {
+  char *dot = extension(filename);
+  char *side_filename = malloc(strlen(filename) + strlen(suffix) + 1);
+  if (side_filename == NULL) {
+    return 0;
+  }
+  sprintf(side_filename, "%.*s%s%s", (int)(dot - filename), filename, suffix,
+      dot);
+
+  int success = 1;
+  if (args->use_compression) {
+    write_compressed_bloom(side_filename, filter, num_bits);
+  } else {
+    FILE *outfile;
+    if ((outfile = fopen(side_filename, "w")) == NULL) {
+      success = 0;
+    } else {
+      fwrite((void *)filter, sizeof(uint8_t), 1 << (num_bits - 3), outfile);
+      fclose(outfile);
+    }
+  }
+
+  free(side_filename);
+  return success;
+}
+
+
+/***
+ * Write a Bloom filter out, compressed unless turned off, along with its host
+ * and prefix filters if there are any. Return 0 on failure.
+ */
+int write_bloom(struct args *args, char *filename, byte *bloom, byte *hosts,
+    byte *prefixes) {
+  if (hosts != NULL
+      && !write_side_filter(args, filename, "-hosts", hosts, args->host_bits)) {
+    return 0;
+  }
+  if (prefixes != NULL && !write_side_filter(args, filename, "-prefixes",
+        prefixes, args->prefix_bits)) {
+    return 0;
+  }
+
+  if (args->sharded) {
+    write_sharded_bloom(filename, bloom, args->bloom_bits);
+    return 1;
+  } else if (args->chunked) {
+    write_chunked_bloom(filename, bloom, args->bloom_bits, args->jobs);
+    return 1;
+  } else if (args->use_compression) {
+    // Write the Bloom filter out to a gzip compressed file
+    write_compressed_bloom(filename, bloom, args->bloom_bits);
+    return 1;
+  }
+
+  // Write the Bloom filter out to a non-compressed file
+  FILE *outfile;
+  if ((outfile = fopen(filename, "w")) == NULL) {
+    return 0;
+  }
+  fwrite((void *)bloom, sizeof(uint8_t), 1 << (args->bloom_bits - 3), outfile);
+  fclose(outfile);
+  return 1;
+}
+
+
+/***
+ * Add a key to a plain or sharded Bloom filter, its host to the host filter,
+ * and its path prefixes to the prefix filter, if there are those.
+ */
+void add_key(struct args *args, byte *bloom, byte *hosts, byte *prefixes,
+    uint8_t *key, size_t length) {
+  if (hosts != NULL) {
+    add_url_host(hosts, args->host_bits, key, length);
+  }
+  if (prefixes != NULL) {
+    add_url_prefixes(prefixes, args->prefix_bits, key, length);
+  }
+  if (args->sharded) {
+    add_sharded_bloom(bloom, args->bloom_bits, key, length);
+  } else {
+    add_bloom(bloom, args->bloom_bits, key, length);
+  }
+}
+
+
+/***
+ * Save a key to be added to the filter for its time window later, keeping
+ * track of the first and last windows and how many bytes each one will take
+ * once sorted. Return 0 on failure.
+ */
+int save_key(struct partitions *p, int64_t window, uint8_t *key,
+    size_t length) {
+  if (p->spill == NULL && (p->spill = tmpfile()) == NULL) {
+    return 0;
+  }
+  uint32_t length32 = length;
+  if (fwrite(&window, sizeof(window), 1, p->spill) != 1
+      || fwrite(&length32, sizeof(length32), 1, p->spill) != 1
+      || fwrite(key, 1, length, p->spill) != length) {
+    return 0;
+  }
+
+  // Widen the sizes to cover the window if it is outside the current range
+  int64_t first = p->num_keys == 0 || window < p->first ? window : p->first;
+  int64_t last = p->num_keys == 0 || window > p->last ? window : p->last;
+  if (p->num_keys == 0 || first != p->first || last != p->last) {
+    uint64_t *sizes;
+    size_t count = (last - first) / p->partition + 1;
+    if ((sizes = calloc(count, sizeof(uint64_t))) == NULL) {
+      return 0;
+    }
+    if (p->num_keys > 0) {
+      memcpy(sizes + (p->first - first) / p->partition, p->sizes,
+          ((p->last - p->first) / p->partition + 1) * sizeof(uint64_t));
+    }
+    free(p->sizes);
+    p->sizes = sizes;
+    p->first = first;
+    p->last = last;
+  }
+  p->sizes[(window - p->first) / p->partition] += sizeof(length32) + length;
+  p->num_keys++;
+  return 1;
+}
+
+
+/***
+ * Read the length and bytes of one saved key into a buffer that grows as
+ * needed. Return 0 on failure.
+ */
+int read_key(FILE *f, uint32_t *length, char **key, size_t *capacity) {
+  if (fread(length, sizeof(*length), 1, f) != 1) {
+    return 0;
+  }
+  if (*length > *capacity) {
+    *capacity = 2 * *length;
+    free(*key);
+    if ((*key = malloc(*capacity)) == NULL) {
+      return 0;
+    }
+  }
+  return fread(*key, 1, *length, f) == *length;
+}
+
+
+/***
+ * Replace the spill file with one where every window's keys are stored
+ * together, in order of window. Each key is written at the next free offset
+ * of its window, found from the sizes counted while saving, so it only
+ * seeks when consecutive keys fall in different windows. Return 0 on failure.
+ */
+int sort_spill(struct partitions *p) {
+  size_t count = (p->last - p->first) / p->partition + 1;
+  uint64_t *offsets = malloc(count * sizeof(uint64_t));
+  FILE *sorted = tmpfile();
+  char *key = NULL;
+  size_t key_capacity = 0;
+  int success = offsets != NULL && sorted != NULL;
+
+  for (size_t i = 0, total = 0; success && i < count; i++) {
+    offsets[i] = total;
+    total += p->sizes[i];
+  }
+
+  rewind(p->spill);
+  uint64_t position = 0;
+  int64_t window;
+  uint32_t length;
+  for (size_t n = 0; success && n < p->num_keys; n++) {
+    if (fread(&window, sizeof(window), 1, p->spill) != 1
+        || !read_key(p->spill, &length, &key, &key_capacity)) {
+      success = 0;
+      break;
+    }
+    uint64_t *offset = offsets + (window - p->first) / p->partition;
+    if (*offset != position
+        && fseeko(sorted, (off_t)*offset, SEEK_SET) != 0) {
+      success = 0;
+      break;
+    }
+    if (fwrite(&length, sizeof(length), 1, sorted) != 1
+        || fwrite(key, 1, length, sorted) != length) {
+      success = 0;
+      break;
+    }
+    *offset += sizeof(length) + length;
+    position = *offset;
+  }
+
+  if (success) {
+    fclose(p->spill);
+    p->spill = sorted;
+    rewind(p->spill);
+  } else if (sorted != NULL) {
+    fclose(sorted);
+  }
+  free(offsets);
+  free(key);
+  return success;
+}
+
+
+/***
+ * Return the start of the time window that a time falls in.
+ */
+int64_t window_start(int64_t time, int64_t partition) {
+  int64_t offset = partition == WEEK_SECONDS ? WEEK_OFFSET : 0;
+  int64_t shifted = time - offset;
+  int64_t index = shifted >= 0 ? shifted / partition
+    : -((-shifted + partition - 1) / partition);
+  return index * partition + offset;
+}
+
+
+/***
+ * Allocate the filters for one time window. Return 0 on failure.
+ */
+int new_window(struct args *args, byte **bloom, byte **hosts,
+    byte **prefixes) {
+  *bloom = new_bloom(args->bloom_bits);
+  *hosts = args->host_bits ? new_bloom(args->host_bits) : NULL;
+  *prefixes = args->prefix_bits ? new_bloom(args->prefix_bits) : NULL;
+  return *bloom != NULL && (*hosts != NULL || !args->host_bits)
+    && (*prefixes != NULL || !args->prefix_bits);
+}
+
+
+/***
+ * Build and write out the filter for each time window from the first to the
+ * last. Windows without stories are skipped unless they are at the edges of
+ * the time limits, or unless --empty-windows asks for them, so a range of
+ * windows can be made complete. Each file name is the output file name with
+ * the first date of the window inserted before the extension. The saved keys
+ * are sorted by window first, so only one window's filters are in memory at a
+ * time and each key is read back once. Return 0 on failure.
+ */
+int write_partitions(struct args *args, struct partitions *p) {
+  // Include windows at the edges of the time limits even if they are empty
+  int64_t first = p->first, last = p->last;
+  if (args->use_after) {
+    first = window_start(args->after + 1, args->partition);
+    last = p->num_keys == 0 || last < first ? first : last;
+  }
+  if (args->use_before) {
+    last = window_start(args->before - 1, args->partition);
+    first = p->num_keys == 0 && !args->use_after ? last : first;
+  }
+  if ((p->num_keys == 0 && !args->use_after && !args->use_before)
+      || first > last) {
+    fprintf(stderr, "%s\n", "No stories to partition into time windows");
+    return 1;
+  }
+
+  // Split the output file name around the extension, if there is one
+  char *dot = extension(args->outfile);
+  size_t stem_length = dot - args->outfile;
+  char *filename = malloc(strlen(args->outfile) + 12);
+  byte *f[3] = { NULL, NULL, NULL };
+  char *key = NULL;
+  size_t key_capacity = 0;
+  int success = filename != NULL && new_window(args, f, f + 1, f + 2)
+    && (p->num_keys == 0 || sort_spill(p));
+  if (!success) {
+    perror("Unable to build time window filters");
+  }
+
+  for (int64_t start = first; success && start <= last;
+      start += args->partition) {
+    // Windows outside the saved range only come from the time limits
+    uint64_t size = 0;
+    if (p->num_keys > 0 && start >= p->first && start <= p->last) {
+      size = p->sizes[(start - p->first) / p->partition];
+    }
+    if (size == 0 && start != first && start != last && !args->empty_windows) {
+      continue;
+    }
+
+    // Reuse the filters from the previous window, clearing them
+    memset(f[0], 0, (size_t)1 << (args->bloom_bits - 3));
+    if (f[1] != NULL) {
+      memset(f[1], 0, (size_t)1 << (args->host_bits - 3));
+    }
+    if (f[2] != NULL) {
+      memset(f[2], 0, (size_t)1 << (args->prefix_bits - 3));
+    }
+
+    // The sorted keys for this window follow those of the previous one
+    uint32_t length;
+    for (uint64_t read = 0; read < size; read += sizeof(length) + length) {
+      if (!read_key(p->spill, &length, &key, &key_capacity)) {
+        perror("Unable to build time window filters");
+        success = 0;
+        break;
+      }
+      add_key(args, f[0], f[1], f[2], (uint8_t *)key, length);
+    }
+    if (!success) {
+      break;
+    }
+
+    char date[11];
+    format_date(start, date);
+    sprintf(filename, "%.*s-%s%s", (int)stem_length, args->outfile, date,
+        dot);
+    if (!write_bloom(args, filename, f[0], f[1], f[2])) {
+      perror("Unable to open output file");
+      success = 0;
+    }
+  }
+
+  free_bloom(f[0]);
+  free_bloom(f[1]);
+  free_bloom(f[2]);
+  free(filename);
+  free(key);
+  return success;
+}
+
+
+
 /*******************************************************************************
  * Main function
  ******************************************************************************/
@@ -129,11 +817,28 @@ int main(int argc, char *argv[]) {
   parse_args(argc, argv, &args);
 
   // Open files specified by user inputs
-  FILE *infile;
-  if (args.infile == NULL) {
-    infile = stdin;
-  } else if ((infile = fopen(args.infile, "r")) == NULL) {
-    perror("Unable to open input file");
+  record_reader *infile;
+  if ((infile = open_record_reader(args.infile, args.format, args.fields))
+      == NULL) {
+    if (args.format == FORMAT_CSV) {
+      fprintf(stderr, "Unable to read a CSV header with a \"%s\" column\n",
+          args.fields[FIELD_URL]);
+    } else {
+      perror("Unable to open input file");
+    }
+    return EXIT_FAILURE;
+  }
+  if (args.format == FORMAT_CSV
+      && ((args.use_threshold && infile->columns[FIELD_SCORE] == -1)
+        || ((args.use_after || args.use_before || args.partition)
+          && infile->columns[FIELD_TIME] == -1))) {
+    fprintf(stderr, "%s\n", "CSV header is missing a column to filter by");
+    return EXIT_FAILURE;
+  }
+  if (args.format == FORMAT_CSV && args.item_map != NULL
+      && infile->columns[FIELD_ID] == -1) {
+    fprintf(stderr, "CSV header is missing a \"%s\" column for the item map\n",
+        args.fields[FIELD_ID]);
     return EXIT_FAILURE;
   }
   if (args.outfile == NULL) {
@@ -143,46 +848,166 @@ int main(int argc, char *argv[]) {
   }
 
   // Allocate a new bloom filter
-  byte *bloom;
-  if ((bloom = new_bloom(args.bloom_bits)) == NULL) {
+  byte *bloom = NULL;
+  scalable_bloom *scalable = NULL;
+  if (args.scalable) {
+    if ((scalable = new_scalable_bloom(args.bloom_bits, NUM_HASHES)) == NULL) {
+      perror("Unable to create scalable Bloom filter");
+      return EXIT_FAILURE;
+    }
+  } else if (!args.partition && (bloom = new_bloom(args.bloom_bits)) == NULL) {
     perror("Unable to create Bloom filter");
     return EXIT_FAILURE;
   }
+  byte *hosts = NULL;
+  if (!args.partition && args.host_bits
+      && (hosts = new_bloom(args.host_bits)) == NULL) {
+    perror("Unable to create host filter");
+    return EXIT_FAILURE;
+  }
+  byte *prefixes = NULL;
+  if (!args.partition && args.prefix_bits
+      && (prefixes = new_bloom(args.prefix_bits)) == NULL) {
+    perror("Unable to create prefix filter");
+    return EXIT_FAILURE;
+  }
+  item_map_builder *items = NULL;
+  if (args.item_map != NULL && (items = new_item_map_builder()) == NULL) {
+    perror("Unable to create item map");
+    return EXIT_FAILURE;
+  }
+
+  // Add strings to the bloom filter from the input, record-by-record. URLs
+  // point directly into the input buffer (or the mapped file) where possible,
+  // and do not include the newline since hashing it would cause problems with
+  // JavaScript strings later on.
+  record r;
+  int status;
+  struct partitions partitions = { 0 };
+  partitions.partition = args.partition;
+  size_t untimed = 0;
+  size_t unidentified = 0;
+  size_t unscored = 0;
+  int keep;
+  char *canonical = NULL;
+  size_t canonical_capacity = 0;
+  while ((status = next_record(infile, &r)) != 0) {
+    if (status < 0) {
+      fprintf(stderr, "Skipping malformed record on line %lu\n",
+          (unsigned long)infile->line_number);
+      continue;
+    } else if ((keep = keep_record(&args, &r)) <= 0) {
+      unscored += keep < 0;
+      continue;
+    }
 
-  // Add strings to the bloom filter from the input, line-by-line
-  size_t n = 0;
-  char *buffer = NULL;
-  ssize_t bytes_read;
-  while ((bytes_read = getline(&buffer, &n, infile)) != -1) {
-    assert(bytes_read >= 1);
-    // Use one less byte of the buffer since it includes the deliminter due to
-    // the implementation of getline, and hashing the newline will cause
-    // problems with JavaScript strings later on
-    // NOTE: Important to see that bytes_read is VERY different from n, which
-    // is the allocated size -- originally, missing this led to a gnarly bug
-    add_bloom(bloom, args.bloom_bits, (uint8_t *)buffer, bytes_read - 1);
+    uint8_t *key = (uint8_t *)r.fields[FIELD_URL];
+    size_t length = r.lengths[FIELD_URL];
+    if (args.canonicalize) {
+      if (CANONICAL_MAX(length) > canonical_capacity) {
+        canonical_capacity = 2 * CANONICAL_MAX(length);
+        free(canonical);
+        if ((canonical = malloc(canonical_capacity)) == NULL) {
+          perror("Unable to allocate canonicalization buffer");
+          return EXIT_FAILURE;
+        }
+      }
+      length = canonicalize_url((char *)key, length, canonical);
+      key = (uint8_t *)canonical;
+    }
+
+    if (items != NULL) {
+      int64_t id = 0, score = 0;
+      if (r.fields[FIELD_ID] == NULL
+          || !parse_score(r.fields[FIELD_ID], r.lengths[FIELD_ID], &id)) {
+        id = 0;
+      }
+      if (r.fields[FIELD_SCORE] == NULL || !parse_score(r.fields[FIELD_SCORE],
+            r.lengths[FIELD_SCORE], &score)) {
+        score = 0;
+      }
+      if (id <= 0 || id > UINT32_MAX) {
+        unidentified++;
+      } else if (!add_item_map(items, key, length, (uint32_t)id, score)) {
+        perror("Unable to add story to item map");
+        return EXIT_FAILURE;
+      }
+    }
+
+    if (args.partition) {
+      int64_t time;
+      if (r.fields[FIELD_TIME] == NULL
+          || !parse_time(r.fields[FIELD_TIME], r.lengths[FIELD_TIME], &time)) {
+        untimed++;
+      } else if (!save_key(&partitions, window_start(time, args.partition),
+            key, length)) {
+        perror("Unable to save key for partitioning");
+        return EXIT_FAILURE;
+      }
+    } else if (scalable) {
+      if (hosts != NULL) {
+        add_url_host(hosts, args.host_bits, key, length);
+      }
+      if (prefixes != NULL) {
+        add_url_prefixes(prefixes, args.prefix_bits, key, length);
+      }
+      add_scalable_bloom(scalable, key, length);
+    } else {
+      add_key(&args, bloom, hosts, prefixes, key, length);
+    }
   }
 
-  if (args.use_compression) {
-    // Write the Bloom filter out to a gzip compressed file
-    write_compressed_bloom(args.outfile, bloom, args.bloom_bits);
-  } else {
-    // Write teh Bloom filter out to a non-compressed file
-    FILE *outfile;
-    if ((outfile = fopen(args.outfile, "w")) == NULL) {
-      perror("Unable to open output file");
-      print_usage(argv[0]);
+  if (untimed > 0) {
+    fprintf(stderr, "Skipped %lu records without a time\n",
+        (unsigned long)untimed);
+  }
+  if (unscored > 0) {
+    fprintf(stderr, "Skipped %lu records with a score that is not a number\n",
+        (unsigned long)unscored);
+  }
+  if (unidentified > 0) {
+    fprintf(stderr, "Left %lu records without an item id out of the map\n",
+        (unsigned long)unidentified);
+  }
+  if (items != NULL) {
+    write_item_map(args.item_map, items);
+  }
+
+  if (args.partition) {
+    if (!write_partitions(&args, &partitions)) {
       return EXIT_FAILURE;
     }
-    fwrite((void *)bloom, sizeof(uint8_t), 1 << (args.bloom_bits - 3), outfile);
-    fclose(outfile);
+  } else if (scalable) {
+    write_compressed_scalable_bloom(args.outfile, scalable);
+    if (hosts != NULL && !write_side_filter(&args, args.outfile, "-hosts",
+          hosts, args.host_bits)) {
+      perror("Unable to open host filter output file");
+      return EXIT_FAILURE;
+    }
+    if (prefixes != NULL && !write_side_filter(&args, args.outfile,
+          "-prefixes", prefixes, args.prefix_bits)) {
+      perror("Unable to open prefix filter output file");
+      return EXIT_FAILURE;
+    }
+  } else if (!write_bloom(&args, args.outfile, bloom, hosts, prefixes)) {
+    perror("Unable to open output file");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
   }
 
   // Clean up
-  free(buffer);
+  if (partitions.spill != NULL) {
+    fclose(partitions.spill);
+  }
+  free(partitions.sizes);
+  free(canonical);
   free_bloom(bloom);
+  free_bloom(hosts);
+  free_bloom(prefixes);
+  free_scalable_bloom(scalable);
+  free_item_map_builder(items);
 
-  fclose(infile);
+  close_record_reader(infile);
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,105 @@
+/* bloom-file.c
+ *
+ * Implementation of reading Bloom filter files in every on-disk format.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bloom-file.h"
+#include "chunked-bloom.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+// Largest filter any tool will load, 2^31 bits
+#define MAX_BLOOM_SIZE ((size_t)1 << 28)
+
+static inline int valid_bloom_size(size_t size) {
+  return size > 0 && (size & (size - 1)) == 0 && size <= MAX_BLOOM_SIZE;
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+byte *read_whole_file(char *filename, size_t *size) {
+  FILE *f;
+  if ((f = fopen(filename, "rb")) == NULL) {
+    return NULL;
+  }
+  byte *buffer = NULL;
+  long length;
+  if (fseek(f, 0l, SEEK_END) == 0 && (length = ftell(f)) > 0) {
+    rewind(f);
+    if ((buffer = (byte *)malloc(length)) != NULL
+        && fread(buffer, 1, length, f) != (size_t)length) {
+      free(buffer);
+      buffer = NULL;
+    }
+    *size = length;
+  }
+  fclose(f);
+  return buffer;
+}
+
+
+/***
+ * The format is decided by size before looking at any magic bytes: a file of
+ * exactly a valid filter size is raw, since the first bytes of a raw filter
+ * are arbitrary and may happen to look like a gzip or chunked header. Such a
+ * file is only decompressed if its header promises a larger filter and it
+ * inflates cleanly, which raw bits will essentially never do.
+ */
+byte *load_bloom_file(char *filename, uint8_t *num_bits, int threads) {
+  size_t size;
+  byte *data;
+  if ((data = read_whole_file(filename, &size)) == NULL) {
+    return NULL;
+  }
+  int raw_size = valid_bloom_size(size);
+
+  // Inflate directly into a buffer of the right size if compressed. Chunked
+  // filters are inflated on several threads, each chunk into its place.
+  byte *bloom = NULL;
+  size_t bloom_size = 0;
+  uint8_t chunked_bits;
+  if ((chunked_bits = chunked_bloom_bits(data, size)) > 0) {
+    bloom_size = (size_t)1 << (chunked_bits - 3);
+    if ((!raw_size || bloom_size > size)
+        && (bloom = (byte *)malloc(bloom_size)) != NULL
+        && !decompress_chunked_bloom(data, size, bloom, threads)) {
+      free(bloom);
+      bloom = NULL;
+    }
+  } else if (valid_bloom_size(bloom_size = decompressed_bloom_size(data,
+          size))) {
+    if ((!raw_size || bloom_size > size)
+        && (bloom = (byte *)malloc(bloom_size)) != NULL
+        && !decompress_bloom_into(data, size, bloom, bloom_size)) {
+      free(bloom);
+      bloom = NULL;
+    }
+  }
+
+  if (bloom != NULL) {
+    free(data);
+    data = bloom;
+    size = bloom_size;
+  } else if (!raw_size) {
+    free(data);
+    return NULL;
+  }
+
+  *num_bits = 3;
+  while (((size_t)1 << (*num_bits - 3)) < size) {
+    (*num_bits)++;
+  }
+  return data;
+}
@@ -0,0 +1,40 @@
+/* bloom-file.h
+ *
+ * Interface for reading Bloom filter files from disk in any of the formats the
+ * command-line tools write: raw, gzip compressed, or chunked. Every tool that
+ * loads filters uses these functions, so they all accept the same files.
+ */
+
+
+#ifndef BLOOM_FILE_H
+#define BLOOM_FILE_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Read an entire file into a newly allocated buffer, storing its size. Returns
+ * NULL if the file cannot be read or is empty.
+ */
+byte *read_whole_file(char *filename, size_t *size);
+
+
+/***
+ * Load a Bloom filter file into a newly allocated buffer (freed with
+ * free_bloom), storing its size as a power of two in num_bits. Chunked files
+ * are inflated on the given number of threads. Returns NULL if the file cannot
+ * be read, cannot be decompressed, or is not a valid filter size.
+ */
+byte *load_bloom_file(char *filename, uint8_t *num_bits, int threads);
+
+
+#endif /* BLOOM_FILE_H */
@@ -0,0 +1,254 @@
+/* bloom-jobs.c
+ *
+ * Implementation of Bloom filter operations run on worker threads.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom-jobs.h"
+
+
+
+/*******************************************************************************
+ * Types and structs
+ ******************************************************************************/
+
+struct job {
+  // Only ever read and written atomically, since workers set it when done
+  job_state state;
+  job_kind kind;
+  // Input owned by the job (compressed filter or keys), freed when finished
+  byte *input;
+  size_t input_size;
+  // Filter written or read by the job, owned by the caller
+  byte *bloom;
+  byte *new;
+  uint8_t num_bits;
+  // Output of the job: a filter owned by the caller, or batch query bits
+  // owned by the job
+  byte *result;
+  size_t result_size;
+};
+
+
+
+/*******************************************************************************
+ * Global variables
+ ******************************************************************************/
+
+static struct job jobs[MAX_JOBS];
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+static inline job_state load_state(struct job *job) {
+  return __atomic_load_n(&job->state, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_state(struct job *job, job_state state) {
+  __atomic_store_n(&job->state, state, __ATOMIC_RELEASE);
+}
+
+
+/***
+ * Return whether id refers to a job that has been submitted.
+ */
+static int valid_job(int id) {
+  return id >= 0 && id < MAX_JOBS && load_state(&jobs[id]) != JOB_FREE;
+}
+
+
+/***
+ * Run a batch query over newline-separated keys. Returns 0 if memory for the
+ * keys or results cannot be allocated.
+ */
+static int run_batch(struct job *job) {
+  size_t n = 0;
+  for (size_t i = 0; i < job->input_size; i++) {
+    n += job->input[i] == '\n';
+  }
+  if (job->input_size > 0 && job->input[job->input_size - 1] != '\n') {
+    n++;
+  }
+
+  byte **keys = (byte **)malloc((n > 0 ? n : 1) * sizeof(byte *));
+  uint32_t *lengths = (uint32_t *)malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+  job->result = (byte *)calloc((n + 7) / 8 > 0 ? (n + 7) / 8 : 1, 1);
+  if (keys == NULL || lengths == NULL || job->result == NULL) {
+    free(keys);
+    free(lengths);
+    return 0;
+  }
+
+  byte *start = job->input;
+  byte *end = job->input + job->input_size;
+  for (size_t i = 0; i < n; i++) {
+    byte *newline = (byte *)memchr(start, '\n', end - start);
+    keys[i] = start;
+    lengths[i] = (newline == NULL ? end : newline) - start;
+    start += lengths[i] + 1;
+  }
+  in_bloom_batch(job->bloom, job->num_bits, keys, lengths, n, job->result);
+  job->result_size = n;
+
+  free(keys);
+  free(lengths);
+  return 1;
+}
+
+
+/***
+ * Thread entry point that runs a job to completion and publishes its result.
+ */
+static void *run_job(void *arg) {
+  struct job *job = (struct job *)arg;
+  int success = 1;
+
+  switch (job->kind) {
+    case JOB_DECOMPRESS:
+      success = decompress_bloom_into(job->input, job->input_size,
+          job->bloom, job->result_size);
+      break;
+
+    case JOB_COMBINE:
+      combine_bloom(job->bloom, job->new, job->num_bits);
+      break;
+
+    case JOB_BATCH:
+      success = run_batch(job);
+      break;
+  }
+
+  free(job->input);
+  job->input = NULL;
+  store_state(job, success ? JOB_DONE : JOB_FAILED);
+  return NULL;
+}
+
+
+/***
+ * Claim a free job, or return -1 if there is none.
+ */
+static int claim_job(job_kind kind) {
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if (load_state(&jobs[i]) == JOB_FREE) {
+      (void)memset((void *)&jobs[i], 0, sizeof(struct job));
+      jobs[i].kind = kind;
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+/***
+ * Start a claimed job on its own detached thread, or run it on this one if no
+ * thread can be started.
+ */
+static int start_job(int id) {
+  struct job *job = &jobs[id];
+  store_state(job, JOB_RUNNING);
+
+  pthread_t thread;
+  pthread_attr_t attr;
+  int started = 0;
+  if (pthread_attr_init(&attr) == 0) {
+    (void)pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    started = pthread_create(&thread, &attr, run_job, job) == 0;
+    (void)pthread_attr_destroy(&attr);
+  }
+  if (!started) {
+    run_job(job);
+  }
+  return id;
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+int submit_decompress(byte *compressed, size_t size, byte *bloom,
+    size_t bloom_size) {
+  int id;
+  if ((id = claim_job(JOB_DECOMPRESS)) < 0) {
+    return -1;
+  }
+  jobs[id].input = compressed;
+  jobs[id].input_size = size;
+  jobs[id].bloom = bloom;
+  jobs[id].result = bloom;
+  jobs[id].result_size = bloom_size;
+  return start_job(id);
+}
+
+
+int submit_combine(byte *bloom, byte *new, uint8_t num_bits) {
+  int id;
+  if ((id = claim_job(JOB_COMBINE)) < 0) {
+    return -1;
+  }
+  jobs[id].bloom = bloom;
+  jobs[id].new = new;
+  jobs[id].num_bits = num_bits;
+  jobs[id].result = bloom;
+  jobs[id].result_size = (size_t)1 << (num_bits - 3);
+  return start_job(id);
+}
+
+
+int submit_batch(byte *bloom, uint8_t num_bits, byte *keys, size_t length) {
+  int id;
+  if ((id = claim_job(JOB_BATCH)) < 0) {
+    return -1;
+  }
+  jobs[id].input = keys;
+  jobs[id].input_size = length;
+  jobs[id].bloom = bloom;
+  jobs[id].num_bits = num_bits;
+  return start_job(id);
+}
+
+
+job_state poll_job(int id) {
+  return id >= 0 && id < MAX_JOBS ? load_state(&jobs[id]) : JOB_FREE;
+}
+
+
+job_kind job_kind_of(int id) {
+  return jobs[id].kind;
+}
+
+
+byte *job_result(int id) {
+  return valid_job(id) ? jobs[id].result : NULL;
+}
+
+
+size_t job_size(int id) {
+  return valid_job(id) ? jobs[id].result_size : 0;
+}
+
+
+/***
+ * Only batch query results belong to the job; filters belong to the caller.
+ */
+int release_job(int id) {
+  job_state state = poll_job(id);
+  if (state == JOB_FREE || state == JOB_RUNNING) {
+    return 0;
+  }
+  if (jobs[id].kind == JOB_BATCH) {
+    free(jobs[id].result);
+  }
+  jobs[id].result = NULL;
+  store_state(&jobs[id], JOB_FREE);
+  return 1;
+}
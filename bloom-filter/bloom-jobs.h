@@ -0,0 +1,121 @@
+/* bloom-jobs.h
+ *
+ * Interface for running slow Bloom filter operations (decompression, merges,
+ * and batch queries) on worker threads, so that the thread that submits them
+ * can keep answering ordinary lookups in the meantime. Each job is submitted,
+ * polled until it is finished, and then released.
+ *
+ * Jobs are submitted, polled, and released from one thread only. Workers only
+ * write to the memory of their own job, and publish their results by setting
+ * its state last.
+ */
+
+
+#ifndef BLOOM_JOBS_H
+#define BLOOM_JOBS_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// Maximum number of jobs submitted but not yet released
+#define MAX_JOBS 16
+
+typedef enum job_state_e {
+  JOB_FREE = 0,
+  JOB_RUNNING,
+  JOB_DONE,
+  JOB_FAILED,
+} job_state;
+
+typedef enum job_kind_e {
+  JOB_DECOMPRESS,
+  JOB_COMBINE,
+  JOB_BATCH,
+} job_kind;
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Start inflating a gzip compressed filter into bloom, a caller-allocated
+ * buffer of exactly bloom_size bytes. The job takes ownership of compressed,
+ * which must have been allocated with malloc, and frees it when finished.
+ *
+ * Returns a job id, or -1 if there is no free job, in which case the caller
+ * keeps ownership of compressed.
+ */
+int submit_decompress(byte *compressed, size_t size, byte *bloom,
+    size_t bloom_size);
+
+
+/***
+ * Start combining new into bloom, as by combine_bloom. Lookups in bloom may
+ * continue while the job runs, since bits are only ever set: a lookup sees
+ * either the old or the combined value of each byte.
+ *
+ * Returns a job id, or -1 if there is no free job.
+ */
+int submit_combine(byte *bloom, byte *new, uint8_t num_bits);
+
+
+/***
+ * Start checking every newline-separated key in keys against the filter, as
+ * by in_bloom_batch. The job takes ownership of keys, which must have been
+ * allocated with malloc. When the job is done, job_result returns one bit per
+ * key and job_size returns the number of keys.
+ *
+ * Returns a job id, or -1 if there is no free job, in which case the caller
+ * keeps ownership of keys.
+ */
+int submit_batch(byte *bloom, uint8_t num_bits, byte *keys, size_t length);
+
+
+/***
+ * Return the state of a job without waiting for it. Jobs whose threads cannot
+ * be started (as in WebAssembly built without them) are run while they are
+ * submitted, so they are already finished when first polled.
+ */
+job_state poll_job(int id);
+
+
+/***
+ * Return the kind of a submitted job.
+ */
+job_kind job_kind_of(int id);
+
+
+/***
+ * Return the output of a finished job: the filter written by a decompression
+ * or merge, or the bits written by a batch query.
+ */
+byte *job_result(int id);
+
+
+/***
+ * Return the size of the output of a finished job: bytes of filter, or the
+ * number of keys in a batch query.
+ */
+size_t job_size(int id);
+
+
+/***
+ * Free everything owned by a finished job and make its id available again.
+ * Filters passed in by the caller are never freed. Running jobs cannot be
+ * released, and 0 is returned if one is.
+ */
+int release_job(int id);
+
+
+#endif /* BLOOM_JOBS_H */
@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h> // memset, memcpy
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
@@ -20,7 +21,15 @@
 #define EMSCRIPTEN_KEEPALIVE
 #endif /* __EMSCRIPTEN__ */
 
+#include "arena.h"
+#include "bloom-jobs.h"
 #include "bloom.h"
+#include "cuckoo.h"
+#include "host-filter.h"
+#include "item-map.h"
+#include "lookup-cache.h"
+#include "prefix-filter.h"
+#include "sharded-bloom.h"
 
 
 
@@ -35,41 +44,195 @@ struct decompressed_s {
 
 
 
+/*******************************************************************************
+ * Global variables
+ ******************************************************************************/
+
+// Bloom filters are carved from one region so that filters freed by
+// freeBloom are reused by the next ones allocated, rather than fragmenting
+// the heap. Chunks are sized for one 16MB filter each.
+static region *filters = NULL;
+
+// Per-call scratch memory (URLs and compressed filters copied in from
+// JavaScript) comes from an arena that is reset at the end of each call
+static arena *scratch = NULL;
+
+// Results of recent lookups, keyed by URL. Every wrapper below that changes
+// the contents of a filter, or frees or allocates one, invalidates it.
+static lookup_cache *lookups = NULL;
+
+// Fingerprint of the URL last looked up in the cache, as high and low halves,
+// so a result found after a miss can be cached without hashing the URL again
+static uint32_t last_fingerprint[2];
+
+// Results of decompression are returned in static storage instead of on the
+// heap, so there is nothing for the caller to free
+static struct decompressed_s decompressed;
+
+#ifdef BLOOM_STATS
+// Statistics are formatted as JSON into static storage for the same reason
+static char stats_json[16384];
+#endif /* BLOOM_STATS */
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Lazily set up the region and arena the first time they are needed.
+ */
+static int init_arenas() {
+  if (filters == NULL && (filters = new_region((1 << 24) + 64)) == NULL) {
+    return 0;
+  }
+  if (scratch == NULL && (scratch = new_arena(1 << 16)) == NULL) {
+    return 0;
+  }
+  return 1;
+}
+
+
+/***
+ * Release all scratch memory at the end of a call.
+ */
+static void reset_scratch() {
+  if (scratch != NULL) {
+    arena_reset(scratch);
+  }
+}
+
+
+/***
+ * Forget all cached lookup results, because the filters they came from have
+ * changed.
+ */
+static void invalidate_lookups() {
+  if (lookups != NULL) {
+    invalidate_lookup_cache(lookups);
+  }
+}
+
+
+/***
+ * Allocate a zeroed filter of 2^num_bits bits from the filter region.
+ */
+static byte *region_bloom(uint8_t num_bits) {
+  if (num_bits < 3 || num_bits > 31 || !init_arenas()) {
+    return NULL;
+  }
+
+  size_t num_bytes = (size_t)1 << (num_bits - 3);
+  byte *bloom;
+  if ((bloom = (byte *)region_alloc(filters, num_bytes)) != NULL) {
+    (void)memset((void *)bloom, 0, num_bytes);
+  }
+  return bloom;
+}
+
+
+
 /*******************************************************************************
  * Wrappers around library functions
  ******************************************************************************/
 
+/***
+ * Return space for size bytes of input to the next call, such as a URL or a
+ * compressed Bloom filter. The space is only valid until that call returns.
+ */
+EMSCRIPTEN_KEEPALIVE
+byte *js_scratch_alloc(size_t size) {
+  if (!init_arenas()) {
+    return NULL;
+  }
+  return (byte *)arena_alloc(scratch, size);
+}
+
+
+/***
+ * Return the number of bytes reserved for filters and for scratch memory.
+ * Useful for confirming that the heap does not grow across reloads.
+ */
+EMSCRIPTEN_KEEPALIVE
+size_t js_filters_reserved() {
+  return filters == NULL ? 0 : region_reserved(filters);
+}
+
+EMSCRIPTEN_KEEPALIVE
+size_t js_scratch_reserved() {
+  return scratch == NULL ? 0 : arena_reserved(scratch);
+}
+
+
 EMSCRIPTEN_KEEPALIVE
 byte *js_new_bloom(uint8_t num_bits) {
-  return new_bloom(num_bits);
+  invalidate_lookups();
+  return region_bloom(num_bits);
 }
 
 
 EMSCRIPTEN_KEEPALIVE
 void js_free_bloom(byte *bloom) {
-  free_bloom(bloom);
+  invalidate_lookups();
+  if (filters != NULL) {
+    region_free(filters, bloom);
+  }
 }
 
 
 /***
- * Return a pointer to a heap-allocated structure containing a pointer to the
- * heap-allocated decompressed Bloom filter and its size. Use the helpful
- * wrappers below to return the address and size individually from the structure.
+ * Return a pointer to a statically-allocated structure containing a pointer to
+ * the decompressed Bloom filter and its size. Use the helpful wrappers below
+ * to return the address and size individually from the structure.
  *
  * Implemented this way to facilitate returning a size and address with only
  * one call to the underlying decompression function – decompressing twice is
  * wasteful.
  *
- * NOTE: Both the structure and returned Bloom filter must be individually and
- * manually freed.
+ * The compressed filter is expected to be in scratch memory, and is released
+ * before returning. Since gzip records the decompressed size, the filter is
+ * allocated from the filter region up-front and inflated directly into it.
+ * Streams without a recorded size fall back to decompress_bloom and are
+ * copied into the region. Chunked filters are only read by the command-line
+ * tools, and are rejected here like any other invalid data.
+ *
+ * NOTE: The returned Bloom filter must be freed using js_free_bloom. The
+ * structure itself must not be freed.
  */
 EMSCRIPTEN_KEEPALIVE
 struct decompressed_s *js_decompress_bloom(byte *compressed, size_t size) {
-  struct decompressed_s *decompressed = malloc(sizeof(struct decompressed_s));
-  byte *bloom;
-  decompressed->size = decompress_bloom(compressed, size, &bloom);
-  decompressed->bloom = bloom;
-  return decompressed;
+  invalidate_lookups();
+  decompressed.bloom = NULL;
+  decompressed.size = 0;
+
+  size_t bloom_size = decompressed_bloom_size(compressed, size);
+  if (bloom_size >= 1 && init_arenas()) {
+    byte *bloom;
+    if ((bloom = (byte *)region_alloc(filters, bloom_size)) != NULL) {
+      if (decompress_bloom_into(compressed, size, bloom, bloom_size)) {
+        decompressed.bloom = bloom;
+        decompressed.size = bloom_size;
+      } else {
+        region_free(filters, bloom);
+      }
+    }
+  } else if (init_arenas()) {
+    byte *raw = NULL;
+    size_t raw_size = decompress_bloom(compressed, size, &raw);
+    byte *bloom;
+    if (raw_size > 0
+        && (bloom = (byte *)region_alloc(filters, raw_size)) != NULL) {
+      (void)memcpy((void *)bloom, (void *)raw, raw_size);
+      decompressed.bloom = bloom;
+      decompressed.size = raw_size;
+    }
+    free(raw);
+  }
+
+  reset_scratch();
+
+  return &decompressed;
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -83,21 +246,420 @@ byte *js_get_decompressed_bloom(struct decompressed_s *decompressed) {
 }
 
 
+/***
+ * The data is expected to be in scratch memory, and is released before
+ * returning. The same goes for each of the wrappers below that take data.
+ */
 EMSCRIPTEN_KEEPALIVE
 void js_add_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length) {
   add_bloom(bloom, num_bits, data, length);
+  invalidate_lookups();
+  reset_scratch();
 }
 
 
 EMSCRIPTEN_KEEPALIVE
 int js_in_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length) {
-  return in_bloom(bloom, num_bits, data, length);
+  int result = in_bloom(bloom, num_bits, data, length);
+  reset_scratch();
+  return result;
 }
 
 
 EMSCRIPTEN_KEEPALIVE
 void js_combine_bloom(byte *bloom, byte *new, uint8_t num_bits) {
   combine_bloom(bloom, new, num_bits);
+  invalidate_lookups();
+}
+
+
+/***
+ * Host filter wrappers. A URL is checked against the small host filter first,
+ * so most lookups on hosts that were never submitted do not touch the URL
+ * filter at all.
+ */
+EMSCRIPTEN_KEEPALIVE
+void js_add_url_host(byte *hosts, uint8_t host_bits, byte *data,
+    uint32_t length) {
+  add_url_host(hosts, host_bits, data, length);
+  invalidate_lookups();
+  reset_scratch();
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+int js_in_bloom_with_hosts(byte *hosts, uint8_t host_bits, byte *bloom,
+    uint8_t num_bits, byte *data, uint32_t length) {
+  int result = in_bloom_with_hosts(hosts, host_bits, bloom, num_bits, data,
+      length);
+  reset_scratch();
+  return result;
+}
+
+
+/***
+ * Prefix filter wrappers. The longest prefix of a URL with stories under it is
+ * found by probing every prefix of the URL in one pass.
+ */
+EMSCRIPTEN_KEEPALIVE
+void js_add_url_prefixes(byte *prefixes, uint8_t prefix_bits, byte *data,
+    uint32_t length) {
+  add_url_prefixes(prefixes, prefix_bits, data, length);
+  reset_scratch();
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+uint32_t js_longest_url_prefix(byte *prefixes, uint8_t prefix_bits,
+    byte *data, uint32_t length) {
+  uint32_t result = longest_url_prefix(prefixes, prefix_bits, data, length);
+  reset_scratch();
+  return result;
+}
+
+
+/***
+ * Sharded filter wrappers. Only the compressed filter is kept in memory when
+ * it is opened, and each lookup decompresses at most the one shard its URL
+ * falls in. The compressed data is expected to be in scratch memory, so it is
+ * copied before the scratch memory is released. The copy, the filter, and its
+ * shards all come from the filter region, so they are reused across resets.
+ */
+EMSCRIPTEN_KEEPALIVE
+sharded_bloom *js_open_sharded_bloom(byte *compressed, size_t size) {
+  invalidate_lookups();
+  sharded_bloom *filter = NULL;
+  byte *data;
+  if (init_arenas()
+      && (data = (byte *)region_alloc(filters, size)) != NULL) {
+    (void)memcpy((void *)data, (void *)compressed, size);
+    if ((filter = open_sharded_bloom(data, size, filters)) == NULL) {
+      region_free(filters, data);
+    }
+  }
+  reset_scratch();
+  return filter;
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+void js_free_sharded_bloom(sharded_bloom *filter) {
+  invalidate_lookups();
+  if (filter == NULL) {
+    return;
+  }
+  byte *data = filter->data;
+  free_sharded_bloom(filter);
+  region_free(filters, data);
+}
+
+
+/***
+ * Returns -1 if the shard for the URL could not be decompressed.
+ */
+EMSCRIPTEN_KEEPALIVE
+int js_in_sharded_bloom(sharded_bloom *filter, byte *data, uint32_t length) {
+  int result = in_sharded_bloom(filter, data, length);
+  reset_scratch();
+  return result;
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+int js_sharded_loaded(sharded_bloom *filter) {
+  return filter->num_loaded;
+}
+
+
+/***
+ * Return the fraction of bits set in a Bloom filter.
+ */
+EMSCRIPTEN_KEEPALIVE
+double js_fill_ratio(byte *bloom, uint8_t num_bits) {
+  return fill_ratio(bloom, num_bits);
+}
+
+
+/***
+ * Return the statistics collected by the library as a JSON string, or null if
+ * it was compiled without them (see STATS in the Makefile). Each operation
+ * has a count of calls, keys, and hits, the total time in nanoseconds, and a
+ * histogram in which entry i counts calls taking 2^i to 2^(i + 1) ns.
+ *
+ * NOTE: The string is statically allocated, and must not be freed.
+ */
+EMSCRIPTEN_KEEPALIVE
+char *js_get_stats() {
+#ifdef BLOOM_STATS
+  char *names[NUM_STATS_OPS] = {
+    "add_bloom", "in_bloom", "in_bloom_batch", "combine_bloom",
+    "decompress_bloom",
+  };
+  bloom_stats *stats = get_bloom_stats();
+  size_t used = 0;
+  used += snprintf(stats_json + used, sizeof(stats_json) - used, "{");
+  for (int op = 0; op < NUM_STATS_OPS; op++) {
+    op_stats *s = &stats->ops[op];
+    used += snprintf(stats_json + used, sizeof(stats_json) - used,
+        "%s\"%s\":{\"calls\":%llu,\"keys\":%llu,\"hits\":%llu,"
+        "\"total_ns\":%llu,\"histogram\":[", op == 0 ? "" : ",", names[op],
+        (unsigned long long)s->calls, (unsigned long long)s->keys,
+        (unsigned long long)s->hits, (unsigned long long)s->total_ns);
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+      used += snprintf(stats_json + used, sizeof(stats_json) - used, "%s%llu",
+          i == 0 ? "" : ",", (unsigned long long)s->histogram[i]);
+    }
+    used += snprintf(stats_json + used, sizeof(stats_json) - used, "]}");
+  }
+  (void)snprintf(stats_json + used, sizeof(stats_json) - used, "}");
+  return stats_json;
+#else /* BLOOM_STATS */
+  return "null";
+#endif /* BLOOM_STATS */
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+void js_reset_stats() {
+#ifdef BLOOM_STATS
+  reset_bloom_stats();
+#endif /* BLOOM_STATS */
+}
+
+
+/***
+ * Cuckoo filter wrappers used to store stories learned locally, along with the
+ * index of the highest score threshold each one meets.
+ */
+EMSCRIPTEN_KEEPALIVE
+cuckoo *js_new_cuckoo(uint8_t num_bits) {
+  invalidate_lookups();
+  return new_cuckoo(num_bits);
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+void js_free_cuckoo(cuckoo *filter) {
+  invalidate_lookups();
+  free_cuckoo(filter);
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+int js_insert_cuckoo(cuckoo *filter, byte *data, uint32_t length,
+    uint8_t value) {
+  int result = insert_cuckoo(filter, data, length, value);
+  invalidate_lookups();
+  reset_scratch();
+  return result;
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+int js_delete_cuckoo(cuckoo *filter, byte *data, uint32_t length) {
+  int result = delete_cuckoo(filter, data, length);
+  invalidate_lookups();
+  reset_scratch();
+  return result;
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+int js_lookup_cuckoo(cuckoo *filter, byte *data, uint32_t length) {
+  int result = lookup_cuckoo(filter, data, length);
+  reset_scratch();
+  return result;
+}
+
+
+
+/***
+ * Lookup cache wrappers. The extension caches the best score threshold found
+ * for each canonical URL, so that revisiting a page costs one fingerprint and
+ * one probe instead of a lookup in every filter. The cache holds 2^10 results
+ * in 16KB, and is allocated the first time a result is cached.
+ *
+ * Returns the cached value, or -2 if there is none. Either way, the URL's
+ * fingerprint is left at the address returned by js_last_fingerprint, to be
+ * passed back to js_put_cached after a miss.
+ */
+EMSCRIPTEN_KEEPALIVE
+int js_get_cached(byte *data, uint32_t length) {
+  uint64_t fingerprint = lookup_fingerprint(data, length);
+  last_fingerprint[0] = fingerprint >> 32;
+  last_fingerprint[1] = fingerprint & 0xffffffff;
+  int32_t value = -2;
+  if (lookups == NULL || !get_lookup_cache(lookups, fingerprint, &value)) {
+    value = -2;
+  }
+  reset_scratch();
+  return value;
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+uint32_t *js_last_fingerprint() {
+  return last_fingerprint;
+}
+
+
+/***
+ * Values cached from JavaScript must be at least -1 (meaning the URL is in no
+ * filter), and other values are not cached.
+ */
+EMSCRIPTEN_KEEPALIVE
+void js_put_cached(uint32_t high, uint32_t low, int32_t value) {
+  if (value >= -1
+      && (lookups != NULL || (lookups = new_lookup_cache(10)) != NULL)) {
+    put_lookup_cache(lookups, ((uint64_t)high << 32) | low, value);
+  }
+}
+
+
+/***
+ * Needed when results change for reasons the library cannot see, such as the
+ * settings choosing which filters are checked.
+ */
+EMSCRIPTEN_KEEPALIVE
+void js_invalidate_cached() {
+  invalidate_lookups();
+}
+
+
+
+/***
+ * Item map wrappers. The map is not compressed, so it is copied straight into
+ * memory allocated from the filter region with js_new_item_map, and freed
+ * with js_free_bloom like a filter. It must be checked with js_valid_item_map
+ * before lookups.
+ */
+EMSCRIPTEN_KEEPALIVE
+byte *js_new_item_map(size_t size) {
+  if (size == 0 || !init_arenas()) {
+    return NULL;
+  }
+  return (byte *)region_alloc(filters, size);
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+int js_valid_item_map(byte *map, size_t size) {
+  return valid_item_map(map, size);
+}
+
+
+/***
+ * Returns the item id of the story, or 0 if it is not in the map.
+ */
+EMSCRIPTEN_KEEPALIVE
+uint32_t js_lookup_item(byte *map, byte *data, uint32_t length) {
+  uint32_t id = lookup_item_map(map, data, length);
+  reset_scratch();
+  return id;
+}
+
+
+/***
+ * Job wrappers. Decompression, merges, and batch queries are submitted from
+ * JavaScript and polled until they finish. In bloom-threads.js they run on
+ * worker threads over the shared heap, so startup and updates do not block
+ * tab updates, which keep checking filters with the synchronous wrappers
+ * above. In bloom.js, which has no threads, jobs finish while submitted.
+ *
+ * Data is copied out of scratch memory, since the job outlives the call.
+ * Each submit function returns a job id, or -1 if the job cannot be started.
+ */
+EMSCRIPTEN_KEEPALIVE
+int js_submit_decompress(byte *compressed, size_t size) {
+  size_t bloom_size = decompressed_bloom_size(compressed, size);
+
+  // Filters are only allocated here, on the main thread, since the region is
+  // not shared between threads
+  byte *bloom = NULL, *copy = NULL;
+  int id = -1;
+  if (bloom_size > 0 && init_arenas()
+      && (bloom = (byte *)region_alloc(filters, bloom_size)) != NULL
+      && (copy = (byte *)malloc(size)) != NULL) {
+    (void)memcpy((void *)copy, (void *)compressed, size);
+    id = submit_decompress(copy, size, bloom, bloom_size);
+  }
+  if (id < 0) {
+    free(copy);
+    if (bloom != NULL) {
+      region_free(filters, bloom);
+    }
+  }
+  reset_scratch();
+  return id;
+}
+
+
+/***
+ * Neither filter may be freed until the job has finished.
+ */
+EMSCRIPTEN_KEEPALIVE
+int js_submit_combine(byte *bloom, byte *new, uint8_t num_bits) {
+  return submit_combine(bloom, new, num_bits);
+}
+
+
+/***
+ * The data holds newline-separated keys, and the filter may not be freed
+ * until the job has finished.
+ */
+EMSCRIPTEN_KEEPALIVE
+int js_submit_batch(byte *bloom, uint8_t num_bits, byte *data,
+    uint32_t length) {
+  byte *copy;
+  int id = -1;
+  if ((copy = (byte *)malloc(length > 0 ? length : 1)) != NULL) {
+    (void)memcpy((void *)copy, (void *)data, length);
+    if ((id = submit_batch(bloom, num_bits, copy, length)) < 0) {
+      free(copy);
+    }
+  }
+  reset_scratch();
+  return id;
+}
+
+
+/***
+ * Returns a job_state. Cached lookups are invalidated once a job that wrote a
+ * filter has finished, as they are by the synchronous wrappers.
+ */
+EMSCRIPTEN_KEEPALIVE
+int js_poll_job(int id) {
+  job_state state = poll_job(id);
+  if ((state == JOB_DONE || state == JOB_FAILED)
+      && job_kind_of(id) != JOB_BATCH) {
+    invalidate_lookups();
+  }
+  return state;
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+byte *js_job_result(int id) {
+  return job_result(id);
+}
+
+
+EMSCRIPTEN_KEEPALIVE
+size_t js_job_size(int id) {
+  return job_size(id);
+}
+
+
+/***
+ * Filters that failed to decompress are freed along with the job.
+ */
+EMSCRIPTEN_KEEPALIVE
+void js_release_job(int id) {
+  if (poll_job(id) == JOB_FAILED && job_kind_of(id) == JOB_DECOMPRESS
+      && filters != NULL) {
+    region_free(filters, job_result(id));
+  }
+  release_job(id);
 }
 
 
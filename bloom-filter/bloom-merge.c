@@ -0,0 +1,192 @@
+/* bloom-merge.c
+ *
+ * Command-line program to merge Bloom filters of the same size into one, for
+ * example to combine the time windows created by bloom-create --partition-by.
+ */
+
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom-file.h"
+#include "chunked-bloom.h"
+
+
+
+/*******************************************************************************
+ * Types, structs, and constants
+ ******************************************************************************/
+
+struct args {
+  char *outfile;
+  int use_compression;
+  int chunked;
+  int jobs;
+  int num_infiles;
+  char **infiles;
+};
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Print a usage string describing this program's command-line arguments.
+ */
+void print_usage(char *prog_name) {
+  printf("Usage: %s [OPTION]... OUTFILE INFILE...\n"
+      "Merge Bloom filters of the same size (compressed or not) into one.\n"
+      "A story is in the merged filter if it is in any of the input filters.\n\n"
+      "Options:\n"
+      " -c, --no-compress\tTurn off gzip output compression, on by default\n"
+      " -k, --chunked\t\tCompress the filter in independent 1MB chunks that\n"
+      "\t\t\tcan be compressed and decompressed in parallel\n"
+      " -j, --jobs=N\t\tNumber of threads (de)compressing chunks, default is\n"
+      "\t\t\tthe number of CPUs\n"
+      " -h, --help\t\tDisplay this help message\n", prog_name);
+}
+
+
+/***
+ * Parse comand line arguments, setting their values in the parsed_args struct.
+ */
+void parse_args(int argc, char *argv[], struct args *parsed_args) {
+  // Set default values
+  parsed_args->use_compression = 1;
+  parsed_args->chunked = 0;
+  parsed_args->jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (parsed_args->jobs < 1) {
+    parsed_args->jobs = 1;
+  }
+
+  int c, long_index;
+  struct option opts[] = {
+    { "no-compress", no_argument, NULL, 'c' },
+    { "chunked", no_argument, NULL, 'k' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "help", no_argument, NULL, 'h' },
+    { 0, 0, 0, 0 }
+  };
+  while ((c = getopt_long(argc, argv, "ckj:h", opts, &long_index)) != -1) {
+    switch(c) {
+      case 'c':
+        parsed_args->use_compression = 0;
+        break;
+
+      case 'k':
+        parsed_args->chunked = 1;
+        break;
+
+      case 'j':
+        parsed_args->jobs = atoi(optarg);
+        if (parsed_args->jobs <= 0) {
+          fprintf(stderr, "%s\n\n", "Must have at least one job.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'h':
+        print_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+        break;
+
+      default:
+        // Add a blank line because an error will probably be printed
+        puts("");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+        break;
+    }
+  }
+
+  // Make sure there is an outfile and at least one infile
+  if (optind + 1 >= argc) {
+    fprintf(stderr, "%s\n\n", "Output and input files not specified!");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  parsed_args->outfile = argv[optind];
+  parsed_args->infiles = &argv[optind + 1];
+  parsed_args->num_infiles = argc - optind - 1;
+
+  if (parsed_args->chunked && !parsed_args->use_compression) {
+    fprintf(stderr, "%s\n\n", "Chunked filters are always compressed.");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+/***
+ * Load a Bloom filter in any format, decompressing it on the given number of
+ * threads if it is chunked, and store its size as a power of two. Exit with an
+ * error if it cannot be loaded.
+ */
+byte *load_filter(char *filename, uint8_t *num_bits, int threads) {
+  byte *bloom;
+  if ((bloom = load_bloom_file(filename, num_bits, threads)) == NULL) {
+    fprintf(stderr, "Unable to load Bloom filter %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  return bloom;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+  // Parse command-line arguments
+  struct args args;
+  parse_args(argc, argv, &args);
+
+  // Merge every filter into the first one, keeping at most two in memory
+  uint8_t num_bits;
+  byte *merged = load_filter(args.infiles[0], &num_bits, args.jobs);
+  size_t size = (size_t)1 << (num_bits - 3);
+
+  for (int i = 1; i < args.num_infiles; i++) {
+    uint8_t new_bits;
+    byte *new = load_filter(args.infiles[i], &new_bits, args.jobs);
+    if (new_bits != num_bits) {
+      fprintf(stderr, "Bloom filter %s is %zu bytes, but %s is %zu bytes\n",
+          args.infiles[i], (size_t)1 << (new_bits - 3), args.infiles[0],
+          size);
+      return EXIT_FAILURE;
+    }
+    combine_bloom(merged, new, num_bits);
+    free_bloom(new);
+  }
+
+  if (args.chunked) {
+    write_chunked_bloom(args.outfile, merged, num_bits, args.jobs);
+  } else if (args.use_compression) {
+    // Write the Bloom filter out to a gzip compressed file
+    write_compressed_bloom(args.outfile, merged, num_bits);
+  } else {
+    // Write the Bloom filter out to a non-compressed file
+    FILE *outfile;
+    if ((outfile = fopen(args.outfile, "w")) == NULL) {
+      perror("Unable to open output file");
+      return EXIT_FAILURE;
+    }
+    fwrite((void *)merged, sizeof(uint8_t), size, outfile);
+    fclose(outfile);
+  }
+
+  // Clean up
+  free_bloom(merged);
+
+  return EXIT_SUCCESS;
+}
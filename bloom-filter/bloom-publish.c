@@ -0,0 +1,1584 @@
+/* bloom-publish.c
+ *
+ * Command-line program that builds every release artifact from a CSV or JSON
+ * Lines export of stories in one run: the full filter for each score threshold
+ * with its host filter, a partial filter of the stories submitted in each
+ * recent time range, a delta filter of the stories added since the previous
+ * build, the map of item ids, and info.json describing all of them.
+ * Only the lowest threshold's full filter gets a prefix filter, since the
+ * extension only needs one to find sections of sites with stories.
+ *
+ * The fingerprint and threshold level of every story are saved as the state
+ * of each build, with the size and SHA-256 of every file. The next build
+ * compares the export against that state, so full filters are updated by
+ * adding just the new stories to the previous filters, and outputs whose
+ * stories did not change at all are not rebuilt, recompressed, or read back.
+ * Stories that were removed stay in full filters until there are enough of
+ * them to be worth a rebuild.
+ */
+
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "bloom.h"
+#include "bloom-file.h"
+#include "canonicalize.h"
+#include "host-filter.h"
+#include "item-map.h"
+#include "prefix-filter.h"
+#include "record-reader.h"
+
+
+
+/*******************************************************************************
+ * Types, structs, and constants
+ ******************************************************************************/
+
+// Values for options that only have a long form
+enum long_options {
+  OPT_SCORE_FIELD = 256,
+};
+
+#define MAX_THRESHOLDS 16
+#define MAX_RANGES 8
+
+struct args {
+  char *infile;
+  char *outdir;
+  char *state;
+  record_format format;
+  char *fields[NUM_FIELDS];
+  int num_thresholds;
+  int64_t thresholds[MAX_THRESHOLDS];
+  int num_ranges;
+  char *range_names[MAX_RANGES];
+  int64_t ranges[MAX_RANGES];
+  int bloom_bits;
+  int host_bits;
+  int prefix_bits;
+  int64_t interval;
+  int full;
+};
+
+// One record of the export. The level of a story is the number of thresholds
+// its score meets, since thresholds are in ascending order.
+struct story {
+  uint64_t fingerprint;
+  int64_t time;
+  size_t offset;
+  uint32_t length;
+  uint8_t level;
+};
+
+// All records with the same URL, which are next to each other once the
+// stories are sorted by fingerprint
+struct entry {
+  uint64_t fingerprint;
+  uint32_t first;
+  uint32_t count;
+  uint8_t level;
+};
+
+struct stories {
+  struct story *stories;
+  size_t num_stories;
+  size_t stories_capacity;
+  char *data;
+  size_t data_size;
+  size_t data_capacity;
+  struct entry *entries;
+  size_t num_entries;
+  int64_t latest;
+};
+
+// A URL filter, with its host filter if those are enabled, and its prefix
+// filter if it has one
+struct filter_set {
+  byte *bloom;
+  byte *hosts;
+  byte *prefixes;
+};
+
+// Generated files listed in info.json
+#define MAX_FILES 256
+
+// A generated file, with the size and SHA-256 of what was written
+struct output {
+  char *name;
+  uint64_t size;
+  char sha256[65];
+};
+
+// Saved state of the previous build, and of this one once it is written.
+// Entries are sorted by fingerprint. Stories that meet no threshold are left
+// out. Stale counts are the number of stories still in each full filter that
+// no longer meet its threshold.
+struct state {
+  int valid;
+  int64_t generated;
+  size_t count;
+  uint64_t *fingerprints;
+  uint8_t *levels;
+  uint64_t partial_digests[MAX_THRESHOLDS][MAX_RANGES];
+  uint64_t stale[MAX_THRESHOLDS];
+  int num_outputs;
+  struct output *outputs;
+};
+
+// Bytes "HNPS" followed by a version number begin every state file
+#define STATE_MAGIC 0x53504e48u
+#define STATE_VERSION 2
+
+// A full filter is rebuilt once more than 1 in this many of its stories are
+// stale
+#define STALE_FRACTION 100
+
+// Seconds between the expected end of one build and the next
+#define BUILD_MARGIN (20 * 60)
+
+
+
+/*******************************************************************************
+ * Global variables
+ ******************************************************************************/
+
+static struct output files[MAX_FILES];
+static int num_files = 0;
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Print a usage string describing this program's command-line arguments.
+ */
+void print_usage(char *prog_name) {
+  printf("Usage: %s [OPTION]... INFILE OUTDIR\n"
+      "Build every release artifact from INFILE, a CSV or JSON Lines export\n"
+      "of stories, into OUTDIR: for each score threshold T, the full filter\n"
+      "hn-T.bloom, a partial filter hn-RANGE-T.bloom of the stories submitted\n"
+      "in each time RANGE before the latest story, and a delta filter\n"
+      "hn-delta-T.bloom of the stories added since the previous build; the\n"
+      "prefix filter of the lowest threshold's full filter; the item map\n"
+      "hn-ids.map; and info.json with the size and SHA-256 of each.\n"
+      "Outputs from the previous build in OUTDIR are only rebuilt if their\n"
+      "stories changed, and full filters that only gained stories are\n"
+      "updated in place.\n\n"
+      "Options:\n"
+      " -f, --format=FMT\tRead INFILE as FMT, csv (the default) or jsonl\n"
+      " --score-field=NAME\tColumn or key of scores, default is score\n"
+      " -t, --thresholds=LIST\tComma-separated score thresholds, default is\n"
+      "\t\t\t0,10,75,250,500\n"
+      " -r, --ranges=LIST\tComma-separated time ranges of partial filters,\n"
+      "\t\t\tlike 24hours or 7days, default is 7days,24hours\n"
+      " -b, --bloom-bits=EXP\tUse 2^EXP bits for URL filters, default is 27\n"
+      " -H, --host-bits=EXP\tUse 2^EXP bits for host filters, default is 22,\n"
+      "\t\t\tor 0 for none\n"
+      " -P, --prefix-bits=EXP\tUse 2^EXP bits for the prefix filter, default\n"
+      "\t\t\tis 25, or 0 for none\n"
+      " -s, --state=FILE\tRead the previous build's state from FILE, and\n"
+      "\t\t\twrite this build's, default is OUTDIR/publish.state\n"
+      " -i, --interval=SECONDS\tTime until the next build, default is 86400\n"
+      " -F, --full\t\tIgnore the previous build and rebuild everything\n"
+      " -h, --help\t\tDisplay this help message\n", prog_name);
+}
+
+
+/***
+ * Parse a comma-separated list of score thresholds in ascending order.
+ * Return 0 if it is not valid.
+ */
+int parse_thresholds(char *list, struct args *parsed_args) {
+  parsed_args->num_thresholds = 0;
+  char *end;
+  do {
+    if (parsed_args->num_thresholds == MAX_THRESHOLDS) {
+      return 0;
+    }
+    int64_t threshold = strtoll(list, &end, 10);
+    if (end == list || (parsed_args->num_thresholds > 0 && threshold
+          <= parsed_args->thresholds[parsed_args->num_thresholds - 1])) {
+      return 0;
+    }
+    parsed_args->thresholds[parsed_args->num_thresholds++] = threshold;
+    list = end + 1;
+  } while (*end == ',');
+  return *end == '\0';
+}
+
+
+/***
+ * Parse a comma-separated list of time ranges like 24hours or 7days. Each is
+ * also the name of its partial filters. Return 0 if it is not valid.
+ */
+int parse_ranges(char *list, struct args *parsed_args) {
+  parsed_args->num_ranges = 0;
+  for (char *range = strtok(list, ","); range != NULL;
+      range = strtok(NULL, ",")) {
+    if (parsed_args->num_ranges == MAX_RANGES) {
+      return 0;
+    }
+    char *unit;
+    int64_t count = strtoll(range, &unit, 10);
+    int64_t seconds;
+    if (count <= 0 || unit == range) {
+      return 0;
+    } else if (strcmp(unit, "hours") == 0 || strcmp(unit, "hour") == 0) {
+      seconds = 3600;
+    } else if (strcmp(unit, "days") == 0 || strcmp(unit, "day") == 0) {
+      seconds = 86400;
+    } else if (strcmp(unit, "weeks") == 0 || strcmp(unit, "week") == 0) {
+      seconds = 7 * 86400;
+    } else {
+      return 0;
+    }
+    parsed_args->range_names[parsed_args->num_ranges] = range;
+    parsed_args->ranges[parsed_args->num_ranges++] = count * seconds;
+  }
+  return parsed_args->num_ranges > 0;
+}
+
+
+/***
+ * Parse comand line arguments, setting their values in the parsed_args struct.
+ */
+void parse_args(int argc, char *argv[], struct args *parsed_args) {
+  // Set default values, which match the published release
+  static char default_ranges[] = "7days,24hours";
+  parsed_args->state = NULL;
+  parsed_args->format = FORMAT_CSV;
+  parsed_args->fields[FIELD_URL] = "url";
+  parsed_args->fields[FIELD_SCORE] = "score";
+  parsed_args->fields[FIELD_TIME] = "time";
+  parsed_args->fields[FIELD_ID] = "id";
+  parse_thresholds("0,10,75,250,500", parsed_args);
+  parse_ranges(default_ranges, parsed_args);
+  parsed_args->bloom_bits = 27;
+  parsed_args->host_bits = 22;
+  parsed_args->prefix_bits = 25;
+  parsed_args->interval = 86400;
+  parsed_args->full = 0;
+
+  int c, long_index;
+  struct option opts[] = {
+    { "format", required_argument, NULL, 'f' },
+    { "score-field", required_argument, NULL, OPT_SCORE_FIELD },
+    { "thresholds", required_argument, NULL, 't' },
+    { "ranges", required_argument, NULL, 'r' },
+    { "bloom-bits", required_argument, NULL, 'b' },
+    { "host-bits", required_argument, NULL, 'H' },
+    { "prefix-bits", required_argument, NULL, 'P' },
+    { "state", required_argument, NULL, 's' },
+    { "interval", required_argument, NULL, 'i' },
+    { "full", no_argument, NULL, 'F' },
+    { "help", no_argument, NULL, 'h' },
+    { 0, 0, 0, 0 }
+  };
+  while ((c = getopt_long(argc, argv, "f:t:r:b:H:P:s:i:Fh", opts,
+          &long_index)) != -1) {
+    switch(c) {
+      case 'f':
+        if (strcmp(optarg, "csv") == 0) {
+          parsed_args->format = FORMAT_CSV;
+        } else if (strcmp(optarg, "jsonl") == 0) {
+          parsed_args->format = FORMAT_JSONL;
+        } else {
+          fprintf(stderr, "Unknown format %s.\n\n", optarg);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case OPT_SCORE_FIELD:
+        parsed_args->fields[FIELD_SCORE] = optarg;
+        break;
+
+      case 't':
+        if (!parse_thresholds(optarg, parsed_args)) {
+          fprintf(stderr, "Thresholds must be at most %d ascending numbers."
+              "\n\n", MAX_THRESHOLDS);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'r':
+        if (!parse_ranges(optarg, parsed_args)) {
+          fprintf(stderr, "Must have 1 to %d ranges in hours, days, or weeks."
+              "\n\n", MAX_RANGES);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'b':
+        parsed_args->bloom_bits = atoi(optarg);
+        if (parsed_args->bloom_bits > 31 || parsed_args->bloom_bits < 3) {
+          fprintf(stderr, "%s\n\n", "Must have 3 <= bloom-bits < 32.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'H':
+        parsed_args->host_bits = atoi(optarg);
+        if (parsed_args->host_bits != 0 && (parsed_args->host_bits > 31
+              || parsed_args->host_bits < HOST_BLOCK_BITS)) {
+          fprintf(stderr, "Must have host-bits = 0 or %d <= host-bits < 32."
+              "\n\n", HOST_BLOCK_BITS);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'P':
+        parsed_args->prefix_bits = atoi(optarg);
+        if (parsed_args->prefix_bits != 0 && (parsed_args->prefix_bits > 31
+              || parsed_args->prefix_bits < PREFIX_BLOCK_BITS)) {
+          fprintf(stderr, "Must have prefix-bits = 0 or %d <= prefix-bits < "
+              "32.\n\n", PREFIX_BLOCK_BITS);
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 's':
+        parsed_args->state = optarg;
+        break;
+
+      case 'i':
+        parsed_args->interval = atoll(optarg);
+        break;
+
+      case 'F':
+        parsed_args->full = 1;
+        break;
+
+      case 'h':
+        print_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+        break;
+
+      default:
+        // Add a blank line because an error will probably be printed
+        puts("");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+        break;
+    }
+  }
+
+  // Make sure there is an input file and an output directory
+  if (optind + 2 > argc) {
+    fprintf(stderr, "%s\n\n", "Input file or output directory not specified!");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  parsed_args->infile = argv[optind];
+  parsed_args->outdir = argv[optind + 1];
+}
+
+
+/***
+ * Return a newly allocated path of a file in the output directory, and exit
+ * if it cannot be allocated.
+ */
+char *output_path(struct args *args, char *name) {
+  char *path = malloc(strlen(args->outdir) + strlen(name) + 2);
+  if (path == NULL) {
+    perror("Unable to allocate file name");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(path, "%s/%s", args->outdir, name);
+  return path;
+}
+
+
+/***
+ * Return a newly allocated temporary path to write a file under before it is
+ * renamed into place, and exit if it cannot be allocated.
+ */
+char *temp_name(char *path) {
+  char *temp_path = malloc(strlen(path) + 5);
+  if (temp_path == NULL) {
+    perror("Unable to allocate file name");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(temp_path, "%s.tmp", path);
+  return temp_path;
+}
+
+
+/***
+ * Return the name of a side filter of a URL filter, with suffix inserted
+ * before the extension, as bloom-create names them.
+ */
+char *side_name(char *name, char *suffix) {
+  char *dot = strrchr(name, '.');
+  char *side = malloc(strlen(name) + strlen(suffix) + 1);
+  if (side == NULL) {
+    perror("Unable to allocate file name");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(side, "%.*s%s%s", (int)(dot - name), name, suffix, dot);
+  return side;
+}
+
+
+/***
+ * Remember a generated file to be listed in info.json and the state, with its
+ * size and SHA-256.
+ */
+void add_file(char *name, uint64_t size, char *sha256) {
+  if (num_files == MAX_FILES
+      || (files[num_files].name = strdup(name)) == NULL) {
+    fprintf(stderr, "Unable to list %s in info.json\n", name);
+    exit(EXIT_FAILURE);
+  }
+  files[num_files].size = size;
+  strcpy(files[num_files].sha256, sha256);
+  num_files++;
+}
+
+
+/***
+ * Read and inflate a whole gzip file into a newly allocated buffer, storing
+ * its exact length, which decompress_bloom rounds up to a power of two.
+ */
+byte *read_gzip_file(char *filename, size_t *size) {
+  size_t compressed_size;
+  byte *compressed = read_whole_file(filename, &compressed_size);
+  if (compressed == NULL) {
+    return NULL;
+  }
+  *size = decompressed_bloom_size(compressed, compressed_size);
+  byte *data = *size > 0 ? malloc(*size) : NULL;
+  if (data != NULL
+      && !decompress_bloom_into(compressed, compressed_size, data, *size)) {
+    free(data);
+    data = NULL;
+  }
+  free(compressed);
+  return data;
+}
+
+
+/***
+ * Gzip compress data in memory at compression level 9 (maximum), like
+ * write_compressed_bloom, so it can be hashed before it is written. Return a
+ * newly allocated buffer and store its size, or exit on failure.
+ */
+byte *gzip_data(byte *data, size_t size, size_t *compressed_size) {
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  byte *compressed = NULL;
+  if (deflateInit2(&stream, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)
+      == Z_OK) {
+    size_t bound = deflateBound(&stream, (uLong)size);
+    if ((compressed = malloc(bound)) != NULL) {
+      stream.next_in = (Bytef *)data;
+      stream.avail_in = (uInt)size;
+      stream.next_out = (Bytef *)compressed;
+      stream.avail_out = (uInt)bound;
+      if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
+        *compressed_size = stream.total_out;
+      } else {
+        free(compressed);
+        compressed = NULL;
+      }
+    }
+    (void)deflateEnd(&stream);
+  }
+  if (compressed == NULL) {
+    fprintf(stderr, "Unable to compress output file\n");
+    exit(EXIT_FAILURE);
+  }
+  return compressed;
+}
+
+
+/***
+ * Files are written under a temporary name and renamed into place, so that
+ * readers (like bloomd) never see one half-written, and an interrupted build
+ * never leaves one behind.
+ */
+void finish_file(char *temp_path, char *path) {
+  if (rename(temp_path, path) != 0) {
+    perror("Unable to rename output file");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+/***
+ * Mix the bits of a 64-bit value, so that sums of fingerprints depend on all
+ * of their bits (the splitmix64 finalizer).
+ */
+uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+
+
+/*******************************************************************************
+ * SHA-256
+ ******************************************************************************/
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr32(uint32_t x, int r) {
+  return (x >> r) | (x << (32 - r));
+}
+
+
+/***
+ * Hash one 64 byte block into the state.
+ */
+void sha256_block(uint32_t *h, byte *block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16
+      | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18)
+      ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19)
+      ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5],
+           g = h[6], k = h[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+    uint32_t t1 = k + s1 + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+    uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+    uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+    k = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+  h[5] += f;
+  h[6] += g;
+  h[7] += k;
+}
+
+
+/***
+ * Write the SHA-256 of data as 64 hexadecimal digits and a NUL to out, so
+ * the extension can check downloads with crypto.subtle.digest.
+ */
+void sha256_hex(byte *data, size_t length, char *out) {
+  uint32_t h[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+    0x1f83d9ab, 0x5be0cd19,
+  };
+  size_t i;
+  for (i = 0; i + 64 <= length; i += 64) {
+    sha256_block(h, data + i);
+  }
+
+  // Pad the rest with a 1 bit, zeros, and the length in bits
+  byte last[128] = { 0 };
+  size_t rest = length - i;
+  memcpy(last, data + i, rest);
+  last[rest] = 0x80;
+  size_t last_size = rest < 56 ? 64 : 128;
+  uint64_t bits = (uint64_t)length * 8;
+  for (int j = 0; j < 8; j++) {
+    last[last_size - 1 - j] = (bits >> (8 * j)) & 0xff;
+  }
+  for (size_t j = 0; j < last_size; j += 64) {
+    sha256_block(h, last + j);
+  }
+
+  for (int j = 0; j < 8; j++) {
+    sprintf(out + 8 * j, "%08x", h[j]);
+  }
+}
+
+
+
+/*******************************************************************************
+ * Reading stories
+ ******************************************************************************/
+
+/***
+ * Save a canonical story URL and its level and time. Return 0 on failure.
+ */
+int save_story(struct stories *s, char *url, size_t length, uint8_t level,
+    int64_t time) {
+  if (s->num_stories == s->stories_capacity) {
+    size_t capacity = s->stories_capacity == 0 ? 1 << 16
+      : 2 * s->stories_capacity;
+    struct story *stories = realloc(s->stories, capacity * sizeof(*stories));
+    if (stories == NULL) {
+      return 0;
+    }
+    s->stories = stories;
+    s->stories_capacity = capacity;
+  }
+  if (s->data_size + length > s->data_capacity) {
+    size_t capacity = s->data_capacity == 0 ? 1 << 24 : s->data_capacity;
+    while (capacity < s->data_size + length) {
+      capacity *= 2;
+    }
+    char *data = realloc(s->data, capacity);
+    if (data == NULL) {
+      return 0;
+    }
+    s->data = data;
+    s->data_capacity = capacity;
+  }
+
+  memcpy(s->data + s->data_size, url, length);
+  struct story *story = &s->stories[s->num_stories++];
+  story->fingerprint = item_fingerprint((byte *)url, length);
+  story->time = time;
+  story->offset = s->data_size;
+  story->length = length;
+  story->level = level;
+  s->data_size += length;
+  return 1;
+}
+
+
+/***
+ * Order stories by fingerprint for qsort.
+ */
+int compare_stories(const void *a, const void *b) {
+  uint64_t x = ((struct story *)a)->fingerprint;
+  uint64_t y = ((struct story *)b)->fingerprint;
+  return (x > y) - (x < y);
+}
+
+
+/***
+ * Read every story from the export, adding each one with an id to the item
+ * map, then sort them and group the records of each URL into one entry.
+ */
+void read_stories(struct args *args, struct stories *s,
+    item_map_builder *items) {
+  record_reader *infile;
+  if ((infile = open_record_reader(args->infile, args->format, args->fields))
+      == NULL) {
+    if (args->format == FORMAT_CSV) {
+      fprintf(stderr, "Unable to read a CSV header with a \"%s\" column\n",
+          args->fields[FIELD_URL]);
+    } else {
+      perror("Unable to open input file");
+    }
+    exit(EXIT_FAILURE);
+  }
+
+  record r;
+  int status;
+  char *canonical = NULL;
+  size_t canonical_capacity = 0;
+  while ((status = next_record(infile, &r)) != 0) {
+    if (status < 0) {
+      fprintf(stderr, "Skipping malformed record on line %lu\n",
+          (unsigned long)infile->line_number);
+      continue;
+    } else if (r.fields[FIELD_URL] == NULL || r.lengths[FIELD_URL] == 0) {
+      continue;
+    }
+
+    size_t length = r.lengths[FIELD_URL];
+    if (CANONICAL_MAX(length) > canonical_capacity) {
+      canonical_capacity = 2 * CANONICAL_MAX(length);
+      free(canonical);
+      if ((canonical = malloc(canonical_capacity)) == NULL) {
+        perror("Unable to allocate canonicalization buffer");
+        exit(EXIT_FAILURE);
+      }
+    }
+    length = canonicalize_url(r.fields[FIELD_URL], length, canonical);
+
+    // Missing scores count as zero, like SQLite casts NULL
+    int64_t score = 0, time = 0, id = 0;
+    if (r.fields[FIELD_SCORE] != NULL && r.lengths[FIELD_SCORE] > 0
+        && !parse_score(r.fields[FIELD_SCORE], r.lengths[FIELD_SCORE],
+          &score)) {
+      fprintf(stderr, "Skipping record with a score that is not a number on "
+          "line %lu\n", (unsigned long)infile->line_number);
+      continue;
+    }
+    if (r.fields[FIELD_TIME] != NULL) {
+      parse_time(r.fields[FIELD_TIME], r.lengths[FIELD_TIME], &time);
+    }
+    if (r.fields[FIELD_ID] == NULL
+        || !parse_score(r.fields[FIELD_ID], r.lengths[FIELD_ID], &id)) {
+      id = 0;
+    }
+    uint8_t level = 0;
+    while (level < args->num_thresholds && score >= args->thresholds[level]) {
+      level++;
+    }
+
+    s->latest = time > s->latest ? time : s->latest;
+    if (level == 0) {
+      continue;
+    }
+    if (!save_story(s, canonical, length, level, time)
+        || (id > 0 && id <= UINT32_MAX
+          && !add_item_map(items, (byte *)canonical, length, (uint32_t)id,
+            score))) {
+      perror("Unable to save story");
+      exit(EXIT_FAILURE);
+    }
+  }
+  free(canonical);
+  close_record_reader(infile);
+
+  qsort(s->stories, s->num_stories, sizeof(struct story), compare_stories);
+  if ((s->entries = malloc((s->num_stories + 1) * sizeof(struct entry)))
+      == NULL) {
+    perror("Unable to allocate story entries");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < s->num_stories; i++) {
+    struct story *story = &s->stories[i];
+    struct entry *last = s->num_entries > 0
+      ? &s->entries[s->num_entries - 1] : NULL;
+    if (last != NULL && last->fingerprint == story->fingerprint) {
+      last->count++;
+      last->level = story->level > last->level ? story->level : last->level;
+      continue;
+    }
+    struct entry *e = &s->entries[s->num_entries++];
+    e->fingerprint = story->fingerprint;
+    e->first = i;
+    e->count = 1;
+    e->level = story->level;
+  }
+}
+
+
+/***
+ * Return whether any record of a URL meets a threshold and was submitted
+ * after a time, which puts it in that threshold's partial filter.
+ */
+int in_partial(struct stories *s, struct entry *e, int threshold,
+    int64_t after) {
+  for (uint32_t i = e->first; i < e->first + e->count; i++) {
+    if (s->stories[i].level > threshold && s->stories[i].time > after) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+
+/*******************************************************************************
+ * State
+ ******************************************************************************/
+
+/***
+ * Serialize integers in little-endian order regardless of platform.
+ */
+void write_u64(byte *buf, uint64_t x) {
+  for (int i = 0; i < 8; i++) {
+    buf[i] = (x >> (8 * i)) & 0xff;
+  }
+}
+
+uint64_t read_u64(byte *buf) {
+  uint64_t x = 0;
+  for (int i = 0; i < 8; i++) {
+    x |= (uint64_t)buf[i] << (8 * i);
+  }
+  return x;
+}
+
+
+/***
+ * Return the size of the state header, which records everything that
+ * decides the contents of the outputs besides the stories.
+ */
+size_t state_header_size(struct args *args) {
+  return 8 * (6 + 2 * args->num_thresholds + args->num_ranges
+      + args->num_thresholds * args->num_ranges);
+}
+
+void write_state_header(struct args *args, struct state *state, byte *buf) {
+  write_u64(buf, (uint64_t)STATE_VERSION << 32 | STATE_MAGIC);
+  write_u64(buf + 8, (uint64_t)args->bloom_bits << 16
+      | (uint64_t)args->host_bits << 8 | args->prefix_bits);
+  write_u64(buf + 16, (uint64_t)args->num_thresholds << 8 | args->num_ranges);
+  write_u64(buf + 24, state->generated);
+  write_u64(buf + 32, state->count);
+  buf += 40;
+  for (int i = 0; i < args->num_thresholds; i++, buf += 8) {
+    write_u64(buf, args->thresholds[i]);
+  }
+  for (int j = 0; j < args->num_ranges; j++, buf += 8) {
+    write_u64(buf, args->ranges[j]);
+  }
+  for (int i = 0; i < args->num_thresholds; i++) {
+    for (int j = 0; j < args->num_ranges; j++, buf += 8) {
+      write_u64(buf, state->partial_digests[i][j]);
+    }
+  }
+  for (int i = 0; i < args->num_thresholds; i++, buf += 8) {
+    write_u64(buf, state->stale[i]);
+  }
+  // Reserved
+  write_u64(buf, 0);
+}
+
+
+/***
+ * Read the list of files written by the previous build, which follows its
+ * entries: their number, then the size, SHA-256 in hexadecimal, name length,
+ * and name of each. Return 0 if the list is not complete.
+ */
+int read_outputs(struct state *state, byte *data, size_t size) {
+  if (size < 8 || read_u64(data) > MAX_FILES) {
+    return 0;
+  }
+  int num_outputs = (int)read_u64(data);
+  if ((state->outputs = calloc(num_outputs + 1, sizeof(struct output)))
+      == NULL) {
+    return 0;
+  }
+  data += 8;
+  size -= 8;
+  for (int i = 0; i < num_outputs; i++, state->num_outputs++) {
+    struct output *output = &state->outputs[i];
+    if (size < 80) {
+      return 0;
+    }
+    output->size = read_u64(data);
+    memcpy(output->sha256, data + 8, 64);
+    output->sha256[64] = '\0';
+    uint64_t length = read_u64(data + 72);
+    data += 80;
+    size -= 80;
+    if (size < length || (output->name = malloc(length + 1)) == NULL) {
+      return 0;
+    }
+    memcpy(output->name, data, length);
+    output->name[length] = '\0';
+    data += length;
+    size -= length;
+  }
+  return size == 0;
+}
+
+
+/***
+ * Free the entries and file list of a state.
+ */
+void free_state(struct state *state) {
+  for (int i = 0; i < state->num_outputs; i++) {
+    free(state->outputs[i].name);
+  }
+  free(state->outputs);
+  free(state->fingerprints);
+  free(state->levels);
+}
+
+
+/***
+ * Load the previous build's state. It is only valid if it was built with the
+ * same options, since otherwise none of its outputs can be reused.
+ */
+void read_state(struct args *args, struct state *state) {
+  memset(state, 0, sizeof(*state));
+  size_t size = 0;
+  byte *data = read_gzip_file(args->state, &size);
+  if (data == NULL) {
+    return;
+  }
+
+  size_t header_size = state_header_size(args);
+  struct state expected = { 0 };
+  byte *header = malloc(header_size);
+  if (header == NULL || size < header_size) {
+    free(data);
+    free(header);
+    return;
+  }
+  expected.generated = read_u64(data + 24);
+  expected.count = read_u64(data + 32);
+  byte *digests = data + 40 + 8 * (args->num_thresholds + args->num_ranges);
+  for (int i = 0; i < args->num_thresholds; i++) {
+    for (int j = 0; j < args->num_ranges; j++, digests += 8) {
+      expected.partial_digests[i][j] = read_u64(digests);
+    }
+  }
+  for (int i = 0; i < args->num_thresholds; i++, digests += 8) {
+    expected.stale[i] = read_u64(digests);
+  }
+  write_state_header(args, &expected, header);
+
+  // Everything else in the header must match, and the entries and file list
+  // must all be there
+  size_t entries_size = 9 * expected.count;
+  if (memcmp(header, data, header_size) == 0
+      && (size - header_size) / 9 >= expected.count
+      && (state->fingerprints = malloc(expected.count * sizeof(uint64_t)))
+        != NULL
+      && (state->levels = malloc(expected.count)) != NULL
+      && read_outputs(state, data + header_size + entries_size,
+        size - header_size - entries_size)) {
+    state->valid = 1;
+    state->generated = expected.generated;
+    state->count = expected.count;
+    memcpy(state->partial_digests, expected.partial_digests,
+        sizeof(expected.partial_digests));
+    memcpy(state->stale, expected.stale, sizeof(expected.stale));
+    byte *entry = data + header_size;
+    for (size_t i = 0; i < expected.count; i++, entry += 9) {
+      state->fingerprints[i] = read_u64(entry);
+      state->levels[i] = entry[8];
+    }
+  } else {
+    fprintf(stderr, "Previous state %s was built with different options, "
+        "so everything is rebuilt\n", args->state);
+    free_state(state);
+    memset(state, 0, sizeof(*state));
+  }
+  free(header);
+  free(data);
+}
+
+
+/***
+ * Write this build's state and the list of files it wrote, gzip compressed.
+ */
+void write_state(struct args *args, struct state *state, struct stories *s) {
+  size_t header_size = state_header_size(args);
+  state->count = s->num_entries;
+  size_t size = header_size + 9 * s->num_entries + 8;
+  for (int i = 0; i < num_files; i++) {
+    size += 80 + strlen(files[i].name);
+  }
+  byte *data = malloc(size);
+  if (data == NULL) {
+    perror("Unable to allocate state");
+    exit(EXIT_FAILURE);
+  }
+  write_state_header(args, state, data);
+  byte *entry = data + header_size;
+  for (size_t i = 0; i < s->num_entries; i++, entry += 9) {
+    write_u64(entry, s->entries[i].fingerprint);
+    entry[8] = s->entries[i].level;
+  }
+  write_u64(entry, num_files);
+  entry += 8;
+  for (int i = 0; i < num_files; i++) {
+    size_t length = strlen(files[i].name);
+    write_u64(entry, files[i].size);
+    memcpy(entry + 8, files[i].sha256, 64);
+    write_u64(entry + 72, length);
+    memcpy(entry + 80, files[i].name, length);
+    entry += 80 + length;
+  }
+
+  char *temp_path = temp_name(args->state);
+  gzFile outfile;
+  if ((outfile = gzopen(temp_path, "wb6")) == NULL
+      || gzwrite(outfile, (voidpc)data, (unsigned)size) == 0) {
+    perror("Unable to write state");
+    exit(EXIT_FAILURE);
+  }
+  gzclose_w(outfile);
+  finish_file(temp_path, args->state);
+  free(temp_path);
+  free(data);
+}
+
+
+
+/*******************************************************************************
+ * Building filters
+ ******************************************************************************/
+
+/***
+ * Allocate a URL filter and its side filters, with a prefix filter only if
+ * prefixes is set and prefix filters are enabled.
+ */
+void new_filter_set(struct args *args, struct filter_set *f, int prefixes) {
+  memset(f, 0, sizeof(*f));
+  if ((f->bloom = new_bloom(args->bloom_bits)) == NULL
+      || (args->host_bits && (f->hosts = new_bloom(args->host_bits)) == NULL)
+      || (prefixes && args->prefix_bits
+        && (f->prefixes = new_bloom(args->prefix_bits)) == NULL)) {
+    perror("Unable to create Bloom filter");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+void clear_filter_set(struct args *args, struct filter_set *f) {
+  memset(f->bloom, 0, (size_t)1 << (args->bloom_bits - 3));
+  if (f->hosts != NULL) {
+    memset(f->hosts, 0, (size_t)1 << (args->host_bits - 3));
+  }
+  if (f->prefixes != NULL) {
+    memset(f->prefixes, 0, (size_t)1 << (args->prefix_bits - 3));
+  }
+}
+
+
+void free_filter_set(struct filter_set *f) {
+  free_bloom(f->bloom);
+  free_bloom(f->hosts);
+  free_bloom(f->prefixes);
+}
+
+
+/***
+ * Add the URL of an entry to every filter in a set.
+ */
+void add_entry(struct args *args, struct stories *s, struct filter_set *f,
+    struct entry *e) {
+  struct story *story = &s->stories[e->first];
+  byte *url = (byte *)s->data + story->offset;
+  add_bloom(f->bloom, args->bloom_bits, url, story->length);
+  if (f->hosts != NULL) {
+    add_url_host(f->hosts, args->host_bits, url, story->length);
+  }
+  if (f->prefixes != NULL) {
+    add_url_prefixes(f->prefixes, args->prefix_bits, url, story->length);
+  }
+}
+
+
+/***
+ * Write data into a file in the output directory.
+ */
+void write_file(struct args *args, char *name, byte *data, size_t size) {
+  char *path = output_path(args, name);
+  char *temp_path = temp_name(path);
+  FILE *f;
+  if ((f = fopen(temp_path, "wb")) == NULL
+      || fwrite(data, 1, size, f) != size || fclose(f) != 0) {
+    perror("Unable to write output file");
+    exit(EXIT_FAILURE);
+  }
+  finish_file(temp_path, path);
+  free(temp_path);
+  free(path);
+}
+
+
+/***
+ * Write data into a file in the output directory, and list it with the size
+ * and SHA-256 of the data, so that it never has to be read back.
+ */
+void write_output(struct args *args, char *name, byte *data, size_t size) {
+  write_file(args, name, data, size);
+  char hash[65];
+  sha256_hex(data, size, hash);
+  add_file(name, size, hash);
+}
+
+
+/***
+ * Return the saved size and SHA-256 of a file of the previous build, or NULL
+ * if its state does not list it.
+ */
+struct output *previous_output(struct state *previous, char *name) {
+  for (int i = 0; i < previous->num_outputs; i++) {
+    if (strcmp(previous->outputs[i].name, name) == 0) {
+      return &previous->outputs[i];
+    }
+  }
+  return NULL;
+}
+
+
+/***
+ * List a file that is unchanged from the previous build, with the size and
+ * SHA-256 saved in its state. Only if the state does not have them is the
+ * file read back to hash it.
+ */
+void keep_output(struct args *args, struct state *previous, char *name) {
+  struct output *output = previous_output(previous, name);
+  if (output != NULL) {
+    add_file(name, output->size, output->sha256);
+    return;
+  }
+
+  char *path = output_path(args, name);
+  size_t size = 0;
+  byte *data = read_whole_file(path, &size);
+  if (data == NULL) {
+    fprintf(stderr, "Unable to read %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  char hash[65];
+  sha256_hex(data, size, hash);
+  add_file(name, size, hash);
+  free(data);
+  free(path);
+}
+
+
+/***
+ * Load one filter of the previous build with the shared loader, replacing the
+ * one in place. Return 0 if it is missing or is not the right size.
+ */
+int load_filter(struct args *args, char *name, byte **bloom, int num_bits) {
+  char *path = output_path(args, name);
+  uint8_t loaded_bits;
+  // Published filters are plain gzip, so there are no chunks to inflate on
+  // other threads
+  byte *loaded = load_bloom_file(path, &loaded_bits, 1);
+  free(path);
+  if (loaded == NULL || loaded_bits != num_bits) {
+    free_bloom(loaded);
+    return 0;
+  }
+  free_bloom(*bloom);
+  *bloom = loaded;
+  return 1;
+}
+
+
+/***
+ * Load a URL filter of the previous build and its side filters.
+ */
+int load_filter_set(struct args *args, char *name, struct filter_set *f) {
+  int success = load_filter(args, name, &f->bloom, args->bloom_bits);
+  char *side;
+  if (success && f->hosts != NULL) {
+    success = load_filter(args, side = side_name(name, "-hosts"), &f->hosts,
+        args->host_bits);
+    free(side);
+  }
+  if (success && f->prefixes != NULL) {
+    success = load_filter(args, side = side_name(name, "-prefixes"),
+        &f->prefixes, args->prefix_bits);
+    free(side);
+  }
+  return success;
+}
+
+
+/***
+ * Compress one filter and write it into the output directory.
+ */
+void write_filter(struct args *args, char *name, byte *bloom, int num_bits) {
+  size_t size;
+  byte *compressed = gzip_data(bloom, (size_t)1 << (num_bits - 3), &size);
+  write_output(args, name, compressed, size);
+  free(compressed);
+}
+
+
+/***
+ * Write a URL filter and its side filters, or only list them in info.json if
+ * they are unchanged from the previous build.
+ */
+void write_filter_set(struct args *args, struct state *previous, char *name,
+    struct filter_set *f, int changed) {
+  char *side;
+  if (changed) {
+    write_filter(args, name, f->bloom, args->bloom_bits);
+  } else {
+    keep_output(args, previous, name);
+  }
+  if (args->host_bits) {
+    side = side_name(name, "-hosts");
+    if (changed) {
+      write_filter(args, side, f->hosts, args->host_bits);
+    } else {
+      keep_output(args, previous, side);
+    }
+    free(side);
+  }
+  side = side_name(name, "-prefixes");
+  if (f->prefixes != NULL) {
+    if (changed) {
+      write_filter(args, side, f->prefixes, args->prefix_bits);
+    } else {
+      keep_output(args, previous, side);
+    }
+  } else {
+    // Remove a prefix filter left by an older build, so that it is not
+    // published with this one
+    char *path = output_path(args, side);
+    remove(path);
+    free(path);
+  }
+  free(side);
+}
+
+
+/***
+ * Return whether all of a previous build's outputs for a filter set are still
+ * in the output directory.
+ */
+int filter_set_exists(struct args *args, char *name, struct filter_set *f) {
+  char *names[3] = { name, NULL, NULL };
+  if (args->host_bits) {
+    names[1] = side_name(name, "-hosts");
+  }
+  if (f->prefixes != NULL) {
+    names[2] = side_name(name, "-prefixes");
+  }
+  int exists = 1;
+  for (int i = 0; i < 3; i++) {
+    if (i == 0 || names[i] != NULL) {
+      struct stat st;
+      char *path = output_path(args, names[i]);
+      exists = exists && stat(path, &st) == 0;
+      free(path);
+    }
+  }
+  free(names[1]);
+  free(names[2]);
+  return exists;
+}
+
+
+/***
+ * Build or update the full and delta filters of one threshold. Entries are
+ * merged with the previous state, both sorted by fingerprint, to find the
+ * stories added and removed since. Removed stories are left in the full
+ * filter as stale, which only adds to its false positives, until more than 1
+ * in STALE_FRACTION of its stories are stale and it is rebuilt.
+ */
+void publish_threshold(struct args *args, struct stories *s,
+    struct state *previous, struct state *state, int threshold,
+    struct filter_set *full, struct filter_set *delta, int *delta_written) {
+  size_t added = 0, removed = 0, total = 0;
+  size_t j = 0;
+  for (size_t i = 0; i < s->num_entries; i++) {
+    uint64_t fingerprint = s->entries[i].fingerprint;
+    for (; j < previous->count && previous->fingerprints[j] < fingerprint;
+        j++) {
+      removed += previous->levels[j] > threshold;
+    }
+    int was_in = j < previous->count
+      && previous->fingerprints[j] == fingerprint
+      && previous->levels[j] > threshold;
+    int is_in = s->entries[i].level > threshold;
+    added += is_in && !was_in;
+    removed += was_in && !is_in;
+    total += is_in;
+    j += j < previous->count && previous->fingerprints[j] == fingerprint;
+  }
+  for (; j < previous->count; j++) {
+    removed += previous->levels[j] > threshold;
+  }
+
+  char name[64];
+  sprintf(name, "hn-%lld.bloom", (long long)args->thresholds[threshold]);
+  clear_filter_set(args, full);
+  uint64_t stale = previous->valid ? previous->stale[threshold] + removed : 0;
+  int incremental = previous->valid && stale * STALE_FRACTION <= total
+    && filter_set_exists(args, name, full);
+  if (incremental && added == 0) {
+    fprintf(stderr, "%s is unchanged\n", name);
+    write_filter_set(args, previous, name, full, 0);
+  } else if (incremental && load_filter_set(args, name, full)) {
+    fprintf(stderr, "Adding %lu stories to %s\n", (unsigned long)added, name);
+  } else {
+    incremental = 0;
+    clear_filter_set(args, full);
+    fprintf(stderr, "Rebuilding %s\n", name);
+  }
+  state->stale[threshold] = incremental ? stale : 0;
+
+  // A delta has the stories added since the previous build, so a filter from
+  // that build merged with it has every story of this one, plus any removed
+  // since, just like a full filter updated in place
+  clear_filter_set(args, delta);
+  *delta_written = previous->valid;
+  j = 0;
+  for (size_t i = 0; (added > 0 || !incremental) && i < s->num_entries; i++) {
+    struct entry *e = &s->entries[i];
+    if (e->level <= threshold) {
+      continue;
+    }
+    for (; j < previous->count && previous->fingerprints[j] < e->fingerprint;
+        j++);
+    int was_in = j < previous->count
+      && previous->fingerprints[j] == e->fingerprint
+      && previous->levels[j] > threshold;
+    if (!incremental || !was_in) {
+      add_entry(args, s, full, e);
+    }
+    if (*delta_written && !was_in) {
+      add_entry(args, s, delta, e);
+    }
+  }
+
+  if (!incremental || added > 0) {
+    write_filter_set(args, previous, name, full, 1);
+  }
+  sprintf(name, "hn-delta-%lld.bloom", (long long)args->thresholds[threshold]);
+  if (*delta_written) {
+    write_filter_set(args, previous, name, delta, 1);
+  } else {
+    // Remove any older delta, so that it is not published with this build
+    char *suffixes[] = { "", "-hosts", "-prefixes" };
+    for (int i = 0; i < 3; i++) {
+      char *side = side_name(name, suffixes[i]);
+      char *path = output_path(args, side);
+      remove(path);
+      free(path);
+      free(side);
+    }
+  }
+}
+
+
+/***
+ * Build the partial filters of one threshold, skipping those with the same
+ * stories as in the previous build, and store their digests in state.
+ */
+void publish_partials(struct args *args, struct stories *s,
+    struct state *previous, struct state *state, int threshold,
+    struct filter_set *partial) {
+  for (int r = 0; r < args->num_ranges; r++) {
+    int64_t after = s->latest - args->ranges[r];
+
+    // Digest the stories in the filter: a sum of mixed fingerprints does not
+    // depend on their order, and the count is in the low bits
+    uint64_t digest = 0;
+    for (size_t i = 0; i < s->num_entries; i++) {
+      if (in_partial(s, &s->entries[i], threshold, after)) {
+        digest += mix64(s->entries[i].fingerprint) << 20 | 1;
+      }
+    }
+    state->partial_digests[threshold][r] = digest;
+
+    char name[64];
+    sprintf(name, "hn-%s-%lld.bloom", args->range_names[r],
+        (long long)args->thresholds[threshold]);
+    if (previous->valid && previous->partial_digests[threshold][r] == digest
+        && filter_set_exists(args, name, partial)) {
+      fprintf(stderr, "%s is unchanged\n", name);
+      write_filter_set(args, previous, name, partial, 0);
+      continue;
+    }
+
+    fprintf(stderr, "Rebuilding %s\n", name);
+    clear_filter_set(args, partial);
+    for (size_t i = 0; i < s->num_entries; i++) {
+      if (in_partial(s, &s->entries[i], threshold, after)) {
+        add_entry(args, s, partial, &s->entries[i]);
+      }
+    }
+    write_filter_set(args, previous, name, partial, 1);
+  }
+}
+
+
+/***
+ * Write the item map, unless it is the same as the previous build's. Its ids
+ * and scores can change without any URL changing, so the state cannot tell,
+ * but building and hashing it in memory is cheap next to downloading it
+ * again, and the previous map is never read back.
+ */
+void publish_item_map(struct args *args, struct state *previous,
+    item_map_builder *items, char *name) {
+  size_t size;
+  byte *map;
+  if ((map = build_item_map(items, &size)) == NULL) {
+    perror("Unable to build item map");
+    exit(EXIT_FAILURE);
+  }
+  char hash[65];
+  sha256_hex(map, size, hash);
+
+  struct output *output = previous_output(previous, name);
+  char *path = output_path(args, name);
+  struct stat st;
+  if (output != NULL && output->size == size
+      && strcmp(output->sha256, hash) == 0 && stat(path, &st) == 0) {
+    fprintf(stderr, "%s is unchanged\n", name);
+  } else {
+    // The map is not compressed, as write_item_map explains
+    fprintf(stderr, "Rebuilding %s\n", name);
+    write_file(args, name, map, size);
+  }
+  add_file(name, size, hash);
+
+  free(path);
+  free(map);
+}
+
+
+/***
+ * Write info.json, which the extension reads to find the filters to
+ * download, with the size and SHA-256 of every file as it was written.
+ */
+void write_info(struct args *args, struct stories *s, struct state *previous,
+    int *deltas, char *item_map, int64_t generated) {
+  char *path = output_path(args, "info.json");
+  char *temp_path = output_path(args, "info.json.tmp");
+  FILE *f;
+  if ((f = fopen(temp_path, "w")) == NULL) {
+    perror("Unable to write info.json");
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(f, "{\n   \"thresholds\": [");
+  for (int i = 0; i < args->num_thresholds; i++) {
+    fprintf(f, "%s%lld", i ? "," : "", (long long)args->thresholds[i]);
+  }
+  fprintf(f, "],\n   \"dates\": {\n");
+  for (int r = 0; r < args->num_ranges; r++) {
+    fprintf(f, "      \"%lld\": \"%s\"%s\n",
+        (long long)(s->latest - args->ranges[r]), args->range_names[r],
+        r + 1 < args->num_ranges ? "," : "");
+  }
+  fprintf(f, "   },\n   \"version\": \"0.6\",\n   \"compressed\": true,\n");
+  if (args->host_bits) {
+    fprintf(f, "   \"hosts\": true,\n   \"host_bits\": %d,\n",
+        args->host_bits);
+  }
+  if (args->prefix_bits) {
+    fprintf(f, "   \"prefixes\": true,\n   \"prefix_bits\": %d,\n"
+        "   \"prefix_threshold\": %lld,\n", args->prefix_bits,
+        (long long)args->thresholds[0]);
+  }
+  fprintf(f, "   \"item_map\": \"%s\",\n", item_map);
+  if (previous->valid) {
+    fprintf(f, "   \"deltas\": {\n");
+    int first = 1;
+    for (int i = 0; i < args->num_thresholds; i++) {
+      if (deltas[i]) {
+        fprintf(f, "%s      \"%lld\": \"hn-delta-%lld.bloom\"",
+            first ? "" : ",\n", (long long)args->thresholds[i],
+            (long long)args->thresholds[i]);
+        first = 0;
+      }
+    }
+    fprintf(f, "\n   },\n   \"delta_from\": %lld,\n",
+        (long long)previous->generated);
+  }
+  fprintf(f, "   \"date_generated\": %lld,\n   \"next_generated\": %lld,\n"
+      "   \"last_submitted\": %lld,\n   \"files\": {\n", (long long)generated,
+      (long long)(generated + args->interval + BUILD_MARGIN),
+      (long long)s->latest);
+
+  for (int i = 0; i < num_files; i++) {
+    fprintf(f, "      \"%s\": {\n         \"size\": %llu,\n"
+        "         \"sha256\": \"%s\"\n      }%s\n", files[i].name,
+        (unsigned long long)files[i].size, files[i].sha256,
+        i + 1 < num_files ? "," : "");
+  }
+  fprintf(f, "   }\n}\n");
+
+  fclose(f);
+  finish_file(temp_path, path);
+  free(temp_path);
+  free(path);
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+  // Parse command-line arguments
+  struct args args;
+  parse_args(argc, argv, &args);
+  if (args.state == NULL) {
+    args.state = output_path(&args, "publish.state");
+  }
+  int64_t generated = time(NULL);
+
+  struct state previous = { 0 }, state = { 0 };
+  if (!args.full) {
+    read_state(&args, &previous);
+  }
+  state.generated = generated;
+
+  struct stories s = { 0 };
+  item_map_builder *items;
+  if ((items = new_item_map_builder()) == NULL) {
+    perror("Unable to create item map");
+    return EXIT_FAILURE;
+  }
+  read_stories(&args, &s, items);
+  fprintf(stderr, "Read %lu stories with %lu distinct URLs\n",
+      (unsigned long)s.num_stories, (unsigned long)s.num_entries);
+
+  struct filter_set full, other;
+  new_filter_set(&args, &full, 1);
+  new_filter_set(&args, &other, 0);
+  int deltas[MAX_THRESHOLDS] = { 0 };
+  for (int i = 0; i < args.num_thresholds; i++) {
+    publish_threshold(&args, &s, &previous, &state, i, &full, &other,
+        &deltas[i]);
+    publish_partials(&args, &s, &previous, &state, i, &other);
+
+    // The lowest threshold's prefix filter has every other threshold's
+    // prefixes, so it is the only one published
+    free_bloom(full.prefixes);
+    full.prefixes = NULL;
+  }
+  free_filter_set(&full);
+  free_filter_set(&other);
+
+  char *item_map = "hn-ids.map";
+  publish_item_map(&args, &previous, items, item_map);
+  free_item_map_builder(items);
+
+  write_info(&args, &s, &previous, deltas, item_map, generated);
+  write_state(&args, &state, &s);
+
+  // Clean up
+  for (int i = 0; i < num_files; i++) {
+    free(files[i].name);
+  }
+  free_state(&previous);
+  free(s.stories);
+  free(s.data);
+  free(s.entries);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,373 @@
+/* bloom-query.c
+ *
+ * Command-line program to check many strings against one or more Bloom
+ * filters at once, for example to scan access logs or crawl lists.
+ */
+
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bloom-file.h"
+#include "canonicalize.h"
+#include "line-reader.h"
+
+
+
+/*******************************************************************************
+ * Types, structs, and constants
+ ******************************************************************************/
+
+// Number of keys looked up together with in_bloom_batch
+#define KEYS_PER_BATCH 256
+
+struct args {
+  char *infile;
+  int threads;
+  int canonicalize;
+  int matches_only;
+  int num_filters;
+  char **filters;
+};
+
+struct filter {
+  char *label;
+  byte *bloom;
+  uint8_t num_bits;
+};
+
+// Each thread handles a range of complete lines and writes its results to its
+// own output buffer, which is written out in order once all threads finish
+struct job {
+  struct args *args;
+  struct filter *filters;
+  char *start;
+  char *end;
+  char *out;
+  size_t out_size;
+  size_t out_capacity;
+  char *canonical;
+  size_t canonical_capacity;
+};
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Print a usage string describing this program's command-line arguments.
+ */
+void print_usage(char *prog_name) {
+  printf("Usage: %s [OPTION]... [LABEL=]FILTER...\n"
+      "Check newline-separated input strings against Bloom filters. For each\n"
+      "line, print the LABEL of the last FILTER containing it, or \"miss\",\n"
+      "followed by a tab and the line. Give filters in increasing threshold\n"
+      "order (e.g. 0=hn-0.bloom 10=hn-10.bloom) to print the highest one.\n"
+      "Filters may be gzip compressed or not. The default LABEL is \"hit\".\n\n"
+      "Options:\n"
+      " -i, --input=IN\t\tInput file to read strings from, default is stdin\n"
+      " -t, --threads=N\tNumber of threads, default is the number of CPUs\n"
+      " -c, --canonicalize\tCanonicalize URLs before checking them\n"
+      " -m, --matches-only\tOnly print lines found in at least one filter\n"
+      " -h, --help\t\tDisplay this help message\n", prog_name);
+}
+
+
+/***
+ * Parse comand line arguments, setting their values in the parsed_args struct.
+ */
+void parse_args(int argc, char *argv[], struct args *parsed_args) {
+  // Set default values
+  parsed_args->infile = NULL;
+  parsed_args->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (parsed_args->threads < 1) {
+    parsed_args->threads = 1;
+  }
+  parsed_args->canonicalize = 0;
+  parsed_args->matches_only = 0;
+
+  int c, long_index;
+  struct option opts[] = {
+    { "input", required_argument, NULL, 'i' },
+    { "threads", required_argument, NULL, 't' },
+    { "canonicalize", no_argument, NULL, 'c' },
+    { "matches-only", no_argument, NULL, 'm' },
+    { "help", no_argument, NULL, 'h' },
+    { 0, 0, 0, 0 }
+  };
+  while ((c = getopt_long(argc, argv, "i:t:cmh", opts, &long_index)) != -1) {
+    switch(c) {
+      case 'i':
+        parsed_args->infile = optarg;
+        break;
+
+      case 't':
+        parsed_args->threads = atoi(optarg);
+        if (parsed_args->threads <= 0) {
+          fprintf(stderr, "%s\n\n", "Must have at least one thread.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'c':
+        parsed_args->canonicalize = 1;
+        break;
+
+      case 'm':
+        parsed_args->matches_only = 1;
+        break;
+
+      case 'h':
+        print_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+        break;
+
+      default:
+        // Add a blank line because an error will probably be printed
+        puts("");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+        break;
+    }
+  }
+
+  // Make sure there is at least one filter
+  if (optind >= argc) {
+    fprintf(stderr, "%s\n\n", "No Bloom filters specified!");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  parsed_args->num_filters = argc - optind;
+  parsed_args->filters = argv + optind;
+
+  return;
+}
+
+
+/***
+ * Load a filter from an argument of the form [LABEL=]FILTER in any format.
+ * Exit the program with an error message on failure.
+ */
+void load_filter(char *arg, struct filter *filter, int threads) {
+  char *equals = strchr(arg, '=');
+  char *filename = arg;
+  filter->label = "hit";
+  if (equals != NULL) {
+    *equals = '\0';
+    filter->label = arg;
+    filename = equals + 1;
+  }
+
+  if ((filter->bloom = load_bloom_file(filename, &filter->num_bits, threads))
+      == NULL) {
+    fprintf(stderr, "Unable to load Bloom filter %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+/***
+ * Append bytes to a job's output buffer, growing it if necessary.
+ */
+void append_output(struct job *job, const char *data, size_t length) {
+  if (job->out_size + length > job->out_capacity) {
+    job->out_capacity = 2 * (job->out_size + length);
+    if ((job->out = realloc(job->out, job->out_capacity)) == NULL) {
+      perror("Unable to allocate output buffer");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(job->out + job->out_size, data, length);
+  job->out_size += length;
+}
+
+
+/***
+ * Look up one batch of lines in every filter and write out the results.
+ */
+void query_batch(struct job *job, char **lines, uint32_t *line_lengths,
+    size_t n) {
+  byte *keys[KEYS_PER_BATCH];
+  uint32_t lengths[KEYS_PER_BATCH];
+  byte hits[KEYS_PER_BATCH / 8];
+  int matched[KEYS_PER_BATCH];
+
+  // Canonicalize into a per-thread buffer sized for the whole batch
+  if (job->args->canonicalize) {
+    size_t needed = 0;
+    for (size_t i = 0; i < n; i++) {
+      needed += CANONICAL_MAX(line_lengths[i]);
+    }
+    if (needed > job->canonical_capacity) {
+      job->canonical_capacity = 2 * needed;
+      free(job->canonical);
+      if ((job->canonical = malloc(job->canonical_capacity)) == NULL) {
+        perror("Unable to allocate canonicalization buffer");
+        exit(EXIT_FAILURE);
+      }
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < n; i++) {
+      keys[i] = (byte *)job->canonical + offset;
+      lengths[i] = canonicalize_url(lines[i], line_lengths[i],
+          job->canonical + offset);
+      offset += CANONICAL_MAX(line_lengths[i]);
+    }
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      keys[i] = (byte *)lines[i];
+      lengths[i] = line_lengths[i];
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    matched[i] = -1;
+  }
+  for (int f = 0; f < job->args->num_filters; f++) {
+    in_bloom_batch(job->filters[f].bloom, job->filters[f].num_bits, keys,
+        lengths, n, hits);
+    for (size_t i = 0; i < n; i++) {
+      if (hits[i >> 3] & (1 << (7 - (i & 0x7)))) {
+        matched[i] = f;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (matched[i] < 0 && job->args->matches_only) {
+      continue;
+    }
+    char *label = matched[i] < 0 ? "miss" : job->filters[matched[i]].label;
+    append_output(job, label, strlen(label));
+    append_output(job, "\t", 1);
+    append_output(job, lines[i], line_lengths[i]);
+    append_output(job, "\n", 1);
+  }
+}
+
+
+/***
+ * Thread entry point: split the job's range into lines, stripping a trailing
+ * carriage return from each, and query them in batches.
+ */
+void *query_range(void *arg) {
+  struct job *job = (struct job *)arg;
+  char *lines[KEYS_PER_BATCH];
+  uint32_t lengths[KEYS_PER_BATCH];
+  size_t n = 0;
+
+  char *next = job->start;
+  while (next < job->end) {
+    lengths[n] = split_line(&next, job->end, &lines[n]);
+    if (++n == KEYS_PER_BATCH) {
+      query_batch(job, lines, lengths, n);
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    query_batch(job, lines, lengths, n);
+  }
+
+  return NULL;
+}
+
+
+/***
+ * Split a block of complete lines evenly (by bytes, on line boundaries) among
+ * the jobs, run them, and write out their results in order.
+ */
+void query_block(struct job *jobs, int num_jobs, char *start, char *end) {
+  pthread_t threads[num_jobs];
+  size_t share = (end - start) / num_jobs + 1;
+
+  char *next = start;
+  for (int i = 0; i < num_jobs; i++) {
+    jobs[i].start = next;
+    if (i == num_jobs - 1 || (size_t)(end - next) <= share) {
+      next = end;
+    } else {
+      char *newline = memchr(next + share, '\n', end - next - share);
+      next = newline == NULL ? end : newline + 1;
+    }
+    jobs[i].end = next;
+    jobs[i].out_size = 0;
+  }
+
+  // Run the first job on this thread, and only start threads with work to do
+  for (int i = 1; i < num_jobs; i++) {
+    if (jobs[i].start < jobs[i].end
+        && pthread_create(&threads[i], NULL, query_range, &jobs[i]) != 0) {
+      perror("Unable to start thread");
+      exit(EXIT_FAILURE);
+    }
+  }
+  query_range(&jobs[0]);
+  for (int i = 1; i < num_jobs; i++) {
+    if (jobs[i].start < jobs[i].end) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  for (int i = 0; i < num_jobs; i++) {
+    fwrite(jobs[i].out, 1, jobs[i].out_size, stdout);
+  }
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+  // Parse command-line arguments
+  struct args args;
+  parse_args(argc, argv, &args);
+
+  // Open the input, which is read in large blocks (or mapped) rather than
+  // line-by-line, so each block can be split among the threads
+  line_reader *infile;
+  if ((infile = open_line_reader(args.infile)) == NULL) {
+    perror("Unable to open input file");
+    return EXIT_FAILURE;
+  }
+
+  // Load the Bloom filters
+  struct filter filters[args.num_filters];
+  for (int i = 0; i < args.num_filters; i++) {
+    load_filter(args.filters[i], &filters[i], args.threads);
+  }
+
+  struct job jobs[args.threads];
+  memset(jobs, 0, sizeof(jobs));
+  for (int i = 0; i < args.threads; i++) {
+    jobs[i].args = &args;
+    jobs[i].filters = filters;
+  }
+
+  char *start, *end;
+  while (next_block(infile, &start, &end)) {
+    query_block(jobs, args.threads, start, end);
+  }
+
+  // Clean up
+  for (int i = 0; i < args.threads; i++) {
+    free(jobs[i].out);
+    free(jobs[i].canonical);
+  }
+  for (int i = 0; i < args.num_filters; i++) {
+    free_bloom(filters[i].bloom);
+  }
+  close_line_reader(infile);
+
+  return EXIT_SUCCESS;
+}
@@ -10,6 +10,7 @@
 
 #include <stdlib.h>
 #include <string.h> // memcpy
+#include <time.h>
 #include <zlib.h>
 
 #include "bloom.h"
@@ -17,6 +18,113 @@
 
 
 
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+// Prefetch for reading with low temporal locality, since each probe location
+// is only visited once per key
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch((p), 0, 1)
+#else /* __GNUC__ */
+#define PREFETCH(p) ((void)(p))
+#endif /* __GNUC__ */
+
+
+#ifdef BLOOM_STATS
+static bloom_stats stats;
+
+// Counters are shared by every thread, so they are added to atomically. They
+// only count, so relaxed ordering is enough.
+#ifdef __GNUC__
+#define STATS_ADD_TO(counter, n) \
+  ((void)__atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED))
+#else /* __GNUC__ */
+#define STATS_ADD_TO(counter, n) ((void)((counter) += (n)))
+#endif /* __GNUC__ */
+
+/***
+ * Return the time from a monotonic clock in nanoseconds.
+ */
+static uint64_t now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+
+/***
+ * Count one call to an operation that started at the given time.
+ */
+static void record_stats(stats_op op, uint64_t keys, uint64_t hits,
+    uint64_t start) {
+  uint64_t elapsed = now_ns() - start;
+  op_stats *s = &stats.ops[op];
+  STATS_ADD_TO(s->calls, 1);
+  STATS_ADD_TO(s->keys, keys);
+  STATS_ADD_TO(s->hits, hits);
+  STATS_ADD_TO(s->total_ns, elapsed);
+
+  int bucket = 0;
+  while (bucket < STATS_BUCKETS - 1 && (elapsed >> (bucket + 1)) != 0) {
+    bucket++;
+  }
+  STATS_ADD_TO(s->histogram[bucket], 1);
+}
+
+#define STATS_START() uint64_t stats_start = now_ns()
+#define STATS_END(op, keys, hits) record_stats((op), (keys), (hits), \
+    stats_start)
+#else /* BLOOM_STATS */
+#define STATS_START() do {} while (0)
+#define STATS_END(op, keys, hits) do {} while (0)
+#endif /* BLOOM_STATS */
+
+
+/***
+ * Hash a group of keys starting at index start, storing every probe bit index
+ * and prefetching the byte that holds it. Return the number of keys hashed.
+ */
+static size_t hash_group(byte *bloom, uint8_t num_bits, byte **keys,
+    uint32_t *lengths, size_t start, size_t n,
+    uint32_t indices[BATCH_GROUP][NUM_HASHES]) {
+  size_t count = n - start < BATCH_GROUP ? n - start : BATCH_GROUP;
+  for (size_t k = 0; k < count; k++) {
+    for (int i = 0; i < NUM_HASHES; i++) {
+      uint32_t hash = murmur3(keys[start + k], lengths[start + k], i);
+      hash >>= 32 - num_bits;
+      indices[k][i] = hash;
+      PREFETCH(bloom + (hash >> 3));
+    }
+  }
+  return count;
+}
+
+
+/***
+ * Check a group of keys whose probe indices have already been computed, and
+ * set or clear their bits in out_bits.
+ */
+static void resolve_group(byte *bloom, size_t start, size_t count,
+    uint32_t indices[BATCH_GROUP][NUM_HASHES], byte *out_bits) {
+  for (size_t k = 0; k < count; k++) {
+    int set = 1;
+    for (int i = 0; set && i < NUM_HASHES; i++) {
+      uint32_t hash = indices[k][i];
+      set = bloom[hash >> 3] & (1 << (7 - (hash & 0x7)));
+    }
+
+    size_t j = start + k;
+    if (set) {
+      out_bits[j >> 3] |= 1 << (7 - (j & 0x7));
+    } else {
+      out_bits[j >> 3] &= ~(1 << (7 - (j & 0x7)));
+    }
+  }
+}
+
+
+
 /*******************************************************************************
  * Library functions
  ******************************************************************************/
@@ -81,7 +189,7 @@ void write_compressed_bloom(char *filename, byte *bloom, uint8_t num_bits) {
  * reallocating *bloom would mess up stream.avail_out if it points directly
  * into *bloom.
  */
-size_t decompress_bloom(byte *compressed, size_t size, byte **bloom) {
+static size_t inflate_bloom(byte *compressed, size_t size, byte **bloom) {
   z_stream stream;
   stream.zalloc = Z_NULL;
   stream.zfree = Z_NULL;
@@ -143,12 +251,74 @@ size_t decompress_bloom(byte *compressed, size_t size, byte **bloom) {
   return bloom_size;
 }
 
+/***
+ * Time decompression around inflate_bloom, which returns early on errors.
+ */
+size_t decompress_bloom(byte *compressed, size_t size, byte **bloom) {
+  STATS_START();
+  size_t bloom_size = inflate_bloom(compressed, size, bloom);
+  STATS_END(STATS_DECOMPRESS, 1, bloom_size > 0);
+  return bloom_size;
+}
+
+
+/***
+ * The last four bytes of a gzip stream are the uncompressed size modulo 2^32
+ * in little-endian order. Bloom filters are always smaller than 2^32 bytes, so
+ * this is the exact size.
+ */
+size_t decompressed_bloom_size(byte *compressed, size_t size) {
+  // The two magic bytes identify gzip, and the header and trailer alone are at
+  // least 18 bytes
+  if (size < 18 || compressed[0] != 0x1f || compressed[1] != 0x8b) {
+    return 0u;
+  }
+
+  byte *trailer = compressed + size - 4;
+  return (size_t)trailer[0]
+    | ((size_t)trailer[1] << 8)
+    | ((size_t)trailer[2] << 16)
+    | ((size_t)trailer[3] << 24);
+}
+
+
+/***
+ * Inflate straight into the destination buffer, with no intermediate buffer
+ * on the stack and no reallocation. Inflation can never write past the end of
+ * the buffer since avail_out bounds it.
+ */
+int decompress_bloom_into(byte *compressed, size_t size, byte *bloom,
+    size_t bloom_size) {
+  STATS_START();
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+
+  stream.next_in = (Bytef *)compressed;
+  stream.avail_in = (uInt)size;
+  stream.next_out = (Bytef *)bloom;
+  stream.avail_out = (uInt)bloom_size;
+
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+    return 0;
+  }
+
+  int ret = inflate(&stream, Z_FINISH);
+  (void)inflateEnd(&stream);
+
+  int success = ret == Z_STREAM_END && stream.avail_out == 0;
+  STATS_END(STATS_DECOMPRESS, 1, success);
+  return success;
+}
+
 
 /***
  * Add a bit at an index derived from murmur3 hashes seeded by the current
  * iteration -- justification for number of iterations can be found in bloom.h.
  */
 void add_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length) {
+  STATS_START();
   for (int i = 0; i < NUM_HASHES; i++) {
     // Calculate the hash value and only take the minimum number of
     // higher-order bits required to index fully into the filter.  Recall that
@@ -159,6 +329,7 @@ void add_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length) {
     // Divide by 8 to index into the correct byte, set the correct bit to 1
     bloom[hash >> 3] |= 1 << (7 - (hash & 0x7));
   }
+  STATS_END(STATS_ADD, 1, 0);
 }
 
 
@@ -167,6 +338,8 @@ void add_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length) {
  * iteration -- justification for number of iterations can be found in bloom.h.
  */
 int in_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length) {
+  STATS_START();
+  int found = 1;
   for (int i = 0; i < NUM_HASHES; i++) {
     // Calculate the hash value and only take the minimum number of
     // higher-order bits required to index fully into the filter.  Recall that
@@ -177,14 +350,51 @@ int in_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length) {
     // Divide by 8 to index into the correct byte, get the correct bit
     int set = bloom[hash >> 3] & (1 << (7 - (hash & 0x7)));
 
-    // Return early if any of the expected bits are not set, meaning the
+    // Stop early if any of the expected bits are not set, meaning the
     // element is not in the filter
     if (!set) {
-      return 0;
+      found = 0;
+      break;
     }
   }
 
-  return 1;
+  STATS_END(STATS_IN, 1, found);
+  return found;
+}
+
+
+/***
+ * Software pipelined in two stages with double-buffered indices: the next
+ * group is hashed (and its probes prefetched) before the current group is
+ * resolved, so the prefetches have a whole group's worth of hashing to land.
+ */
+void in_bloom_batch(byte *bloom, uint8_t num_bits, byte **keys,
+    uint32_t *lengths, size_t n, byte *out_bits) {
+  STATS_START();
+  uint32_t indices[2][BATCH_GROUP][NUM_HASHES];
+  size_t start = 0;
+  size_t count = hash_group(bloom, num_bits, keys, lengths, 0, n, indices[0]);
+  int current = 0;
+
+  while (count > 0) {
+    size_t next_start = start + count;
+    size_t next_count = hash_group(bloom, num_bits, keys, lengths, next_start,
+        n, indices[!current]);
+
+    resolve_group(bloom, start, count, indices[current], out_bits);
+
+    start = next_start;
+    count = next_count;
+    current = !current;
+  }
+
+#ifdef BLOOM_STATS
+  uint64_t hits = 0;
+  for (size_t j = 0; j < n; j++) {
+    hits += (out_bits[j >> 3] >> (7 - (j & 0x7))) & 1;
+  }
+  STATS_END(STATS_IN_BATCH, n, hits);
+#endif /* BLOOM_STATS */
 }
 
 
@@ -193,10 +403,47 @@ int in_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length) {
  * each byte in bloom, and storing the result in bloom.
  */
 void combine_bloom(byte *bloom, byte *new, uint8_t num_bits) {
+  STATS_START();
   // Number of bytes is 2^num_bits / 8
   size_t num_bytes = 1 << (num_bits - 3);
 
   for (size_t i = 0; i < num_bytes; i++) {
     bloom[i] |= new[i];
   }
+  STATS_END(STATS_COMBINE, 1, 0);
+}
+
+
+/***
+ * Count set bits eight bytes at a time.
+ */
+double fill_ratio(byte *bloom, uint8_t num_bits) {
+  size_t num_bytes = (size_t)1 << (num_bits - 3);
+  uint64_t set = 0;
+  size_t i = 0;
+#ifdef __GNUC__
+  for (; i + 8 <= num_bytes; i += 8) {
+    uint64_t word;
+    (void)memcpy((void *)&word, (void *)(bloom + i), 8);
+    set += __builtin_popcountll(word);
+  }
+#endif /* __GNUC__ */
+  for (; i < num_bytes; i++) {
+    for (byte b = bloom[i]; b != 0; b &= b - 1) {
+      set++;
+    }
+  }
+  return (double)set / ((double)num_bytes * 8);
+}
+
+
+#ifdef BLOOM_STATS
+bloom_stats *get_bloom_stats() {
+  return &stats;
+}
+
+
+void reset_bloom_stats() {
+  (void)memset((void *)&stats, 0, sizeof(stats));
 }
+#endif /* BLOOM_STATS */
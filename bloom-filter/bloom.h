@@ -12,6 +12,7 @@
 #define BLOOM_H
 
 
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -31,8 +32,46 @@
 #define NUM_HASHES 23
 #endif /* NUM_HASHES */
 
+// Number of keys hashed and prefetched together by in_bloom_batch. Each group
+// issues up to BATCH_GROUP * NUM_HASHES prefetches, which is enough to keep
+// the memory system busy without evicting the previous group's lines.
+#ifndef BATCH_GROUP
+#define BATCH_GROUP 8
+#endif /* BATCH_GROUP */
+
 typedef uint8_t byte;
 
+// Compile with -D BLOOM_STATS to count and time calls to the operations below.
+// Times are bucketed into a histogram by powers of two nanoseconds. Counters
+// are updated atomically, so no counts are lost when filters are used from
+// several threads at once, but resetting them is not atomic.
+#ifdef BLOOM_STATS
+#define STATS_BUCKETS 32
+
+typedef enum {
+  STATS_ADD,
+  STATS_IN,
+  STATS_IN_BATCH,
+  STATS_COMBINE,
+  STATS_DECOMPRESS,
+  NUM_STATS_OPS,
+} stats_op;
+
+typedef struct op_stats_s {
+  uint64_t calls;
+  // Keys added or checked, and for lookups, the number found
+  uint64_t keys;
+  uint64_t hits;
+  uint64_t total_ns;
+  // Number of calls that took at least 2^i and less than 2^(i + 1) ns
+  uint64_t histogram[STATS_BUCKETS];
+} op_stats;
+
+typedef struct bloom_stats_s {
+  op_stats ops[NUM_STATS_OPS];
+} bloom_stats;
+#endif /* BLOOM_STATS */
+
 
 
 /*******************************************************************************
@@ -73,6 +112,23 @@ void write_compressed_bloom(char *filename, byte *bloom, uint8_t num_bits);
 size_t decompress_bloom(byte *compressed, size_t size, byte **bloom);
 
 
+/***
+ * Return the decompressed size in bytes of a gzip compressed Bloom filter, as
+ * recorded in the gzip trailer, or 0 if the data is not a gzip stream. This
+ * allows the caller to allocate the filter up-front.
+ */
+size_t decompressed_bloom_size(byte *compressed, size_t size);
+
+
+/***
+ * Decompress a Bloom filter directly into a caller-allocated buffer of exactly
+ * bloom_size bytes. Return 1 on success, and 0 if decompression fails or the
+ * decompressed filter is not exactly bloom_size bytes.
+ */
+int decompress_bloom_into(byte *compressed, size_t size, byte *bloom,
+    size_t bloom_size);
+
+
 /***
  * Add data to the Bloom filter.
  */
@@ -85,6 +141,19 @@ void add_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length);
 int in_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length);
 
 
+/***
+ * Check n keys at once, storing whether keys[i] is (probably) in the Bloom
+ * filter as bit i of out_bits, which must hold at least ceil(n / 8) bytes.
+ * Bits are ordered from the highest-order bit of each byte, like the filter.
+ *
+ * Keys are processed in groups of BATCH_GROUP: while one group is checked,
+ * the next group is hashed and all of its probe locations are prefetched, so
+ * that memory accesses overlap instead of stalling one at a time.
+ */
+void in_bloom_batch(byte *bloom, uint8_t num_bits, byte **keys,
+    uint32_t *lengths, size_t n, byte *out_bits);
+
+
 /***
  * Combine two bloom filters. Destructively modifies the bloom parameter to
  * become the combined filter.
@@ -95,4 +164,26 @@ int in_bloom(byte *bloom, uint8_t num_bits, byte *data, uint32_t length);
 void combine_bloom(byte *bloom, byte *new, uint8_t num_bits);
 
 
+/***
+ * Return the fraction of bits set in a Bloom filter. As the filter fills up,
+ * the false positive rate approaches this ratio to the power of NUM_HASHES.
+ */
+double fill_ratio(byte *bloom, uint8_t num_bits);
+
+
+#ifdef BLOOM_STATS
+/***
+ * Return the statistics collected since the program started or since they
+ * were last reset.
+ */
+bloom_stats *get_bloom_stats(void);
+
+
+/***
+ * Set all statistics back to zero.
+ */
+void reset_bloom_stats(void);
+#endif /* BLOOM_STATS */
+
+
 #endif /* BLOOM_H */
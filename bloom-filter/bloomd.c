@@ -0,0 +1,672 @@
+/* bloomd.c
+ *
+ * Long-running server that answers Bloom filter lookups from many clients at
+ * once, and picks up new versions of the filter (and of a delta filter merged
+ * into it) as they land. Lookups never wait for a reload: each new version is
+ * built off to the side and swapped in with one atomic pointer exchange, and
+ * the old version is only freed once no lookup can still be using it, like
+ * read-copy-update.
+ *
+ * Clients send one URL per line, and get back one line per URL: 1 if it is
+ * (probably) in the filter, and 0 if it is not.
+ */
+
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom-file.h"
+#include "canonicalize.h"
+
+
+
+/*******************************************************************************
+ * Types, structs, and constants
+ ******************************************************************************/
+
+struct args {
+  char *filter;
+  char *delta;
+  char *socket_path;
+  int threads;
+  int canonicalize;
+  long interval_ms;
+};
+
+// One immutable version of the filter. Versions are never changed once they
+// are published, only replaced.
+struct version {
+  byte *bloom;
+  uint8_t num_bits;
+  unsigned long number;
+};
+
+// Each reader counts its epoch up when it starts using the current version
+// and again when it is done, so the epoch is odd while it may be using one.
+// Readers are padded to separate cache lines so they do not slow each other.
+struct reader {
+  unsigned long epoch;
+  char padding[64 - sizeof(unsigned long)];
+};
+
+// A file that is watched for new versions. The stat of the last version
+// loaded, or tried, tells whether the file has changed since. The file is
+// checked before it is loaded, so a version written while it is loading is
+// still noticed afterward.
+struct source {
+  char *filename;
+  int exists, seen_exists;
+  struct stat loaded, seen;
+};
+
+// Bytes read from a client at once. Lines longer than this are still
+// answered, by growing the buffer.
+#define READ_SIZE (1 << 16)
+
+// How long reloads wait between checks that readers have finished with the
+// old version
+#define GRACE_POLL_NS 50000
+
+
+
+/*******************************************************************************
+ * Global variables
+ ******************************************************************************/
+
+static struct args args;
+
+// Version that new lookups use, only ever read and written atomically
+static struct version *current = NULL;
+
+static struct reader *readers = NULL;
+static int num_readers = 0;
+
+// Socket that clients connect to, if not answering standard input
+static int listener = -1;
+
+// Files watched for new versions, and the filters loaded from them, which are
+// only used by the main thread
+static struct source filter_source = { 0 }, delta_source = { 0 };
+static byte *base = NULL, *delta = NULL;
+static uint8_t base_bits = 0, delta_bits = 0;
+
+static volatile sig_atomic_t reload_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Print a usage string describing this program's command-line arguments.
+ */
+void print_usage(char *prog_name) {
+  printf("Usage: %s [OPTION]... FILTER\n"
+      "Answer lookups in a Bloom filter (compressed or not) from standard\n"
+      "input, or from clients of a Unix socket, one URL per line. Each URL\n"
+      "gets a line with 1 if it is in the filter and 0 if not. New versions\n"
+      "of FILTER are loaded as they are written, or on SIGHUP, without\n"
+      "pausing lookups. Write new versions to a temporary file and rename\n"
+      "them over FILTER, so a partly written file is never loaded.\n\n"
+      "Options:\n"
+      " -s, --socket=PATH\tListen on a Unix socket instead of standard input\n"
+      " -t, --threads=N\tNumber of threads answering socket clients, each\n"
+      "\t\t\tserving one client at a time, default is the number\n"
+      "\t\t\tof CPUs\n"
+      " -d, --delta=FILE\tMerge the filter in FILE into FILTER, such as a\n"
+      "\t\t\tpartial filter of the latest stories, again whenever\n"
+      "\t\t\teither changes\n"
+      " -C, --canonicalize\tCanonicalize URLs before looking them up\n"
+      " -i, --interval=MS\tCheck for new versions every MS milliseconds,\n"
+      "\t\t\tdefault is 1000\n"
+      " -h, --help\t\tDisplay this help message\n", prog_name);
+}
+
+
+/***
+ * Parse comand line arguments, setting their values in the parsed_args struct.
+ */
+void parse_args(int argc, char *argv[], struct args *parsed_args) {
+  // Set default values
+  parsed_args->delta = NULL;
+  parsed_args->socket_path = NULL;
+  parsed_args->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (parsed_args->threads < 1) {
+    parsed_args->threads = 1;
+  }
+  parsed_args->canonicalize = 0;
+  parsed_args->interval_ms = 1000;
+
+  int c, long_index;
+  struct option opts[] = {
+    { "socket", required_argument, NULL, 's' },
+    { "threads", required_argument, NULL, 't' },
+    { "delta", required_argument, NULL, 'd' },
+    { "canonicalize", no_argument, NULL, 'C' },
+    { "interval", required_argument, NULL, 'i' },
+    { "help", no_argument, NULL, 'h' },
+    { 0, 0, 0, 0 }
+  };
+  while ((c = getopt_long(argc, argv, "s:t:d:Ci:h", opts, &long_index))
+      != -1) {
+    switch(c) {
+      case 's':
+        parsed_args->socket_path = optarg;
+        break;
+
+      case 't':
+        parsed_args->threads = atoi(optarg);
+        if (parsed_args->threads <= 0) {
+          fprintf(stderr, "%s\n\n", "Must have at least one thread.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'd':
+        parsed_args->delta = optarg;
+        break;
+
+      case 'C':
+        parsed_args->canonicalize = 1;
+        break;
+
+      case 'i':
+        parsed_args->interval_ms = atol(optarg);
+        if (parsed_args->interval_ms <= 0) {
+          fprintf(stderr, "%s\n\n", "Interval must be positive.");
+          print_usage(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'h':
+        print_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+        break;
+
+      default:
+        // Add a blank line because an error will probably be printed
+        puts("");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+        break;
+    }
+  }
+
+  // Make sure there is a filter
+  if (optind >= argc) {
+    fprintf(stderr, "%s\n\n", "Filter not specified!");
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  parsed_args->filter = argv[optind];
+}
+
+
+/***
+ * Return the current time in milliseconds from a monotonic clock.
+ */
+double now_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+
+/***
+ * Load a Bloom filter with the shared loader, storing its size as a power of
+ * two bits. Unlike the other tools, return NULL instead of exiting if it
+ * cannot be loaded, so the server keeps answering with the last good version.
+ * Chunked filters are inflated on one thread, leaving the rest to the clients.
+ */
+byte *load_filter(char *filename, uint8_t *num_bits) {
+  byte *bloom;
+  if ((bloom = load_bloom_file(filename, num_bits, 1)) == NULL) {
+    fprintf(stderr, "Unable to load Bloom filter %s\n", filename);
+  }
+  return bloom;
+}
+
+
+/***
+ * Return whether a watched file has changed since it was last loaded. Files
+ * that are missing have changed if they existed before.
+ */
+int source_changed(struct source *s) {
+  s->seen_exists = stat(s->filename, &s->seen) == 0;
+  if (!s->seen_exists || !s->exists) {
+    return s->seen_exists != s->exists;
+  }
+  return s->seen.st_ino != s->loaded.st_ino
+    || s->seen.st_size != s->loaded.st_size
+    || s->seen.st_mtim.tv_sec != s->loaded.st_mtim.tv_sec
+    || s->seen.st_mtim.tv_nsec != s->loaded.st_mtim.tv_nsec;
+}
+
+
+/***
+ * Remember the file as it was when last checked, before it is loaded.
+ */
+void source_loaded(struct source *s) {
+  s->exists = s->seen_exists;
+  s->loaded = s->seen;
+}
+
+
+
+/*******************************************************************************
+ * Read-copy-update
+ ******************************************************************************/
+
+/***
+ * Start using the current version, which stays valid until read_unlock.
+ * Readers never wait, so a lookup costs two uncontended atomic increments on
+ * the reader's own cache line.
+ */
+static inline struct version *read_lock(struct reader *r) {
+  __atomic_add_fetch(&r->epoch, 1, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+}
+
+static inline void read_unlock(struct reader *r) {
+  __atomic_add_fetch(&r->epoch, 1, __ATOMIC_RELEASE);
+}
+
+
+/***
+ * Wait until every reader that might have been using the previous version
+ * has finished with it. Readers that were not using any version, or that
+ * have moved on since, already see the new one.
+ */
+void synchronize_readers() {
+  for (int i = 0; i < num_readers; i++) {
+    unsigned long epoch = __atomic_load_n(&readers[i].epoch,
+        __ATOMIC_SEQ_CST);
+    if ((epoch & 1) == 0) {
+      continue;
+    }
+    struct timespec pause = { 0, GRACE_POLL_NS };
+    while (__atomic_load_n(&readers[i].epoch, __ATOMIC_ACQUIRE) == epoch) {
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+
+
+/***
+ * Make a new version current for all later lookups, then free the previous
+ * one once it is no longer in use.
+ */
+void publish(struct version *v) {
+  struct version *old = __atomic_exchange_n(&current, v, __ATOMIC_SEQ_CST);
+  synchronize_readers();
+  if (old != NULL) {
+    free(old->bloom);
+    free(old);
+  }
+}
+
+
+/***
+ * Build a new version from the base filter and the delta filter, if there is
+ * one, and publish it. The base is copied, since it is kept to merge with
+ * later deltas. Return 0 on failure.
+ */
+int publish_version() {
+  static unsigned long number = 0;
+  uint8_t num_bits = base_bits;
+  size_t size = (size_t)1 << (num_bits - 3);
+  struct version *v = (struct version *)malloc(sizeof(struct version));
+  if (v == NULL || (v->bloom = (byte *)malloc(size)) == NULL) {
+    free(v);
+    return 0;
+  }
+  memcpy(v->bloom, base, size);
+  if (delta != NULL && delta_bits == num_bits) {
+    combine_bloom(v->bloom, delta, num_bits);
+  } else if (delta != NULL) {
+    fprintf(stderr, "Delta filter %s has 2^%d bits, but %s has 2^%d bits, "
+        "so it is not merged\n", args.delta, delta_bits, args.filter,
+        num_bits);
+  }
+  v->num_bits = num_bits;
+  v->number = ++number;
+  publish(v);
+  return 1;
+}
+
+
+
+/*******************************************************************************
+ * Serving lookups
+ ******************************************************************************/
+
+/***
+ * Write all of a buffer, returning 0 if the client has gone away.
+ */
+int write_all(int fd, char *buffer, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(fd, buffer, length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return 0;
+    }
+    buffer += n;
+    length -= n;
+  }
+  return 1;
+}
+
+
+/***
+ * Answer lookups from one client until it disconnects. Everything read at
+ * once is looked up against one version and answered with one write, so a
+ * client that sends many URLs at a time pays for few system calls.
+ */
+void serve(int in_fd, int out_fd, struct reader *r) {
+  size_t capacity = READ_SIZE;
+  char *in = (char *)malloc(capacity);
+  char *out = (char *)malloc(2 * capacity);
+  size_t canonical_capacity = CANONICAL_MAX(capacity);
+  char *canonical = args.canonicalize ? (char *)malloc(canonical_capacity)
+    : NULL;
+  if (in == NULL || out == NULL || (args.canonicalize && canonical == NULL)) {
+    perror("Unable to allocate buffers for a client");
+    free(in);
+    free(out);
+    free(canonical);
+    return;
+  }
+
+  size_t used = 0;
+  ssize_t n;
+  while (1) {
+    if (used == capacity) {
+      // A single line fills the whole buffer, so make room for the rest
+      char *grown_in = (char *)realloc(in, 2 * capacity);
+      char *grown_out = grown_in == NULL ? NULL
+        : (char *)realloc(out, 4 * capacity);
+      if (grown_in != NULL) {
+        in = grown_in;
+      }
+      if (grown_out == NULL) {
+        break;
+      }
+      out = grown_out;
+      capacity *= 2;
+    }
+    if ((n = read(in_fd, in + used, capacity - used)) < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      break;
+    }
+    used += n;
+
+    size_t start = 0, out_length = 0;
+    char *newline;
+    struct version *v = read_lock(r);
+    while ((newline = (char *)memchr(in + start, '\n', used - start))
+        != NULL) {
+      char *key = in + start;
+      size_t length = newline - key;
+      start += length + 1;
+      if (length > 0 && key[length - 1] == '\r') {
+        length--;
+      }
+      if (args.canonicalize) {
+        if (CANONICAL_MAX(length) > canonical_capacity) {
+          char *grown = (char *)realloc(canonical, CANONICAL_MAX(length));
+          if (grown == NULL) {
+            out[out_length++] = '0';
+            out[out_length++] = '\n';
+            continue;
+          }
+          canonical = grown;
+          canonical_capacity = CANONICAL_MAX(length);
+        }
+        length = canonicalize_url(key, length, canonical);
+        key = canonical;
+      }
+      out[out_length++] = in_bloom(v->bloom, v->num_bits, (byte *)key,
+          length) ? '1' : '0';
+      out[out_length++] = '\n';
+    }
+    read_unlock(r);
+
+    if (!write_all(out_fd, out, out_length)) {
+      break;
+    }
+    memmove(in, in + start, used - start);
+    used -= start;
+  }
+
+  free(in);
+  free(out);
+  free(canonical);
+}
+
+
+/***
+ * Thread entry point for answering clients of the socket one at a time. The
+ * kernel hands each new client to one of the threads waiting in accept.
+ */
+void *serve_socket(void *arg) {
+  struct reader *r = (struct reader *)arg;
+  while (1) {
+    int client = accept(listener, NULL, NULL);
+    if (client < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        perror("Unable to accept a client");
+        struct timespec pause = { 0, 100000000 };
+        nanosleep(&pause, NULL);
+      }
+      continue;
+    }
+    serve(client, client, r);
+    close(client);
+  }
+  return NULL;
+}
+
+
+/***
+ * Thread entry point for answering lookups from standard input, which stops
+ * the server when the input ends.
+ */
+void *serve_stdin(void *arg) {
+  serve(STDIN_FILENO, STDOUT_FILENO, (struct reader *)arg);
+  stop_requested = 1;
+  return NULL;
+}
+
+
+/***
+ * Open the socket clients connect to, replacing any left by a previous run.
+ */
+int open_listener(char *path) {
+  struct sockaddr_un address;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path %s is too long\n", path);
+    exit(EXIT_FAILURE);
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  int fd;
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("Unable to create socket");
+    exit(EXIT_FAILURE);
+  }
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0
+      || listen(fd, SOMAXCONN) != 0) {
+    perror("Unable to listen on socket");
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+
+
+/*******************************************************************************
+ * Reloading
+ ******************************************************************************/
+
+/***
+ * Signal handlers only set flags, which the main thread checks between
+ * sleeps.
+ */
+void handle_reload(int signal) {
+  reload_requested = 1;
+  (void)signal;
+}
+
+void handle_stop(int signal) {
+  stop_requested = 1;
+  (void)signal;
+}
+
+
+/***
+ * Load the filter and delta again if either has changed, or unconditionally
+ * if forced. Return whether a new version needs to be published. If a file
+ * cannot be loaded, such as when it is being written in place, the last good
+ * version is kept until the file changes again.
+ */
+int reload_sources(int force) {
+  int changed = 0;
+  uint8_t num_bits;
+  byte *bloom;
+  if (source_changed(&filter_source) || force) {
+    source_loaded(&filter_source);
+    if ((bloom = load_filter(filter_source.filename, &num_bits)) != NULL) {
+      free(base);
+      base = bloom;
+      base_bits = num_bits;
+      changed = 1;
+    }
+  }
+
+  // Deltas may not have been written yet, or may be removed once a full
+  // filter includes them, so a missing delta is the same as an empty one
+  if (delta_source.filename != NULL
+      && (source_changed(&delta_source) || force)) {
+    source_loaded(&delta_source);
+    if (!delta_source.exists) {
+      changed = changed || delta != NULL;
+      free(delta);
+      delta = NULL;
+    } else if ((bloom = load_filter(delta_source.filename, &num_bits))
+        != NULL) {
+      free(delta);
+      delta = bloom;
+      delta_bits = num_bits;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv, &args);
+  filter_source.filename = args.filter;
+  delta_source.filename = args.delta;
+
+  double start = now_ms();
+  if (!reload_sources(1) || base == NULL || !publish_version()) {
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr, "Loaded version 1 in %.1f ms\n", now_ms() - start);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = handle_reload;
+  sigaction(SIGHUP, &action, NULL);
+  action.sa_handler = handle_stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  // Clients that disconnect early should not stop the server
+  action.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &action, NULL);
+
+  // Only the main thread handles signals, so threads answering lookups are
+  // never interrupted by them
+  sigset_t signals, previous;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGHUP);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+  num_readers = args.socket_path != NULL ? args.threads : 1;
+  if ((readers = (struct reader *)calloc(num_readers, sizeof(struct reader)))
+      == NULL) {
+    perror("Unable to allocate readers");
+    exit(EXIT_FAILURE);
+  }
+  if (args.socket_path != NULL) {
+    listener = open_listener(args.socket_path);
+  }
+  for (int i = 0; i < num_readers; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, args.socket_path != NULL ? serve_socket
+          : serve_stdin, &readers[i]) != 0) {
+      perror("Unable to start thread");
+      exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  // Check for new versions every interval, and right away on SIGHUP
+  double last_check = now_ms();
+  while (!stop_requested) {
+    struct timespec pause = { 0, 10000000 };
+    nanosleep(&pause, NULL);
+    if (!reload_requested && now_ms() - last_check < args.interval_ms) {
+      continue;
+    }
+    int force = reload_requested;
+    reload_requested = 0;
+    last_check = now_ms();
+
+    start = now_ms();
+    if (reload_sources(force)
+        && publish_version()) {
+      fprintf(stderr, "Loaded version %lu in %.1f ms\n",
+          __atomic_load_n(&current, __ATOMIC_SEQ_CST)->number,
+          now_ms() - start);
+    }
+  }
+
+  // Threads answering lookups end with the process
+  if (args.socket_path != NULL) {
+    unlink(args.socket_path);
+  }
+  return EXIT_SUCCESS;
+}
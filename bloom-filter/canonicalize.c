@@ -0,0 +1,441 @@
+/* canonicalize.c
+ *
+ * Port of `URL.canonicalize` from canonicalize.py to C. The behavior of
+ * Python's urllib.parse (urlsplit, parse_qs, and urlencode) is reproduced as
+ * closely as is practical, since the output must match byte-for-byte to hit
+ * in Bloom filters generated by the Python script.
+ */
+
+
+#include <string.h> // memcpy, memcmp
+
+#include "canonicalize.h"
+
+
+
+/*******************************************************************************
+ * Types and constants
+ ******************************************************************************/
+
+typedef struct span_s {
+  const char *p;
+  size_t n;
+} span;
+
+static const char *undesirable_params[] = {
+  "ref",
+  "sms_ss",
+  "gclid",
+  "fbclid",
+  "at_xt",
+  "_r",
+};
+#define NUM_UNDESIRABLE \
+  (sizeof(undesirable_params) / sizeof(undesirable_params[0]))
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+static inline int span_eq(span s, const char *str) {
+  size_t n = strlen(str);
+  return s.n == n && memcmp(s.p, str, n) == 0;
+}
+
+static inline int span_starts(span s, const char *str) {
+  size_t n = strlen(str);
+  return s.n >= n && memcmp(s.p, str, n) == 0;
+}
+
+static inline int span_ends(span s, const char *str) {
+  size_t n = strlen(str);
+  return s.n >= n && memcmp(s.p + s.n - n, str, n) == 0;
+}
+
+static inline int is_alpha(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+
+/***
+ * Return the next byte of s decoded like Python's unquote_plus, advancing
+ * *pos. Invalid percent escapes are passed through literally.
+ */
+static inline char next_decoded(span s, size_t *pos) {
+  char c = s.p[(*pos)++];
+  if (c == '+') {
+    return ' ';
+  }
+  if (c == '%' && *pos + 2 <= s.n) {
+    int hi = hex_value(s.p[*pos]), lo = hex_value(s.p[*pos + 1]);
+    if (hi >= 0 && lo >= 0) {
+      *pos += 2;
+      return (char)((hi << 4) | lo);
+    }
+  }
+  return c;
+}
+
+
+/***
+ * Compare two raw query components by their decoded values.
+ */
+static int decoded_eq(span a, span b) {
+  size_t i = 0, j = 0;
+  while (i < a.n && j < b.n) {
+    if (next_decoded(a, &i) != next_decoded(b, &j)) {
+      return 0;
+    }
+  }
+  return i == a.n && j == b.n;
+}
+
+
+/***
+ * Compare a raw query component, once decoded, to a plain string. If prefix
+ * is set, only check that the decoded component starts with str.
+ */
+static int decoded_is(span a, const char *str, int prefix) {
+  size_t i = 0, j = 0, n = strlen(str);
+  while (i < a.n && j < n) {
+    if (next_decoded(a, &i) != str[j++]) {
+      return 0;
+    }
+  }
+  return j == n && (prefix || i == a.n);
+}
+
+
+/***
+ * Append bytes encoded like Python's quote_plus: letters, digits, and "_.-~"
+ * are kept, spaces become "+", and everything else is percent-encoded. If
+ * decode is set, the input is decoded first.
+ */
+static size_t append_encoded(char *out, span s, int decode) {
+  static const char *hex = "0123456789ABCDEF";
+  size_t n = 0, pos = 0;
+  while (pos < s.n) {
+    unsigned char c = decode ? next_decoded(s, &pos) : s.p[pos++];
+    if (is_alpha(c) || (c >= '0' && c <= '9') || c == '_' || c == '.'
+        || c == '-' || c == '~') {
+      out[n++] = c;
+    } else if (c == ' ') {
+      out[n++] = '+';
+    } else {
+      out[n++] = '%';
+      out[n++] = hex[c >> 4];
+      out[n++] = hex[c & 0xf];
+    }
+  }
+  return n;
+}
+
+
+/***
+ * Find the next name-value pair in a query string like Python's parse_qsl
+ * with keep_blank_values, advancing *pos. Return 0 when there are no more.
+ */
+static int next_param(span query, size_t *pos, span *name, span *value) {
+  while (*pos < query.n) {
+    size_t start = *pos, end = start;
+    while (end < query.n && query.p[end] != '&') {
+      end++;
+    }
+    *pos = end + 1;
+    if (end == start) {
+      continue;
+    }
+
+    const char *eq = memchr(query.p + start, '=', end - start);
+    name->p = query.p + start;
+    if (eq == NULL) {
+      name->n = end - start;
+      value->p = query.p + end;
+      value->n = 0;
+    } else {
+      name->n = eq - name->p;
+      value->p = eq + 1;
+      value->n = query.p + end - value->p;
+    }
+    return 1;
+  }
+  return 0;
+}
+
+
+/***
+ * Split a URL into netloc, path, and query like Python's urlsplit. The scheme
+ * and fragment are discarded.
+ */
+static void split_url(span url, span *netloc, span *path, span *query) {
+  // Drop a scheme made of valid scheme characters that starts with a letter
+  const char *colon = memchr(url.p, ':', url.n);
+  if (colon != NULL && colon > url.p && is_alpha(url.p[0])) {
+    const char *c = url.p;
+    while (c < colon && (is_alpha(*c) || (*c >= '0' && *c <= '9')
+          || *c == '+' || *c == '-' || *c == '.')) {
+      c++;
+    }
+    if (c == colon) {
+      url.n -= colon + 1 - url.p;
+      url.p = colon + 1;
+    }
+  }
+
+  netloc->p = url.p;
+  netloc->n = 0;
+  if (url.n >= 2 && url.p[0] == '/' && url.p[1] == '/') {
+    size_t end = 2;
+    while (end < url.n && url.p[end] != '/' && url.p[end] != '?'
+        && url.p[end] != '#') {
+      end++;
+    }
+    netloc->p = url.p + 2;
+    netloc->n = end - 2;
+    url.p += end;
+    url.n -= end;
+  }
+
+  const char *hash = memchr(url.p, '#', url.n);
+  if (hash != NULL) {
+    url.n = hash - url.p;
+  }
+
+  query->p = url.p + url.n;
+  query->n = 0;
+  const char *question = memchr(url.p, '?', url.n);
+  if (question != NULL) {
+    query->p = question + 1;
+    query->n = url.p + url.n - query->p;
+    url.n = question - url.p;
+  }
+
+  *path = url;
+}
+
+
+/***
+ * Remove every match of the regular expression "/web/[^/]*\/" from path,
+ * compacting the result in-place at dest (which may overlap path as long as
+ * it does not come after it). Return the length of the result.
+ */
+static size_t strip_archive(span path, char *dest) {
+  size_t n = 0, i = 0;
+  while (i < path.n) {
+    if (path.n - i >= 5 && memcmp(path.p + i, "/web/", 5) == 0) {
+      const char *slash = memchr(path.p + i + 5, '/', path.n - i - 5);
+      if (slash != NULL) {
+        i = slash + 1 - path.p;
+        continue;
+      }
+    }
+    dest[n++] = path.p[i++];
+  }
+  return n;
+}
+
+
+/***
+ * Decide whether a parameter is kept. The YouTube rules keep only "v" (or
+ * "list") parameters if one is present, so keep_only is NULL otherwise.
+ */
+static int keep_param(span name, const char *keep_only) {
+  if (keep_only != NULL) {
+    return decoded_is(name, keep_only, 0);
+  }
+  for (size_t i = 0; i < NUM_UNDESIRABLE; i++) {
+    if (decoded_is(name, undesirable_params[i], 0)) {
+      return 0;
+    }
+  }
+  return !decoded_is(name, "utm_", 1);
+}
+
+
+/***
+ * Return 1 if the query has a kept parameter with the same decoded name.
+ */
+static int has_param(span query, const char *name) {
+  size_t pos = 0;
+  span n, v;
+  while (next_param(query, &pos, &n, &v)) {
+    if (decoded_is(n, name, 0)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/***
+ * Append the kept parameters of the query like Python's urlencode of a dict
+ * from parse_qs: parameters are grouped by name in order of each name's first
+ * appearance, and names and values are re-encoded.
+ */
+static size_t append_query(char *out, span query, const char *keep_only) {
+  size_t n = 0, pos = 0;
+  span name, value;
+  while (next_param(query, &pos, &name, &value)) {
+    if (!keep_param(name, keep_only)) {
+      continue;
+    }
+
+    // Skip names that have already been written as part of an earlier group
+    size_t prev_pos = 0;
+    span prev_name, prev_value;
+    int seen = 0;
+    while (!seen && next_param(query, &prev_pos, &prev_name, &prev_value)
+        && prev_name.p < name.p) {
+      seen = decoded_eq(prev_name, name);
+    }
+    if (seen) {
+      continue;
+    }
+
+    // Write every parameter with this name, starting with this one
+    size_t group_pos = name.p - query.p;
+    span group_name, group_value;
+    while (next_param(query, &group_pos, &group_name, &group_value)) {
+      if (!decoded_eq(group_name, name)) {
+        continue;
+      }
+      if (n > 0) {
+        out[n++] = '&';
+      }
+      n += append_encoded(out + n, group_name, 1);
+      out[n++] = '=';
+      n += append_encoded(out + n, group_value, 1);
+    }
+  }
+  return n;
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+/***
+ * The steps are in the same order as `URL.canonicalize` in canonicalize.py.
+ * The order in which the transformations take place is subtly important.
+ */
+size_t canonicalize_url(const char *url, size_t length, char *out) {
+  // Copy the URL into the scratch space at the end of the output buffer,
+  // stripping leading control characters and spaces, and removing tabs and
+  // newlines like urlsplit does
+  char *scratch = out + CANONICAL_MAX(length) - length;
+  size_t start = 0, n = 0;
+  while (start < length && (unsigned char)url[start] <= ' ') {
+    start++;
+  }
+  for (size_t i = start; i < length; i++) {
+    if (url[i] != '\t' && url[i] != '\r' && url[i] != '\n') {
+      scratch[n++] = url[i];
+    }
+  }
+
+  span netloc, path, query;
+  split_url((span){ scratch, n }, &netloc, &path, &query);
+
+  // Use the original URL for archive.org links
+  while (span_eq(netloc, "web.archive.org") && span_starts(path, "/web")) {
+    n = strip_archive(path, scratch);
+    start = 0;
+    while (start < n && (unsigned char)scratch[start] <= ' ') {
+      start++;
+    }
+    split_url((span){ scratch + start, n - start }, &netloc, &path, &query);
+  }
+
+  // HTML files almost exclusively use URL parameters for tracking
+  int clear_query = span_ends(path, ".html");
+
+  // Truncate index.html, index.php, and trailing slashes
+  if (span_ends(path, "index.html")) {
+    path.n -= strlen("index.html");
+  }
+  if (span_ends(path, "index.php")) {
+    path.n -= strlen("index.php");
+  }
+  while (path.n > 0 && path.p[path.n - 1] == '/') {
+    path.n--;
+  }
+
+  // Remove www.
+  if (span_starts(netloc, "www.")) {
+    netloc.p += strlen("www.");
+    netloc.n -= strlen("www.");
+  }
+
+  // Turn youtu.be links into youtube.com ones, where the only parameter left
+  // is "v", set to the path (not decoded, just like in Python)
+  span youtube_id = { NULL, 0 };
+  if (span_eq(netloc, "youtu.be")) {
+    netloc = (span){ "youtube.com", strlen("youtube.com") };
+    youtube_id = path;
+    while (youtube_id.n > 0 && youtube_id.p[0] == '/') {
+      youtube_id.p++;
+      youtube_id.n--;
+    }
+    path = (span){ "/watch", strlen("/watch") };
+  }
+
+  const char *keep_only = NULL;
+  if (!clear_query && youtube_id.p == NULL && span_eq(netloc, "youtube.com")) {
+    if (has_param(query, "v")) {
+      keep_only = "v";
+    } else if (has_param(query, "list")) {
+      keep_only = "list";
+    }
+  }
+
+  // Pretty much all Amazon URL parameters seem to be useless tracking
+  if (span_eq(netloc, "amazon.com")) {
+    clear_query = 1;
+  }
+
+  // Mobile Wikipedia links are annoying
+  if (span_eq(netloc, "en.m.wikipedia.org")) {
+    netloc = (span){ "en.wikipedia.org", strlen("en.wikipedia.org") };
+  }
+
+  // Reassemble like urlunsplit with no scheme or fragment. The netloc and
+  // path may point into the scratch space, but the output never grows past
+  // its start, and always trails behind what is being read.
+  size_t out_n = 0;
+  if (netloc.n > 0) {
+    out[out_n++] = '/';
+    out[out_n++] = '/';
+    memmove(out + out_n, netloc.p, netloc.n);
+    out_n += netloc.n;
+    if (path.n > 0 && path.p[0] != '/') {
+      out[out_n++] = '/';
+    }
+  }
+  memmove(out + out_n, path.p, path.n);
+  out_n += path.n;
+
+  if (youtube_id.p != NULL) {
+    memcpy(out + out_n, "?v=", 3);
+    out_n += 3;
+    out_n += append_encoded(out + out_n, youtube_id, 0);
+  } else if (!clear_query) {
+    size_t query_n = append_query(out + out_n + 1, query, keep_only);
+    if (query_n > 0) {
+      out[out_n] = '?';
+      out_n += 1 + query_n;
+    }
+  }
+
+  return out_n;
+}
@@ -0,0 +1,45 @@
+/* canonicalize.h
+ *
+ * Interface for "canonicalizing" URLs in C, so that native tools can go
+ * straight from raw URLs to Bloom filter keys without canonicalize.py.
+ */
+
+
+#ifndef CANONICALIZE_H
+#define CANONICALIZE_H
+
+
+#include <stddef.h>
+
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+// Number of bytes the output buffer must hold to canonicalize a URL of length
+// bytes. Query strings are percent-encoded again after decoding, so they may
+// grow up to three times in size, and the rest is used as scratch space.
+#define CANONICAL_MAX(length) (4 * (length) + 16)
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Transform a URL to make it as "canonical" as possible, writing the result to
+ * out and returning its length. The input does not need to be NUL-terminated,
+ * and the output is not NUL-terminated. out must hold at least
+ * CANONICAL_MAX(length) bytes.
+ *
+ * NOTE: This *MUST* give the same output as `URL.canonicalize` in
+ * `canonicalize.py`, which is used to generate the Bloom filters. The only
+ * known difference is that invalid UTF-8 in percent-encoded query strings is
+ * passed through rather than replaced with U+FFFD.
+ */
+size_t canonicalize_url(const char *url, size_t length, char *out);
+
+
+#endif /* CANONICALIZE_H */
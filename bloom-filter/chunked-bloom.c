@@ -0,0 +1,340 @@
+/* chunked-bloom.c
+ *
+ * Implementation of chunked containers of compressed Bloom filters, which
+ * are compressed and decompressed one chunk per thread, like pigz.
+ */
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "chunked-bloom.h"
+
+
+
+/*******************************************************************************
+ * Types and structs
+ ******************************************************************************/
+
+// Each thread handles every threads-th chunk, starting from its own id, so no
+// synchronization is needed beyond joining the threads
+struct chunk_job {
+  byte *data;
+  size_t size;
+  byte *bloom;
+  uint8_t num_bits;
+  uint32_t first;
+  uint32_t stride;
+  uint32_t num_chunks;
+  // Compressed chunks and their sizes, when writing
+  byte **compressed;
+  size_t *sizes;
+  // Set to 0 if any chunk fails
+  int success;
+};
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Serialize 32-bit integers in little-endian order regardless of platform.
+ */
+static void write_u32(byte *buf, uint32_t x) {
+  for (int i = 0; i < 4; i++) {
+    buf[i] = (x >> (8 * i)) & 0xff;
+  }
+}
+
+static uint32_t read_u32(byte *buf) {
+  uint32_t x = 0;
+  for (int i = 0; i < 4; i++) {
+    x |= (uint32_t)buf[i] << (8 * i);
+  }
+  return x;
+}
+
+
+/***
+ * Return the size of each chunk as a power of two bytes for a filter of
+ * 2^num_bits bits.
+ */
+static inline uint8_t chunk_bits(uint8_t num_bits) {
+  return num_bits - 3 < CHUNK_BITS ? num_bits - 3 : CHUNK_BITS;
+}
+
+
+/***
+ * Compress one chunk into a newly allocated gzip stream, storing its size, or
+ * return NULL with a size of 0 if no bits are set.
+ */
+static byte *compress_chunk(byte *chunk, size_t size, size_t *compressed_size) {
+  *compressed_size = 0;
+  size_t i = 0;
+  while (i < size && chunk[i] == 0) {
+    i++;
+  }
+  if (i == size) {
+    return NULL;
+  }
+
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  // Add 16 to the window bits for a gzip header, so each chunk can be
+  // inflated with decompress_bloom_into
+  if (deflateInit2(&stream, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)
+      != Z_OK) {
+    exit(EXIT_FAILURE);
+  }
+
+  size_t bound = deflateBound(&stream, size);
+  byte *compressed = (byte *)malloc(bound);
+  if (compressed == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  stream.next_in = (Bytef *)chunk;
+  stream.avail_in = (uInt)size;
+  stream.next_out = (Bytef *)compressed;
+  stream.avail_out = (uInt)bound;
+  if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+    exit(EXIT_FAILURE);
+  }
+  *compressed_size = stream.total_out;
+  (void)deflateEnd(&stream);
+
+  return compressed;
+}
+
+
+/***
+ * Thread entry point for compressing a job's share of the chunks.
+ */
+static void *compress_job(void *arg) {
+  struct chunk_job *job = (struct chunk_job *)arg;
+  size_t size = (size_t)1 << chunk_bits(job->num_bits);
+  for (uint32_t i = job->first; i < job->num_chunks; i += job->stride) {
+    job->compressed[i] = compress_chunk(job->bloom + i * size, size,
+        &job->sizes[i]);
+  }
+  return NULL;
+}
+
+
+/***
+ * Thread entry point for decompressing a job's share of the chunks.
+ */
+static void *decompress_job(void *arg) {
+  struct chunk_job *job = (struct chunk_job *)arg;
+  for (uint32_t i = job->first; job->success && i < job->num_chunks;
+      i += job->stride) {
+    job->success = decompress_chunk(job->data, job->size, job->bloom, i);
+  }
+  return NULL;
+}
+
+
+/***
+ * Run each job on its own thread, and the first on this one. A job whose
+ * thread cannot be started is run on this thread after the first.
+ */
+static void run_jobs(struct chunk_job *jobs, int num_jobs,
+    void *(*run)(void *)) {
+  pthread_t threads[num_jobs];
+  int started[num_jobs];
+  for (int i = 1; i < num_jobs; i++) {
+    started[i] = pthread_create(&threads[i], NULL, run, &jobs[i]) == 0;
+  }
+  run(&jobs[0]);
+  for (int i = 1; i < num_jobs; i++) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      run(&jobs[i]);
+    }
+  }
+}
+
+
+/***
+ * Set up one job per thread, but never more jobs than chunks.
+ */
+static int init_jobs(struct chunk_job *jobs, int threads, byte *data,
+    size_t size, byte *bloom, uint8_t num_bits, uint32_t chunks) {
+  int num_jobs = (uint32_t)threads < chunks ? threads : (int)chunks;
+  (void)memset((void *)jobs, 0, threads * sizeof(struct chunk_job));
+  for (int i = 0; i < num_jobs; i++) {
+    jobs[i].data = data;
+    jobs[i].size = size;
+    jobs[i].bloom = bloom;
+    jobs[i].num_bits = num_bits;
+    jobs[i].first = i;
+    jobs[i].stride = num_jobs;
+    jobs[i].num_chunks = chunks;
+    jobs[i].compressed = NULL;
+    jobs[i].sizes = NULL;
+    jobs[i].success = 1;
+  }
+  return num_jobs;
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+/***
+ * Check the header, and that every chunk lies within the data after the
+ * index.
+ */
+uint8_t chunked_bloom_bits(byte *data, size_t size) {
+  if (size < CHUNKED_HEADER_SIZE || read_u32(data) != CHUNKED_MAGIC
+      || data[4] != CHUNKED_VERSION || data[5] < 3 || data[5] > 31
+      || data[6] != chunk_bits(data[5]) || data[7] != NUM_HASHES) {
+    return 0;
+  }
+  uint32_t chunks = read_u32(data + 8);
+  if (chunks != (uint32_t)1 << (data[5] - 3 - data[6])
+      || CHUNKED_INDEX_SIZE(chunks) > size - CHUNKED_HEADER_SIZE) {
+    return 0;
+  }
+
+  size_t start = CHUNKED_HEADER_SIZE + CHUNKED_INDEX_SIZE(chunks);
+  for (uint32_t i = 0; i < chunks; i++) {
+    byte *entry = data + CHUNKED_HEADER_SIZE + 8 * i;
+    size_t offset = read_u32(entry);
+    size_t length = read_u32(entry + 4);
+    if (length > 0 && (offset < start || offset > size
+          || length > size - offset)) {
+      return 0;
+    }
+  }
+  return data[5];
+}
+
+
+uint32_t num_chunks(byte *data) {
+  return read_u32(data + 8);
+}
+
+
+/***
+ * Bits are numbered from the start of the filter, eight to a byte.
+ */
+uint32_t chunk_of_bit(byte *data, uint32_t index) {
+  return index >> (data[6] + 3);
+}
+
+
+/***
+ * The header, index, and chunks are only written out once every chunk has
+ * been compressed, since the index needs all of their sizes.
+ */
+void write_chunked_bloom(char *filename, byte *bloom, uint8_t num_bits,
+    int threads) {
+  FILE *outfile;
+  if ((outfile = fopen(filename, "wb")) == NULL) {
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t chunks = (uint32_t)1 << (num_bits - 3 - chunk_bits(num_bits));
+  byte **compressed = (byte **)calloc(chunks, sizeof(byte *));
+  size_t *sizes = (size_t *)calloc(chunks, sizeof(size_t));
+  if (compressed == NULL || sizes == NULL) {
+    exit(EXIT_FAILURE);
+  }
+
+  struct chunk_job jobs[threads < 1 ? 1 : threads];
+  int num_jobs = init_jobs(jobs, threads < 1 ? 1 : threads, NULL, 0, bloom,
+      num_bits, chunks);
+  for (int i = 0; i < num_jobs; i++) {
+    jobs[i].compressed = compressed;
+    jobs[i].sizes = sizes;
+  }
+  run_jobs(jobs, num_jobs, compress_job);
+
+  size_t index_size = CHUNKED_INDEX_SIZE(chunks);
+  byte *header = (byte *)calloc(1, CHUNKED_HEADER_SIZE + index_size);
+  if (header == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  write_u32(header, CHUNKED_MAGIC);
+  header[4] = CHUNKED_VERSION;
+  header[5] = num_bits;
+  header[6] = chunk_bits(num_bits);
+  header[7] = NUM_HASHES;
+  write_u32(header + 8, chunks);
+  size_t offset = CHUNKED_HEADER_SIZE + index_size;
+  for (uint32_t i = 0; i < chunks; i++) {
+    write_u32(header + CHUNKED_HEADER_SIZE + 8 * i,
+        sizes[i] == 0 ? 0 : offset);
+    write_u32(header + CHUNKED_HEADER_SIZE + 8 * i + 4, sizes[i]);
+    offset += sizes[i];
+  }
+
+  if (fwrite(header, 1, CHUNKED_HEADER_SIZE + index_size, outfile)
+      != CHUNKED_HEADER_SIZE + index_size) {
+    exit(EXIT_FAILURE);
+  }
+  for (uint32_t i = 0; i < chunks; i++) {
+    if (sizes[i] > 0
+        && fwrite(compressed[i], 1, sizes[i], outfile) != sizes[i]) {
+      exit(EXIT_FAILURE);
+    }
+    free(compressed[i]);
+  }
+
+  free(header);
+  free(compressed);
+  free(sizes);
+  fclose(outfile);
+}
+
+
+/***
+ * Empty chunks are zeroed rather than inflated.
+ */
+int decompress_chunk(byte *data, size_t size, byte *bloom, uint32_t chunk) {
+  size_t chunk_size = (size_t)1 << data[6];
+  byte *entry = data + CHUNKED_HEADER_SIZE + 8 * chunk;
+  size_t offset = read_u32(entry);
+  size_t compressed_size = read_u32(entry + 4);
+  byte *out = bloom + chunk * chunk_size;
+
+  if (compressed_size == 0) {
+    (void)memset((void *)out, 0, chunk_size);
+    return 1;
+  }
+  if (offset > size || compressed_size > size - offset) {
+    return 0;
+  }
+  return decompress_bloom_into(data + offset, compressed_size, out,
+      chunk_size);
+}
+
+
+int decompress_chunked_bloom(byte *data, size_t size, byte *bloom,
+    int threads) {
+  uint8_t num_bits;
+  if ((num_bits = chunked_bloom_bits(data, size)) == 0) {
+    return 0;
+  }
+
+  struct chunk_job jobs[threads < 1 ? 1 : threads];
+  int num_jobs = init_jobs(jobs, threads < 1 ? 1 : threads, data, size, bloom,
+      num_bits, num_chunks(data));
+  run_jobs(jobs, num_jobs, decompress_job);
+
+  int success = 1;
+  for (int i = 0; i < num_jobs; i++) {
+    success = success && jobs[i].success;
+  }
+  return success;
+}
@@ -0,0 +1,95 @@
+/* chunked-bloom.h
+ *
+ * Interface for a chunked container of a compressed Bloom filter: the filter
+ * is split into fixed-size chunks of bytes, each compressed separately behind
+ * an offset table. Unlike one gzip stream, chunks can be compressed and
+ * decompressed on as many threads as there are chunks, and a reader can
+ * inflate only the chunks it needs. The decompressed filter is identical to
+ * the original, so it is used with add_bloom and in_bloom as usual.
+ */
+
+
+#ifndef CHUNKED_BLOOM_H
+#define CHUNKED_BLOOM_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// Chunks hold 2^CHUNK_BITS bytes, so a 16MB filter has 16 chunks of 1MB.
+// Filters smaller than one chunk are stored as a single chunk.
+#define CHUNK_BITS 20
+
+// Bytes "CHNK" followed by a version number begin every serialized filter,
+// then the size of the filter and of each chunk as powers of two (in bits and
+// bytes respectively), NUM_HASHES, and the number of chunks. The header is
+// followed by an index with the offset from the start of the file and the
+// size of each chunk, then the chunks themselves, each of which is a separate
+// gzip stream. Chunks with no bits set have a size of 0.
+#define CHUNKED_MAGIC 0x4b4e4843u
+#define CHUNKED_VERSION 1
+#define CHUNKED_HEADER_SIZE 12
+#define CHUNKED_INDEX_SIZE(num_chunks) (8 * (size_t)(num_chunks))
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Return the size as a power of two of the filter in a chunked container, or
+ * 0 if the data is not a valid chunked container.
+ */
+uint8_t chunked_bloom_bits(byte *data, size_t size);
+
+
+/***
+ * Return the number of chunks in a valid chunked container.
+ */
+uint32_t num_chunks(byte *data);
+
+
+/***
+ * Return the chunk that holds bit index (as computed by add_bloom) in a valid
+ * chunked container.
+ */
+uint32_t chunk_of_bit(byte *data, uint32_t index);
+
+
+/***
+ * Write a filter out as a chunked container, compressing the chunks at level
+ * 9 on the given number of threads. Exit the program with a failure code if
+ * writing fails.
+ */
+void write_chunked_bloom(char *filename, byte *bloom, uint8_t num_bits,
+    int threads);
+
+
+/***
+ * Decompress one chunk of a valid chunked container into its place in bloom,
+ * a buffer of 2^chunked_bloom_bits(data) bits. Returns 0 on failure.
+ */
+int decompress_chunk(byte *data, size_t size, byte *bloom, uint32_t chunk);
+
+
+/***
+ * Decompress a whole chunked container into bloom, a buffer of
+ * 2^chunked_bloom_bits(data) bits, on the given number of threads. If threads
+ * cannot be started (as in WebAssembly built without them), the remaining
+ * chunks are decompressed on the calling thread. Returns 0 if the data is not
+ * a valid chunked container or any chunk fails to decompress.
+ */
+int decompress_chunked_bloom(byte *data, size_t size, byte *bloom,
+    int threads);
+
+
+#endif /* CHUNKED_BLOOM_H */
@@ -0,0 +1,211 @@
+/* counting-bloom.c
+ *
+ * Implementation of counting Bloom filters with 4-bit counters, supporting
+ * adding, removing, checking membership, merging, and conversion to plain Bloom
+ * filters.
+ */
+
+
+#include <stdlib.h>
+
+// Emscripten translates SSE2 intrinsics to wasm SIMD when compiling with
+// -msimd128 -msse2, so this also covers the wasm build in that case
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
+#include "counting-bloom.h"
+#include "murmur.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Get the counter at index i. Counters are stored in the same order as the
+ * bits of a plain Bloom filter, so the even-indexed counter is the high-order
+ * nibble of each byte.
+ */
+static inline uint8_t get_counter(byte *counts, uint32_t i) {
+  return (counts[i >> 1] >> ((~i & 0x1) << 2)) & COUNTER_MAX;
+}
+
+
+/***
+ * Overwrite the counter at index i with value, which must be at most
+ * COUNTER_MAX.
+ */
+static inline void set_counter(byte *counts, uint32_t i, uint8_t value) {
+  uint8_t shift = (~i & 0x1) << 2;
+  counts[i >> 1] = (counts[i >> 1] & ~(COUNTER_MAX << shift)) | (value << shift);
+}
+
+
+/***
+ * Saturating add of each pair of 4-bit counters in two bytes.
+ */
+static inline byte add_counter_pair(byte a, byte b) {
+  uint8_t hi = (a >> 4) + (b >> 4);
+  uint8_t lo = (a & COUNTER_MAX) + (b & COUNTER_MAX);
+  hi = hi > COUNTER_MAX ? COUNTER_MAX : hi;
+  lo = lo > COUNTER_MAX ? COUNTER_MAX : lo;
+  return (hi << 4) | lo;
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+/***
+ * Allocate an empty, zeroed counting Bloom filter of 2^num_bits counters.
+ */
+byte *new_counting_bloom(uint8_t num_bits) {
+  if (num_bits == 0 || num_bits > 31) {
+    return NULL;
+  }
+
+  // Subtracting 1 divides by 2 to account for packing two counters per byte
+  return (byte *)calloc((size_t)1 << (num_bits - 1), sizeof(byte));
+}
+
+
+void free_counting_bloom(byte *counts) {
+  free(counts);
+}
+
+
+/***
+ * A counting filter of 2^num_bits counters is exactly as many bytes as a plain
+ * filter of 2^(num_bits + 2) bits, so reuse the plain filter writer.
+ */
+void write_compressed_counting_bloom(char *filename, byte *counts,
+    uint8_t num_bits) {
+  write_compressed_bloom(filename, counts, num_bits + 2);
+}
+
+
+/***
+ * Increment counters at indices derived from murmur3 hashes exactly like
+ * add_bloom derives bit indices, so that converted filters are compatible.
+ */
+void add_counting_bloom(byte *counts, uint8_t num_bits, byte *data,
+    uint32_t length) {
+  for (int i = 0; i < NUM_HASHES; i++) {
+    uint32_t hash = murmur3(data, length, i);
+    hash >>= 32 - num_bits;
+
+    uint8_t count = get_counter(counts, hash);
+    if (count < COUNTER_MAX) {
+      set_counter(counts, hash, count + 1);
+    }
+  }
+}
+
+
+/***
+ * Check membership before decrementing anything so that removing an element
+ * that is definitely not in the filter does not corrupt other elements.
+ */
+int remove_counting_bloom(byte *counts, uint8_t num_bits, byte *data,
+    uint32_t length) {
+  if (!in_counting_bloom(counts, num_bits, data, length)) {
+    return 0;
+  }
+
+  for (int i = 0; i < NUM_HASHES; i++) {
+    uint32_t hash = murmur3(data, length, i);
+    hash >>= 32 - num_bits;
+
+    // Saturated counters stay saturated since their true value is unknown
+    uint8_t count = get_counter(counts, hash);
+    if (count > 0 && count < COUNTER_MAX) {
+      set_counter(counts, hash, count - 1);
+    }
+  }
+
+  return 1;
+}
+
+
+int in_counting_bloom(byte *counts, uint8_t num_bits, byte *data,
+    uint32_t length) {
+  for (int i = 0; i < NUM_HASHES; i++) {
+    uint32_t hash = murmur3(data, length, i);
+    hash >>= 32 - num_bits;
+
+    // Return early if any counter is zero
+    if (!get_counter(counts, hash)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+/***
+ * Each output byte holds 8 bits corresponding to the 8 counters packed into 4
+ * consecutive bytes of the counting filter.
+ */
+byte *counting_to_bloom(byte *counts, uint8_t num_bits) {
+  if (num_bits < 3) {
+    return NULL;
+  }
+
+  byte *bloom;
+  if ((bloom = new_bloom(num_bits)) == NULL) {
+    return NULL;
+  }
+
+  size_t num_bytes = (size_t)1 << (num_bits - 3);
+  for (size_t i = 0; i < num_bytes; i++) {
+    byte b = 0;
+    for (int j = 0; j < 4; j++) {
+      byte pair = counts[(i << 2) + j];
+      b |= ((pair >> 4) != 0) << (7 - 2 * j);
+      b |= ((pair & COUNTER_MAX) != 0) << (6 - 2 * j);
+    }
+    bloom[i] = b;
+  }
+
+  return bloom;
+}
+
+
+/***
+ * Add the counters 16 bytes (32 counters) at a time where SSE2 is available.
+ * The low and high nibbles are separated into bytes, added with unsigned
+ * saturation, clamped to COUNTER_MAX, and then packed back together.
+ */
+void combine_counting_bloom(byte *counts, byte *new, uint8_t num_bits) {
+  size_t num_bytes = (size_t)1 << (num_bits - 1);
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi8(COUNTER_MAX);
+  for (; i + 16 <= num_bytes; i += 16) {
+    __m128i a = _mm_loadu_si128((__m128i *)(counts + i));
+    __m128i b = _mm_loadu_si128((__m128i *)(new + i));
+
+    __m128i lo = _mm_adds_epu8(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+    lo = _mm_min_epu8(lo, mask);
+
+    // There is no 8-bit shift, but masking after a 16-bit shift is equivalent
+    __m128i hi = _mm_adds_epu8(_mm_and_si128(_mm_srli_epi16(a, 4), mask),
+        _mm_and_si128(_mm_srli_epi16(b, 4), mask));
+    hi = _mm_min_epu8(hi, mask);
+
+    _mm_storeu_si128((__m128i *)(counts + i),
+        _mm_or_si128(_mm_slli_epi16(hi, 4), lo));
+  }
+#endif /* __SSE2__ */
+
+  // Handle small filters and anything left over from the vectorized loop
+  for (; i < num_bytes; i++) {
+    counts[i] = add_counter_pair(counts[i], new[i]);
+  }
+}
@@ -0,0 +1,104 @@
+/* counting-bloom.h
+ *
+ * Interface for a counting Bloom filter with 4-bit counters. Unlike the plain
+ * Bloom filters in bloom.h, elements can be removed, so a filter can be kept
+ * up-to-date incrementally and converted to a plain Bloom filter for shipping.
+ */
+
+
+#ifndef COUNTING_BLOOM_H
+#define COUNTING_BLOOM_H
+
+
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// Counters are 4 bits wide, so they saturate at 15. Saturated counters are
+// "sticky" and are never decremented, since the true count is unknown and
+// decrementing could otherwise cause false negatives.
+#define COUNTER_MAX 0xf
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Allocate a new counting Bloom filter with 2^num_bits counters. Two counters
+ * are packed into each byte, so this allocates 2^(num_bits - 1) bytes.
+ *
+ * NOTE: input num_bits represents a power of 2. Any x not satisfying 0 < x <
+ * 32 will return NULL.
+ */
+byte *new_counting_bloom(uint8_t num_bits);
+
+
+/***
+ * Free an allocated counting Bloom filter.
+ */
+void free_counting_bloom(byte *counts);
+
+
+/***
+ * Write a counting Bloom filter out to a gzip compressed file. It can be read
+ * back in with decompress_bloom from bloom.h.
+ */
+void write_compressed_counting_bloom(char *filename, byte *counts,
+    uint8_t num_bits);
+
+
+/***
+ * Add data to the counting Bloom filter.
+ */
+void add_counting_bloom(byte *counts, uint8_t num_bits, byte *data,
+    uint32_t length);
+
+
+/***
+ * Remove data from the counting Bloom filter. Returns 1 if the data was
+ * (probably) in the filter and has been removed, and 0 if it was definitely not
+ * in the filter, in which case the filter is left unchanged.
+ *
+ * NOTE: Removing data that was never added can cause false negatives for other
+ * elements. Only remove what has been added.
+ */
+int remove_counting_bloom(byte *counts, uint8_t num_bits, byte *data,
+    uint32_t length);
+
+
+/***
+ * Returns an int representing whether data is (probably) in the counting
+ * Bloom filter.
+ */
+int in_counting_bloom(byte *counts, uint8_t num_bits, byte *data,
+    uint32_t length);
+
+
+/***
+ * Allocate and return a plain Bloom filter of 2^num_bits bits with a bit set
+ * for every non-zero counter. The result can be used with every function in
+ * bloom.h, and must be freed with free_bloom.
+ */
+byte *counting_to_bloom(byte *counts, uint8_t num_bits);
+
+
+/***
+ * Combine two counting Bloom filters by adding their counters, saturating at
+ * COUNTER_MAX. Destructively modifies the counts parameter to become the
+ * combined filter.
+ *
+ * Both counts and new *MUST* be the exact same size. Hence, num_bits describes
+ * the size of counts and new.
+ */
+void combine_counting_bloom(byte *counts, byte *new, uint8_t num_bits);
+
+
+#endif /* COUNTING_BLOOM_H */
@@ -0,0 +1,248 @@
+/* cuckoo.c
+ *
+ * Implementation of cuckoo filters with partial-key cuckoo hashing, as
+ * described in "Cuckoo Filter: Practically Better Than Bloom" by Fan et al.
+ * Each fingerprint is stored with a small value so that a single filter can
+ * record which score threshold bucket an element belongs to.
+ */
+
+
+#include <stdlib.h>
+#include <string.h> // memset
+
+#include "cuckoo.h"
+#include "murmur.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Derive the primary bucket index and a non-zero fingerprint from two murmur3
+ * hashes of the data. This is the only hashing done on the data itself.
+ */
+static void cuckoo_hash(cuckoo *filter, byte *data, uint32_t length,
+    uint32_t *index, uint32_t *fingerprint) {
+  *index = murmur3(data, length, 0) >> (32 - filter->num_bits);
+  *fingerprint = murmur3(data, length, 1) >> CUCKOO_VALUE_BITS;
+  if (*fingerprint == 0) {
+    *fingerprint = 1;
+  }
+}
+
+
+/***
+ * The alternate bucket only depends on the current bucket and the fingerprint,
+ * so entries can be moved without knowing the original data. XOR makes this
+ * symmetric: the alternate of the alternate is the original bucket.
+ */
+static inline uint32_t alt_index(cuckoo *filter, uint32_t index,
+    uint32_t fingerprint) {
+  return index ^ ((fingerprint * 0x5bd1e995u) >> (32 - filter->num_bits));
+}
+
+
+/***
+ * Return a pointer to the slot in the bucket holding fingerprint, or NULL.
+ */
+static inline uint32_t *find_slot(cuckoo *filter, uint32_t index,
+    uint32_t fingerprint) {
+  uint32_t *bucket = filter->buckets + index * CUCKOO_SLOTS;
+  for (int i = 0; i < CUCKOO_SLOTS; i++) {
+    if (bucket[i] >> CUCKOO_VALUE_BITS == fingerprint) {
+      return bucket + i;
+    }
+  }
+  return NULL;
+}
+
+
+/***
+ * Store entry in an empty slot of the bucket if there is one. Return 1 if the
+ * entry was stored, and 0 if the bucket is full.
+ */
+static inline int store_slot(cuckoo *filter, uint32_t index, uint32_t entry) {
+  uint32_t *bucket = filter->buckets + index * CUCKOO_SLOTS;
+  for (int i = 0; i < CUCKOO_SLOTS; i++) {
+    if (bucket[i] == 0) {
+      bucket[i] = entry;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/***
+ * Place a packed entry in bucket index or its alternate, evicting existing
+ * entries to their alternate buckets if both are full. If no space is found
+ * after CUCKOO_MAX_KICKS evictions, the last evicted entry becomes the victim.
+ */
+static void place_entry(cuckoo *filter, uint32_t index, uint32_t entry) {
+  uint32_t fingerprint = entry >> CUCKOO_VALUE_BITS;
+  if (store_slot(filter, index, entry)) {
+    return;
+  }
+  index = alt_index(filter, index, fingerprint);
+  if (store_slot(filter, index, entry)) {
+    return;
+  }
+
+  for (int kick = 0; kick < CUCKOO_MAX_KICKS; kick++) {
+    // Evicting a deterministic but varying slot is enough to avoid cycles in
+    // practice without needing a random number generator
+    uint32_t *slot = filter->buckets + index * CUCKOO_SLOTS
+      + ((entry + kick) % CUCKOO_SLOTS);
+    uint32_t evicted = *slot;
+    *slot = entry;
+    entry = evicted;
+
+    index = alt_index(filter, index, entry >> CUCKOO_VALUE_BITS);
+    if (store_slot(filter, index, entry)) {
+      return;
+    }
+  }
+
+  filter->victim = entry;
+  filter->victim_index = index;
+}
+
+
+/***
+ * Return 1 if the victim slot holds fingerprint for either candidate bucket.
+ */
+static inline int victim_matches(cuckoo *filter, uint32_t i1, uint32_t i2,
+    uint32_t fingerprint) {
+  return filter->victim != 0
+    && filter->victim >> CUCKOO_VALUE_BITS == fingerprint
+    && (filter->victim_index == i1 || filter->victim_index == i2);
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+/***
+ * Allocate buckets aligned to a cache line so that no bucket is split across
+ * two lines, meaning a lookup touches at most two cache lines.
+ */
+cuckoo *new_cuckoo(uint8_t num_bits) {
+  if (num_bits == 0 || num_bits > 27) {
+    return NULL;
+  }
+
+  cuckoo *filter;
+  if ((filter = (cuckoo *)malloc(sizeof(cuckoo))) == NULL) {
+    return NULL;
+  }
+
+  size_t num_bytes = ((size_t)1 << num_bits) * CUCKOO_SLOTS * sizeof(uint32_t);
+  if (posix_memalign((void **)&filter->buckets, 64, num_bytes) != 0) {
+    free(filter);
+    return NULL;
+  }
+  (void)memset((void *)filter->buckets, 0, num_bytes);
+
+  filter->num_bits = num_bits;
+  filter->count = 0;
+  filter->victim = 0;
+  filter->victim_index = 0;
+
+  return filter;
+}
+
+
+void free_cuckoo(cuckoo *filter) {
+  if (filter == NULL) {
+    return;
+  }
+  free(filter->buckets);
+  free(filter);
+}
+
+
+/***
+ * Existing entries have their value replaced so that an element whose score
+ * moves between threshold buckets is updated in-place rather than duplicated.
+ */
+int insert_cuckoo(cuckoo *filter, byte *data, uint32_t length, uint8_t value) {
+  uint32_t i1, fingerprint;
+  cuckoo_hash(filter, data, length, &i1, &fingerprint);
+  uint32_t i2 = alt_index(filter, i1, fingerprint);
+  uint32_t entry = (fingerprint << CUCKOO_VALUE_BITS)
+    | (value & CUCKOO_VALUE_MAX);
+
+  uint32_t *slot;
+  if ((slot = find_slot(filter, i1, fingerprint)) != NULL
+      || (slot = find_slot(filter, i2, fingerprint)) != NULL) {
+    *slot = entry;
+    return 1;
+  }
+  if (victim_matches(filter, i1, i2, fingerprint)) {
+    filter->victim = entry;
+    return 1;
+  }
+
+  // If there is already a victim, the table is too full to keep inserting
+  if (filter->victim != 0) {
+    return 0;
+  }
+
+  place_entry(filter, i1, entry);
+  filter->count++;
+
+  return 1;
+}
+
+
+/***
+ * Freeing a slot may make room for the victim, so try to place it again.
+ */
+int delete_cuckoo(cuckoo *filter, byte *data, uint32_t length) {
+  uint32_t i1, fingerprint;
+  cuckoo_hash(filter, data, length, &i1, &fingerprint);
+  uint32_t i2 = alt_index(filter, i1, fingerprint);
+
+  uint32_t *slot;
+  if ((slot = find_slot(filter, i1, fingerprint)) != NULL
+      || (slot = find_slot(filter, i2, fingerprint)) != NULL) {
+    *slot = 0;
+  } else if (victim_matches(filter, i1, i2, fingerprint)) {
+    filter->victim = 0;
+    filter->count--;
+    return 1;
+  } else {
+    return 0;
+  }
+  filter->count--;
+
+  if (filter->victim != 0) {
+    uint32_t victim = filter->victim;
+    filter->victim = 0;
+    place_entry(filter, filter->victim_index, victim);
+  }
+
+  return 1;
+}
+
+
+int lookup_cuckoo(cuckoo *filter, byte *data, uint32_t length) {
+  uint32_t i1, fingerprint;
+  cuckoo_hash(filter, data, length, &i1, &fingerprint);
+  uint32_t i2 = alt_index(filter, i1, fingerprint);
+
+  uint32_t *slot;
+  if ((slot = find_slot(filter, i1, fingerprint)) != NULL
+      || (slot = find_slot(filter, i2, fingerprint)) != NULL) {
+    return *slot & CUCKOO_VALUE_MAX;
+  }
+  if (victim_matches(filter, i1, i2, fingerprint)) {
+    return filter->victim & CUCKOO_VALUE_MAX;
+  }
+
+  return -1;
+}
@@ -0,0 +1,90 @@
+/* cuckoo.h
+ *
+ * Interface for a cuckoo filter storing a small value (such as a score
+ * threshold bucket) alongside each fingerprint. Unlike Bloom filters, elements
+ * can be updated and removed, and each lookup touches at most two buckets.
+ */
+
+
+#ifndef CUCKOO_H
+#define CUCKOO_H
+
+
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// Each bucket holds four 32-bit slots, so a bucket is 16 bytes and never
+// straddles a cache line. Each slot stores a 28-bit fingerprint in the
+// high-order bits and a 4-bit value in the low-order bits. A slot of all zeros
+// is empty, so fingerprints are never zero.
+#define CUCKOO_SLOTS 4
+#define CUCKOO_VALUE_BITS 4
+#define CUCKOO_VALUE_MAX ((1 << CUCKOO_VALUE_BITS) - 1)
+
+// Maximum number of evictions before an insertion gives up. The last evicted
+// entry is kept in the victim slot so that nothing is lost.
+#define CUCKOO_MAX_KICKS 500
+
+typedef struct cuckoo_s {
+  // Number of buckets is 2^num_bits
+  uint8_t num_bits;
+  // Number of entries currently stored, including the victim
+  uint32_t count;
+  // Overflow slot and the bucket index it was evicted from, used when an
+  // insertion runs out of kicks. A victim of 0 means the slot is empty.
+  uint32_t victim;
+  uint32_t victim_index;
+  uint32_t *buckets;
+} cuckoo;
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Allocate a new, empty cuckoo filter with 2^num_bits buckets of CUCKOO_SLOTS
+ * slots each.
+ *
+ * NOTE: Any num_bits not satisfying 0 < x < 28 will return NULL.
+ */
+cuckoo *new_cuckoo(uint8_t num_bits);
+
+
+/***
+ * Free an allocated cuckoo filter.
+ */
+void free_cuckoo(cuckoo *filter);
+
+
+/***
+ * Insert data into the filter with the given value, which must be at most
+ * CUCKOO_VALUE_MAX. If the data is already in the filter, its value is
+ * replaced instead. Returns 1 on success and 0 if the filter is full.
+ */
+int insert_cuckoo(cuckoo *filter, byte *data, uint32_t length, uint8_t value);
+
+
+/***
+ * Remove data from the filter. Returns 1 if it was (probably) in the filter
+ * and has been removed, 0 otherwise.
+ */
+int delete_cuckoo(cuckoo *filter, byte *data, uint32_t length);
+
+
+/***
+ * Return the value stored with data if it is (probably) in the filter, and -1
+ * if it is definitely not in the filter.
+ */
+int lookup_cuckoo(cuckoo *filter, byte *data, uint32_t length);
+
+
+#endif /* CUCKOO_H */
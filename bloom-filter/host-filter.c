@@ -0,0 +1,135 @@
+/* host-filter.c
+ *
+ * Implementation of blocked, host-level Bloom filters placed in front of the
+ * full URL filter.
+ */
+
+
+#include <stdlib.h>
+
+#include "host-filter.h"
+#include "murmur.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Return a pointer to the block a host falls in, and store the hash used to
+ * pick the bits within the block.
+ */
+static inline byte *host_block(byte *hosts, uint8_t num_bits, byte *host,
+    uint32_t length, uint32_t *bits) {
+  uint32_t block = 0;
+  if (num_bits > HOST_BLOCK_BITS) {
+    block = murmur3(host, length, HOST_SEED_BLOCK)
+      >> (32 - (num_bits - HOST_BLOCK_BITS));
+  }
+  *bits = murmur3(host, length, HOST_SEED_BITS);
+  return hosts + ((size_t)block << (HOST_BLOCK_BITS - 3));
+}
+
+
+/***
+ * Return the index of the ith bit for a host within its block. The bits are
+ * found by double hashing the two halves of one hash; an odd step guarantees
+ * that every index is distinct.
+ */
+static inline uint32_t host_bit(uint32_t bits, int i) {
+  uint32_t step = (bits >> 16) | 1;
+  return (bits + i * step) & ((1 << HOST_BLOCK_BITS) - 1);
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+/***
+ * Find the host of a canonical URL like //example.com/path, storing a pointer
+ * to it in host and returning its length. A leading scheme (followed by ://)
+ * is skipped if there is one. The host ends at the first /, ?, or #.
+ */
+uint32_t url_host(byte *url, uint32_t length, byte **host) {
+  uint32_t start = 0;
+  while (start < length && url[start] != ':' && url[start] != '/'
+      && url[start] != '?' && url[start] != '#') {
+    start++;
+  }
+  if (start + 2 < length && url[start] == ':' && url[start + 1] == '/'
+      && url[start + 2] == '/') {
+    start++;
+  } else {
+    start = 0;
+  }
+  if (start + 1 < length && url[start] == '/' && url[start + 1] == '/') {
+    start += 2;
+  }
+
+  uint32_t end = start;
+  while (end < length && url[end] != '/' && url[end] != '?'
+      && url[end] != '#') {
+    end++;
+  }
+
+  *host = url + start;
+  return end - start;
+}
+
+
+/***
+ * Add a host to a host filter of 2^num_bits bits (as allocated by new_bloom).
+ */
+void add_host_filter(byte *hosts, uint8_t num_bits, byte *host,
+    uint32_t length) {
+  uint32_t bits;
+  byte *block = host_block(hosts, num_bits, host, length, &bits);
+  for (int i = 0; i < HOST_HASHES; i++) {
+    uint32_t bit = host_bit(bits, i);
+    block[bit >> 3] |= 1 << (7 - (bit & 0x7));
+  }
+}
+
+
+/***
+ * Returns an int representing whether a host is (probably) in the filter.
+ */
+int in_host_filter(byte *hosts, uint8_t num_bits, byte *host, uint32_t length) {
+  uint32_t bits;
+  byte *block = host_block(hosts, num_bits, host, length, &bits);
+  for (int i = 0; i < HOST_HASHES; i++) {
+    uint32_t bit = host_bit(bits, i);
+    if (!(block[bit >> 3] & (1 << (7 - (bit & 0x7))))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+/***
+ * Add the host of a canonical URL to a host filter.
+ */
+void add_url_host(byte *hosts, uint8_t num_bits, byte *url, uint32_t length) {
+  byte *host;
+  uint32_t host_length = url_host(url, length, &host);
+  add_host_filter(hosts, num_bits, host, host_length);
+}
+
+
+/***
+ * Check a canonical URL against the host filter first, and then against the
+ * URL filter only if its host may have been seen.
+ */
+int in_bloom_with_hosts(byte *hosts, uint8_t host_bits, byte *bloom,
+    uint8_t num_bits, byte *url, uint32_t length) {
+  byte *host;
+  uint32_t host_length = url_host(url, length, &host);
+  if (!in_host_filter(hosts, host_bits, host, host_length)) {
+    return 0;
+  }
+  return in_bloom(bloom, num_bits, url, length);
+}
@@ -0,0 +1,83 @@
+/* host-filter.h
+ *
+ * Interface for a small, host-level Bloom filter that is checked in front of
+ * the full URL filter. Most pages visited are on hosts that have never been
+ * submitted to Hacker News, so most lookups are answered by a single cache
+ * line of the host filter without touching the much larger URL filter.
+ */
+
+
+#ifndef HOST_FILTER_H
+#define HOST_FILTER_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// The host filter is blocked: every bit for a host falls in the same 2^9 bit
+// (64 byte) block, so a lookup touches exactly one cache line. Fewer hashes
+// than NUM_HASHES are used because the filter holds far fewer keys per bit.
+#define HOST_BLOCK_BITS 9
+#ifndef HOST_HASHES
+#define HOST_HASHES 7
+#endif /* HOST_HASHES */
+
+// Seeds for the two hashes of each host, distinct from those used for the
+// bit indices of the URL filter (0 to NUM_HASHES - 1) and from SHARD_SEED
+#define HOST_SEED_BLOCK 0xfffffffeu
+#define HOST_SEED_BITS 0xfffffffdu
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Find the host of a canonical URL like //example.com/path, storing a pointer
+ * to it in host and returning its length. A leading scheme (followed by ://)
+ * is skipped if there is one. The host ends at the first /, ?, or #.
+ */
+uint32_t url_host(byte *url, uint32_t length, byte **host);
+
+
+/***
+ * Add a host to a host filter of 2^num_bits bits (as allocated by new_bloom).
+ *
+ * NOTE: num_bits must be at least HOST_BLOCK_BITS.
+ */
+void add_host_filter(byte *hosts, uint8_t num_bits, byte *host,
+    uint32_t length);
+
+
+/***
+ * Returns an int representing whether a host is (probably) in the filter.
+ */
+int in_host_filter(byte *hosts, uint8_t num_bits, byte *host, uint32_t length);
+
+
+/***
+ * Add the host of a canonical URL to a host filter.
+ */
+void add_url_host(byte *hosts, uint8_t num_bits, byte *url, uint32_t length);
+
+
+/***
+ * Check a canonical URL against the host filter first, and then against the
+ * URL filter only if its host may have been seen. Gives the same answer as
+ * in_bloom on the URL filter alone as long as every URL added to the URL
+ * filter had its host added to the host filter.
+ */
+int in_bloom_with_hosts(byte *hosts, uint8_t host_bits, byte *bloom,
+    uint8_t num_bits, byte *url, uint32_t length);
+
+
+#endif /* HOST_FILTER_H */
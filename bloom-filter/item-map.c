@@ -0,0 +1,368 @@
+/* item-map.c
+ *
+ * Implementation of a compact map from story URL fingerprints to Hacker News
+ * item ids.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "item-map.h"
+#include "murmur.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Serialize integers in little-endian order regardless of platform.
+ */
+static void write_u32(byte *buf, uint32_t x) {
+  for (int i = 0; i < 4; i++) {
+    buf[i] = (x >> (8 * i)) & 0xff;
+  }
+}
+
+static uint32_t read_u32(byte *buf) {
+  uint32_t x = 0;
+  for (int i = 0; i < 4; i++) {
+    x |= (uint32_t)buf[i] << (8 * i);
+  }
+  return x;
+}
+
+
+/***
+ * Read or write a value of the given number of bits (at most 32) starting at
+ * a bit offset into a packed array.
+ */
+static uint32_t read_bits(byte *packed, size_t bit, uint8_t bits) {
+  uint32_t x = 0;
+  for (uint8_t b = 0; b < bits; b++, bit++) {
+    x = (x << 1) | ((packed[bit >> 3] >> (7 - (bit & 7))) & 1);
+  }
+  return x;
+}
+
+static void write_bits(byte *packed, size_t bit, uint8_t bits, uint32_t x) {
+  for (int b = bits - 1; b >= 0; b--, bit++) {
+    if ((x >> b) & 1) {
+      packed[bit >> 3] |= 1 << (7 - (bit & 7));
+    }
+  }
+}
+
+
+/***
+ * Return the number of bits in the codes of all entries. The highest
+ * bucket_bits bits of a fingerprint pick its bucket, and the rest are coded
+ * as the difference d from the previous fingerprint in the bucket (or from
+ * zero): d >> rice_bits one bits, a zero bit, then the low rice_bits bits of
+ * d.
+ */
+static uint64_t code_bits(item_entry *entries, size_t count,
+    uint8_t bucket_bits, uint8_t rice_bits) {
+  uint8_t shift = ITEM_FINGERPRINT_BITS - bucket_bits;
+  uint64_t mask = ((uint64_t)1 << shift) - 1;
+  uint64_t bits = 0, previous = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t value = entries[i].fingerprint & mask;
+    if (i == 0 || (entries[i].fingerprint >> shift)
+        != (entries[i - 1].fingerprint >> shift)) {
+      previous = 0;
+    }
+    bits += ((value - previous) >> rice_bits) + 1 + rice_bits;
+    previous = value;
+  }
+  return bits;
+}
+
+
+/***
+ * Order entries by fingerprint, then with the one to keep first, for qsort.
+ */
+static int compare_entries(const void *a, const void *b) {
+  const item_entry *x = (const item_entry *)a;
+  const item_entry *y = (const item_entry *)b;
+  if (x->fingerprint != y->fingerprint) {
+    return x->fingerprint < y->fingerprint ? -1 : 1;
+  } else if (x->score != y->score) {
+    return x->score > y->score ? -1 : 1;
+  }
+  return (x->id > y->id) - (x->id < y->id);
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+item_map_builder *new_item_map_builder(void) {
+  return (item_map_builder *)calloc(1, sizeof(item_map_builder));
+}
+
+
+void free_item_map_builder(item_map_builder *builder) {
+  if (builder == NULL) {
+    return;
+  }
+  free(builder->entries);
+  free(builder);
+}
+
+
+/***
+ * Two 32-bit murmur3 hashes make up the fingerprint, so that distinct URLs
+ * only collide with probability about 2^-64.
+ */
+uint64_t item_fingerprint(byte *data, uint32_t length) {
+  return ((uint64_t)murmur3(data, length, ITEM_SEED_HIGH) << 32)
+    | murmur3(data, length, ITEM_SEED_LOW);
+}
+
+
+/***
+ * Duplicates are kept until the map is built, when sorting brings them
+ * together.
+ */
+int add_item_map(item_map_builder *builder, byte *data, uint32_t length,
+    uint32_t id, int64_t score) {
+  if (id == 0) {
+    return 0;
+  }
+  if (builder->num_entries == builder->capacity) {
+    size_t capacity = builder->capacity == 0 ? 1 << 12 : 2 * builder->capacity;
+    item_entry *entries = (item_entry *)realloc(builder->entries,
+        capacity * sizeof(item_entry));
+    if (entries == NULL) {
+      return 0;
+    }
+    builder->entries = entries;
+    builder->capacity = capacity;
+  }
+
+  item_entry *entry = &builder->entries[builder->num_entries++];
+  entry->fingerprint = item_fingerprint(data, length)
+    >> (64 - ITEM_FINGERPRINT_BITS);
+  entry->id = id;
+  entry->score = score;
+  return 1;
+}
+
+
+/***
+ * Ids are packed with just enough bits for the largest one. Since the
+ * differences between sorted hashes are close to geometrically distributed,
+ * the best remainder size for the Rice codes is within one of the base two
+ * logarithm of their mean, so both sizes are tried.
+ */
+byte *build_item_map(item_map_builder *builder, size_t *size) {
+  qsort(builder->entries, builder->num_entries, sizeof(item_entry),
+      compare_entries);
+
+  // Keep the first entry for each fingerprint, in place
+  size_t count = 0;
+  uint32_t max_id = 1;
+  for (size_t i = 0; i < builder->num_entries; i++) {
+    if (count == 0 || builder->entries[i].fingerprint
+        != builder->entries[count - 1].fingerprint) {
+      builder->entries[count++] = builder->entries[i];
+      max_id = builder->entries[i].id > max_id ? builder->entries[i].id
+        : max_id;
+    }
+  }
+  builder->num_entries = count;
+  if ((uint64_t)count > UINT32_MAX) {
+    return NULL;
+  }
+
+  uint8_t id_bits = 0;
+  while (id_bits < 32 && (max_id >> id_bits) != 0) {
+    id_bits++;
+  }
+  uint8_t bucket_bits = 0;
+  while (bucket_bits < ITEM_MAP_MAX_BUCKET_BITS
+      && (count >> bucket_bits) > ITEM_MAP_BUCKET_SIZE) {
+    bucket_bits++;
+  }
+  uint8_t rice_bits = 0;
+  uint64_t mean = ((uint64_t)1 << ITEM_FINGERPRINT_BITS) / (count + 1);
+  while (rice_bits < 32 && rice_bits + 1 < ITEM_FINGERPRINT_BITS - bucket_bits
+      && ((uint64_t)2 << rice_bits) <= mean) {
+    rice_bits++;
+  }
+  uint64_t num_code_bits = code_bits(builder->entries, count, bucket_bits,
+      rice_bits);
+  if (rice_bits > 0) {
+    uint64_t smaller = code_bits(builder->entries, count, bucket_bits,
+        rice_bits - 1);
+    if (smaller < num_code_bits) {
+      num_code_bits = smaller;
+      rice_bits--;
+    }
+  }
+  // Directory entries hold bit offsets into the codes as 32-bit integers
+  if (num_code_bits > UINT32_MAX) {
+    return NULL;
+  }
+
+  size_t directory_size = ITEM_MAP_DIRECTORY_SIZE(bucket_bits);
+  size_t ids_size = ITEM_MAP_IDS_SIZE(count, id_bits);
+  *size = ITEM_MAP_HEADER_SIZE + directory_size + ids_size
+    + (num_code_bits + 7) / 8;
+  byte *map = (byte *)calloc(1, *size);
+  if (map == NULL) {
+    return NULL;
+  }
+  write_u32(map, ITEM_MAP_MAGIC);
+  map[4] = ITEM_MAP_VERSION;
+  map[5] = id_bits;
+  map[6] = bucket_bits;
+  map[7] = rice_bits;
+  write_u32(map + 8, (uint32_t)count);
+
+  byte *directory = map + ITEM_MAP_HEADER_SIZE;
+  byte *ids = directory + directory_size;
+  byte *codes = ids + ids_size;
+  uint8_t shift = ITEM_FINGERPRINT_BITS - bucket_bits;
+  uint64_t mask = ((uint64_t)1 << shift) - 1;
+  uint64_t previous = 0;
+  size_t bit = 0, i = 0;
+  for (size_t bucket = 0; bucket <= ((size_t)1 << bucket_bits); bucket++) {
+    write_u32(directory + 8 * bucket, (uint32_t)i);
+    write_u32(directory + 8 * bucket + 4, (uint32_t)bit);
+    for (previous = 0; i < count
+        && (builder->entries[i].fingerprint >> shift) == bucket; i++) {
+      uint64_t value = builder->entries[i].fingerprint & mask;
+      // The one bits of the quotient, then its terminating zero bit
+      for (uint64_t q = (value - previous) >> rice_bits; q > 0; q--, bit++) {
+        codes[bit >> 3] |= 1 << (7 - (bit & 7));
+      }
+      bit++;
+      write_bits(codes, bit, rice_bits,
+          (uint32_t)((value - previous) & (((uint64_t)1 << rice_bits) - 1)));
+      bit += rice_bits;
+      previous = value;
+      write_bits(ids, i * id_bits, id_bits, builder->entries[i].id);
+    }
+  }
+  return map;
+}
+
+
+/***
+ * The map is written uncompressed, since the codes and packed ids leave
+ * almost nothing for gzip to remove.
+ */
+void write_item_map(char *filename, item_map_builder *builder) {
+  size_t size;
+  byte *map;
+  if ((map = build_item_map(builder, &size)) == NULL) {
+    exit(EXIT_FAILURE);
+  }
+
+  FILE *outfile;
+  if ((outfile = fopen(filename, "wb")) == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  if (fwrite(map, 1, size, outfile) != size) {
+    fclose(outfile);
+    exit(EXIT_FAILURE);
+  }
+  if (fclose(outfile) != 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  free(map);
+}
+
+
+/***
+ * The directory must start at the beginning and never go backwards, so that
+ * lookups never decode past the end of the codes or index past the ids.
+ */
+int valid_item_map(byte *map, size_t size) {
+  if (size < ITEM_MAP_HEADER_SIZE || read_u32(map) != ITEM_MAP_MAGIC
+      || map[4] != ITEM_MAP_VERSION || map[5] < 1 || map[5] > 32
+      || map[6] > ITEM_MAP_MAX_BUCKET_BITS
+      || map[7] >= ITEM_FINGERPRINT_BITS - map[6] || map[7] > 32) {
+    return 0;
+  }
+  size_t count = read_u32(map + 8);
+  size_t directory_size = ITEM_MAP_DIRECTORY_SIZE(map[6]);
+  size_t ids_size = ITEM_MAP_IDS_SIZE(count, map[5]);
+  size -= ITEM_MAP_HEADER_SIZE;
+  if (size < directory_size || size - directory_size < ids_size) {
+    return 0;
+  }
+  size -= directory_size + ids_size;
+
+  byte *directory = map + ITEM_MAP_HEADER_SIZE;
+  uint32_t first = 0, bit = 0;
+  if (read_u32(directory) != 0 || read_u32(directory + 4) != 0) {
+    return 0;
+  }
+  for (size_t bucket = 1; bucket <= ((size_t)1 << map[6]); bucket++) {
+    uint32_t next_first = read_u32(directory + 8 * bucket);
+    uint32_t next_bit = read_u32(directory + 8 * bucket + 4);
+    if (next_first < first || next_bit < bit) {
+      return 0;
+    }
+    first = next_first;
+    bit = next_bit;
+  }
+  return first == count && ((size_t)bit + 7) / 8 <= size;
+}
+
+
+uint32_t item_map_count(byte *map) {
+  return read_u32(map + 8);
+}
+
+
+/***
+ * Decode the codes of the fingerprint's bucket in order until reaching it, or
+ * passing where it would be. Decoding stops at the end of the bucket's codes
+ * even if they are corrupt.
+ */
+uint32_t lookup_item_map(byte *map, byte *data, uint32_t length) {
+  uint8_t id_bits = map[5], bucket_bits = map[6], rice_bits = map[7];
+  uint8_t shift = ITEM_FINGERPRINT_BITS - bucket_bits;
+  uint64_t fingerprint = item_fingerprint(data, length)
+    >> (64 - ITEM_FINGERPRINT_BITS);
+  uint64_t remainder = fingerprint & (((uint64_t)1 << shift) - 1);
+
+  byte *directory = map + ITEM_MAP_HEADER_SIZE;
+  byte *ids = directory + ITEM_MAP_DIRECTORY_SIZE(bucket_bits);
+  byte *codes = ids + ITEM_MAP_IDS_SIZE(item_map_count(map), id_bits);
+  size_t bucket = fingerprint >> shift;
+  uint32_t i = read_u32(directory + 8 * bucket);
+  uint32_t end = read_u32(directory + 8 * (bucket + 1));
+  size_t bit = read_u32(directory + 8 * bucket + 4);
+  size_t end_bit = read_u32(directory + 8 * (bucket + 1) + 4);
+
+  uint64_t value = 0;
+  for (; i < end; i++) {
+    uint64_t quotient = 0;
+    while (bit < end_bit && ((codes[bit >> 3] >> (7 - (bit & 7))) & 1)) {
+      quotient++;
+      bit++;
+    }
+    if (bit + 1 + rice_bits > end_bit) {
+      break;
+    }
+    value += quotient << rice_bits | read_bits(codes, bit + 1, rice_bits);
+    bit += 1 + rice_bits;
+
+    if (value == remainder) {
+      return read_bits(ids, (size_t)i * id_bits, id_bits);
+    } else if (value > remainder) {
+      break;
+    }
+  }
+  return 0;
+}
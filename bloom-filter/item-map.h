@@ -0,0 +1,141 @@
+/* item-map.h
+ *
+ * Interface for a compact, static map from a 40-bit fingerprint of each
+ * (canonical) story URL to the id of its Hacker News item, so the discussion
+ * for a page can be found without searching Algolia. Fingerprints are split
+ * into buckets by their highest bits, and the rest of each one is stored as
+ * its Rice-coded difference from the one before it in the same bucket. With
+ * the bit-packed ids, a map takes under 6 bytes per story, and lookups decode
+ * only the few dozen fingerprints in one bucket.
+ */
+
+
+#ifndef ITEM_MAP_H
+#define ITEM_MAP_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// Bytes "HNID" followed by a version number begin every serialized map, then
+// the number of bits in each packed id, the number of bits of a fingerprint
+// that pick its bucket, the number of bits of each Rice code's remainder, and
+// the number of entries. The 16 byte header is followed by a directory of
+// every bucket's first entry and the first bit of its codes, as pairs of
+// little-endian 32-bit integers with one more pair marking the end, then the
+// id of each entry in ascending order of fingerprint, then the codes. Ids and
+// codes are packed starting from the highest-order bit of each byte, like the
+// filters.
+#define ITEM_MAP_MAGIC 0x44494e48u
+#define ITEM_MAP_VERSION 2
+#define ITEM_MAP_HEADER_SIZE 16
+#define ITEM_MAP_DIRECTORY_SIZE(bucket_bits) \
+  (8 * (((size_t)1 << (bucket_bits)) + 1))
+#define ITEM_MAP_IDS_SIZE(num_entries, id_bits) \
+  (((size_t)(num_entries) * (id_bits) + 7) / 8)
+
+// Fingerprints are truncated to 40 bits, which is plenty to tell millions of
+// stories apart: a URL that is not in a map of n stories is only mistaken for
+// one that is with probability n / 2^40
+#define ITEM_FINGERPRINT_BITS 40
+
+// Buckets hold about this many entries, so a lookup decodes about this many
+// codes
+#define ITEM_MAP_BUCKET_SIZE 64
+#define ITEM_MAP_MAX_BUCKET_BITS 24
+
+// Seeds for the two halves of a fingerprint, distinct from the seeds used to
+// index Bloom filters, shards, host filters, and the lookup cache
+#define ITEM_SEED_HIGH 0xfffffffau
+#define ITEM_SEED_LOW 0xfffffff9u
+
+typedef struct item_entry_s {
+  uint64_t fingerprint;
+  uint32_t id;
+  int64_t score;
+} item_entry;
+
+typedef struct item_map_builder_s {
+  item_entry *entries;
+  size_t num_entries;
+  size_t capacity;
+} item_map_builder;
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Allocate a new, empty map builder. Returns NULL on failure.
+ */
+item_map_builder *new_item_map_builder(void);
+
+
+/***
+ * Free an allocated map builder.
+ */
+void free_item_map_builder(item_map_builder *builder);
+
+
+/***
+ * Return the 64-bit fingerprint of data. Maps keep its highest
+ * ITEM_FINGERPRINT_BITS bits.
+ */
+uint64_t item_fingerprint(byte *data, uint32_t length);
+
+
+/***
+ * Add a story to the map. If the same URL is added more than once, the story
+ * with the highest score is kept, and the earliest (lowest id) of those with
+ * the same score. URLs whose truncated fingerprints collide are treated the
+ * same way. Ids must be nonzero. Returns 0 on failure.
+ */
+int add_item_map(item_map_builder *builder, byte *data, uint32_t length,
+    uint32_t id, int64_t score);
+
+
+/***
+ * Serialize the map into a newly allocated buffer, storing its size. Returns
+ * NULL on failure.
+ */
+byte *build_item_map(item_map_builder *builder, size_t *size);
+
+
+/***
+ * Write the serialized map out to a file. Exit the program with a failure code
+ * if writing fails.
+ */
+void write_item_map(char *filename, item_map_builder *builder);
+
+
+/***
+ * Return whether data holds a complete, serialized map.
+ */
+int valid_item_map(byte *map, size_t size);
+
+
+/***
+ * Return the number of entries in a valid map.
+ */
+uint32_t item_map_count(byte *map);
+
+
+/***
+ * Return the id of the story with the given URL in a valid map, or 0 if there
+ * is none. As with a Bloom filter, a URL that is not in the map is very
+ * rarely mistaken for one that is, when their fingerprints collide.
+ */
+uint32_t lookup_item_map(byte *map, byte *data, uint32_t length);
+
+
+#endif /* ITEM_MAP_H */
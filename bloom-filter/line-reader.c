@@ -0,0 +1,238 @@
+/* line-reader.c
+ *
+ * Functions for reading newline-separated input quickly. Regular files are
+ * memory-mapped so lines can be hashed straight out of the page cache, and
+ * other input is read in large blocks. Either way, line boundaries are found
+ * with memchr, which the C library implements with vector instructions.
+ */
+
+
+// NOTE: GNU extensions used for memrchr
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "line-reader.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Read from the stream into the buffer until it holds at least one newline or
+ * the stream ends, growing the buffer if a single line does not fit. Return 0
+ * on error.
+ */
+static int fill_buffer(line_reader *reader) {
+  // Move any partial line left over from the last block to the front
+  size_t remaining = reader->size - reader->consumed;
+  memmove(reader->buffer, reader->buffer + reader->consumed, remaining);
+  reader->size = remaining;
+  reader->consumed = 0;
+
+  size_t searched = 0;
+  while (memchr(reader->buffer + searched, '\n', reader->size - searched)
+      == NULL) {
+    searched = reader->size;
+    if (reader->size == reader->capacity) {
+      char *grown = realloc(reader->buffer, reader->capacity * 2);
+      if (grown == NULL) {
+        return 0;
+      }
+      reader->buffer = grown;
+      reader->capacity *= 2;
+    }
+
+    // gzread takes an int length, so large buffers are filled in pieces
+    size_t want = reader->capacity - reader->size;
+    if (want > INT_MAX / 2) {
+      want = INT_MAX / 2;
+    }
+    int bytes_read = gzread(reader->stream, reader->buffer + reader->size,
+        (unsigned)want);
+    if (bytes_read < 0) {
+      return 0;
+    } else if (bytes_read == 0) {
+      break;
+    }
+    reader->size += bytes_read;
+  }
+
+  return 1;
+}
+
+
+/***
+ * Use a file descriptor as a stream, decompressing it if it is gzipped.
+ */
+static int open_stream(line_reader *reader, int fd) {
+  if ((reader->stream = gzdopen(fd, "rb")) == NULL) {
+    return 0;
+  }
+  gzbuffer(reader->stream, 1 << 20);
+
+  reader->capacity = READER_BLOCK_SIZE;
+  if ((reader->buffer = malloc(reader->capacity)) == NULL) {
+    return 0;
+  }
+  return 1;
+}
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Open a file for reading lines, or standard input if filename is NULL.
+ * Returns NULL on failure.
+ */
+line_reader *open_line_reader(char *filename) {
+  line_reader *reader = calloc(1, sizeof(line_reader));
+  if (reader == NULL) {
+    return NULL;
+  }
+
+  int fd = STDIN_FILENO;
+  if (filename != NULL && (fd = open(filename, O_RDONLY)) == -1) {
+    free(reader);
+    return NULL;
+  }
+
+  // Map regular files unless they are gzipped, which have to be streamed
+  // through zlib. Empty files cannot be mapped, but have no lines anyway.
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+    reader->map_size = info.st_size;
+    if (reader->map_size == 0) {
+      close(fd);
+      return reader;
+    }
+
+    reader->map = mmap(NULL, reader->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (reader->map == MAP_FAILED) {
+      reader->map = NULL;
+    } else if (reader->map_size >= 2 && (unsigned char)reader->map[0] == 0x1f
+        && (unsigned char)reader->map[1] == 0x8b) {
+      munmap(reader->map, reader->map_size);
+      reader->map = NULL;
+    } else {
+      madvise(reader->map, reader->map_size, MADV_SEQUENTIAL);
+      close(fd);
+      return reader;
+    }
+  }
+
+  if (!open_stream(reader, fd)) {
+    close_line_reader(reader);
+    return NULL;
+  }
+  return reader;
+}
+
+
+/***
+ * Close the reader. Lines and blocks previously returned are no longer valid.
+ */
+void close_line_reader(line_reader *reader) {
+  if (reader == NULL) {
+    return;
+  }
+  if (reader->map != NULL) {
+    munmap(reader->map, reader->map_size);
+  }
+  if (reader->stream != NULL) {
+    gzclose(reader->stream);
+  }
+  free(reader->buffer);
+  free(reader);
+}
+
+
+/***
+ * Get the next block of complete lines (the last block may end without a
+ * newline). Return 1 and set start and end if there is a block, and 0 at the
+ * end of the input. The block is only valid until the next call.
+ */
+int next_block(line_reader *reader, char **start, char **end) {
+  if (reader->map != NULL) {
+    size_t remaining = reader->map_size - reader->map_offset;
+    if (remaining == 0) {
+      return 0;
+    }
+
+    // Take roughly one block, extended to the end of the line it stops in
+    char *block = reader->map + reader->map_offset;
+    char *block_end = reader->map + reader->map_size;
+    if (remaining > READER_BLOCK_SIZE) {
+      char *newline = memchr(block + READER_BLOCK_SIZE, '\n',
+          remaining - READER_BLOCK_SIZE);
+      if (newline != NULL) {
+        block_end = newline + 1;
+      }
+    }
+
+    reader->map_offset = block_end - reader->map;
+    *start = block;
+    *end = block_end;
+    return 1;
+  }
+
+  if (reader->stream == NULL || !fill_buffer(reader)
+      || reader->size == 0) {
+    return 0;
+  }
+
+  // Return every complete line, or the final partial line at the end
+  char *last_newline = memrchr(reader->buffer, '\n', reader->size);
+  if (last_newline == NULL) {
+    reader->consumed = reader->size;
+  } else {
+    reader->consumed = last_newline + 1 - reader->buffer;
+  }
+  *start = reader->buffer;
+  *end = reader->buffer + reader->consumed;
+  return 1;
+}
+
+
+/***
+ * Get the next line without its trailing newline or carriage return. Return 1
+ * and set line and length if there is a line, and 0 at the end of the input.
+ * The line is only valid until the next call.
+ */
+int next_line(line_reader *reader, char **line, size_t *length) {
+  if (reader->block == reader->block_end
+      && !next_block(reader, &reader->block, &reader->block_end)) {
+    return 0;
+  }
+  *length = split_line(&reader->block, reader->block_end, line);
+  return 1;
+}
+
+
+/***
+ * Split the first line off of a block, advancing *start past it. Return the
+ * line's length without its trailing newline or carriage return.
+ */
+size_t split_line(char **start, char *end, char **line) {
+  char *newline = memchr(*start, '\n', end - *start);
+  char *line_end = newline == NULL ? end : newline;
+
+  *line = *start;
+  *start = newline == NULL ? end : newline + 1;
+  if (line_end > *line && line_end[-1] == '\r') {
+    line_end--;
+  }
+  return line_end - *line;
+}
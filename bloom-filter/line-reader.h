@@ -0,0 +1,90 @@
+/* line-reader.h
+ *
+ * Interface for reading newline-separated input quickly. Regular files are
+ * memory-mapped and lines are returned as pointers directly into the mapping.
+ * Anything else (such as standard input) is read in large blocks. Gzip
+ * compressed input is detected and decompressed automatically.
+ */
+
+
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+
+#include <stddef.h>
+#include <zlib.h>
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// Size of blocks read from streams, and the approximate size of blocks
+// returned by next_block for memory-mapped files
+#ifndef READER_BLOCK_SIZE
+#define READER_BLOCK_SIZE (1 << 24)
+#endif /* READER_BLOCK_SIZE */
+
+typedef struct line_reader_s {
+  // Memory-mapped regular file, or NULL if reading from a stream
+  char *map;
+  size_t map_size;
+  size_t map_offset;
+
+  // Stream being read in blocks, which zlib passes through unchanged if it is
+  // not gzip compressed
+  gzFile stream;
+  char *buffer;
+  size_t capacity;
+  size_t size;
+  size_t consumed;
+
+  // Remaining lines of the current block, used by next_line
+  char *block;
+  char *block_end;
+} line_reader;
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Open a file for reading lines, or standard input if filename is NULL.
+ * Returns NULL on failure.
+ */
+line_reader *open_line_reader(char *filename);
+
+
+/***
+ * Close the reader. Lines and blocks previously returned are no longer valid.
+ */
+void close_line_reader(line_reader *reader);
+
+
+/***
+ * Get the next block of complete lines (the last block may end without a
+ * newline). Return 1 and set start and end if there is a block, and 0 at the
+ * end of the input. The block is only valid until the next call.
+ */
+int next_block(line_reader *reader, char **start, char **end);
+
+
+/***
+ * Get the next line without its trailing newline or carriage return. Return 1
+ * and set line and length if there is a line, and 0 at the end of the input.
+ * The line is only valid until the next call.
+ */
+int next_line(line_reader *reader, char **line, size_t *length);
+
+
+/***
+ * Split the first line off of a block, advancing *start past it. Return the
+ * line's length without its trailing newline or carriage return.
+ */
+size_t split_line(char **start, char *end, char **line);
+
+
+#endif /* LINE_READER_H */
@@ -0,0 +1,136 @@
+/* lookup-cache.c
+ *
+ * Implementation of an open-addressed cache of recent lookup results with
+ * bounded linear probing and generation-based invalidation.
+ */
+
+
+#include <stdlib.h>
+
+#include "lookup-cache.h"
+#include "murmur.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Return the slot an entry is probed from first. The low-order bits of the
+ * fingerprint come from their own murmur3 hash, so they are evenly spread.
+ */
+static inline uint32_t home_slot(lookup_cache *cache, uint64_t fingerprint) {
+  return (uint32_t)fingerprint & ((1u << cache->num_bits) - 1);
+}
+
+
+/***
+ * Return the entry i slots after the home slot, wrapping around the end.
+ */
+static inline lookup_entry *probe(lookup_cache *cache, uint32_t home, int i) {
+  return cache->entries + ((home + i) & ((1u << cache->num_bits) - 1));
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+lookup_cache *new_lookup_cache(uint8_t num_bits) {
+  if (num_bits == 0 || num_bits >= 28) {
+    return NULL;
+  }
+
+  lookup_cache *cache;
+  if ((cache = (lookup_cache *)malloc(sizeof(lookup_cache))) == NULL) {
+    return NULL;
+  }
+  cache->num_bits = num_bits;
+  cache->generation = 1;
+  if ((cache->entries = (lookup_entry *)calloc(1 << num_bits,
+          sizeof(lookup_entry))) == NULL) {
+    free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+
+void free_lookup_cache(lookup_cache *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  free(cache->entries);
+  free(cache);
+}
+
+
+/***
+ * Two 32-bit murmur3 hashes make up the fingerprint, so that distinct URLs
+ * only collide with probability about 2^-64.
+ */
+uint64_t lookup_fingerprint(byte *data, uint32_t length) {
+  return ((uint64_t)murmur3(data, length, LOOKUP_SEED_HIGH) << 32)
+    | murmur3(data, length, LOOKUP_SEED_LOW);
+}
+
+
+int get_lookup_cache(lookup_cache *cache, uint64_t fingerprint,
+    int32_t *value) {
+  uint32_t home = home_slot(cache, fingerprint);
+  for (int i = 0; i < LOOKUP_CACHE_PROBES; i++) {
+    lookup_entry *entry = probe(cache, home, i);
+    if (entry->generation == cache->generation
+        && entry->fingerprint == fingerprint) {
+      *value = entry->value;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/***
+ * When every probed slot holds another current entry, one of them is evicted,
+ * chosen by the high-order bits of the fingerprint so that no slot is always
+ * the one to go.
+ */
+void put_lookup_cache(lookup_cache *cache, uint64_t fingerprint,
+    int32_t value) {
+  uint32_t home = home_slot(cache, fingerprint);
+  lookup_entry *target = NULL;
+  for (int i = 0; i < LOOKUP_CACHE_PROBES; i++) {
+    lookup_entry *entry = probe(cache, home, i);
+    if (entry->generation != cache->generation) {
+      if (target == NULL) {
+        target = entry;
+      }
+    } else if (entry->fingerprint == fingerprint) {
+      target = entry;
+      break;
+    }
+  }
+  if (target == NULL) {
+    target = probe(cache, home, (fingerprint >> 62) % LOOKUP_CACHE_PROBES);
+  }
+
+  target->fingerprint = fingerprint;
+  target->generation = cache->generation;
+  target->value = value;
+}
+
+
+/***
+ * After 2^32 - 1 invalidations the generation would wrap around to values
+ * that old entries still hold, so the entries are cleared instead.
+ */
+void invalidate_lookup_cache(lookup_cache *cache) {
+  if (++cache->generation == 0) {
+    for (uint32_t i = 0; i < (1u << cache->num_bits); i++) {
+      cache->entries[i].generation = 0;
+    }
+    cache->generation = 1;
+  }
+}
@@ -0,0 +1,97 @@
+/* lookup-cache.h
+ *
+ * Interface for a small, fixed-size cache of recent lookup results, keyed by a
+ * 64-bit fingerprint of each (canonical) URL. Revisiting a page costs one
+ * fingerprint and one probe of the cache, instead of a lookup in every
+ * filter. All entries are invalidated at once by bumping a generation counter
+ * whenever the filters behind the cached results change.
+ */
+
+
+#ifndef LOOKUP_CACHE_H
+#define LOOKUP_CACHE_H
+
+
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// An entry is found within this many slots of its home slot, or not at all.
+// Four 16 byte entries span at most two cache lines.
+#define LOOKUP_CACHE_PROBES 4
+
+// Seeds for the two halves of a fingerprint, distinct from the seeds used to
+// index Bloom filters, shards, and host filters
+#define LOOKUP_SEED_HIGH 0xfffffffcu
+#define LOOKUP_SEED_LOW 0xfffffffbu
+
+typedef struct lookup_entry_s {
+  uint64_t fingerprint;
+  // Entries from an older generation than the cache are empty
+  uint32_t generation;
+  int32_t value;
+} lookup_entry;
+
+typedef struct lookup_cache_s {
+  // Number of entries is 2^num_bits
+  uint8_t num_bits;
+  // Current generation, which is never 0 so that zeroed entries are empty
+  uint32_t generation;
+  lookup_entry *entries;
+} lookup_cache;
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Allocate a new, empty cache with 2^num_bits entries.
+ *
+ * NOTE: Any num_bits not satisfying 0 < x < 28 will return NULL.
+ */
+lookup_cache *new_lookup_cache(uint8_t num_bits);
+
+
+/***
+ * Free an allocated cache.
+ */
+void free_lookup_cache(lookup_cache *cache);
+
+
+/***
+ * Return the 64-bit fingerprint of data used as a cache key.
+ */
+uint64_t lookup_fingerprint(byte *data, uint32_t length);
+
+
+/***
+ * If a result is cached for the fingerprint in the current generation, store
+ * it in *value and return 1. Otherwise return 0.
+ */
+int get_lookup_cache(lookup_cache *cache, uint64_t fingerprint,
+    int32_t *value);
+
+
+/***
+ * Cache a result for the fingerprint, replacing its previous result if there
+ * is one, and otherwise an empty or arbitrary entry near its home slot.
+ */
+void put_lookup_cache(lookup_cache *cache, uint64_t fingerprint,
+    int32_t value);
+
+
+/***
+ * Forget every cached result in constant time by starting a new generation.
+ */
+void invalidate_lookup_cache(lookup_cache *cache);
+
+
+#endif /* LOOKUP_CACHE_H */
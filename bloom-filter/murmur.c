@@ -10,6 +10,8 @@
  */
 
 
+#include <string.h>
+
 #include "murmur.h"
 
 
@@ -23,37 +25,22 @@ uint32_t rotl32(uint32_t x, int8_t r) {
 }
 
 
-
-/*******************************************************************************
- * Library functions
- ******************************************************************************/
-
 /***
- * I wish I could say why any of this worked, but honestly, I have no idea. I
- * copied this from the original version in C++, to which it is nearly
- * identical. I applied common sense where necessary, and am relying on the
- * tests to validate that this is a correct implementation.
+ * The steps of murmur3 shared by hashing all at once and incrementally: mixing
+ * a block into the hash, mixing in the last few bytes, and finalizing.
  */
-uint32_t murmur3(uint8_t *data, uint32_t length, uint32_t seed) {
-  int nblocks = length / 4;
-  uint32_t h1 = seed;
-  uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593;
-  uint32_t *blocks = (uint32_t *)(data + nblocks * 4);
-
-  for (int i = -nblocks; i < 0; i++) {
-    uint32_t k1 = blocks[i];
-
-    k1 *= c1;
-    k1 = rotl32(k1, 15);
-    k1 *= c2;
-
-    h1 ^= k1;
-    h1 = rotl32(h1, 13);
-    h1 = h1 * 5 + 0xe6546b64;
-  }
+static inline uint32_t mix_block(uint32_t h1, uint32_t k1) {
+  k1 *= 0xcc9e2d51;
+  k1 = rotl32(k1, 15);
+  k1 *= 0x1b873593;
+
+  h1 ^= k1;
+  h1 = rotl32(h1, 13);
+  return h1 * 5 + 0xe6546b64;
+}
 
+static inline uint32_t mix_tail(uint32_t h1, uint8_t *tail, uint32_t length) {
   uint32_t k1 = 0;
-  uint8_t *tail = (uint8_t *)(data + nblocks * 4);
   // This switch is implemented with fallthrough in the original version, but I
   // copied some code around to placate the compiler, which was giving me
   // obnoxious warnings
@@ -62,34 +49,84 @@ uint32_t murmur3(uint8_t *data, uint32_t length, uint32_t seed) {
       k1 ^= tail[2] << 16;
       k1 ^= tail[1] << 8;
       k1 ^= tail[0];
-      k1 *= c1;
-      k1 = rotl32(k1, 15);
-      k1 *= c2;
-      h1 ^= k1;
       break;
     case 2:
       k1 ^= tail[1] << 8;
       k1 ^= tail[0];
-      k1 *= c1;
-      k1 = rotl32(k1, 15);
-      k1 *= c2;
-      h1 ^= k1;
       break;
     case 1:
       k1 ^= tail[0];
-      k1 *= c1;
-      k1 = rotl32(k1, 15);
-      k1 *= c2;
-      h1 ^= k1;
       break;
+    default:
+      return h1;
   };
+  k1 *= 0xcc9e2d51;
+  k1 = rotl32(k1, 15);
+  k1 *= 0x1b873593;
+  return h1 ^ k1;
+}
 
+static inline uint32_t finalize(uint32_t h1, uint32_t length) {
   h1 ^= length;
   h1 ^= h1 >> 16;
   h1 *= 0x85ebca6b;
   h1 ^= h1 >> 13;
   h1 *= 0xc2b2ae35;
   h1 ^= h1 >> 16;
-
   return h1;
 }
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+/***
+ * I wish I could say why any of this worked, but honestly, I have no idea. I
+ * copied this from the original version in C++, to which it is nearly
+ * identical. I applied common sense where necessary, and am relying on the
+ * tests to validate that this is a correct implementation.
+ */
+uint32_t murmur3(uint8_t *data, uint32_t length, uint32_t seed) {
+  int nblocks = length / 4;
+  uint32_t h1 = seed;
+  uint32_t *blocks = (uint32_t *)(data + nblocks * 4);
+
+  for (int i = -nblocks; i < 0; i++) {
+    // Keys are often hashed in place from the middle of an input buffer, so
+    // blocks may be unaligned. This compiles to a plain load where that is
+    // allowed.
+    uint32_t k1;
+    memcpy(&k1, blocks + i, sizeof(k1));
+    h1 = mix_block(h1, k1);
+  }
+
+  h1 = mix_tail(h1, data + nblocks * 4, length);
+  return finalize(h1, length);
+}
+
+
+void murmur3_init(murmur3_state *state, uint32_t seed) {
+  state->h1 = seed;
+  state->length = 0;
+}
+
+
+void murmur3_update(murmur3_state *state, uint8_t *data, uint32_t length) {
+  uint32_t h1 = state->h1;
+  for (uint32_t i = 0; i + 4 <= length; i += 4) {
+    uint32_t k1;
+    memcpy(&k1, data + i, sizeof(k1));
+    h1 = mix_block(h1, k1);
+  }
+  state->h1 = h1;
+  state->length += length;
+}
+
+
+uint32_t murmur3_final(const murmur3_state *state, uint8_t *tail,
+    uint32_t tail_length) {
+  return finalize(mix_tail(state->h1, tail, tail_length),
+      state->length + tail_length);
+}
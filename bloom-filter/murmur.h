@@ -15,6 +15,19 @@
 
 
 
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+// A hash computed incrementally, so that many prefixes of the same data can be
+// hashed without starting over for each one
+typedef struct murmur3_state_s {
+  uint32_t h1;
+  uint32_t length;
+} murmur3_state;
+
+
+
 /*******************************************************************************
  * Interface functions
  ******************************************************************************/
@@ -25,4 +38,26 @@
  */
 uint32_t murmur3(uint8_t *data, uint32_t length, uint32_t seed);
 
+
+/***
+ * Start hashing data incrementally with the given seed.
+ */
+void murmur3_init(murmur3_state *state, uint32_t seed);
+
+
+/***
+ * Hash the next length bytes of data, which must be a multiple of 4, since
+ * murmur3 hashes data in blocks of 4 bytes.
+ */
+void murmur3_update(murmur3_state *state, uint8_t *data, uint32_t length);
+
+
+/***
+ * Return the hash of all data hashed so far followed by tail_length (less than
+ * 4) bytes of tail, which is what murmur3 would return for all of it at once.
+ * The state is not changed, so hashing can continue afterward.
+ */
+uint32_t murmur3_final(const murmur3_state *state, uint8_t *tail,
+    uint32_t tail_length);
+
 #endif /* MURMUR_H */
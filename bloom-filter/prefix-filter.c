@@ -0,0 +1,183 @@
+/* prefix-filter.c
+ *
+ * Implementation of blocked Bloom filters of URL path prefixes, probed with
+ * incrementally computed hashes.
+ */
+
+
+#include <stdlib.h>
+
+#include "host-filter.h"
+#include "murmur.h"
+#include "prefix-filter.h"
+
+
+
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+// Both hashes of a URL, advanced together from one prefix to the next. Only
+// whole blocks of 4 bytes are hashed into the states, up to hashed bytes.
+struct prefix_hasher {
+  murmur3_state block;
+  murmur3_state bits;
+  uint32_t hashed;
+};
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Return a pointer to the block with the given hash in a filter.
+ */
+static inline byte *prefix_block(byte *prefixes, uint8_t num_bits,
+    uint32_t hash) {
+  uint32_t block = 0;
+  if (num_bits > PREFIX_BLOCK_BITS) {
+    block = hash >> (32 - (num_bits - PREFIX_BLOCK_BITS));
+  }
+  return prefixes + ((size_t)block << (PREFIX_BLOCK_BITS - 3));
+}
+
+
+/***
+ * Set or check the bits for a prefix within its block, found by double
+ * hashing the two halves of one hash as in host filters.
+ */
+static inline void set_prefix_bits(byte *block, uint32_t bits) {
+  uint32_t step = (bits >> 16) | 1;
+  for (int i = 0; i < PREFIX_HASHES; i++) {
+    uint32_t bit = (bits + i * step) & ((1 << PREFIX_BLOCK_BITS) - 1);
+    block[bit >> 3] |= 1 << (7 - (bit & 0x7));
+  }
+}
+
+static inline int test_prefix_bits(byte *block, uint32_t bits) {
+  uint32_t step = (bits >> 16) | 1;
+  for (int i = 0; i < PREFIX_HASHES; i++) {
+    uint32_t bit = (bits + i * step) & ((1 << PREFIX_BLOCK_BITS) - 1);
+    if (!(block[bit >> 3] & (1 << (7 - (bit & 0x7))))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+static void init_hasher(struct prefix_hasher *h) {
+  murmur3_init(&h->block, PREFIX_SEED_BLOCK);
+  murmur3_init(&h->bits, PREFIX_SEED_BITS);
+  h->hashed = 0;
+}
+
+
+/***
+ * Hash the URL up to end, which is never less than the previous end, and
+ * store both hashes of that prefix. Only the bytes since the previous prefix
+ * are hashed.
+ */
+static inline void hash_prefix(struct prefix_hasher *h, byte *url,
+    uint32_t end, uint32_t *block, uint32_t *bits) {
+  uint32_t whole = end & ~3u;
+  murmur3_update(&h->block, url + h->hashed, whole - h->hashed);
+  murmur3_update(&h->bits, url + h->hashed, whole - h->hashed);
+  h->hashed = whole;
+  *block = murmur3_final(&h->block, url + whole, end - whole);
+  *bits = murmur3_final(&h->bits, url + whole, end - whole);
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+/***
+ * The host ends where url_host finds it ending, and the path ends at the
+ * first ? or #.
+ */
+int url_prefixes(byte *url, uint32_t length, uint32_t *ends) {
+  byte *host;
+  uint32_t host_length = url_host(url, length, &host);
+  uint32_t i = (host - url) + host_length;
+  if (host_length == 0) {
+    return 0;
+  }
+
+  int count = 0;
+  ends[count++] = i;
+  if (i >= length || url[i] != '/') {
+    return count;
+  }
+  for (i++; i < length && url[i] != '?' && url[i] != '#'; i++) {
+    if (url[i] == '/' && i > ends[count - 1] + 1) {
+      if (count == PREFIX_MAX_DEPTH) {
+        return count;
+      }
+      ends[count++] = i;
+    }
+  }
+  if (i > ends[count - 1] + 1 && count < PREFIX_MAX_DEPTH) {
+    ends[count++] = i;
+  }
+  return count;
+}
+
+
+void add_prefix_filter(byte *prefixes, uint8_t num_bits, byte *prefix,
+    uint32_t length) {
+  byte *block = prefix_block(prefixes, num_bits,
+      murmur3(prefix, length, PREFIX_SEED_BLOCK));
+  set_prefix_bits(block, murmur3(prefix, length, PREFIX_SEED_BITS));
+}
+
+
+int in_prefix_filter(byte *prefixes, uint8_t num_bits, byte *prefix,
+    uint32_t length) {
+  byte *block = prefix_block(prefixes, num_bits,
+      murmur3(prefix, length, PREFIX_SEED_BLOCK));
+  return test_prefix_bits(block, murmur3(prefix, length, PREFIX_SEED_BITS));
+}
+
+
+void add_url_prefixes(byte *prefixes, uint8_t num_bits, byte *url,
+    uint32_t length) {
+  uint32_t ends[PREFIX_MAX_DEPTH];
+  int count = url_prefixes(url, length, ends);
+
+  struct prefix_hasher h;
+  init_hasher(&h);
+  for (int i = 0; i < count; i++) {
+    uint32_t block, bits;
+    hash_prefix(&h, url, ends[i], &block, &bits);
+    set_prefix_bits(prefix_block(prefixes, num_bits, block), bits);
+  }
+}
+
+
+/***
+ * A prefix can only be in the filter if all shorter prefixes are, since
+ * stories add all of them, so most pages are answered by the first probe.
+ */
+uint32_t longest_url_prefix(byte *prefixes, uint8_t num_bits, byte *url,
+    uint32_t length) {
+  uint32_t ends[PREFIX_MAX_DEPTH];
+  int count = url_prefixes(url, length, ends);
+
+  struct prefix_hasher h;
+  init_hasher(&h);
+  uint32_t longest = 0;
+  for (int i = 0; i < count; i++) {
+    uint32_t block, bits;
+    hash_prefix(&h, url, ends[i], &block, &bits);
+    if (!test_prefix_bits(prefix_block(prefixes, num_bits, block), bits)) {
+      break;
+    }
+    longest = ends[i];
+  }
+  return longest;
+}
@@ -0,0 +1,98 @@
+/* prefix-filter.h
+ *
+ * Interface for a Bloom filter of the path prefixes of story URLs, which tells
+ * whether any story was submitted from under the same section of a site (such
+ * as a blog or a repository) as a page, even if the page itself never was.
+ * The prefixes of a canonical URL like //example.com/blog/2021/post are
+ * //example.com, //example.com/blog, //example.com/blog/2021, and the whole
+ * path. Every story adds all of its prefixes, so a page's prefixes are probed
+ * from shortest to longest, and probing stops at the first one missing.
+ *
+ * Like host filters, prefix filters are blocked so that each probe touches one
+ * cache line. The hashes of every prefix are computed incrementally, in one
+ * pass over the URL, so probing all of them costs little more than hashing the
+ * URL once.
+ */
+
+
+#ifndef PREFIX_FILTER_H
+#define PREFIX_FILTER_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// Every bit for a prefix falls in the same 2^9 bit (64 byte) block, as in host
+// filters
+#define PREFIX_BLOCK_BITS 9
+#ifndef PREFIX_HASHES
+#define PREFIX_HASHES 7
+#endif /* PREFIX_HASHES */
+
+// Prefixes of a URL beyond this many, counting the host, are left out, since
+// they are rarely shared by more than one story
+#define PREFIX_MAX_DEPTH 8
+
+// Seeds for the two hashes of each prefix, distinct from the seeds used to
+// index Bloom filters, shards, host filters, the lookup cache, and item maps
+#define PREFIX_SEED_BLOCK 0xfffffff8u
+#define PREFIX_SEED_BITS 0xfffffff7u
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Find the prefixes of a canonical URL, storing the length of each in ends,
+ * which must have room for PREFIX_MAX_DEPTH lengths, from shortest to longest.
+ * The first prefix ends after the host, and the rest end before each / in the
+ * path and at the end of the path, before any query or fragment. Returns the
+ * number of prefixes.
+ */
+int url_prefixes(byte *url, uint32_t length, uint32_t *ends);
+
+
+/***
+ * Add one prefix to a prefix filter of 2^num_bits bits (as allocated by
+ * new_bloom).
+ *
+ * NOTE: num_bits must be at least PREFIX_BLOCK_BITS.
+ */
+void add_prefix_filter(byte *prefixes, uint8_t num_bits, byte *prefix,
+    uint32_t length);
+
+
+/***
+ * Returns an int representing whether one prefix is (probably) in the filter.
+ */
+int in_prefix_filter(byte *prefixes, uint8_t num_bits, byte *prefix,
+    uint32_t length);
+
+
+/***
+ * Add every prefix of a canonical URL to a prefix filter.
+ */
+void add_url_prefixes(byte *prefixes, uint8_t num_bits, byte *url,
+    uint32_t length);
+
+
+/***
+ * Return the length of the longest prefix of a canonical URL that is
+ * (probably) in the filter, or 0 if not even its host is. The URL is under a
+ * section of the site with stories if the prefix ends in its path.
+ */
+uint32_t longest_url_prefix(byte *prefixes, uint8_t num_bits, byte *url,
+    uint32_t length);
+
+
+#endif /* PREFIX_FILTER_H */
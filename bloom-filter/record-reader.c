@@ -0,0 +1,727 @@
+/* record-reader.c
+ *
+ * Functions for reading stories from CSV and JSON Lines exports of the Hacker
+ * News dataset. Values point directly into the input where possible, and are
+ * only copied when they contain escapes or span multiple lines.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "line-reader.h"
+#include "record-reader.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Make sure a buffer can hold at least size bytes. Return 0 on failure.
+ */
+static int reserve(char **buffer, size_t *capacity, size_t size) {
+  if (size <= *capacity) {
+    return 1;
+  }
+  size_t new_capacity = *capacity == 0 ? 256 : *capacity;
+  while (new_capacity < size) {
+    new_capacity *= 2;
+  }
+  char *grown = realloc(*buffer, new_capacity);
+  if (grown == NULL) {
+    return 0;
+  }
+  *buffer = grown;
+  *capacity = new_capacity;
+  return 1;
+}
+
+
+/***
+ * Return the index of the field with the given name, or -1 if none match.
+ */
+static int field_index(record_reader *reader, char *name, size_t length) {
+  for (int f = 0; f < NUM_FIELDS; f++) {
+    if (reader->names[f] != NULL && strlen(reader->names[f]) == length
+        && memcmp(reader->names[f], name, length) == 0) {
+      return f;
+    }
+  }
+  return -1;
+}
+
+
+/***
+ * Get the next non-empty line, counting lines as they are read.
+ */
+static int next_nonempty_line(record_reader *reader, char **line,
+    size_t *length) {
+  do {
+    if (!next_line(reader->lines, line, length)) {
+      return 0;
+    }
+    reader->lines_read++;
+  } while (*length == 0 && reader->format != FORMAT_LINES);
+  reader->line_number = reader->lines_read;
+  return 1;
+}
+
+
+/***
+ * Return whether a line has an odd number of quotes, meaning a quoted CSV
+ * field continues onto the next line.
+ */
+static int odd_quotes(char *line, size_t length) {
+  int odd = 0;
+  char *end = line + length;
+  while ((line = memchr(line, '"', end - line)) != NULL) {
+    odd = !odd;
+    line++;
+  }
+  return odd;
+}
+
+
+/***
+ * If a CSV record continues past the end of its first line, join the lines it
+ * spans (with newlines between them) into one buffer. Return 0 if the input
+ * ends in the middle of a quoted field.
+ */
+static int join_lines(record_reader *reader, char **line, size_t *length) {
+  if (!odd_quotes(*line, *length)) {
+    return 1;
+  }
+
+  size_t size = *length;
+  if (!reserve(&reader->joined, &reader->joined_capacity, size)) {
+    return 0;
+  }
+  memcpy(reader->joined, *line, size);
+
+  int odd = 1;
+  char *next;
+  size_t next_length;
+  while (odd) {
+    if (!next_line(reader->lines, &next, &next_length)) {
+      return 0;
+    }
+    reader->lines_read++;
+    if (!reserve(&reader->joined, &reader->joined_capacity,
+          size + 1 + next_length)) {
+      return 0;
+    }
+    reader->joined[size++] = '\n';
+    memcpy(reader->joined + size, next, next_length);
+    size += next_length;
+    odd ^= odd_quotes(next, next_length);
+  }
+
+  *line = reader->joined;
+  *length = size;
+  return 1;
+}
+
+
+/***
+ * Read the CSV field starting at *pos, advancing past it and the comma after
+ * it. Quoted fields without escaped quotes point into the line, and others are
+ * unescaped into scratch space at *scratch_used, which must be able to hold
+ * the whole line. Like Python's csv module, text after a closing quote is kept.
+ * Return 1 if there is a field, 0 at the end of the line, and -1 if a quote is
+ * not closed.
+ */
+static int next_csv_field(record_reader *reader, char *line, size_t length,
+    size_t *pos, size_t *scratch_used, char **value, size_t *value_length) {
+  if (*pos > length) {
+    return 0;
+  }
+
+  char *start = line + *pos, *end = line + length;
+  char *field_end;
+  if (start < end && *start == '"') {
+    char *quote = memchr(start + 1, '"', end - start - 1);
+    if (quote == NULL) {
+      return -1;
+    }
+
+    if (quote + 1 == end || quote[1] == ',') {
+      // Simple quoted field
+      *value = start + 1;
+      *value_length = quote - start - 1;
+      field_end = quote + 1;
+    } else {
+      // Unescape doubled quotes and keep text after the closing quote
+      char *out = reader->scratch + *scratch_used;
+      size_t n = 0;
+      char *c = start + 1;
+      int quoted = 1;
+      while (c < end && (quoted || *c != ',')) {
+        if (quoted && *c == '"') {
+          if (c + 1 < end && c[1] == '"') {
+            out[n++] = '"';
+            c += 2;
+          } else {
+            quoted = 0;
+            c++;
+          }
+        } else {
+          out[n++] = *c++;
+        }
+      }
+      if (quoted) {
+        return -1;
+      }
+      *value = out;
+      *value_length = n;
+      *scratch_used += n;
+      field_end = c;
+    }
+  } else {
+    field_end = memchr(start, ',', end - start);
+    if (field_end == NULL) {
+      field_end = end;
+    }
+    *value = start;
+    *value_length = field_end - start;
+  }
+
+  // Skip the comma, or move past the end if this was the last field
+  *pos = field_end - line + 1;
+  return 1;
+}
+
+
+/***
+ * Find the column of each field from the CSV header row.
+ */
+static int read_csv_header(record_reader *reader) {
+  char *line;
+  size_t length;
+  if (!next_nonempty_line(reader, &line, &length)
+      || !join_lines(reader, &line, &length)
+      || !reserve(&reader->scratch, &reader->scratch_capacity, length)) {
+    return 0;
+  }
+
+  // Skip a UTF-8 byte order mark, which spreadsheet programs like to add
+  if (length >= 3 && memcmp(line, "\xef\xbb\xbf", 3) == 0) {
+    line += 3;
+    length -= 3;
+  }
+
+  size_t pos = 0, scratch_used = 0;
+  char *value;
+  size_t value_length;
+  int status;
+  for (int column = 0; (status = next_csv_field(reader, line, length, &pos,
+          &scratch_used, &value, &value_length)) == 1; column++) {
+    int f = field_index(reader, value, value_length);
+    if (f >= 0 && reader->columns[f] == -1) {
+      reader->columns[f] = column;
+    }
+  }
+
+  return status == 0 && reader->columns[FIELD_URL] != -1;
+}
+
+
+/***
+ * Parse one CSV record, which may span multiple lines.
+ */
+static int parse_csv(record_reader *reader, char *line, size_t length,
+    record *r) {
+  if (!join_lines(reader, &line, &length)
+      || !reserve(&reader->scratch, &reader->scratch_capacity, length)) {
+    return -1;
+  }
+
+  size_t pos = 0, scratch_used = 0;
+  char *value;
+  size_t value_length;
+  int status;
+  for (int column = 0; (status = next_csv_field(reader, line, length, &pos,
+          &scratch_used, &value, &value_length)) == 1; column++) {
+    for (int f = 0; f < NUM_FIELDS; f++) {
+      if (reader->columns[f] == column) {
+        r->fields[f] = value;
+        r->lengths[f] = value_length;
+      }
+    }
+  }
+
+  return status == 0 ? 1 : -1;
+}
+
+
+/***
+ * Skip whitespace in a JSON line.
+ */
+static size_t skip_space(char *line, size_t length, size_t pos) {
+  while (pos < length && (line[pos] == ' ' || line[pos] == '\t'
+        || line[pos] == '\r' || line[pos] == '\n')) {
+    pos++;
+  }
+  return pos;
+}
+
+
+/***
+ * Skip a JSON string starting at the opening quote at *pos, leaving *pos after
+ * the closing quote. Set *escaped if it contains any escapes. Return 0 if the
+ * string is not closed.
+ */
+static int skip_string(char *line, size_t length, size_t *pos, int *escaped) {
+  *escaped = 0;
+  for (size_t i = *pos + 1; i < length; i++) {
+    if (line[i] == '\\') {
+      *escaped = 1;
+      i++;
+    } else if (line[i] == '"') {
+      *pos = i + 1;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/***
+ * Skip a JSON object or array starting at *pos. Return 0 if it is not closed.
+ */
+static int skip_nested(char *line, size_t length, size_t *pos) {
+  int depth = 0, escaped;
+  size_t i = *pos;
+  while (i < length) {
+    char c = line[i];
+    if (c == '"') {
+      if (!skip_string(line, length, &i, &escaped)) {
+        return 0;
+      }
+      continue;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if ((c == '}' || c == ']') && --depth == 0) {
+      *pos = i + 1;
+      return 1;
+    }
+    i++;
+  }
+  return 0;
+}
+
+
+/***
+ * Parse four hexadecimal digits, returning -1 if they are invalid.
+ */
+static long hex4(char *s) {
+  long value = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = s[i];
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      value |= c - 'A' + 10;
+    } else {
+      return -1;
+    }
+  }
+  return value;
+}
+
+
+/***
+ * Unescape the contents of a JSON string (without its quotes) into out, which
+ * must be at least as long as the input. Escaped code points are written as
+ * UTF-8. Return the output length, or -1 if an escape is invalid.
+ */
+static long unescape_json(char *s, size_t length, char *out) {
+  size_t n = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (s[i] != '\\') {
+      out[n++] = s[i];
+      continue;
+    }
+    if (++i >= length) {
+      return -1;
+    }
+    switch (s[i]) {
+      case '"': out[n++] = '"'; break;
+      case '\\': out[n++] = '\\'; break;
+      case '/': out[n++] = '/'; break;
+      case 'b': out[n++] = '\b'; break;
+      case 'f': out[n++] = '\f'; break;
+      case 'n': out[n++] = '\n'; break;
+      case 'r': out[n++] = '\r'; break;
+      case 't': out[n++] = '\t'; break;
+      case 'u': {
+        long code;
+        if (i + 4 >= length || (code = hex4(s + i + 1)) < 0) {
+          return -1;
+        }
+        i += 4;
+
+        // Combine surrogate pairs. Lone surrogates are written as-is.
+        if (code >= 0xd800 && code < 0xdc00 && i + 6 < length
+            && s[i + 1] == '\\' && s[i + 2] == 'u') {
+          long low = hex4(s + i + 3);
+          if (low >= 0xdc00 && low < 0xe000) {
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            i += 6;
+          }
+        }
+
+        // Escapes are at least six bytes, and UTF-8 is at most four, so the
+        // output never gets ahead of the input
+        if (code < 0x80) {
+          out[n++] = code;
+        } else if (code < 0x800) {
+          out[n++] = 0xc0 | (code >> 6);
+          out[n++] = 0x80 | (code & 0x3f);
+        } else if (code < 0x10000) {
+          out[n++] = 0xe0 | (code >> 12);
+          out[n++] = 0x80 | ((code >> 6) & 0x3f);
+          out[n++] = 0x80 | (code & 0x3f);
+        } else {
+          out[n++] = 0xf0 | (code >> 18);
+          out[n++] = 0x80 | ((code >> 12) & 0x3f);
+          out[n++] = 0x80 | ((code >> 6) & 0x3f);
+          out[n++] = 0x80 | (code & 0x3f);
+        }
+        break;
+      }
+      default:
+        return -1;
+    }
+  }
+  return n;
+}
+
+
+/***
+ * Parse one JSON object, keeping the values of the fields being read. Nested
+ * values are skipped, and null values are treated as missing.
+ */
+static int parse_jsonl(record_reader *reader, char *line, size_t length,
+    record *r) {
+  if (!reserve(&reader->scratch, &reader->scratch_capacity, length)) {
+    return -1;
+  }
+  size_t scratch_used = 0;
+
+  size_t pos = skip_space(line, length, 0);
+  if (pos >= length || line[pos] != '{') {
+    return -1;
+  }
+  pos = skip_space(line, length, pos + 1);
+  if (pos < length && line[pos] == '}') {
+    return 1;
+  }
+
+  int escaped;
+  while (1) {
+    // Key
+    if (pos >= length || line[pos] != '"') {
+      return -1;
+    }
+    size_t key_start = pos + 1;
+    if (!skip_string(line, length, &pos, &escaped)) {
+      return -1;
+    }
+    int f = field_index(reader, line + key_start, pos - 1 - key_start);
+    pos = skip_space(line, length, pos);
+    if (pos >= length || line[pos] != ':') {
+      return -1;
+    }
+    pos = skip_space(line, length, pos + 1);
+    if (pos >= length) {
+      return -1;
+    }
+
+    // Value
+    size_t value_start = pos;
+    if (line[pos] == '"') {
+      if (!skip_string(line, length, &pos, &escaped)) {
+        return -1;
+      }
+      if (f >= 0) {
+        char *value = line + value_start + 1;
+        size_t value_length = pos - 1 - value_start - 1;
+        if (escaped) {
+          char *out = reader->scratch + scratch_used;
+          long n = unescape_json(value, value_length, out);
+          if (n < 0) {
+            return -1;
+          }
+          value = out;
+          value_length = n;
+          scratch_used += n;
+        }
+        r->fields[f] = value;
+        r->lengths[f] = value_length;
+      }
+    } else if (line[pos] == '{' || line[pos] == '[') {
+      if (!skip_nested(line, length, &pos)) {
+        return -1;
+      }
+    } else {
+      while (pos < length && line[pos] != ',' && line[pos] != '}'
+          && line[pos] != ' ' && line[pos] != '\t') {
+        pos++;
+      }
+      if (pos == value_start) {
+        return -1;
+      }
+      if (f >= 0) {
+        int is_null = pos - value_start == 4
+          && memcmp(line + value_start, "null", 4) == 0;
+        r->fields[f] = is_null ? NULL : line + value_start;
+        r->lengths[f] = is_null ? 0 : pos - value_start;
+      }
+    }
+
+    pos = skip_space(line, length, pos);
+    if (pos < length && line[pos] == ',') {
+      pos = skip_space(line, length, pos + 1);
+    } else if (pos < length && line[pos] == '}') {
+      return 1;
+    } else {
+      return -1;
+    }
+  }
+}
+
+
+/***
+ * Count days since the Unix epoch for a date in the proleptic Gregorian
+ * calendar. From: http://howardhinnant.github.io/date_algorithms.html
+ */
+static int64_t days_from_civil(int64_t year, int64_t month, int64_t day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t year_of_era = year - era * 400;
+  int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day
+    - 1;
+  int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100
+    + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+
+/***
+ * Find the date for a number of days since the Unix epoch, which is the
+ * inverse of days_from_civil.
+ */
+static void civil_from_days(int64_t days, int64_t *year, int64_t *month,
+    int64_t *day) {
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  int64_t day_of_era = days - era * 146097;
+  int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524
+      - day_of_era / 146096) / 365;
+  int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4
+      - year_of_era / 100);
+  int64_t month_index = (5 * day_of_year + 2) / 153;
+  *day = day_of_year - (153 * month_index + 2) / 5 + 1;
+  *month = month_index < 10 ? month_index + 3 : month_index - 9;
+  *year = year_of_era + era * 400 + (*month <= 2);
+}
+
+
+/***
+ * Parse exactly count digits starting at s, returning -1 if any are missing.
+ */
+static int64_t parse_digits(char *s, char *end, int count) {
+  int64_t value = 0;
+  for (int i = 0; i < count; i++) {
+    if (s + i >= end || s[i] < '0' || s[i] > '9') {
+      return -1;
+    }
+    value = value * 10 + (s[i] - '0');
+  }
+  return value;
+}
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Open a file (or standard input if filename is NULL) to read records with the
+ * given field names, which are ignored for FORMAT_LINES. For CSV, the header
+ * row is read immediately, and it is an error if it has no URL column. Returns
+ * NULL on failure.
+ */
+record_reader *open_record_reader(char *filename, record_format format,
+    char *names[NUM_FIELDS]) {
+  record_reader *reader = calloc(1, sizeof(record_reader));
+  if (reader == NULL) {
+    return NULL;
+  }
+  reader->format = format;
+  for (int f = 0; f < NUM_FIELDS; f++) {
+    reader->names[f] = names[f];
+    reader->columns[f] = -1;
+  }
+
+  if ((reader->lines = open_line_reader(filename)) == NULL
+      || (format == FORMAT_CSV && !read_csv_header(reader))) {
+    close_record_reader(reader);
+    return NULL;
+  }
+  return reader;
+}
+
+
+/***
+ * Close the reader. Records previously returned are no longer valid.
+ */
+void close_record_reader(record_reader *reader) {
+  if (reader == NULL) {
+    return;
+  }
+  close_line_reader(reader->lines);
+  free(reader->joined);
+  free(reader->scratch);
+  free(reader);
+}
+
+
+/***
+ * Read the next record. Return 1 if there is a record, 0 at the end of the
+ * input, and -1 if the record is malformed (in which case it is skipped and
+ * reading can continue).
+ */
+int next_record(record_reader *reader, record *r) {
+  memset(r, 0, sizeof(record));
+
+  char *line;
+  size_t length;
+  if (!next_nonempty_line(reader, &line, &length)) {
+    return 0;
+  }
+
+  switch (reader->format) {
+    case FORMAT_CSV:
+      return parse_csv(reader, line, length, r);
+
+    case FORMAT_JSONL:
+      return parse_jsonl(reader, line, length, r);
+
+    default:
+      r->fields[FIELD_URL] = line;
+      r->lengths[FIELD_URL] = length;
+      return 1;
+  }
+}
+
+
+/***
+ * Scores are parsed the way SQLite casts text to an integer, so fractional
+ * parts are truncated, except that text that is not a number is rejected
+ * rather than read as 0.
+ */
+int parse_score(char *value, size_t length, int64_t *score) {
+  size_t i = 0;
+  while (i < length && (value[i] == ' ' || value[i] == '\t')) {
+    i++;
+  }
+  while (length > i && (value[length - 1] == ' '
+        || value[length - 1] == '\t')) {
+    length--;
+  }
+  int negative = 0;
+  if (i < length && (value[i] == '-' || value[i] == '+')) {
+    negative = value[i] == '-';
+    i++;
+  }
+  size_t digits = i;
+  int64_t result = 0;
+  for (; i < length && value[i] >= '0' && value[i] <= '9'; i++) {
+    result = result * 10 + (value[i] - '0');
+  }
+  if (i == digits) {
+    return 0;
+  }
+  if (i < length && value[i] == '.') {
+    for (i++; i < length && value[i] >= '0' && value[i] <= '9'; i++);
+  }
+  if (i < length) {
+    return 0;
+  }
+  *score = negative ? -result : result;
+  return 1;
+}
+
+
+/***
+ * Parse a time given either in Unix seconds or as a UTC date of the form
+ * "YYYY-MM-DD", optionally followed by "HH:MM[:SS]" and ignored fractional
+ * seconds or time zone suffixes. Return 1 and set *time on success, and 0 if
+ * the value is not a time.
+ */
+int parse_time(char *value, size_t length, int64_t *time) {
+  char *s = value, *end = value + length;
+  while (s < end && (*s == ' ' || *s == '\t')) {
+    s++;
+  }
+  while (end > s && (end[-1] == ' ' || end[-1] == '\t')) {
+    end--;
+  }
+  if (s == end) {
+    return 0;
+  }
+
+  // Dates have a dash after the year, otherwise it should be Unix seconds
+  if (end - s < 5 || s[4] != '-') {
+    return parse_score(s, end - s, time);
+  }
+
+  int64_t year = parse_digits(s, end, 4);
+  int64_t month = s + 7 < end && s[7] == '-' ? parse_digits(s + 5, end, 2) : -1;
+  int64_t day = parse_digits(s + 8, end, 2);
+  if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31) {
+    return 0;
+  }
+  *time = days_from_civil(year, month, day) * 86400;
+
+  s += 10;
+  if (s < end && (*s == 'T' || *s == ' ')) {
+    int64_t hour = parse_digits(s + 1, end, 2);
+    int64_t minute = s + 3 < end && s[3] == ':'
+      ? parse_digits(s + 4, end, 2) : -1;
+    if (hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+      return 0;
+    }
+    *time += hour * 3600 + minute * 60;
+    s += 6;
+    if (s < end && *s == ':') {
+      int64_t second = parse_digits(s + 1, end, 2);
+      if (second < 0 || second > 60) {
+        return 0;
+      }
+      *time += second;
+    }
+  }
+
+  return 1;
+}
+
+
+/***
+ * Write the UTC date of a time in Unix seconds to out as "YYYY-MM-DD" with a
+ * NUL terminator, so out must hold at least 11 bytes. Return the length.
+ */
+size_t format_date(int64_t time, char *out) {
+  int64_t days = time >= 0 ? time / 86400 : -((-time + 86399) / 86400);
+  int64_t year, month, day;
+  civil_from_days(days, &year, &month, &day);
+  return snprintf(out, 11, "%04d-%02d-%02d", (int)year, (int)month, (int)day);
+}
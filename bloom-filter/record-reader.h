@@ -0,0 +1,124 @@
+/* record-reader.h
+ *
+ * Interface for reading the URL, score, and time of each story from a CSV or
+ * JSON Lines export of the Hacker News dataset, so that bloom-create can
+ * generate filters without a separate preprocessing step.
+ */
+
+
+#ifndef RECORD_READER_H
+#define RECORD_READER_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "line-reader.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// Fields read from each record, used to index the arrays below
+#define FIELD_URL 0
+#define FIELD_SCORE 1
+#define FIELD_TIME 2
+#define FIELD_ID 3
+#define NUM_FIELDS 4
+
+typedef enum record_format_e {
+  // Each line is a URL
+  FORMAT_LINES,
+  // Comma-separated values with a header row naming the columns, where fields
+  // may be quoted (and quoted fields may contain commas, escaped quotes, and
+  // newlines)
+  FORMAT_CSV,
+  // One JSON object per line, with fields looked up by key
+  FORMAT_JSONL,
+} record_format;
+
+typedef struct record_s {
+  // Values that are not present (or are JSON null) have a NULL pointer. The
+  // values are not NUL-terminated, and are only valid until the next record.
+  char *fields[NUM_FIELDS];
+  size_t lengths[NUM_FIELDS];
+} record;
+
+typedef struct record_reader_s {
+  line_reader *lines;
+  record_format format;
+  char *names[NUM_FIELDS];
+
+  // Column of each field in CSV input, or -1 if it is not in the header
+  int columns[NUM_FIELDS];
+
+  // Line number where the last record started, for error messages
+  size_t line_number;
+  size_t lines_read;
+
+  // Copy of records that span multiple lines
+  char *joined;
+  size_t joined_capacity;
+
+  // Values that had to be unescaped
+  char *scratch;
+  size_t scratch_capacity;
+} record_reader;
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Open a file (or standard input if filename is NULL) to read records with the
+ * given field names, which are ignored for FORMAT_LINES. For CSV, the header
+ * row is read immediately, and it is an error if it has no URL column. Returns
+ * NULL on failure.
+ */
+record_reader *open_record_reader(char *filename, record_format format,
+    char *names[NUM_FIELDS]);
+
+
+/***
+ * Close the reader. Records previously returned are no longer valid.
+ */
+void close_record_reader(record_reader *reader);
+
+
+/***
+ * Read the next record. Return 1 if there is a record, 0 at the end of the
+ * input, and -1 if the record is malformed (in which case it is skipped and
+ * reading can continue).
+ */
+int next_record(record_reader *reader, record *r);
+
+
+/***
+ * Parse an integer score: surrounding whitespace and a sign are allowed, and a
+ * fractional part is truncated. Return 1 and set *score on success, and 0 if
+ * the value is empty or not a number.
+ */
+int parse_score(char *value, size_t length, int64_t *score);
+
+
+/***
+ * Parse a time given either in Unix seconds or as a UTC date of the form
+ * "YYYY-MM-DD", optionally followed by "HH:MM[:SS]" and ignored fractional
+ * seconds or time zone suffixes. Return 1 and set *time on success, and 0 if
+ * the value is not a time.
+ */
+int parse_time(char *value, size_t length, int64_t *time);
+
+
+/***
+ * Write the UTC date of a time in Unix seconds to out as "YYYY-MM-DD" with a
+ * NUL terminator, so out must hold at least 11 bytes. Return the length.
+ */
+size_t format_date(int64_t time, char *out);
+
+
+#endif /* RECORD_READER_H */
@@ -0,0 +1,293 @@
+/* scalable-bloom.c
+ *
+ * Implementation of scalable Bloom filters built from a chain of plain Bloom
+ * filter layers with geometrically increasing sizes and tightening false
+ * positive rates.
+ */
+
+
+#include <stdlib.h>
+#include <string.h> // memcpy
+#include <zlib.h>
+
+#include "scalable-bloom.h"
+#include "murmur.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Return hash number i of data, computing it only if it has not already been
+ * computed for a previous layer. The seeds match add_bloom and in_bloom.
+ */
+static inline uint32_t shared_hash(uint32_t *hashes, uint8_t *computed,
+    byte *data, uint32_t length, uint8_t i) {
+  while (*computed <= i) {
+    hashes[*computed] = murmur3(data, length, *computed);
+    (*computed)++;
+  }
+  return hashes[i];
+}
+
+
+/***
+ * Check one layer using (and extending) the shared array of hashes.
+ */
+static int in_layer(scalable_bloom *filter, uint8_t layer, uint32_t *hashes,
+    uint8_t *computed, byte *data, uint32_t length) {
+  uint8_t num_bits = scalable_layer_bits(filter, layer);
+  uint8_t num_hashes = scalable_layer_hashes(filter, layer);
+  byte *bloom = filter->layers[layer];
+
+  for (uint8_t i = 0; i < num_hashes; i++) {
+    uint32_t hash = shared_hash(hashes, computed, data, length, i);
+    hash >>= 32 - num_bits;
+    if (!(bloom[hash >> 3] & (1 << (7 - (hash & 0x7))))) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+/***
+ * Serialize 32-bit integers in little-endian order regardless of platform.
+ */
+static void write_u32(byte *buf, uint32_t x) {
+  for (int i = 0; i < 4; i++) {
+    buf[i] = (x >> (8 * i)) & 0xff;
+  }
+}
+
+static uint32_t read_u32(byte *buf) {
+  uint32_t x = 0;
+  for (int i = 0; i < 4; i++) {
+    x |= (uint32_t)buf[i] << (8 * i);
+  }
+  return x;
+}
+
+
+/***
+ * Return 1 if a new layer can be added to the filter.
+ */
+static int can_grow(scalable_bloom *filter) {
+  uint8_t next = filter->num_layers;
+  return next < SCALABLE_MAX_LAYERS
+    && filter->base_bits + next <= 31
+    && filter->base_hashes + next <= SCALABLE_MAX_HASHES;
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+scalable_bloom *new_scalable_bloom(uint8_t base_bits, uint8_t base_hashes) {
+  if (base_bits < 3 || base_bits > 31
+      || base_hashes == 0 || base_hashes > SCALABLE_MAX_HASHES) {
+    return NULL;
+  }
+
+  scalable_bloom *filter;
+  if ((filter = (scalable_bloom *)calloc(1, sizeof(scalable_bloom))) == NULL) {
+    return NULL;
+  }
+  filter->base_bits = base_bits;
+  filter->base_hashes = base_hashes;
+
+  if ((filter->layers[0] = new_bloom(base_bits)) == NULL) {
+    free(filter);
+    return NULL;
+  }
+  filter->num_layers = 1;
+
+  return filter;
+}
+
+
+void free_scalable_bloom(scalable_bloom *filter) {
+  if (filter == NULL) {
+    return;
+  }
+  for (uint8_t i = 0; i < filter->num_layers; i++) {
+    free_bloom(filter->layers[i]);
+  }
+  free(filter);
+}
+
+
+uint8_t scalable_layer_bits(scalable_bloom *filter, uint8_t i) {
+  return filter->base_bits + i;
+}
+
+
+uint8_t scalable_layer_hashes(scalable_bloom *filter, uint8_t i) {
+  return filter->base_hashes + i;
+}
+
+
+/***
+ * A filter of m bits with k hashes has the lowest false positive rate when it
+ * holds n = m ln(2) / k elements, at which point half of its bits are set.
+ */
+uint32_t scalable_layer_capacity(scalable_bloom *filter, uint8_t i) {
+  uint64_t m = (uint64_t)1 << scalable_layer_bits(filter, i);
+  return (uint32_t)(m * 693147u / (1000000u * scalable_layer_hashes(filter, i)));
+}
+
+
+/***
+ * Only the newest layer is ever added to, since the older layers are full.
+ */
+int add_scalable_bloom(scalable_bloom *filter, byte *data, uint32_t length) {
+  uint32_t hashes[SCALABLE_MAX_HASHES];
+  uint8_t computed = 0;
+  int success = 1;
+
+  // Skip elements that are already present so they don't use up capacity
+  for (uint8_t i = 0; i < filter->num_layers; i++) {
+    if (in_layer(filter, i, hashes, &computed, data, length)) {
+      return 1;
+    }
+  }
+
+  uint8_t newest = filter->num_layers - 1;
+  if (filter->count >= scalable_layer_capacity(filter, newest)) {
+    byte *layer;
+    if (can_grow(filter)
+        && (layer = new_bloom(scalable_layer_bits(filter, newest + 1)))
+          != NULL) {
+      filter->layers[++newest] = layer;
+      filter->num_layers++;
+      filter->count = 0;
+    } else {
+      success = 0;
+    }
+  }
+
+  uint8_t num_bits = scalable_layer_bits(filter, newest);
+  uint8_t num_hashes = scalable_layer_hashes(filter, newest);
+  byte *bloom = filter->layers[newest];
+  for (uint8_t i = 0; i < num_hashes; i++) {
+    uint32_t hash = shared_hash(hashes, &computed, data, length, i);
+    hash >>= 32 - num_bits;
+    bloom[hash >> 3] |= 1 << (7 - (hash & 0x7));
+  }
+  filter->count++;
+
+  return success;
+}
+
+
+int in_scalable_bloom(scalable_bloom *filter, byte *data, uint32_t length) {
+  uint32_t hashes[SCALABLE_MAX_HASHES];
+  uint8_t computed = 0;
+
+  for (uint8_t i = 0; i < filter->num_layers; i++) {
+    if (in_layer(filter, i, hashes, &computed, data, length)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/***
+ * The file is a 12 byte header (magic, version, base bits, base hashes, number
+ * of layers, and the newest layer's count) followed by each layer in order.
+ * Exit the program with a failure code if opening or writing the gzip fails,
+ * just like write_compressed_bloom.
+ */
+void write_compressed_scalable_bloom(char *filename, scalable_bloom *filter) {
+  gzFile outfile;
+  if ((outfile = gzopen(filename, "wb9")) == NULL) {
+    exit(EXIT_FAILURE);
+  }
+
+  byte header[12];
+  write_u32(header, SCALABLE_MAGIC);
+  header[4] = SCALABLE_VERSION;
+  header[5] = filter->base_bits;
+  header[6] = filter->base_hashes;
+  header[7] = filter->num_layers;
+  write_u32(header + 8, filter->count);
+  if (gzwrite(outfile, (voidpc)header, sizeof(header)) == 0) {
+    gzclose_w(outfile);
+    exit(EXIT_FAILURE);
+  }
+
+  for (uint8_t i = 0; i < filter->num_layers; i++) {
+    uint32_t num_bytes = (uint32_t)1 << (scalable_layer_bits(filter, i) - 3);
+    if (gzwrite(outfile, (voidpc)filter->layers[i], num_bytes) == 0) {
+      gzclose_w(outfile);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  gzclose_w(outfile);
+}
+
+
+/***
+ * Inflate into a buffer of exactly the size recorded in the gzip trailer, then
+ * validate the header and copy each layer into its own allocation. The layers
+ * must account for every byte after the header.
+ */
+scalable_bloom *decompress_scalable_bloom(byte *compressed, size_t size) {
+  size_t raw_size = decompressed_bloom_size(compressed, size);
+  byte *raw = raw_size >= 12 ? (byte *)malloc(raw_size) : NULL;
+  if (raw == NULL
+      || !decompress_bloom_into(compressed, size, raw, raw_size)) {
+    free(raw);
+    return NULL;
+  }
+
+  uint8_t num_layers = raw[7];
+  scalable_bloom *filter;
+  if (read_u32(raw) != SCALABLE_MAGIC || raw[4] != SCALABLE_VERSION
+      || num_layers == 0 || num_layers > SCALABLE_MAX_LAYERS
+      || raw[5] + num_layers - 1 > 31
+      || raw[6] + num_layers - 1 > SCALABLE_MAX_HASHES
+      || (filter = new_scalable_bloom(raw[5], raw[6])) == NULL) {
+    free(raw);
+    return NULL;
+  }
+  filter->count = read_u32(raw + 8);
+
+  size_t expected = 12;
+  for (uint8_t i = 0; i < num_layers; i++) {
+    expected += (size_t)1 << (scalable_layer_bits(filter, i) - 3);
+  }
+  if (expected != raw_size) {
+    free_scalable_bloom(filter);
+    free(raw);
+    return NULL;
+  }
+
+  size_t offset = 12;
+  for (uint8_t i = 0; i < num_layers; i++) {
+    size_t num_bytes = (size_t)1 << (scalable_layer_bits(filter, i) - 3);
+    if (i > 0 && (filter->layers[i] = new_bloom(
+            scalable_layer_bits(filter, i))) == NULL) {
+      free_scalable_bloom(filter);
+      free(raw);
+      return NULL;
+    }
+    if (i > 0) {
+      filter->num_layers++;
+    }
+    (void)memcpy((void *)filter->layers[i], (void *)(raw + offset), num_bytes);
+    offset += num_bytes;
+  }
+
+  free(raw);
+
+  return filter;
+}
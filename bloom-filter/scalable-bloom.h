@@ -0,0 +1,121 @@
+/* scalable-bloom.h
+ *
+ * Interface for a scalable Bloom filter: a chain of plain Bloom filter layers
+ * that grows as elements are added, instead of being sized for a fixed number
+ * of elements up-front. Based on "Scalable Bloom Filters" by Almeida et al.
+ */
+
+
+#ifndef SCALABLE_BLOOM_H
+#define SCALABLE_BLOOM_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// Each layer has twice as many bits as the one before it, and uses one more
+// hash, which halves its false positive rate when full. The overall false
+// positive rate is therefore bounded by twice that of the first layer, no
+// matter how many layers are added.
+//
+// Layers take their bit indices from the same murmur3 hashes (seeded by hash
+// number) as add_bloom, so the hashes for a key are only computed once and
+// shared by every layer.
+#define SCALABLE_MAX_HASHES 32
+#define SCALABLE_MAX_LAYERS 16
+
+// Bytes "SBLM" followed by a version number begin every serialized filter
+#define SCALABLE_MAGIC 0x4d4c4253u
+#define SCALABLE_VERSION 1
+
+typedef struct scalable_bloom_s {
+  // Size of the first layer in bits is 2^base_bits
+  uint8_t base_bits;
+  // Number of hashes used by the first layer
+  uint8_t base_hashes;
+  uint8_t num_layers;
+  // Number of elements added to the newest layer
+  uint32_t count;
+  byte *layers[SCALABLE_MAX_LAYERS];
+} scalable_bloom;
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Allocate a new scalable Bloom filter with a single layer of 2^base_bits
+ * bits using base_hashes hashes. Using NUM_HASHES hashes with 27 base bits
+ * matches the plain filters for the first ~4 million elements.
+ *
+ * NOTE: Returns NULL unless 3 <= base_bits < 32 and
+ * 0 < base_hashes <= SCALABLE_MAX_HASHES.
+ */
+scalable_bloom *new_scalable_bloom(uint8_t base_bits, uint8_t base_hashes);
+
+
+/***
+ * Free an allocated scalable Bloom filter and all of its layers.
+ */
+void free_scalable_bloom(scalable_bloom *filter);
+
+
+/***
+ * Return the number of bits in layer i.
+ */
+uint8_t scalable_layer_bits(scalable_bloom *filter, uint8_t i);
+
+
+/***
+ * Return the number of hashes used by layer i.
+ */
+uint8_t scalable_layer_hashes(scalable_bloom *filter, uint8_t i);
+
+
+/***
+ * Return the number of elements layer i holds before a new layer is added.
+ */
+uint32_t scalable_layer_capacity(scalable_bloom *filter, uint8_t i);
+
+
+/***
+ * Add data to the filter, adding a new layer first if the newest one is full.
+ * Elements already (probably) in the filter are not added again. Returns 1 on
+ * success, or 0 if the filter could not grow, in which case data is added to
+ * the last layer anyway at the cost of a higher false positive rate.
+ */
+int add_scalable_bloom(scalable_bloom *filter, byte *data, uint32_t length);
+
+
+/***
+ * Returns an int representing whether data is (probably) in any layer.
+ */
+int in_scalable_bloom(scalable_bloom *filter, byte *data, uint32_t length);
+
+
+/***
+ * Write the filter, including all layers, out to a single gzip compressed
+ * file.
+ */
+void write_compressed_scalable_bloom(char *filename, scalable_bloom *filter);
+
+
+/***
+ * Decompress a filter written by write_compressed_scalable_bloom. Returns NULL
+ * if the data is not a valid scalable Bloom filter. The result must be freed
+ * with free_scalable_bloom.
+ */
+scalable_bloom *decompress_scalable_bloom(byte *compressed, size_t size);
+
+
+#endif /* SCALABLE_BLOOM_H */
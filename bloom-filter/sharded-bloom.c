@@ -0,0 +1,289 @@
+/* sharded-bloom.c
+ *
+ * Implementation of sharded Bloom filters, which are split by the top bits of
+ * a hash into separately compressed shards that are decompressed on demand.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "sharded-bloom.h"
+#include "murmur.h"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Serialize 32-bit integers in little-endian order regardless of platform.
+ */
+static void write_u32(byte *buf, uint32_t x) {
+  for (int i = 0; i < 4; i++) {
+    buf[i] = (x >> (8 * i)) & 0xff;
+  }
+}
+
+static uint32_t read_u32(byte *buf) {
+  uint32_t x = 0;
+  for (int i = 0; i < 4; i++) {
+    x |= (uint32_t)buf[i] << (8 * i);
+  }
+  return x;
+}
+
+
+/***
+ * Allocate and free memory from a region, or from the heap if it is NULL.
+ */
+static void *shard_alloc(region *memory, size_t size) {
+  return memory == NULL ? malloc(size) : region_alloc(memory, size);
+}
+
+static void shard_free(region *memory, void *p) {
+  if (memory == NULL) {
+    free(p);
+  } else {
+    region_free(memory, p);
+  }
+}
+
+
+/***
+ * Return the size of each shard in bytes.
+ */
+static inline size_t shard_size(uint8_t num_bits) {
+  return (size_t)1 << (num_bits - SHARD_BITS - 3);
+}
+
+
+/***
+ * Compress one shard into a newly allocated gzip stream, storing its size, or
+ * return NULL with a size of 0 if no bits are set.
+ */
+static byte *compress_shard(byte *shard, size_t size, size_t *compressed_size) {
+  *compressed_size = 0;
+  size_t i = 0;
+  while (i < size && shard[i] == 0) {
+    i++;
+  }
+  if (i == size) {
+    return NULL;
+  }
+
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  // Add 16 to the window bits for a gzip header, so each shard can be
+  // inflated with decompress_bloom_into
+  if (deflateInit2(&stream, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)
+      != Z_OK) {
+    exit(EXIT_FAILURE);
+  }
+
+  size_t bound = deflateBound(&stream, size);
+  byte *compressed = (byte *)malloc(bound);
+  if (compressed == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  stream.next_in = (Bytef *)shard;
+  stream.avail_in = (uInt)size;
+  stream.next_out = (Bytef *)compressed;
+  stream.avail_out = (uInt)bound;
+  if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+    exit(EXIT_FAILURE);
+  }
+  *compressed_size = stream.total_out;
+  (void)deflateEnd(&stream);
+
+  return compressed;
+}
+
+
+
+/*******************************************************************************
+ * Library functions
+ ******************************************************************************/
+
+/***
+ * Return the shard that a key is stored in.
+ */
+uint8_t shard_index(byte *data, uint32_t length) {
+  return murmur3(data, length, SHARD_SEED) >> (32 - SHARD_BITS);
+}
+
+
+/***
+ * Add data to a whole, uncompressed sharded filter of 2^num_bits bits (as
+ * allocated by new_bloom), in which each shard is a contiguous block.
+ */
+void add_sharded_bloom(byte *bloom, uint8_t num_bits, byte *data,
+    uint32_t length) {
+  byte *shard = bloom + shard_index(data, length) * shard_size(num_bits);
+  add_bloom(shard, num_bits - SHARD_BITS, data, length);
+}
+
+
+/***
+ * Write a whole sharded filter out with each shard compressed separately.
+ */
+void write_sharded_bloom(char *filename, byte *bloom, uint8_t num_bits) {
+  FILE *outfile;
+  if ((outfile = fopen(filename, "wb")) == NULL) {
+    exit(EXIT_FAILURE);
+  }
+
+  byte *compressed[NUM_SHARDS];
+  size_t sizes[NUM_SHARDS];
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    compressed[i] = compress_shard(bloom + i * shard_size(num_bits),
+        shard_size(num_bits), &sizes[i]);
+  }
+
+  byte header[SHARDED_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  write_u32(header, SHARDED_MAGIC);
+  header[4] = SHARDED_VERSION;
+  header[5] = num_bits;
+  header[6] = SHARD_BITS;
+  header[7] = NUM_HASHES;
+  size_t offset = SHARDED_HEADER_SIZE;
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    write_u32(header + 8 + 8 * i, sizes[i] == 0 ? 0 : offset);
+    write_u32(header + 12 + 8 * i, sizes[i]);
+    offset += sizes[i];
+  }
+
+  if (fwrite(header, 1, sizeof(header), outfile) != sizeof(header)) {
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    if (sizes[i] > 0
+        && fwrite(compressed[i], 1, sizes[i], outfile) != sizes[i]) {
+      exit(EXIT_FAILURE);
+    }
+    free(compressed[i]);
+  }
+
+  fclose(outfile);
+}
+
+
+/***
+ * Read the header and index of a serialized sharded filter without
+ * decompressing any shards. The data is not copied, so it must outlive the
+ * returned filter. Returns NULL if the data is not a valid sharded filter.
+ */
+sharded_bloom *open_sharded_bloom(byte *data, size_t size, region *memory) {
+  if (size < SHARDED_HEADER_SIZE || read_u32(data) != SHARDED_MAGIC
+      || data[4] != SHARDED_VERSION || data[6] != SHARD_BITS
+      || data[7] != NUM_HASHES || data[5] < SHARD_BITS + 3 || data[5] > 31) {
+    return NULL;
+  }
+
+  // Every shard must lie within the data
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    size_t offset = read_u32(data + 8 + 8 * i);
+    size_t length = read_u32(data + 12 + 8 * i);
+    if (length > 0 && (offset < SHARDED_HEADER_SIZE || offset > size
+          || length > size - offset)) {
+      return NULL;
+    }
+  }
+
+  sharded_bloom *filter = shard_alloc(memory, sizeof(sharded_bloom));
+  if (filter == NULL) {
+    return NULL;
+  }
+  memset(filter, 0, sizeof(sharded_bloom));
+  filter->memory = memory;
+  filter->num_bits = data[5];
+  filter->data = data;
+  filter->size = size;
+  return filter;
+}
+
+
+/***
+ * Free a sharded filter and its loaded shards, but not its serialized data.
+ */
+void free_sharded_bloom(sharded_bloom *filter) {
+  if (filter == NULL) {
+    return;
+  }
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    shard_free(filter->memory, filter->shards[i]);
+  }
+  shard_free(filter->memory, filter);
+}
+
+
+/***
+ * Decompress a shard if it has not been loaded yet. Returns 0 on failure.
+ */
+int load_shard(sharded_bloom *filter, uint8_t shard) {
+  if (filter->loaded[shard]) {
+    return 1;
+  }
+
+  // Empty shards never need any memory
+  size_t offset = read_u32(filter->data + 8 + 8 * shard);
+  size_t compressed_size = read_u32(filter->data + 12 + 8 * shard);
+  if (compressed_size > 0) {
+    size_t size = shard_size(filter->num_bits);
+    byte *bloom = (byte *)shard_alloc(filter->memory, size);
+    if (bloom == NULL || !decompress_bloom_into(filter->data + offset,
+          compressed_size, bloom, size)) {
+      shard_free(filter->memory, bloom);
+      return 0;
+    }
+    filter->shards[shard] = bloom;
+  }
+
+  filter->loaded[shard] = 1;
+  filter->num_loaded++;
+  return 1;
+}
+
+
+/***
+ * Returns whether a shard has been loaded.
+ */
+int shard_loaded(sharded_bloom *filter, uint8_t shard) {
+  return filter->loaded[shard];
+}
+
+
+/***
+ * Check data against one loaded shard, which must be the one returned by
+ * shard_index. Returns -1 if the shard is not loaded.
+ */
+int in_shard(sharded_bloom *filter, uint8_t shard, byte *data,
+    uint32_t length) {
+  if (!filter->loaded[shard]) {
+    return -1;
+  }
+  if (filter->shards[shard] == NULL) {
+    return 0;
+  }
+  return in_bloom(filter->shards[shard], filter->num_bits - SHARD_BITS, data,
+      length);
+}
+
+
+/***
+ * Returns an int representing whether data is (probably) in the filter,
+ * loading its shard first if necessary, or -1 if the shard cannot be loaded.
+ */
+int in_sharded_bloom(sharded_bloom *filter, byte *data, uint32_t length) {
+  uint8_t shard = shard_index(data, length);
+  if (!load_shard(filter, shard)) {
+    return -1;
+  }
+  return in_shard(filter, shard, data, length);
+}
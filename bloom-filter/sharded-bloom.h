@@ -0,0 +1,128 @@
+/* sharded-bloom.h
+ *
+ * Interface for a sharded Bloom filter: one filter split into independent
+ * shards, each compressed separately behind an index, so that a lookup only
+ * has to decompress the one shard its key falls in. Memory use and startup
+ * time then scale with the number of shards actually touched rather than with
+ * the size of the whole filter.
+ */
+
+
+#ifndef SHARDED_BLOOM_H
+#define SHARDED_BLOOM_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "bloom.h"
+
+
+
+/*******************************************************************************
+ * Constants and types
+ ******************************************************************************/
+
+// A key's shard is the top SHARD_BITS bits of its murmur3 hash with
+// SHARD_SEED, which is distinct from the seeds 0 to NUM_HASHES - 1 used for
+// the bit indices. Within a shard, bits are set exactly as add_bloom would
+// for a filter of 2^(num_bits - SHARD_BITS) bits.
+#define SHARD_BITS 8
+#define NUM_SHARDS (1 << SHARD_BITS)
+#define SHARD_SEED 0xffffffffu
+
+// Bytes "SHRD" followed by a version number begin every serialized filter.
+// The header is followed by an index with the offset from the start of the
+// file and the size of each shard, then the shards themselves, each of which
+// is a separate gzip stream. Shards with no bits set have a size of 0.
+#define SHARDED_MAGIC 0x44524853u
+#define SHARDED_VERSION 1
+#define SHARDED_HEADER_SIZE (8 + 8 * NUM_SHARDS)
+
+typedef struct sharded_bloom_s {
+  // Size of the whole filter in bits is 2^num_bits
+  uint8_t num_bits;
+  // Serialized filter, which must stay valid while shards may be loaded
+  byte *data;
+  size_t size;
+  // Decompressed shards, which are NULL until loaded (or if empty)
+  byte *shards[NUM_SHARDS];
+  uint8_t loaded[NUM_SHARDS];
+  uint16_t num_loaded;
+  // Region the filter and its shards are allocated from, or NULL for the heap
+  region *memory;
+} sharded_bloom;
+
+
+
+/*******************************************************************************
+ * Interface functions
+ ******************************************************************************/
+
+/***
+ * Return the shard that a key is stored in.
+ */
+uint8_t shard_index(byte *data, uint32_t length);
+
+
+/***
+ * Add data to a whole, uncompressed sharded filter of 2^num_bits bits (as
+ * allocated by new_bloom), in which each shard is a contiguous block.
+ *
+ * NOTE: num_bits must be at least SHARD_BITS + 3 so each shard has a byte.
+ */
+void add_sharded_bloom(byte *bloom, uint8_t num_bits, byte *data,
+    uint32_t length);
+
+
+/***
+ * Write a whole sharded filter out with each shard compressed separately.
+ */
+void write_sharded_bloom(char *filename, byte *bloom, uint8_t num_bits);
+
+
+/***
+ * Read the header and index of a serialized sharded filter without
+ * decompressing any shards. The data is not copied, so it must outlive the
+ * returned filter. The filter and its shards are allocated from memory, or
+ * from the heap if it is NULL. Returns NULL if the data is not a valid sharded
+ * filter.
+ */
+sharded_bloom *open_sharded_bloom(byte *data, size_t size, region *memory);
+
+
+/***
+ * Free a sharded filter and its loaded shards, but not its serialized data.
+ */
+void free_sharded_bloom(sharded_bloom *filter);
+
+
+/***
+ * Decompress a shard if it has not been loaded yet. Returns 0 on failure.
+ */
+int load_shard(sharded_bloom *filter, uint8_t shard);
+
+
+/***
+ * Returns whether a shard has been loaded.
+ */
+int shard_loaded(sharded_bloom *filter, uint8_t shard);
+
+
+/***
+ * Check data against one loaded shard, which must be the one returned by
+ * shard_index. Returns -1 if the shard is not loaded.
+ */
+int in_shard(sharded_bloom *filter, uint8_t shard, byte *data,
+    uint32_t length);
+
+
+/***
+ * Returns an int representing whether data is (probably) in the filter,
+ * loading its shard first if necessary, or -1 if the shard cannot be loaded.
+ */
+int in_sharded_bloom(sharded_bloom *filter, byte *data, uint32_t length);
+
+
+#endif /* SHARDED_BLOOM_H */
@@ -0,0 +1,18 @@
+/* bloom-load.js
+ *
+ * Load the WebAssembly Bloom filter library. The build with threads runs
+ * decompression, merges, and batch queries on worker threads, but it needs
+ * SharedArrayBuffer, which is only available to cross-origin isolated pages.
+ * Everywhere else, the build without threads runs them on the main thread.
+ */
+
+
+(() => {
+  let threads = self.crossOriginIsolated
+    && typeof SharedArrayBuffer !== "undefined";
+  let script = document.createElement("script");
+  script.type = "text/javascript";
+  script.async = true;
+  script.src = threads ? "bloom-threads.js" : "bloom.js";
+  document.head.appendChild(script);
+})();
@@ -140,10 +140,22 @@ async function storeBloom(filters) {
     addrs[f.threshold] = addr;
     f.addr = null;
 
-    // Update the filter attribute from WebAssembly memory
+    // Update the filter attribute with a copy of WebAssembly memory, since
+    // a view would be invalidated if the heap grows while storing
     if (addr) {
-      f.filter = new Uint8Array(Module.HEAPU8.buffer, addr,
-          Math.pow(2, f.num_bits - 3));
+      f.filter = Module.HEAPU8.slice(addr,
+          addr + Math.pow(2, f.num_bits - 3));
+    }
+
+    // Do the same for the host and prefix filters next to it, if there are
+    // any
+    for (let side of [f.hosts, f.prefixes].filter(side => side)) {
+      side.stored_addr = side.addr;
+      side.addr = null;
+      if (side.stored_addr) {
+        side.filter = Module.HEAPU8.slice(side.stored_addr,
+            side.stored_addr + Math.pow(2, side.num_bits - 3));
+      }
     }
   }
 
@@ -155,6 +167,10 @@ async function storeBloom(filters) {
 
     // Restore addresses
     f.addr = addrs[f.threshold];
+    for (let side of [f.hosts, f.prefixes].filter(side => side)) {
+      side.addr = side.stored_addr;
+      delete side.stored_addr;
+    }
 
     // Unset the semaphore
     f.currently_storing = false;
@@ -185,6 +201,32 @@ async function fetchInfo() {
 }
 
 
+/***
+ * Download a file from the latest release, and check it against the SHA-256
+ * that info.json lists for it, if there is one.
+ */
+async function fetchRelease(filename, info) {
+  let url = ("https://github.com/jstrieb/hackernews-button/releases/latest/"
+            + `download/${filename}`);
+  let bytes = await fetch(url, {
+    cache: "no-cache",
+  })
+    .then(b => b.arrayBuffer())
+    .then(a => new Uint8Array(a));
+
+  let file = info.files && info.files[filename];
+  if (file && file.sha256) {
+    let digest = new Uint8Array(await crypto.subtle.digest("SHA-256", bytes));
+    let hex = Array.from(digest, x => x.toString(16).padStart(2, "0"))
+      .join("");
+    if (hex != file.sha256) {
+      throw `Downloaded ${filename} does not match info.json!`;
+    }
+  }
+  return bytes;
+}
+
+
 /***
  * Fetch the latest Bloom filter(s). Returns a Bloom filter object.
  */
@@ -195,13 +237,7 @@ async function fetchBloom(dateString, threshold, info, decompress = true) {
   if (window.settings.debug_mode) {
     console.debug("Fetching new Bloom filter...");
   }
-  let url = ("https://github.com/jstrieb/hackernews-button/releases/latest/"
-            + `download/${filename}`);
-  let b = await fetch(url, {
-    cache: "no-cache",
-  })
-    .then(b => b.arrayBuffer())
-    .then(a => new Uint8Array(a));
+  let b = await fetchRelease(filename, info);
 
   let bloom = {
     // Filter as an ArrayBuffer
@@ -229,15 +265,28 @@ async function fetchBloom(dateString, threshold, info, decompress = true) {
     console.debug("Fetched: ", bloom);
   }
 
+  // Fetch the host filter that is checked in front of the URL filter, if
+  // there is one. It is made by bloom-create --host-bits.
+  if (info.hosts) {
+    bloom.hosts = {
+      filter: await fetchRelease(filename.replace(/\.bloom$/, "-hosts.bloom"),
+          info),
+      compressed: info.compressed,
+      num_bits: info.host_bits,
+      addr: null,
+    };
+  }
+
+  // Fetch the prefix filter along with the full filter it belongs to
+  if (info.prefixes && !dateString && threshold == info.prefix_threshold) {
+    bloom.prefixes = await fetchPrefixes(info);
+  }
+
   if (decompress) {
     // Set bloom.addr
-    if (bloom.compressed) {
-      decompressBloom(bloom);
-      if (window.settings.debug_mode) {
-        console.debug("Decompressed: ", bloom);
-      }
-    } else {
-      newBloom(bloom);
+    await loadFilterMemory(bloom);
+    if (window.settings.debug_mode) {
+      console.debug("Decompressed: ", bloom);
     }
   }
 
@@ -245,6 +294,22 @@ async function fetchBloom(dateString, threshold, info, decompress = true) {
 }
 
 
+/***
+ * Fetch the filter of path prefixes used to find stories from the same
+ * section of a site. Only the lowest threshold's full filter has one, made by
+ * bloom-publish --prefix-bits.
+ */
+async function fetchPrefixes(info) {
+  return {
+    filter: await fetchRelease(`hn-${info.prefix_threshold}-prefixes.bloom`,
+        info),
+    compressed: info.compressed,
+    num_bits: info.prefix_bits,
+    addr: null,
+  };
+}
+
+
 /***
  * Update the Bloom filter(s) to the latest versions. Destructively modifies
  * the global object window.filters
@@ -292,39 +357,158 @@ async function updateBloom(force = false) {
       window.filters[i] = await fetchBloom(null, f.threshold, info);
     }
 
-    // Otherwise, pick the Bloom filter with the date closest to the
-    // last_generated date to combine with
+    // Otherwise, combine with the delta filter if it was built from the same
+    // release as this filter, since it has exactly the stories added since.
+    // If not, pick the Bloom filter with the date closest to the
+    // last_generated date to combine with.
     else {
-      // Re-sort based on which is closest to the last_generated date
-      let l = f.last_generated;
-      sorted = sorted.sort((x, y) => Math.abs(x - l) - Math.abs(y - l));
+      let dateString;
+      if (info.deltas && info.deltas[f.threshold]
+          && info.delta_from == f.last_generated) {
+        dateString = "delta";
+      } else {
+        // Re-sort based on which is closest to the last_generated date
+        let l = f.last_generated;
+        sorted = sorted.sort((x, y) => Math.abs(x - l) - Math.abs(y - l));
+        dateString = info.dates[sorted[0]];
+      }
 
-      // Download latest partial Bloom filter
-      let dateString = info.dates[sorted[0]];
+      // Download latest delta or partial Bloom filter
       let latestBloom = await fetchBloom(dateString, f.threshold, info);
 
-      // Combine the filters and update the datetimes
-      combineBloom(f, latestBloom);
+      // Combine the filters and update the datetimes. Tabs are still checked
+      // against the filter while it is being combined.
+      await combineBloomAsync(f, latestBloom);
       f.last_downloaded = latestBloom.last_downloaded;
       f.last_generated = latestBloom.last_generated;
       f.next_generated = latestBloom.next_generated;
 
       // Free the allocated partial Bloom filter
       freeBloom(latestBloom);
+
+      // Delta and partial filters have no prefix filter, so the one kept with the full
+      // filter is replaced with the latest instead
+      if (info.prefixes && f.threshold == info.prefix_threshold) {
+        let prefixes = await fetchPrefixes(info);
+        await loadFilterMemory(prefixes);
+        freeBloom(f.prefixes);
+        f.prefixes = prefixes;
+      }
     }
   }
 
   // Store the updated Bloom filter
   await storeBloom(window.filters)
     .catch(e => console.error(e));
+
+  // The map of item ids is regenerated along with the filters
+  await loadItemMap(info)
+    .catch(e => console.error(e));
 }
 
 
+/***
+ * Load the map from story URLs to item ids into WebAssembly memory as
+ * window.item_map, if the latest release has one (made by bloom-create
+ * --item-map). It is kept in local storage next to the filters, and only
+ * downloaded again when info.json lists a different version of it. Without
+ * info, the stored map is used if there is one.
+ */
+async function loadItemMap(info = null) {
+  let stored = (await browser.storage.local.get("item_map")).item_map;
+  if (!info && !stored) {
+    info = await fetchInfo();
+  }
+  if (info && !info.item_map) {
+    return;
+  }
+
+  // The SHA-256 of the map only changes when the map does, while the date
+  // changes with every release
+  let file = info && info.files && info.files[info.item_map];
+  let version = info && (file && file.sha256 || info.date_generated);
+  if (info && (!stored || stored.name != info.item_map
+      || stored.version != version)) {
+    stored = {
+      name: info.item_map,
+      version: version,
+      map: await fetchRelease(info.item_map, info),
+    };
+    await browser.storage.local.set({"item_map": stored});
+  } else if (window.item_map && window.item_map.addr
+      && window.item_map.version == stored.version) {
+    return;
+  }
+
+  // The map is not compressed, so it is copied straight into WebAssembly
+  // memory. The old one is freed first so that two are never loaded at once.
+  freeBloom(window.item_map);
+  window.item_map = null;
+  let map = {
+    addr: Module.ccall(
+      "js_new_item_map",
+      "number",
+      ["number"],
+      [stored.map.length]
+    ),
+    size: stored.map.length,
+    version: stored.version,
+  };
+  if (!map.addr) {
+    throw "Failed to allocate memory for the item map!";
+  }
+  Module.HEAPU8.set(stored.map, map.addr);
+  if (!Module.ccall(
+    "js_valid_item_map",
+    "boolean",
+    ["number", "number"],
+    [map.addr, map.size]
+  )) {
+    freeBloom(map);
+    await browser.storage.local.remove("item_map");
+    throw "Failed to load item map!";
+  }
+
+  window.item_map = map;
+  if (window.settings.debug_mode) {
+    console.debug("Loaded item map: ", map);
+  }
+}
+
 
 /*******************************************************************************
  * Wrapper functions
  ******************************************************************************/
 
+/***
+ * Copy bytes into WebAssembly scratch memory and return the address. Scratch
+ * memory is released at the end of the next call that takes data, so there is
+ * nothing to free, and repeated calls never grow the heap.
+ */
+function scratchBytes(bytes) {
+  let addr = Module.ccall(
+    "js_scratch_alloc",
+    "number",
+    ["number"],
+    [bytes.length]
+  );
+  if (addr === 0) {
+    throw "Failed to allocate scratch memory!";
+  }
+  Module.HEAPU8.set(bytes, addr);
+  return addr;
+}
+
+
+/***
+ * Copy a URL into scratch memory, returning its address and length in bytes.
+ */
+function scratchString(s) {
+  let bytes = new TextEncoder().encode(s);
+  return [scratchBytes(bytes), bytes.length];
+}
+
+
 function newBloom(bloom) {
   // Need to heap-allocate the bloom filter because passing it directly will
   // cause a stack overflow
@@ -339,7 +523,16 @@ function newBloom(bloom) {
 
 
 function freeBloom(bloom) {
-  if (!bloom || !bloom.addr) {
+  if (!bloom) {
+    return;
+  }
+  if (bloom.hosts) {
+    freeBloom(bloom.hosts);
+  }
+  if (bloom.prefixes) {
+    freeBloom(bloom.prefixes);
+  }
+  if (!bloom.addr) {
     return;
   }
 
@@ -358,10 +551,9 @@ function freeBloom(bloom) {
  * from the struct generated by the library functions.
  */
 function decompressBloom(bloom) {
-  // Put the compressed Bloom filter on the heap
+  // Put the compressed Bloom filter in scratch memory
   let compressed = bloom.filter;
-  let compressed_addr = _malloc(compressed.length);
-  Module.writeArrayToMemory(compressed, compressed_addr);
+  let compressed_addr = scratchBytes(compressed);
 
   let decompressed = Module.ccall(
     "js_decompress_bloom",
@@ -386,11 +578,21 @@ function decompressBloom(bloom) {
   );
   bloom.num_bits = Math.round(Math.log2(size_bytes)) + 3,
   bloom.compressed = false;
+}
 
-  _free(compressed_addr);
 
-  // Free the structure, but not the heap-allocated Bloom filter itself
-  _free(decompressed);
+/***
+ * Copy a downloaded or stored Bloom filter into WebAssembly memory, along with
+ * its host and prefix filters if it has them.
+ */
+async function loadFilterMemory(bloom) {
+  for (let f of [bloom, bloom.hosts, bloom.prefixes].filter(f => f)) {
+    if (f.compressed) {
+      await decompressBloomAsync(f);
+    } else {
+      newBloom(f);
+    }
+  }
 }
 
 
@@ -399,13 +601,34 @@ function addBloom(bloom, url) {
     return;
   }
 
-  url = canonicalizeUrl(url);
+  let [addr, length] = scratchString(canonicalizeUrl(url));
   Module.ccall(
     "js_add_bloom",
     null,
-    ["number", "number", "string", "number"],
-    [bloom.addr, bloom.num_bits, url, url.length]
+    ["number", "number", "number", "number"],
+    [bloom.addr, bloom.num_bits, addr, length]
   );
+
+  // The host must be added too, or the URL would be rejected by the host
+  // filter before the URL filter is ever checked
+  if (bloom.hosts && bloom.hosts.addr) {
+    [addr, length] = scratchString(canonicalizeUrl(url));
+    Module.ccall(
+      "js_add_url_host",
+      null,
+      ["number", "number", "number", "number"],
+      [bloom.hosts.addr, bloom.hosts.num_bits, addr, length]
+    );
+  }
+  if (bloom.prefixes && bloom.prefixes.addr) {
+    [addr, length] = scratchString(canonicalizeUrl(url));
+    Module.ccall(
+      "js_add_url_prefixes",
+      null,
+      ["number", "number", "number", "number"],
+      [bloom.prefixes.addr, bloom.prefixes.num_bits, addr, length]
+    );
+  }
 }
 
 
@@ -417,12 +640,23 @@ function inBloom(bloom, url) {
     return false;
   }
 
-  url = canonicalizeUrl(url);
+  let [addr, length] = scratchString(canonicalizeUrl(url));
+  if (bloom.hosts && bloom.hosts.addr) {
+    // Check the small host filter first, which answers most lookups for pages
+    // that have never been submitted without touching the URL filter
+    return Module.ccall(
+      "js_in_bloom_with_hosts",
+      "boolean",
+      ["number", "number", "number", "number", "number", "number"],
+      [bloom.hosts.addr, bloom.hosts.num_bits, bloom.addr, bloom.num_bits,
+        addr, length]
+    );
+  }
   return Module.ccall(
     "js_in_bloom",
     "boolean",
-    ["number", "number", "string", "number"],
-    [bloom.addr, bloom.num_bits, url, url.length]
+    ["number", "number", "number", "number"],
+    [bloom.addr, bloom.num_bits, addr, length]
   );
 }
 
@@ -440,10 +674,433 @@ function combineBloom(bloom, new_bloom) {
     ["number", "number", "number"],
     [bloom.addr, new_bloom.addr, bloom.num_bits]
   );
+
+  // Keep the host filter only if it still covers every URL in the filter
+  if (bloom.hosts && new_bloom.hosts
+      && bloom.hosts.num_bits == new_bloom.hosts.num_bits) {
+    Module.ccall(
+      "js_combine_bloom",
+      null,
+      ["number", "number", "number"],
+      [bloom.hosts.addr, new_bloom.hosts.addr, bloom.hosts.num_bits]
+    );
+  } else if (bloom.hosts) {
+    freeBloom(bloom.hosts);
+    delete bloom.hosts;
+  }
+
+  // Likewise for the prefix filter, which is left alone when combining a
+  // filter without one, since only full filters have them
+  if (bloom.prefixes && new_bloom.prefixes
+      && bloom.prefixes.num_bits == new_bloom.prefixes.num_bits) {
+    Module.ccall(
+      "js_combine_bloom",
+      null,
+      ["number", "number", "number"],
+      [bloom.prefixes.addr, new_bloom.prefixes.addr, bloom.prefixes.num_bits]
+    );
+  } else if (bloom.prefixes && new_bloom.prefixes) {
+    freeBloom(bloom.prefixes);
+    delete bloom.prefixes;
+  }
 }
 
 
 
+/***
+ * Wait for a job submitted to the WebAssembly library to finish, polling
+ * between events so that tabs are still checked in the meantime. In
+ * bloom-threads.js jobs run on worker threads, and in bloom.js they have
+ * already finished by the first poll. Rejects, releasing the job, if it fails.
+ */
+function awaitJob(id) {
+  return new Promise((resolve, reject) => {
+    let poll = () => {
+      // Job states are 1 while running, 2 when done, and 3 if failed
+      let state = Module.ccall(
+        "js_poll_job",
+        "number",
+        ["number"],
+        [id]
+      );
+      if (state == 1) {
+        setTimeout(poll, 5);
+      } else if (state == 2) {
+        resolve(id);
+      } else {
+        releaseJob(id);
+        reject("Bloom filter job failed!");
+      }
+    };
+    poll();
+  });
+}
+
+
+function releaseJob(id) {
+  Module.ccall(
+    "js_release_job",
+    null,
+    ["number"],
+    [id]
+  );
+}
+
+
+/***
+ * Like decompressBloom, but without blocking event handling while the filter
+ * is inflated. Filters that cannot be decompressed as a job (such as those
+ * that are not compressed at all) are decompressed synchronously.
+ */
+async function decompressBloomAsync(bloom) {
+  let compressed = bloom.filter;
+  let compressed_addr = scratchBytes(compressed);
+  let id = Module.ccall(
+    "js_submit_decompress",
+    "number",
+    ["number", "number"],
+    [compressed_addr, compressed.length]
+  );
+  if (id < 0) {
+    decompressBloom(bloom);
+    return;
+  }
+
+  await awaitJob(id)
+    .catch(() => {
+      throw "Failed to decompress downloaded Bloom filter!";
+    });
+  let size_bytes = Module.ccall(
+    "js_job_size",
+    "number",
+    ["number"],
+    [id]
+  );
+  bloom.addr = Module.ccall(
+    "js_job_result",
+    "number",
+    ["number"],
+    [id]
+  );
+  releaseJob(id);
+  bloom.num_bits = Math.round(Math.log2(size_bytes)) + 3;
+  bloom.compressed = false;
+}
+
+
+/***
+ * Like combineBloom, but without blocking event handling during the merge.
+ * The filter can still be checked while it is being combined, and neither
+ * filter may be freed until the returned promise resolves.
+ */
+async function combineBloomAsync(bloom, new_bloom) {
+  if (bloom.num_bits != new_bloom.num_bits) {
+    throw "Trying to combine Bloom filters of different sizes!";
+  }
+  let combineJob = (a, b) => awaitJob(Module.ccall(
+    "js_submit_combine",
+    "number",
+    ["number", "number", "number"],
+    [a.addr, b.addr, a.num_bits]
+  )).then(releaseJob);
+
+  let jobs = [combineJob(bloom, new_bloom)];
+  // Keep the host filter only if it still covers every URL in the filter
+  if (bloom.hosts && new_bloom.hosts
+      && bloom.hosts.num_bits == new_bloom.hosts.num_bits) {
+    jobs.push(combineJob(bloom.hosts, new_bloom.hosts));
+  } else if (bloom.hosts) {
+    freeBloom(bloom.hosts);
+    delete bloom.hosts;
+  }
+  // Likewise for the prefix filter, unless the new filter has none
+  if (bloom.prefixes && new_bloom.prefixes
+      && bloom.prefixes.num_bits == new_bloom.prefixes.num_bits) {
+    jobs.push(combineJob(bloom.prefixes, new_bloom.prefixes));
+  } else if (bloom.prefixes && new_bloom.prefixes) {
+    freeBloom(bloom.prefixes);
+    delete bloom.prefixes;
+  }
+  await Promise.all(jobs);
+}
+
+
+/***
+ * Check many URLs against one filter at once as a job, resolving to
+ * an array with whether each URL is (probably) in the filter. The host filter
+ * is not consulted, since it only ever turns hits into misses.
+ */
+async function inBloomBatch(bloom, urls) {
+  if (!bloom || bloom.currently_storing || !bloom.addr || urls.length == 0) {
+    return urls.map(() => false);
+  }
+
+  let keys = urls.map(canonicalizeUrl).join("\n");
+  let [addr, length] = scratchString(keys);
+  let id = await awaitJob(Module.ccall(
+    "js_submit_batch",
+    "number",
+    ["number", "number", "number", "number"],
+    [bloom.addr, bloom.num_bits, addr, length]
+  ));
+  let bits_addr = Module.ccall(
+    "js_job_result",
+    "number",
+    ["number"],
+    [id]
+  );
+  let bits = Module.HEAPU8.slice(bits_addr,
+    bits_addr + Math.ceil(urls.length / 8));
+  releaseJob(id);
+  return urls.map((_, i) => Boolean((bits[i >> 3] >> (7 - (i & 7))) & 1));
+}
+
+/***
+ * Open a sharded Bloom filter (created by bloom-create --sharded) without
+ * decompressing it. Shards are decompressed on demand by inSharded, so memory
+ * use grows only with the number of distinct shards that have been checked.
+ */
+function openSharded(bloom) {
+  let compressed = bloom.filter;
+  let compressed_addr = scratchBytes(compressed);
+  bloom.addr = Module.ccall(
+    "js_open_sharded_bloom",
+    "number",
+    ["number", "number"],
+    [compressed_addr, compressed.length]
+  );
+  if (!bloom.addr) {
+    throw "Failed to open downloaded sharded Bloom filter!";
+  }
+  bloom.sharded = true;
+}
+
+
+function freeSharded(bloom) {
+  if (!bloom || !bloom.addr) {
+    return;
+  }
+
+  Module.ccall(
+    "js_free_sharded_bloom",
+    null,
+    ["number"],
+    [bloom.addr]
+  );
+  bloom.addr = null;
+}
+
+
+function inSharded(bloom, url) {
+  if (!bloom || !bloom.addr) {
+    return false;
+  }
+
+  let [addr, length] = scratchString(canonicalizeUrl(url));
+  return Module.ccall(
+    "js_in_sharded_bloom",
+    "number",
+    ["number", "number", "number"],
+    [bloom.addr, addr, length]
+  ) == 1;
+}
+
+/***
+ * Return statistics about filter operations, if bloom.js was compiled with
+ * them (make STATS=1), along with how full each filter is. Useful for
+ * debugging from the console.
+ */
+function getStats() {
+  let fillRatio = f => (f && f.addr
+    ? Module.ccall(
+        "js_fill_ratio",
+        "number",
+        ["number", "number"],
+        [f.addr, f.num_bits]
+      )
+    : null);
+
+  return {
+    operations: JSON.parse(Module.ccall(
+      "js_get_stats",
+      "string",
+      [],
+      []
+    )),
+    filters: (window.filters || []).map(f => ({
+      threshold: f.threshold,
+      num_bits: f.num_bits,
+      fill_ratio: fillRatio(f),
+      hosts_fill_ratio: fillRatio(f.hosts),
+    })),
+  };
+}
+
+
+
+/***
+ * Allocate a cuckoo filter for stories learned locally from browsing Hacker
+ * News. Unlike adding to every threshold's Bloom filter, each story is hashed
+ * once and stored once, along with the index of the highest threshold it meets.
+ * 2^14 buckets of 4 slots is 256KB, enough for tens of thousands of stories.
+ */
+function newLocal() {
+  return {
+    addr: Module.ccall(
+      "js_new_cuckoo",
+      "number",
+      ["number"],
+      [14]
+    ),
+  };
+}
+
+
+function freeLocal(local) {
+  if (!local || !local.addr) {
+    return;
+  }
+
+  Module.ccall(
+    "js_free_cuckoo",
+    null,
+    ["number"],
+    [local.addr]
+  );
+  local.addr = null;
+}
+
+
+/***
+ * Store a URL with a value (at most 15). Returns false if the filter is full.
+ */
+function addLocal(local, url, value) {
+  if (!local || !local.addr) {
+    return false;
+  }
+
+  let [addr, length] = scratchString(canonicalizeUrl(url));
+  return Module.ccall(
+    "js_insert_cuckoo",
+    "boolean",
+    ["number", "number", "number", "number"],
+    [local.addr, addr, length, value]
+  );
+}
+
+
+/***
+ * Return the value stored with a URL, or -1 if it is not in the filter.
+ */
+function inLocal(local, url) {
+  if (!local || !local.addr) {
+    return -1;
+  }
+
+  let [addr, length] = scratchString(canonicalizeUrl(url));
+  return Module.ccall(
+    "js_lookup_cuckoo",
+    "number",
+    ["number", "number", "number"],
+    [local.addr, addr, length]
+  );
+}
+
+
+
+
+/***
+ * Return the Hacker News item id for the discussion of a URL, or null if it
+ * is not in the item map (or there is no item map).
+ */
+function lookupItemId(url) {
+  if (!window.item_map || !window.item_map.addr) {
+    return null;
+  }
+
+  let [addr, length] = scratchString(canonicalizeUrl(url));
+  let id = Module.ccall(
+    "js_lookup_item",
+    "number",
+    ["number", "number", "number"],
+    [window.item_map.addr, addr, length]
+  );
+  return id == 0 ? null : id;
+}
+
+
+/***
+ * Return the canonical form of the longest prefix of a URL (its host, or a
+ * section of the site like a blog or a repository) that any story in the
+ * filters was submitted under, or null if there is none.
+ */
+function longestPrefix(url) {
+  // Only the lowest threshold's filter has a prefix filter
+  let f = (window.filters || []).find(f => f.prefixes && f.prefixes.addr
+    && !f.currently_storing);
+  if (!f) {
+    return null;
+  }
+  let canonical = canonicalizeUrl(url);
+  let [addr, length] = scratchString(canonical);
+  let longest = Module.ccall(
+    "js_longest_url_prefix",
+    "number",
+    ["number", "number", "number", "number"],
+    [f.prefixes.addr, f.prefixes.num_bits, addr, length]
+  );
+  // The length is in bytes of UTF-8, which may differ from the string length
+  let bytes = new TextEncoder().encode(canonical);
+  return longest == 0 ? null
+    : new TextDecoder().decode(bytes.subarray(0, longest));
+}
+
+
+/***
+ * Return the score threshold cached for a URL by the last call to
+ * cacheScore, which is -1 if it was in no filter, or null if nothing is
+ * cached, along with the URL's fingerprint to pass to cacheScore after a
+ * miss. Cached scores are forgotten whenever any filter changes.
+ */
+function getCachedScore(url) {
+  let [addr, length] = scratchString(canonicalizeUrl(url));
+  let score = Module.ccall(
+    "js_get_cached",
+    "number",
+    ["number", "number"],
+    [addr, length]
+  );
+  let fingerprint_addr = Module.ccall(
+    "js_last_fingerprint",
+    "number",
+    [],
+    []
+  );
+  let fingerprint = Module.HEAPU32.slice(fingerprint_addr >> 2,
+    (fingerprint_addr >> 2) + 2);
+  return {score: score == -2 ? null : score, fingerprint: fingerprint};
+}
+
+
+function cacheScore(fingerprint, score) {
+  Module.ccall(
+    "js_put_cached",
+    null,
+    ["number", "number", "number"],
+    [fingerprint[0], fingerprint[1], score]
+  );
+}
+
+
+function invalidateCachedScores() {
+  Module.ccall(
+    "js_invalidate_cached",
+    null,
+    [],
+    []
+  );
+}
+
 /*******************************************************************************
  * Main function
  ******************************************************************************/
@@ -460,13 +1117,19 @@ async function loadBloom() {
     }
   });
 
+  // Values in the local filter are indices into window.filters, which may
+  // change when the filters are reloaded, so start it over as well
+  freeLocal(window.local);
+  window.local = newLocal();
+
   // Try to get the Bloom filters out of storage, otherwise download latest.
   window.filters = (await browser.storage.local.get("filters")).filters;
+  let info = null;
   if (!window.filters || !window.filters.every(f => f.filter)) {
     if (window.settings.debug_mode) {
       console.debug("Fetching Bloom filter info...");
     }
-    let info = await fetchInfo();
+    info = await fetchInfo();
 
     window.filters = [];
 
@@ -499,13 +1162,9 @@ async function loadBloom() {
   // Set bloom.addr, must use async-friendly foreach
   for (let i = 0; i < window.filters.length; i++) {
     let f = window.filters[i];
-    if (f.compressed) {
-      decompressBloom(f);
-      if (window.settings.debug_mode) {
-        console.debug("Decompressed: ", f);
-      }
-    } else {
-      newBloom(f);
+    await loadFilterMemory(f);
+    if (window.settings.debug_mode) {
+      console.debug("Decompressed: ", f);
     }
 
     // TODO: Is this enough? Or is this leaking memory?
@@ -514,9 +1173,15 @@ async function loadBloom() {
 
   await storeBloom(window.filters)
     .catch(e => console.error(e));
+
+  // Load the item map in the background, since only clicks need it. It is
+  // downloaded along with new filters, and otherwise comes out of storage.
+  loadItemMap(info)
+    .catch(e => console.error(e));
 }
 
 // NOTE: This works because this file is run before the autogenerated bloom.js
+// or bloom-threads.js, whichever bloom-load.js picks
 var Module = {
   onRuntimeInitialized: loadBloom,
 };
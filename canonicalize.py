@@ -88,7 +88,9 @@ class URL(object):
         important. Do not change the order around without good reason.
 
         NOTE: Any canonicalization changes made here *MUST* be reflected in the
-        `canonicalizeUrl` function within the `bloom-wrap.js` file!
+        `canonicalizeUrl` function within the `bloom-wrap.js` file, and in
+        `canonicalize_url` within `bloom-filter/canonicalize.c`, which
+        bloom-create uses to canonicalize URLs while generating filters!
         """
         self = cls(url)
 
@@ -0,0 +1,263 @@
+/* test/arena-test.c
+ *
+ * Run tests on the arena and region allocators, including that repeatedly
+ * loading and freeing Bloom filters (as resetBloom does) does not grow the
+ * amount of reserved memory. Will print to standard output if run in a
+ * terminal, will print to the browser console if compiled using emscripten
+ * and loaded into the browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "bloom.h"
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+#define FILTER_BITS 20
+#define NUM_FILTERS 5
+#define NUM_CYCLES 10
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Read a whole file into a newly allocated buffer, storing its length.
+ */
+byte *read_file(char *filename, size_t *length) {
+  FILE *f;
+  if ((f = fopen(filename, "rb")) == NULL) {
+    return NULL;
+  }
+  fseek(f, 0l, SEEK_END);
+  *length = ftell(f);
+  rewind(f);
+  byte *buffer = (byte *)malloc(*length);
+  if (fread(buffer, 1, *length, f) != *length) {
+    free(buffer);
+    buffer = NULL;
+  }
+  fclose(f);
+  return buffer;
+}
+
+
+/***
+ * Allocations must be aligned, must not overlap, and resetting must reuse the
+ * same memory.
+ */
+int test_arena() {
+  int success = 1;
+  arena *a = new_arena(256);
+
+  byte *first = arena_alloc(a, 3);
+  byte *second = arena_alloc(a, 100);
+  if ((uintptr_t)first % ARENA_ALIGN || (uintptr_t)second % ARENA_ALIGN
+      || second < first + 3) {
+    puts("Arena allocations are misaligned or overlapping!");
+    success = 0;
+  }
+
+  // Overflow the first chunk, then reset to shrink back to it
+  size_t reserved = arena_reserved(a);
+  for (int i = 0; i < 100; i++) {
+    memset(arena_alloc(a, 100), 0xff, 100);
+  }
+  arena_reset(a);
+  if (arena_reserved(a) != reserved || a->chunks->next != NULL) {
+    puts("Arena reset did not shrink back to its first chunk!");
+    success = 0;
+  }
+
+  // A large input is released by the next reset
+  memset(arena_alloc(a, 1 << 20), 0xff, 1 << 20);
+  arena_reset(a);
+  if (arena_reserved(a) != reserved) {
+    puts("Arena kept memory reserved for a large input!");
+    success = 0;
+  }
+
+  free_arena(a);
+
+  return success;
+}
+
+
+/***
+ * Freed blocks must be reused by allocations that fit in them, split if they
+ * are much larger, and merged back into one block when their chunk empties.
+ */
+int test_region() {
+  int success = 1;
+  region *r = new_region(1 << 12);
+
+  byte *a = region_alloc(r, 1000);
+  byte *b = region_alloc(r, 1000);
+  if (a == NULL || b == NULL || (uintptr_t)a % ARENA_ALIGN
+      || (uintptr_t)b % ARENA_ALIGN || (b > a && b < a + 1000)) {
+    puts("Region allocations are misaligned or overlapping!");
+    success = 0;
+  }
+
+  region_free(r, a);
+  if (region_alloc(r, 500) != a) {
+    puts("Region did not reuse a freed block!");
+    success = 0;
+  }
+
+  // A block larger than the chunk size still gets its own chunk
+  if (region_alloc(r, 1 << 14) == NULL) {
+    puts("Region could not allocate a large block!");
+    success = 0;
+  }
+
+  free_region(r);
+
+  // A small block reusing a larger free one only takes what it needs, and the
+  // rest can be allocated without reserving more
+  r = new_region(1 << 12);
+  a = region_alloc(r, 3000);
+  b = region_alloc(r, 500);
+  size_t reserved = region_reserved(r);
+  region_free(r, a);
+  byte *small = region_alloc(r, 1000);
+  byte *rest = region_alloc(r, 1500);
+  if (small != a || rest == NULL || region_reserved(r) != reserved) {
+    puts("Region did not split a large free block!");
+    success = 0;
+  }
+
+  // Once every block in a chunk is freed, the chunk stays reserved as one
+  // block that fits more than any of the blocks carved from it
+  region_free(r, small);
+  region_free(r, rest);
+  region_free(r, b);
+  byte *whole = region_alloc(r, 3500);
+  if (whole != a || region_reserved(r) != reserved) {
+    puts("Region did not reuse an emptied chunk as one block!");
+    success = 0;
+  }
+
+  free_region(r);
+
+  return success;
+}
+
+
+/***
+ * Simulate the extension repeatedly resetting its filters: copy compressed
+ * filters into scratch memory, inflate each into a block from the region,
+ * then free them all. Every cycle should reserve as much as the first while
+ * its filters are loaded, and keep it reserved after they are freed.
+ */
+int test_reset_cycles() {
+  int success = 1;
+
+  // Make a compressed filter with a few strings in it
+  char *tempfilename = "/tmp/delete-arena.bloom";
+  byte *bloom = new_bloom(FILTER_BITS);
+  add_bloom(bloom, FILTER_BITS, (byte *)"//example.com", 13);
+  write_compressed_bloom(tempfilename, bloom, FILTER_BITS);
+  size_t length;
+  byte *compressed = read_file(tempfilename, &length);
+  if (compressed == NULL) {
+    puts("Could not read compressed filter!");
+    return 0;
+  }
+
+  size_t bloom_size = decompressed_bloom_size(compressed, length);
+  if (bloom_size != (size_t)1 << (FILTER_BITS - 3)) {
+    printf("Expected decompressed size %d, got %d!\n",
+        1 << (FILTER_BITS - 3), (int)bloom_size);
+    return 0;
+  }
+
+  region *filters = new_region(bloom_size + 64);
+  arena *scratch = new_arena(1 << 10);
+  size_t filters_peak = 0, scratch_reserved = 0;
+
+  for (int cycle = 0; success && cycle < NUM_CYCLES; cycle++) {
+    byte *loaded[NUM_FILTERS];
+    for (int i = 0; i < NUM_FILTERS; i++) {
+      byte *copy = arena_alloc(scratch, length);
+      memcpy(copy, compressed, length);
+
+      loaded[i] = region_alloc(filters, bloom_size);
+      if (!decompress_bloom_into(copy, length, loaded[i], bloom_size)
+          || memcmp(loaded[i], bloom, bloom_size) != 0) {
+        puts("Decompressed filter does not match!");
+        success = 0;
+      }
+      arena_reset(scratch);
+    }
+
+    size_t peak = region_reserved(filters);
+    for (int i = 0; i < NUM_FILTERS; i++) {
+      region_free(filters, loaded[i]);
+    }
+
+    if (cycle == 0) {
+      filters_peak = peak;
+      scratch_reserved = arena_reserved(scratch);
+      if (filters_peak < NUM_FILTERS * bloom_size) {
+        printf("Reserved %d bytes for %d filters of %d bytes!\n",
+            (int)filters_peak, NUM_FILTERS, (int)bloom_size);
+        success = 0;
+      }
+    } else if (peak != filters_peak
+        || arena_reserved(scratch) != scratch_reserved) {
+      printf("Reserved memory changed on cycle %d!\n", cycle);
+      success = 0;
+    }
+    if (region_reserved(filters) != peak) {
+      printf("Freed filters were returned to the heap on cycle %d!\n", cycle);
+      success = 0;
+    }
+  }
+  printf("Reserved %d bytes for filters and %d for scratch over %d cycles\n",
+      (int)filters_peak, (int)scratch_reserved, NUM_CYCLES);
+
+  // Decompressing into a buffer of the wrong size must fail
+  byte *small = region_alloc(filters, bloom_size / 2);
+  if (decompress_bloom_into(compressed, length, small, bloom_size / 2)) {
+    puts("Decompressed into a buffer that was too small!");
+    success = 0;
+  }
+
+  free_region(filters);
+  free_arena(scratch);
+  free(compressed);
+  free_bloom(bloom);
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing arena allocators...\n");
+
+  success = success && test_arena();
+  success = success && test_region();
+  success = success && test_reset_cycles();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
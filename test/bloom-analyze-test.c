@@ -0,0 +1,170 @@
+/* test/bloom-analyze-test.c
+ *
+ * Run bloom-analyze on a known filter and a known set of negative keys, and
+ * check that it reports exactly the false positives found by looking each key
+ * up directly. Must be run from the repository root after building
+ * bin/bloom-analyze.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "canonicalize.h"
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+#define FILTER_BITS 16
+#define NUM_ADDED 4000
+#define NUM_NEGATIVES 20000
+
+// The file name has a quote in it to check that it is escaped in the output
+#define TEMPFILTER "/tmp/delete-\"analyze\".bloom"
+#define TEMPKEYS "/tmp/delete-analyze-keys.txt"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Write the raw (not yet canonical) URL for key i into buffer, returning its
+ * length. Keys that were added have tracking parameters that canonicalizing
+ * removes, and the rest have query strings that grow when they are
+ * percent-encoded, so canonical keys are both shorter and longer than the
+ * lines they come from.
+ */
+int make_key(char *buffer, int i) {
+  if (i < NUM_ADDED) {
+    return sprintf(buffer, "https://www.example.com/item?id=%d"
+        "&utm_source=news&utm_medium=link", i);
+  }
+  return sprintf(buffer, "https://other.example.com/s?q=%d"
+      "\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9", i);
+}
+
+
+/***
+ * Find the number in a line of JSON output like "  "name": 123,".
+ */
+int read_count(char *line, char *name, long long *count) {
+  char *found = strstr(line, name);
+  if (found == NULL || found[strlen(name)] != '"') {
+    return 0;
+  }
+  *count = strtoll(found + strlen(name) + 2, NULL, 10);
+  return 1;
+}
+
+
+/***
+ * Build a filter from the canonical added keys, then write every added key and
+ * every negative key to a file, and count how many of them are in the filter.
+ */
+long long make_files() {
+  char key[256];
+  char canonical[CANONICAL_MAX(256)];
+  byte *bloom = new_bloom(FILTER_BITS);
+  for (int i = 0; i < NUM_ADDED; i++) {
+    int length = make_key(key, i);
+    add_bloom(bloom, FILTER_BITS, (byte *)canonical,
+        canonicalize_url(key, length, canonical));
+  }
+  write_compressed_bloom(TEMPFILTER, bloom, FILTER_BITS);
+
+  long long positives = 0;
+  FILE *f = fopen(TEMPKEYS, "w");
+  for (int i = 0; i < NUM_ADDED + NUM_NEGATIVES; i++) {
+    int length = make_key(key, i);
+    fprintf(f, "%s\n", key);
+    positives += in_bloom(bloom, FILTER_BITS, (byte *)canonical,
+        canonicalize_url(key, length, canonical));
+  }
+  fclose(f);
+
+  free_bloom(bloom);
+  return positives;
+}
+
+
+/***
+ * The reported number of queries and positives must match the ones counted
+ * directly, on any number of threads, and the file name must be escaped.
+ */
+int test_counts() {
+  int success = 1;
+  long long expected = make_files();
+  if (expected < NUM_ADDED) {
+    puts("Added keys were not found in the filter!");
+    return 0;
+  }
+
+  for (int threads = 1; threads <= 3; threads++) {
+    char command[256];
+    sprintf(command, "bin/bloom-analyze --canonicalize --threads %d "
+        "--negatives %s '%s'", threads, TEMPKEYS, TEMPFILTER);
+    FILE *output = popen(command, "r");
+    if (output == NULL) {
+      puts("Unable to run bin/bloom-analyze!");
+      return 0;
+    }
+
+    char line[256];
+    long long queries = -1, positives = -1;
+    int escaped = 0;
+    while (fgets(line, sizeof(line), output) != NULL) {
+      read_count(line, "\"queries", &queries);
+      read_count(line, "\"false_positives", &positives);
+      escaped |= strstr(line, "\"filter\": \"/tmp/delete-\\\"analyze\\\""
+          ".bloom\"") != NULL;
+    }
+    if (pclose(output) != 0) {
+      puts("bin/bloom-analyze failed!");
+      success = 0;
+      break;
+    }
+
+    if (queries != NUM_ADDED + NUM_NEGATIVES || positives != expected) {
+      printf("Expected %d queries and %lld positives on %d threads, got %lld "
+          "and %lld!\n", NUM_ADDED + NUM_NEGATIVES, expected, threads,
+          queries, positives);
+      success = 0;
+    }
+    if (!escaped) {
+      puts("Filter name was not escaped in the output!");
+      success = 0;
+    }
+  }
+  printf("Found %lld false positives in %d negative keys\n",
+      expected - NUM_ADDED, NUM_NEGATIVES);
+
+  remove(TEMPFILTER);
+  remove(TEMPKEYS);
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing bloom-analyze...\n");
+
+  success = success && test_counts();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
@@ -0,0 +1,135 @@
+/* test/bloom-file-test.c
+ *
+ * Run tests on loading Bloom filter files in every format, including raw
+ * filters whose first bytes look like a gzip header. Reads and writes
+ * temporary files, so it only runs in a terminal.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom-file.h"
+#include "chunked-bloom.h"
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+#define FILTER_BITS 16
+#define NUM_KEYS 1000
+#define TEMPFILE "/tmp/delete-bloom-file.bloom"
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Write raw bytes to the temporary file.
+ */
+void write_raw(byte *data, size_t size) {
+  FILE *f = fopen(TEMPFILE, "wb");
+  fwrite(data, 1, size, f);
+  fclose(f);
+}
+
+
+/***
+ * Load the temporary file and check that it matches bloom exactly.
+ */
+int check_load(char *format, byte *bloom) {
+  uint8_t num_bits = 0;
+  byte *loaded = load_bloom_file(TEMPFILE, &num_bits, 2);
+  int matches = loaded != NULL && num_bits == FILTER_BITS
+    && memcmp(loaded, bloom, 1 << (FILTER_BITS - 3)) == 0;
+  if (!matches) {
+    printf("Loading a %s filter did not give back the same filter!\n", format);
+  }
+  free_bloom(loaded);
+  return matches;
+}
+
+
+
+/*******************************************************************************
+ * Test functions
+ ******************************************************************************/
+
+/***
+ * Raw, gzip, and chunked files of the same filter must all load as that
+ * filter.
+ */
+int test_formats() {
+  int success = 1;
+  char key[64];
+  byte *bloom = new_bloom(FILTER_BITS);
+  for (int i = 0; i < NUM_KEYS; i++) {
+    add_bloom(bloom, FILTER_BITS, (byte *)key,
+        sprintf(key, "//news.example.com/item/%d", i));
+  }
+
+  write_raw(bloom, 1 << (FILTER_BITS - 3));
+  success = check_load("raw", bloom) && success;
+  write_compressed_bloom(TEMPFILE, bloom, FILTER_BITS);
+  success = check_load("gzip", bloom) && success;
+  write_chunked_bloom(TEMPFILE, bloom, FILTER_BITS, 2);
+  success = check_load("chunked", bloom) && success;
+
+  free_bloom(bloom);
+  remove(TEMPFILE);
+  return success;
+}
+
+
+/***
+ * A raw filter is recognized by its size, even if it begins with the gzip
+ * magic bytes, and files that are neither must be rejected.
+ */
+int test_gzip_lookalike() {
+  int success = 1;
+  byte *bloom = new_bloom(FILTER_BITS);
+  memset(bloom, 0x5a, 1 << (FILTER_BITS - 3));
+  bloom[0] = 0x1f;
+  bloom[1] = 0x8b;
+  bloom[2] = 0x08;
+
+  write_raw(bloom, 1 << (FILTER_BITS - 3));
+  success = check_load("raw gzip lookalike", bloom) && success;
+
+  uint8_t num_bits;
+  write_raw(bloom, (1 << (FILTER_BITS - 3)) - 1);
+  byte *loaded = load_bloom_file(TEMPFILE, &num_bits, 1);
+  if (loaded != NULL) {
+    puts("Loaded a file that is neither raw nor compressed!");
+    free_bloom(loaded);
+    success = 0;
+  }
+
+  free_bloom(bloom);
+  remove(TEMPFILE);
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing Bloom filter files...\n");
+
+  success = success && test_formats();
+  success = success && test_gzip_lookalike();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
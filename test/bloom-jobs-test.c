@@ -0,0 +1,276 @@
+/* test/bloom-jobs-test.c
+ *
+ * Run tests on Bloom filter operations run on worker threads, checking that
+ * their results are identical to the same operations run directly. Will print
+ * to standard output if run in a terminal, will print to the browser console
+ * if compiled using emscripten and loaded into the browser.
+ */
+
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom-jobs.h"
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Write a distinct test key for index i into buffer, returning its length.
+ */
+int make_key(char *buffer, int i) {
+  return sprintf(buffer, "//news.example.com/item/%d", i);
+}
+
+
+/***
+ * Make a filter with num_keys keys, starting from key first.
+ */
+byte *make_filter(uint8_t num_bits, int first, int num_keys) {
+  char key[64];
+  byte *bloom = new_bloom(num_bits);
+  for (int i = first; i < first + num_keys; i++) {
+    add_bloom(bloom, num_bits, (byte *)key, make_key(key, i));
+  }
+  return bloom;
+}
+
+
+/***
+ * Read a whole file into a newly allocated buffer, storing its length.
+ */
+byte *read_file(char *filename, size_t *length) {
+  FILE *f;
+  if ((f = fopen(filename, "rb")) == NULL) {
+    return NULL;
+  }
+  fseek(f, 0l, SEEK_END);
+  *length = ftell(f);
+  rewind(f);
+  byte *buffer = (byte *)malloc(*length);
+  if (fread(buffer, 1, *length, f) != *length) {
+    free(buffer);
+    buffer = NULL;
+  }
+  fclose(f);
+  return buffer;
+}
+
+
+/***
+ * Poll a job until it is finished, as the extension does between events.
+ */
+job_state wait_job(int id) {
+  job_state state;
+  while ((state = poll_job(id)) == JOB_RUNNING) {
+    sched_yield();
+  }
+  return state;
+}
+
+
+
+/*******************************************************************************
+ * Test functions
+ ******************************************************************************/
+
+/***
+ * Filters decompressed by jobs must be identical to the originals, and invalid
+ * data must fail without stopping other jobs.
+ */
+int test_decompress() {
+  int success = 1;
+  char *tempfilename = "/tmp/delete-jobs.bloom";
+  uint8_t num_bits = 24;
+  size_t bloom_size = (size_t)1 << (num_bits - 3);
+  byte *bloom = make_filter(num_bits, 0, (1 << num_bits) / 64);
+  write_compressed_bloom(tempfilename, bloom, num_bits);
+
+  // Submit two jobs at once, one of which has a corrupted trailer
+  size_t length = 0;
+  byte *good = read_file(tempfilename, &length);
+  byte *bad = (byte *)malloc(length);
+  memcpy(bad, good, length);
+  bad[length - 1] ^= 0xff;
+  byte *out = (byte *)malloc(bloom_size);
+  byte *bad_out = (byte *)malloc(bloom_size);
+  int id = submit_decompress(good, length, out, bloom_size);
+  int bad_id = submit_decompress(bad, length, bad_out, bloom_size);
+
+  if (id < 0 || bad_id < 0 || id == bad_id) {
+    puts("Unable to submit decompression jobs!");
+    success = 0;
+  } else if (wait_job(id) != JOB_DONE
+      || job_result(id) != out || job_size(id) != bloom_size
+      || memcmp(out, bloom, bloom_size) != 0) {
+    puts("Decompressed filter differs!");
+    success = 0;
+  } else if (wait_job(bad_id) != JOB_FAILED) {
+    puts("Decompressed a corrupted filter!");
+    success = 0;
+  }
+
+  release_job(id);
+  release_job(bad_id);
+  free(out);
+  free(bad_out);
+
+  remove(tempfilename);
+  free_bloom(bloom);
+
+  return success;
+}
+
+
+/***
+ * Merges run as jobs must match merges run directly.
+ */
+int test_combine() {
+  int success = 1;
+  uint8_t num_bits = 20;
+  size_t bloom_size = (size_t)1 << (num_bits - 3);
+  byte *bloom = make_filter(num_bits, 0, 1000);
+  byte *new = make_filter(num_bits, 1000, 1000);
+  byte *expected = make_filter(num_bits, 0, 1000);
+  combine_bloom(expected, new, num_bits);
+
+  int id = submit_combine(bloom, new, num_bits);
+  if (id < 0 || wait_job(id) != JOB_DONE || job_result(id) != bloom
+      || memcmp(bloom, expected, bloom_size) != 0) {
+    puts("Combined filter differs!");
+    success = 0;
+  }
+  release_job(id);
+
+  free_bloom(bloom);
+  free_bloom(new);
+  free_bloom(expected);
+
+  return success;
+}
+
+
+/***
+ * Batch queries run as jobs must match in_bloom for every key, whether or not
+ * the last key ends in a newline, and with no keys at all.
+ */
+int test_batch() {
+  int success = 1;
+  uint8_t num_bits = 20;
+  int num_keys = 200;
+  byte *bloom = make_filter(num_bits, 0, num_keys / 2);
+
+  for (int trailing = 0; success && trailing < 2; trailing++) {
+    byte *keys = (byte *)malloc(num_keys * 64);
+    size_t length = 0;
+    for (int i = 0; i < num_keys; i++) {
+      length += make_key((char *)keys + length, i);
+      if (trailing || i < num_keys - 1) {
+        keys[length++] = '\n';
+      }
+    }
+
+    int id = submit_batch(bloom, num_bits, keys, length);
+    if (id < 0 || wait_job(id) != JOB_DONE
+        || job_size(id) != (size_t)num_keys) {
+      puts("Batch query failed!");
+      success = 0;
+    }
+    byte *bits = job_result(id);
+    char key[64];
+    for (int i = 0; success && i < num_keys; i++) {
+      int expected = in_bloom(bloom, num_bits, (byte *)key, make_key(key, i));
+      if (((bits[i / 8] >> (7 - i % 8)) & 1) != expected) {
+        printf("Batch query result %d differs!\n", i);
+        success = 0;
+      }
+    }
+    release_job(id);
+  }
+
+  int id = submit_batch(bloom, num_bits, (byte *)malloc(1), 0);
+  if (id < 0 || wait_job(id) != JOB_DONE || job_size(id) != 0) {
+    puts("Empty batch query failed!");
+    success = 0;
+  }
+  release_job(id);
+
+  free_bloom(bloom);
+
+  return success;
+}
+
+
+/***
+ * No more than MAX_JOBS jobs can be outstanding, and released ids are reused.
+ */
+int test_limits() {
+  int success = 1;
+  uint8_t num_bits = 10;
+  byte *bloom = make_filter(num_bits, 0, 10);
+
+  int ids[MAX_JOBS];
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if ((ids[i] = submit_batch(bloom, num_bits, (byte *)malloc(1), 0)) < 0) {
+      puts("Unable to submit the maximum number of jobs!");
+      success = 0;
+    }
+  }
+  byte *keys = (byte *)malloc(1);
+  if (submit_batch(bloom, num_bits, keys, 0) >= 0) {
+    puts("Submitted more than the maximum number of jobs!");
+    success = 0;
+  }
+
+  for (int i = 0; i < MAX_JOBS; i++) {
+    wait_job(ids[i]);
+    if (!release_job(ids[i]) || release_job(ids[i])) {
+      puts("Finished job released incorrectly!");
+      success = 0;
+    }
+  }
+  int id = submit_batch(bloom, num_bits, keys, 0);
+  if (id < 0) {
+    puts("Released job ids are not reused!");
+    success = 0;
+  }
+  wait_job(id);
+  release_job(id);
+
+  free_bloom(bloom);
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing Bloom filter jobs...\n");
+
+  puts("Testing decompression jobs...");
+  success = success && test_decompress();
+
+  puts("Testing merge jobs...");
+  success = success && test_combine();
+
+  puts("Testing batch query jobs...");
+  success = success && test_batch();
+
+  puts("Testing job limits...");
+  success = success && test_limits();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
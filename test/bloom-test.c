@@ -15,6 +15,10 @@
 
 #include "bloom.h"
 
+#ifdef BLOOM_STATS
+#include <pthread.h>
+#endif /* BLOOM_STATS */
+
 
 /*******************************************************************************
  * Constants (strings for testing)
@@ -322,6 +326,204 @@ int test_combine() {
 }
 
 
+/***
+ * Test that batch lookups agree with one-at-a-time lookups, for batch sizes
+ * that are and are not multiples of the group size.
+ */
+int test_batch() {
+  int success = 1;
+
+  uint8_t size = 20;
+  byte *bloom = new_bloom(size);
+  success = success && test_in(bloom, size, input2, 5);
+  success = success && test_in(bloom, size, input4, 17);
+  success = success && test_in(bloom, size, input6, 4);
+
+  char **inputs[] = { input1, input2, input3, input4, input5, input6, input7 };
+  int lens[] = { 1, 5, 4, 17, 8, 4, 4 };
+  byte *keys[43];
+  uint32_t lengths[43];
+  size_t n = 0;
+  for (int i = 0; i < 7; i++) {
+    for (int j = 0; j < lens[i]; j++) {
+      keys[n] = (byte *)inputs[i][j];
+      lengths[n] = strlen(inputs[i][j]);
+      n++;
+    }
+  }
+
+  for (size_t count = 0; count <= n; count++) {
+    byte out_bits[6];
+    memset(out_bits, 0xaa, sizeof(out_bits));
+    in_bloom_batch(bloom, size, keys, lengths, count, out_bits);
+    for (size_t i = 0; i < count; i++) {
+      int expected = in_bloom(bloom, size, keys[i], lengths[i]);
+      int got = (out_bits[i >> 3] >> (7 - (i & 0x7))) & 1;
+      if (expected != got) {
+        printf("Batch lookup disagrees for:\n%s\n", (char *)keys[i]);
+        success = 0;
+        break;
+      }
+    }
+  }
+
+  free_bloom(bloom);
+
+  return success;
+}
+
+
+/***
+ * Test that the fill ratio counts exactly the bits that are set.
+ */
+int test_fill_ratio() {
+  int success = 1;
+
+  uint8_t size = 12;
+  byte *bloom = new_bloom(size);
+  if (fill_ratio(bloom, size) != 0) {
+    puts("Empty Bloom filter has bits set!");
+    success = 0;
+  }
+
+  // Set one bit in each byte except the last, and every bit in the last
+  size_t num_bytes = 1 << (size - 3);
+  for (size_t i = 0; i < num_bytes - 1; i++) {
+    bloom[i] = 1 << (i & 0x7);
+  }
+  bloom[num_bytes - 1] = 0xff;
+  double expected = (double)(num_bytes - 1 + 8) / (num_bytes * 8);
+  if (fill_ratio(bloom, size) != expected) {
+    printf("Fill ratio is %f when %f was expected!\n",
+        fill_ratio(bloom, size), expected);
+    success = 0;
+  }
+
+  free_bloom(bloom);
+
+  return success;
+}
+
+
+/***
+ * Test that the measured false positive rate of a heavily loaded filter is
+ * close to the rate expected from how many of its bits are set, which is the
+ * fill ratio to the power of NUM_HASHES.
+ */
+int test_false_positives() {
+  int success = 1;
+
+  uint8_t size = 16;
+  int num_keys = 4000;
+  int trials = 200000;
+  byte *bloom = new_bloom(size);
+  char key[64];
+  for (int i = 0; i < num_keys; i++) {
+    add_bloom(bloom, size, (byte *)key,
+        sprintf(key, "//news.example.com/item?id=%d", i));
+  }
+
+  int false_positives = 0;
+  for (int i = 0; i < trials; i++) {
+    false_positives += in_bloom(bloom, size, (byte *)key,
+        sprintf(key, "//other.example.com/item?id=%d", i));
+  }
+  double measured = (double)false_positives / trials;
+  double expected = 1;
+  for (int i = 0; i < NUM_HASHES; i++) {
+    expected *= fill_ratio(bloom, size);
+  }
+  printf("False positive rate %f, expected %f\n", measured, expected);
+  if (measured < expected / 2 || measured > expected * 3 / 2) {
+    puts("False positive rate is too far from the expected rate!");
+    success = 0;
+  }
+
+  free_bloom(bloom);
+
+  return success;
+}
+
+
+#ifdef BLOOM_STATS
+#define STATS_THREADS 4
+#define STATS_LOOKUPS 20000
+
+/***
+ * Look up the same key over and over, to count lookups from several threads.
+ */
+void *lookup_thread(void *bloom) {
+  for (int i = 0; i < STATS_LOOKUPS; i++) {
+    (void)in_bloom((byte *)bloom, 16, (byte *)input6[0], strlen(input6[0]));
+  }
+  return NULL;
+}
+
+
+/***
+ * Test that each operation is counted, along with the keys found by lookups.
+ */
+int test_stats() {
+  int success = 1;
+
+  uint8_t size = 16;
+  byte *bloom = new_bloom(size);
+  reset_bloom_stats();
+  for (int i = 0; i < 4; i++) {
+    add_bloom(bloom, size, (byte *)input6[i], strlen(input6[i]));
+  }
+  for (int i = 0; i < 4; i++) {
+    (void)in_bloom(bloom, size, (byte *)input6[i], strlen(input6[i]));
+    (void)in_bloom(bloom, size, (byte *)input7[i], strlen(input7[i]));
+  }
+  combine_bloom(bloom, bloom, size);
+
+  bloom_stats *stats = get_bloom_stats();
+  op_stats *in = &stats->ops[STATS_IN];
+  if (stats->ops[STATS_ADD].calls != 4 || in->calls != 8 || in->keys != 8
+      || in->hits < 4 || stats->ops[STATS_COMBINE].calls != 1
+      || stats->ops[STATS_DECOMPRESS].calls != 0) {
+    puts("Operations were not counted correctly!");
+    success = 0;
+  }
+
+  uint64_t histogram_calls = 0;
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    histogram_calls += in->histogram[i];
+  }
+  if (histogram_calls != in->calls) {
+    puts("Latency histogram does not account for every call!");
+    success = 0;
+  }
+
+  reset_bloom_stats();
+  if (stats->ops[STATS_ADD].calls != 0) {
+    puts("Statistics were not reset!");
+    success = 0;
+  }
+
+  // No counts are lost when several threads look up keys at once
+  pthread_t threads[STATS_THREADS];
+  for (int i = 0; i < STATS_THREADS; i++) {
+    pthread_create(&threads[i], NULL, lookup_thread, bloom);
+  }
+  for (int i = 0; i < STATS_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  if (in->calls != STATS_THREADS * STATS_LOOKUPS
+      || in->keys != STATS_THREADS * STATS_LOOKUPS) {
+    printf("Counted %d lookups from %d threads, expected %d!\n",
+        (int)in->calls, STATS_THREADS, STATS_THREADS * STATS_LOOKUPS);
+    success = 0;
+  }
+
+  free_bloom(bloom);
+
+  return success;
+}
+#endif /* BLOOM_STATS */
+
+
 
 /*******************************************************************************
  * Main function
@@ -343,7 +545,7 @@ int main(int argc, char *argv[]) {
     success = success && test_new_bloom(bloom, i);
 
     // Write a compressed version, then read it back and decompress it
-    size_t new_size;
+    size_t new_size = 0;
     success = success && test_compression(&bloom, i, &new_size);
     if (new_size != (size_t)(1 << (i - 3))) {
       printf("New Bloom filter has size %d when size %d was expected!\n",
@@ -366,9 +568,19 @@ int main(int argc, char *argv[]) {
   // Test combining Bloom filters
   success = success && test_combine();
 
-  // TODO: Add tests that create new bloom filters and generate many strings
-  // over and over, confirming that over time the average converges to the
-  // expected theoretical number of collisions
+  // Test batch lookups
+  success = success && test_batch();
+
+  // Test measuring how full a filter is
+  success = success && test_fill_ratio();
+
+  // Test that the false positive rate matches how full the filter is
+  success = success && test_false_positives();
+
+#ifdef BLOOM_STATS
+  // Test counting and timing operations
+  success = success && test_stats();
+#endif /* BLOOM_STATS */
 
   puts(success ? "Success!" : "Failure!");
   puts("");
@@ -0,0 +1,209 @@
+/* test/chunked-bloom-test.c
+ *
+ * Run tests on chunked containers of compressed Bloom filters, including that
+ * filters decompressed on any number of threads are identical to the
+ * original. Will print to standard output if run in a terminal, will print to
+ * the browser console if compiled using emscripten and loaded into the
+ * browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunked-bloom.h"
+#include "murmur.h"
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Write a distinct test key for index i into buffer, returning its length.
+ */
+int make_key(char *buffer, int i) {
+  return sprintf(buffer, "//news.example.com/item/%d", i);
+}
+
+
+/***
+ * Read a whole file into a newly allocated buffer, storing its length.
+ */
+byte *read_file(char *filename, size_t *length) {
+  FILE *f;
+  if ((f = fopen(filename, "rb")) == NULL) {
+    return NULL;
+  }
+  fseek(f, 0l, SEEK_END);
+  *length = ftell(f);
+  rewind(f);
+  byte *buffer = (byte *)malloc(*length);
+  if (fread(buffer, 1, *length, f) != *length) {
+    free(buffer);
+    buffer = NULL;
+  }
+  fclose(f);
+  return buffer;
+}
+
+
+/***
+ * Build a filter with some keys, write it out as a chunked container on the
+ * given number of threads, and read the container back in.
+ */
+byte *make_filter(char *tempfilename, uint8_t num_bits, int num_keys,
+    int threads, byte **bloom, size_t *length) {
+  char key[64];
+  *bloom = new_bloom(num_bits);
+  for (int i = 0; i < num_keys; i++) {
+    add_bloom(*bloom, num_bits, (byte *)key, make_key(key, i));
+  }
+  write_chunked_bloom(tempfilename, *bloom, num_bits, threads);
+  return read_file(tempfilename, length);
+}
+
+
+/***
+ * Filters written and read on any number of threads, whether smaller than
+ * one chunk or split into many, must come back exactly as they went in, and
+ * each chunk must decompress on its own.
+ */
+int test_round_trip(uint8_t num_bits) {
+  int success = 1;
+  char *tempfilename = "/tmp/delete-chunked.bloom";
+  int threads[] = { 1, 3, 8 };
+  size_t bloom_size = (size_t)1 << (num_bits - 3);
+  // About a third of the bits are set, as in the published filters. Sparser
+  // filters are much slower to compress at level 9.
+  int num_keys = (1 << num_bits) / 64;
+
+  for (int t = 0; success && t < 3; t++) {
+    byte *bloom;
+    size_t length = 0;
+    byte *data = make_filter(tempfilename, num_bits, num_keys, threads[t],
+        &bloom, &length);
+    if (data == NULL || chunked_bloom_bits(data, length) != num_bits) {
+      printf("Chunked filter of size %d is not valid!\n", (int)num_bits);
+      success = 0;
+    }
+
+    byte *decompressed = (byte *)malloc(bloom_size);
+    for (int r = 0; success && r < 3; r++) {
+      memset(decompressed, 0xff, bloom_size);
+      if (!decompress_chunked_bloom(data, length, decompressed, threads[r])
+          || memcmp(decompressed, bloom, bloom_size) != 0) {
+        printf("Filter of size %d written on %d threads and read on %d "
+            "threads differs!\n", (int)num_bits, threads[t], threads[r]);
+        success = 0;
+      }
+    }
+
+    // Check a key by only decompressing the chunks its bits fall in
+    char key[64];
+    int key_length = make_key(key, num_keys / 2);
+    memset(decompressed, 0, bloom_size);
+    for (int i = 0; success && i < NUM_HASHES; i++) {
+      uint32_t index = murmur3((byte *)key, key_length, i) >> (32 - num_bits);
+      if (!decompress_chunk(data, length, decompressed,
+            chunk_of_bit(data, index))) {
+        puts("Unable to decompress a single chunk!");
+        success = 0;
+      }
+    }
+    if (success && !in_bloom(decompressed, num_bits, (byte *)key,
+          key_length)) {
+      puts("Key not found after decompressing only its chunks!");
+      success = 0;
+    }
+
+    free(decompressed);
+    free(data);
+    free_bloom(bloom);
+  }
+
+  remove(tempfilename);
+
+  return success;
+}
+
+
+/***
+ * Empty chunks take no space in the file, and truncated or corrupted data
+ * must be rejected rather than read out of bounds.
+ */
+int test_format() {
+  int success = 1;
+  char *tempfilename = "/tmp/delete-chunked.bloom";
+  uint8_t num_bits = 27;
+
+  byte *bloom;
+  size_t length = 0;
+  byte *data = make_filter(tempfilename, num_bits, 0, 4, &bloom, &length);
+  size_t expected = CHUNKED_HEADER_SIZE
+    + CHUNKED_INDEX_SIZE((size_t)1 << (num_bits - 3 - CHUNK_BITS));
+  if (length != expected) {
+    printf("Empty filter is %d bytes, expected %d!\n", (int)length,
+        (int)expected);
+    success = 0;
+  }
+  free(data);
+  free_bloom(bloom);
+
+  data = make_filter(tempfilename, 16, 100, 1, &bloom, &length);
+  if (chunked_bloom_bits(data, length - 1) != 0) {
+    puts("Accepted a truncated filter!");
+    success = 0;
+  }
+  data[7] ^= 0xff;
+  if (chunked_bloom_bits(data, length) != 0) {
+    puts("Accepted a filter with a different number of hashes!");
+    success = 0;
+  }
+  data[7] ^= 0xff;
+  data[0] ^= 0xff;
+  if (chunked_bloom_bits(data, length) != 0) {
+    puts("Accepted a filter with the wrong magic number!");
+    success = 0;
+  }
+
+  // Decompressing an invalid container must fail cleanly
+  byte *out = new_bloom(16);
+  if (decompress_chunked_bloom(data, length, out, 2)) {
+    puts("Decompressed an invalid chunked filter!");
+    success = 0;
+  }
+
+  free(out);
+  free(data);
+  free_bloom(bloom);
+  remove(tempfilename);
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing chunked Bloom filter containers...\n");
+
+  uint8_t sizes[] = { 9, 16, CHUNK_BITS + 3, CHUNK_BITS + 4 };
+  for (size_t i = 0; success && i < sizeof(sizes); i++) {
+    printf("Testing a chunked filter of size %d...\n", (int)sizes[i]);
+    success = success && test_round_trip(sizes[i]);
+  }
+
+  success = success && test_format();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
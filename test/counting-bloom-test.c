@@ -0,0 +1,225 @@
+/* test/counting-bloom-test.c
+ *
+ * Run tests on the counting Bloom filter implementation. Will print to
+ * standard output if run in a terminal, will print to the browser console if
+ * compiled using emscripten and loaded into the browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "counting-bloom.h"
+
+
+/*******************************************************************************
+ * Constants (strings for testing)
+ ******************************************************************************/
+
+// Sweet Disposition - The Temper Trap
+char *kept[] = {
+  "Sweet disposition",
+  "Never too soon",
+  "Oh, reckless abandon",
+  "Like no one's watching you"
+};
+// Midnight City - M83
+char *removed[] = {
+  "Waiting in a car",
+  "Waiting for a ride in the dark",
+  "The night city grows",
+  "Look and see her eyes, they glow"
+};
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Return 1 if every string is (or is not) in the counting filter as expected.
+ */
+int check_all(byte *counts, uint8_t size, char *strings[], int len,
+    int expected) {
+  for (int i = 0; i < len; i++) {
+    if (in_counting_bloom(counts, size, (byte *)strings[i], strlen(strings[i]))
+        != expected) {
+      printf("Expected %s:\n%s\n", expected ? "present" : "absent", strings[i]);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+/***
+ * Add, remove, and re-check strings in a counting filter of the given size.
+ */
+int test_add_remove(uint8_t size) {
+  int success = 1;
+  byte *counts = new_counting_bloom(size);
+
+  success = success && check_all(counts, size, kept, 4, 0);
+  success = success && check_all(counts, size, removed, 4, 0);
+
+  for (int i = 0; i < 4; i++) {
+    add_counting_bloom(counts, size, (byte *)kept[i], strlen(kept[i]));
+    add_counting_bloom(counts, size, (byte *)removed[i], strlen(removed[i]));
+  }
+  success = success && check_all(counts, size, kept, 4, 1);
+  success = success && check_all(counts, size, removed, 4, 1);
+
+  for (int i = 0; i < 4; i++) {
+    if (!remove_counting_bloom(counts, size, (byte *)removed[i],
+          strlen(removed[i]))) {
+      printf("Failed to remove:\n%s\n", removed[i]);
+      success = 0;
+    }
+  }
+  success = success && check_all(counts, size, kept, 4, 1);
+  success = success && check_all(counts, size, removed, 4, 0);
+
+  // Removing something that is not there must fail and change nothing
+  if (remove_counting_bloom(counts, size, (byte *)removed[0],
+        strlen(removed[0]))) {
+    puts("Removed a string that was not in the filter!");
+    success = 0;
+  }
+  success = success && check_all(counts, size, kept, 4, 1);
+
+  free_counting_bloom(counts);
+
+  if (!success) {
+    printf("Counting Bloom filter test failed for size %d!\n", (int)size);
+  }
+
+  return success;
+}
+
+
+/***
+ * Converting to a plain filter must give the same answers as adding directly
+ * to a plain filter.
+ */
+int test_convert(uint8_t size) {
+  int success = 1;
+  byte *counts = new_counting_bloom(size);
+  byte *expected = new_bloom(size);
+
+  for (int i = 0; i < 4; i++) {
+    add_counting_bloom(counts, size, (byte *)kept[i], strlen(kept[i]));
+    add_bloom(expected, size, (byte *)kept[i], strlen(kept[i]));
+  }
+
+  byte *bloom = counting_to_bloom(counts, size);
+  if (memcmp(bloom, expected, (size_t)1 << (size - 3)) != 0) {
+    puts("Converted Bloom filter does not match the expected filter!");
+    success = 0;
+  }
+
+  free_bloom(bloom);
+  free_bloom(expected);
+  free_counting_bloom(counts);
+
+  return success;
+}
+
+
+/***
+ * Compare the (possibly vectorized) merge against a counter-by-counter one,
+ * including counters that saturate.
+ */
+int test_combine(uint8_t size) {
+  int success = 1;
+  size_t num_bytes = (size_t)1 << (size - 1);
+  byte *a = new_counting_bloom(size);
+  byte *b = new_counting_bloom(size);
+
+  srand(size);
+  for (size_t i = 0; i < num_bytes; i++) {
+    a[i] = rand() & 0xff;
+    b[i] = rand() & 0xff;
+  }
+
+  byte *expected = malloc(num_bytes);
+  for (size_t i = 0; i < num_bytes; i++) {
+    int hi = (a[i] >> 4) + (b[i] >> 4);
+    int lo = (a[i] & 0xf) + (b[i] & 0xf);
+    hi = hi > COUNTER_MAX ? COUNTER_MAX : hi;
+    lo = lo > COUNTER_MAX ? COUNTER_MAX : lo;
+    expected[i] = (hi << 4) | lo;
+  }
+
+  combine_counting_bloom(a, b, size);
+  if (memcmp(a, expected, num_bytes) != 0) {
+    printf("Combined counting filter of size %d is incorrect!\n", (int)size);
+    success = 0;
+  }
+
+  free(expected);
+  free_counting_bloom(a);
+  free_counting_bloom(b);
+
+  return success;
+}
+
+
+/***
+ * Adding the same element more times than a counter can hold must saturate,
+ * and saturated counters must never be decremented.
+ */
+int test_saturation() {
+  int success = 1;
+  uint8_t size = 12;
+  byte *counts = new_counting_bloom(size);
+
+  for (int i = 0; i < 2 * COUNTER_MAX; i++) {
+    add_counting_bloom(counts, size, (byte *)kept[0], strlen(kept[0]));
+  }
+  for (int i = 0; i < 2 * COUNTER_MAX; i++) {
+    remove_counting_bloom(counts, size, (byte *)kept[0], strlen(kept[0]));
+  }
+  success = success && check_all(counts, size, kept, 1, 1);
+
+  free_counting_bloom(counts);
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing counting Bloom filter library...\n");
+
+  for (uint8_t i = 9; i < 24; i++) {
+    printf("Testing a counting Bloom filter of size %d...\n", (int)i);
+    success = success && test_add_remove(i);
+    success = success && test_convert(i);
+    success = success && test_combine(i);
+
+    if (!success) {
+      break;
+    }
+  }
+
+  // Merging tiny filters only exercises the non-vectorized path
+  success = success && test_combine(1);
+  success = success && test_combine(4);
+
+  success = success && test_saturation();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
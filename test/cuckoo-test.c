@@ -0,0 +1,155 @@
+/* test/cuckoo-test.c
+ *
+ * Run tests on the cuckoo filter implementation. Will print to standard
+ * output if run in a terminal, will print to the browser console if compiled
+ * using emscripten and loaded into the browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuckoo.h"
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Write a distinct test key for index i into buffer, returning its length.
+ */
+int make_key(char *buffer, int i) {
+  return sprintf(buffer, "//example.com/story/%d", i);
+}
+
+
+/***
+ * Fill a filter to the given load factor, then check that every key is found
+ * with the right value, that values can be updated, and that keys can be
+ * deleted.
+ */
+int test_fill(uint8_t num_bits, double load) {
+  int success = 1;
+  char key[64];
+  cuckoo *filter = new_cuckoo(num_bits);
+  int n = (int)(load * (1 << num_bits) * CUCKOO_SLOTS);
+
+  for (int i = 0; i < n; i++) {
+    int length = make_key(key, i);
+    if (!insert_cuckoo(filter, (byte *)key, length, i % CUCKOO_VALUE_MAX)) {
+      printf("Insert %d of %d failed at load %f!\n", i, n, load);
+      success = 0;
+      break;
+    }
+  }
+  if (success && filter->count != (uint32_t)n) {
+    printf("Expected count %d, got %u!\n", n, filter->count);
+    success = 0;
+  }
+
+  for (int i = 0; success && i < n; i++) {
+    int length = make_key(key, i);
+    if (lookup_cuckoo(filter, (byte *)key, length) != i % CUCKOO_VALUE_MAX) {
+      printf("False negative or wrong value:\n%s\n", key);
+      success = 0;
+    }
+  }
+
+  // Updating a value must not add a second entry
+  for (int i = 0; success && i < n; i += 2) {
+    int length = make_key(key, i);
+    insert_cuckoo(filter, (byte *)key, length, CUCKOO_VALUE_MAX);
+    if (lookup_cuckoo(filter, (byte *)key, length) != CUCKOO_VALUE_MAX) {
+      printf("Value not updated:\n%s\n", key);
+      success = 0;
+    }
+  }
+  if (success && filter->count != (uint32_t)n) {
+    printf("Updating values changed the count to %u!\n", filter->count);
+    success = 0;
+  }
+
+  // Delete the odd keys, the even keys must remain
+  for (int i = 1; success && i < n; i += 2) {
+    int length = make_key(key, i);
+    if (!delete_cuckoo(filter, (byte *)key, length)) {
+      printf("Failed to delete:\n%s\n", key);
+      success = 0;
+    }
+  }
+  for (int i = 0; success && i < n; i += 2) {
+    int length = make_key(key, i);
+    if (lookup_cuckoo(filter, (byte *)key, length) != CUCKOO_VALUE_MAX) {
+      printf("False negative after deletion:\n%s\n", key);
+      success = 0;
+    }
+  }
+
+  free_cuckoo(filter);
+
+  return success;
+}
+
+
+/***
+ * Keys that were never inserted should almost never be found. With 28-bit
+ * fingerprints and 8 slots probed, a handful of false positives in a million
+ * lookups would already be far above the expected rate.
+ */
+int test_false_positives() {
+  char key[64];
+  uint8_t num_bits = 14;
+  cuckoo *filter = new_cuckoo(num_bits);
+  int n = (1 << num_bits) * 3;
+
+  for (int i = 0; i < n; i++) {
+    int length = make_key(key, i);
+    insert_cuckoo(filter, (byte *)key, length, 1);
+  }
+
+  int false_positives = 0;
+  for (int i = n; i < n + 1000000; i++) {
+    int length = make_key(key, i);
+    false_positives += lookup_cuckoo(filter, (byte *)key, length) != -1;
+  }
+  free_cuckoo(filter);
+
+  printf("%d false positives in 1000000 lookups\n", false_positives);
+  return false_positives < 10;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing cuckoo filter library...\n");
+
+  if (new_cuckoo(0) != NULL || new_cuckoo(28) != NULL) {
+    puts("Invalid sizes should not allocate a filter!");
+    success = 0;
+  }
+
+  for (uint8_t i = 4; i < 18; i++) {
+    printf("Testing a cuckoo filter of size %d...\n", (int)i);
+    success = success && test_fill(i, 0.5);
+    success = success && test_fill(i, 0.9);
+
+    if (!success) {
+      break;
+    }
+  }
+
+  success = success && test_false_positives();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
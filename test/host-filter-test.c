@@ -0,0 +1,160 @@
+/* test/host-filter-test.c
+ *
+ * Run tests on the host-level filter that is checked in front of the URL
+ * filter. Will print to standard output if run in a terminal, will print to
+ * the browser console if compiled using emscripten and loaded into the
+ * browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host-filter.h"
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+#define URL_BITS 24
+#define HOST_BITS 16
+#define NUM_HOSTS 2000
+#define URLS_PER_HOST 10
+
+
+
+/*******************************************************************************
+ * Test functions
+ ******************************************************************************/
+
+/***
+ * Hosts must be found in canonical URLs, with or without a scheme.
+ */
+int test_url_host() {
+  int success = 1;
+
+  struct { char *url; char *host; } cases[] = {
+    { "//example.com/path", "example.com" },
+    { "//example.com", "example.com" },
+    { "//example.com:8080/a/b", "example.com:8080" },
+    { "//example.com?q=1", "example.com" },
+    { "//example.com#top", "example.com" },
+    { "https://example.com/path", "example.com" },
+    { "example.com/path", "example.com" },
+    { "example.com:8080/path", "example.com:8080" },
+    { "//", "" },
+    { "", "" },
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    byte *host;
+    uint32_t length = url_host((byte *)cases[i].url, strlen(cases[i].url),
+        &host);
+    if (length != strlen(cases[i].host)
+        || memcmp(host, cases[i].host, length) != 0) {
+      printf("Found host \"%.*s\" in \"%s\", expected \"%s\"!\n", (int)length,
+          host, cases[i].url, cases[i].host);
+      success = 0;
+    }
+  }
+
+  return success;
+}
+
+
+/***
+ * Every added URL must still be found through the host filter, and most URLs
+ * on hosts that were never added must be rejected by the host filter alone.
+ */
+int test_lookups() {
+  int success = 1;
+  char url[128];
+
+  byte *bloom = new_bloom(URL_BITS);
+  byte *hosts = new_bloom(HOST_BITS);
+  for (int h = 0; h < NUM_HOSTS; h++) {
+    for (int i = 0; i < URLS_PER_HOST; i++) {
+      int length = sprintf(url, "//site%d.example.com/story/%d", h, i);
+      add_bloom(bloom, URL_BITS, (byte *)url, length);
+      add_url_host(hosts, HOST_BITS, (byte *)url, length);
+    }
+  }
+
+  for (int h = 0; success && h < NUM_HOSTS; h++) {
+    for (int i = 0; i < URLS_PER_HOST; i++) {
+      int length = sprintf(url, "//site%d.example.com/story/%d", h, i);
+      if (!in_bloom_with_hosts(hosts, HOST_BITS, bloom, URL_BITS, (byte *)url,
+            length)) {
+        printf("False negative:\n%s\n", url);
+        success = 0;
+        break;
+      }
+    }
+  }
+
+  // New URLs on known hosts fall through to the URL filter
+  int length = sprintf(url, "//site0.example.com/story/%d", URLS_PER_HOST);
+  if (in_bloom_with_hosts(hosts, HOST_BITS, bloom, URL_BITS, (byte *)url,
+        length) != in_bloom(bloom, URL_BITS, (byte *)url, length)) {
+    puts("Lookup on a known host did not match the URL filter!");
+    success = 0;
+  }
+
+  int trials = 100000;
+  int host_positives = 0;
+  for (int h = NUM_HOSTS; h < NUM_HOSTS + trials; h++) {
+    length = sprintf(url, "//site%d.example.com/story/0", h);
+    byte *host;
+    uint32_t host_length = url_host((byte *)url, length, &host);
+    host_positives += in_host_filter(hosts, HOST_BITS, host, host_length);
+  }
+  printf("Host filter false positive rate %f\n",
+      (double)host_positives / trials);
+  if (host_positives > trials / 100) {
+    puts("Host filter false positive rate is too high!");
+    success = 0;
+  }
+
+  free_bloom(bloom);
+  free_bloom(hosts);
+
+  return success;
+}
+
+
+/***
+ * A filter of a single block must work, since there are no block index bits.
+ */
+int test_single_block() {
+  byte *hosts = new_bloom(HOST_BLOCK_BITS);
+  add_host_filter(hosts, HOST_BLOCK_BITS, (byte *)"example.com", 11);
+  int found = in_host_filter(hosts, HOST_BLOCK_BITS, (byte *)"example.com",
+      11);
+  free_bloom(hosts);
+  if (!found) {
+    puts("Host not found in a single-block filter!");
+  }
+  return found;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing host filter...\n");
+
+  success = success && test_url_host();
+  success = success && test_lookups();
+  success = success && test_single_block();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
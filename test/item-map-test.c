@@ -0,0 +1,241 @@
+/* test/item-map-test.c
+ *
+ * Run tests on the map from story URLs to Hacker News item ids, built from a
+ * small fixture of stories the same way bloom-create builds it, and from many
+ * generated stories. Will print to standard output if run in a terminal, will
+ * print to the browser console if compiled using emscripten and loaded into
+ * the browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canonicalize.h"
+#include "item-map.h"
+#include "record-reader.h"
+
+
+/*******************************************************************************
+ * Types and constants
+ ******************************************************************************/
+
+char *field_names[NUM_FIELDS] = { "url", "score", "time", "id" };
+
+// Stories in the format exported from BigQuery, including the same URL
+// submitted more than once, in different forms that canonicalize the same
+char *fixture =
+  "id,url,score,time\n"
+  "8863,http://www.getdropbox.com/u/2/screencast.html,111,1175714200\n"
+  "121003,https://www.example.com/post?utm_source=hn,3,1203000000\n"
+  "121004,https://example.com/post,57,1203000100\n"
+  "121005,http://example.com/post/,57,1203000200\n"
+  "1,http://ycombinator.com,57,1160418111\n"
+  "2,,10,1160418628\n"
+  "3,https://news.example.org/story/3,0,1160419000\n";
+
+struct expected {
+  char *url;
+  uint32_t id;
+};
+
+// URLs as they might be visited, and the discussion each should find
+struct expected fixture_expected[] = {
+  { "https://www.getdropbox.com/u/2/screencast.html", 8863 },
+  // The highest scoring submission wins, and the earliest of those tied
+  { "https://example.com/post", 121004 },
+  { "http://www.example.com/post/?utm_source=twitter", 121004 },
+  { "https://ycombinator.com/", 1 },
+  { "https://news.example.org/story/3", 3 },
+  { "https://news.example.org/story/4", 0 },
+  { "https://example.com/", 0 },
+};
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Canonicalize a URL and look it up in the map.
+ */
+uint32_t lookup_url(byte *map, char *url) {
+  char *canonical = (char *)malloc(CANONICAL_MAX(strlen(url)));
+  size_t length = canonicalize_url(url, strlen(url), canonical);
+  uint32_t id = lookup_item_map(map, (byte *)canonical, length);
+  free(canonical);
+  return id;
+}
+
+
+/***
+ * Write a distinct test key for index i into buffer, returning its length.
+ */
+int make_key(char *buffer, int i) {
+  return sprintf(buffer, "//news.example.com/item/%d", i);
+}
+
+
+
+/*******************************************************************************
+ * Test functions
+ ******************************************************************************/
+
+/***
+ * Build a map from the fixture the way bloom-create does, write it out, read
+ * it back, and check that each URL finds the right discussion.
+ */
+int test_fixture() {
+  int success = 1;
+  char *tempfilename = "/tmp/delete-item-map.csv";
+  char *mapfilename = "/tmp/delete-item-map.map";
+  FILE *f = fopen(tempfilename, "wb");
+  fputs(fixture, f);
+  fclose(f);
+
+  record_reader *reader = open_record_reader(tempfilename, FORMAT_CSV,
+      field_names);
+  item_map_builder *builder = new_item_map_builder();
+  record r;
+  int status;
+  while ((status = next_record(reader, &r)) != 0) {
+    if (status < 0 || r.fields[FIELD_URL] == NULL || r.lengths[FIELD_URL] == 0
+        || r.fields[FIELD_ID] == NULL) {
+      continue;
+    }
+    int64_t id, score;
+    if (!parse_score(r.fields[FIELD_ID], r.lengths[FIELD_ID], &id)
+        || !parse_score(r.fields[FIELD_SCORE], r.lengths[FIELD_SCORE],
+          &score)) {
+      continue;
+    }
+    char canonical[CANONICAL_MAX(256)];
+    size_t length = canonicalize_url(r.fields[FIELD_URL], r.lengths[FIELD_URL],
+        canonical);
+    add_item_map(builder, (byte *)canonical, length, id, score);
+  }
+  close_record_reader(reader);
+  write_item_map(mapfilename, builder);
+  free_item_map_builder(builder);
+
+  // Read the map back the way the extension does
+  f = fopen(mapfilename, "rb");
+  fseek(f, 0l, SEEK_END);
+  size_t size = ftell(f);
+  rewind(f);
+  byte *map = (byte *)malloc(size);
+  if (fread(map, 1, size, f) != size) {
+    puts("Unable to read the map back!");
+    success = 0;
+  }
+  fclose(f);
+  if (!valid_item_map(map, size) || item_map_count(map) != 4) {
+    puts("Map built from the fixture is not valid!");
+    success = 0;
+  }
+
+  for (size_t i = 0; success
+      && i < sizeof(fixture_expected) / sizeof(fixture_expected[0]); i++) {
+    uint32_t id = lookup_url(map, fixture_expected[i].url);
+    if (id != fixture_expected[i].id) {
+      printf("Found item %u for %s, expected %u!\n", id,
+          fixture_expected[i].url, fixture_expected[i].id);
+      success = 0;
+    }
+  }
+
+  free(map);
+  remove(tempfilename);
+  remove(mapfilename);
+
+  return success;
+}
+
+
+/***
+ * Every story in a large map must be found with its id, and stories that are
+ * not in it must not be. Large maps must take less than 7 bytes per story,
+ * and truncated or corrupt maps must be rejected.
+ */
+int test_many(int num_keys) {
+  int success = 1;
+  char key[64];
+  item_map_builder *builder = new_item_map_builder();
+  for (int i = 0; i < num_keys; i++) {
+    add_item_map(builder, (byte *)key, make_key(key, i), 40000000 - i, 0);
+  }
+  size_t size;
+  byte *map = build_item_map(builder, &size);
+  free_item_map_builder(builder);
+
+  if (map == NULL || !valid_item_map(map, size)
+      || item_map_count(map) != (uint32_t)num_keys) {
+    printf("Map of %d stories is not valid!\n", num_keys);
+    free(map);
+    return 0;
+  }
+  if (num_keys >= 100000 && size >= 7 * (size_t)num_keys) {
+    printf("Map of %d stories takes %lu bytes!\n", num_keys,
+        (unsigned long)size);
+    success = 0;
+  }
+  if (valid_item_map(map, size - 1)) {
+    puts("Accepted a truncated map!");
+    success = 0;
+  }
+
+  // Make the last bucket's codes start after the end of the directory
+  byte *end = map + ITEM_MAP_HEADER_SIZE + ITEM_MAP_DIRECTORY_SIZE(map[6]) - 1;
+  *end ^= 0x80;
+  if (valid_item_map(map, size)) {
+    puts("Accepted a map with a corrupt directory!");
+    success = 0;
+  }
+  *end ^= 0x80;
+
+  for (int i = 0; success && i < num_keys; i++) {
+    uint32_t id = lookup_item_map(map, (byte *)key, make_key(key, i));
+    if (id != (uint32_t)(40000000 - i)) {
+      printf("Found item %u for story %d!\n", id, i);
+      success = 0;
+    }
+  }
+  for (int i = num_keys; success && i < 2 * num_keys; i++) {
+    if (lookup_item_map(map, (byte *)key, make_key(key, i)) != 0) {
+      printf("Found an item for story %d, which is not in the map!\n", i);
+      success = 0;
+    }
+  }
+
+  free(map);
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing the story item map...\n");
+
+  puts("Testing a map built from the fixture...");
+  success = success && test_fixture();
+
+  int sizes[] = { 1, 2, 1000, 1 << 18 };
+  for (size_t i = 0; success && i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    printf("Testing a map of %d stories...\n", sizes[i]);
+    success = success && test_many(sizes[i]);
+  }
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
@@ -0,0 +1,195 @@
+/* test/line-reader-test.c
+ *
+ * Run tests on the line reader used by the command-line tools, reading the
+ * same lines from a memory-mapped file, a gzipped file, and a pipe. Should be
+ * compiled with a small READER_BLOCK_SIZE so lines cross block boundaries.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "line-reader.h"
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+#define LONG_LINE_LENGTH (READER_BLOCK_SIZE * 5 + 3)
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Build input with empty lines, carriage returns, a line longer than a block,
+ * and no newline at the end, along with the lines expected from reading it.
+ */
+size_t make_input(char **input, char **expected, size_t *lengths) {
+  static char long_line[LONG_LINE_LENGTH + 1];
+  memset(long_line, 'x', LONG_LINE_LENGTH);
+  long_line[LONG_LINE_LENGTH] = '\0';
+
+  char *lines[] = {
+    "https://news.ycombinator.com",
+    "",
+    "//example.com/path?q=1",
+    long_line,
+    "a",
+    "",
+    "windows line",
+    "\r",
+    "last line without a newline",
+  };
+  char *endings[] = { "\n", "\n", "\n", "\n", "\n", "\n", "\r\n", "\n", "" };
+  size_t n = sizeof(lines) / sizeof(lines[0]);
+
+  size_t size = 0;
+  for (size_t i = 0; i < n; i++) {
+    size += strlen(lines[i]) + strlen(endings[i]);
+  }
+  *input = malloc(size + 1);
+  (*input)[0] = '\0';
+  for (size_t i = 0; i < n; i++) {
+    strcat(*input, lines[i]);
+    strcat(*input, endings[i]);
+
+    // Only one trailing carriage return is stripped
+    expected[i] = lines[i];
+    lengths[i] = strcmp(lines[i], "\r") == 0 ? 0 : strlen(lines[i]);
+  }
+
+  return n;
+}
+
+
+/***
+ * Read every line and compare it to the expected lines.
+ */
+int check_lines(line_reader *reader, char **expected, size_t *lengths,
+    size_t n, char *name) {
+  if (reader == NULL) {
+    printf("Unable to open %s!\n", name);
+    return 0;
+  }
+
+  char *line;
+  size_t length, i = 0;
+  int success = 1;
+  while (next_line(reader, &line, &length)) {
+    if (i >= n || length != lengths[i]
+        || memcmp(line, expected[i], length) != 0) {
+      printf("Line %d of %s does not match!\n", (int)i, name);
+      success = 0;
+      break;
+    }
+    i++;
+  }
+  if (success && i != n) {
+    printf("Expected %d lines from %s, got %d!\n", (int)n, name, (int)i);
+    success = 0;
+  }
+
+  close_line_reader(reader);
+  return success;
+}
+
+
+/***
+ * Blocks must only end on line boundaries (or at the end of the input), and
+ * must cover the whole input.
+ */
+int test_blocks(char *filename, char *input) {
+  int success = 1;
+  line_reader *reader = open_line_reader(filename);
+  size_t total = 0;
+  char *start, *end;
+  while (next_block(reader, &start, &end)) {
+    if (memcmp(start, input + total, end - start) != 0) {
+      puts("Block does not match the input!");
+      success = 0;
+      break;
+    }
+    total += end - start;
+    if (total < strlen(input) && end[-1] != '\n') {
+      puts("Block ended in the middle of a line!");
+      success = 0;
+      break;
+    }
+  }
+  if (success && total != strlen(input)) {
+    puts("Blocks did not cover the whole input!");
+    success = 0;
+  }
+  close_line_reader(reader);
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing line reader...\n");
+
+  char *input, *expected[16];
+  size_t lengths[16];
+  size_t n = make_input(&input, expected, lengths);
+
+  char *tempfilename = "/tmp/delete-line-reader.txt";
+  FILE *f = fopen(tempfilename, "wb");
+  fputs(input, f);
+  fclose(f);
+
+  char *gzfilename = "/tmp/delete-line-reader.txt.gz";
+  gzFile gz = gzopen(gzfilename, "wb");
+  gzputs(gz, input);
+  gzclose(gz);
+
+  char *emptyfilename = "/tmp/delete-line-reader-empty.txt";
+  fclose(fopen(emptyfilename, "wb"));
+
+  success = success && check_lines(open_line_reader(tempfilename), expected,
+      lengths, n, "mapped file");
+  success = success && check_lines(open_line_reader(gzfilename), expected,
+      lengths, n, "gzipped file");
+  success = success && check_lines(open_line_reader(emptyfilename), expected,
+      lengths, 0, "empty file");
+  success = success && test_blocks(tempfilename, input);
+  success = success && test_blocks(gzfilename, input);
+
+  // Read from a pipe on standard input, which cannot be mapped. The input is
+  // small enough to fit in the pipe's buffer before anything reads it.
+  int fds[2];
+  if (success && pipe(fds) == 0) {
+    if (write(fds[1], input, strlen(input)) != (ssize_t)strlen(input)) {
+      puts("Unable to write to pipe!");
+      success = 0;
+    }
+    close(fds[1]);
+    dup2(fds[0], STDIN_FILENO);
+    close(fds[0]);
+    success = success && check_lines(open_line_reader(NULL), expected,
+        lengths, n, "standard input");
+  }
+
+  remove(tempfilename);
+  remove(gzfilename);
+  remove(emptyfilename);
+  free(input);
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
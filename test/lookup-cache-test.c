@@ -0,0 +1,150 @@
+/* test/lookup-cache-test.c
+ *
+ * Run tests on the lookup result cache. Will print to standard output if run
+ * in a terminal, will print to the browser console if compiled using
+ * emscripten and loaded into the browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lookup-cache.h"
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Return the fingerprint of a distinct test key for index i.
+ */
+uint64_t key_fingerprint(int i) {
+  char key[64];
+  int length = sprintf(key, "//example.com/story/%d", i);
+  return lookup_fingerprint((byte *)key, length);
+}
+
+
+/***
+ * Cache fewer results than there are entries, and check that each one comes
+ * back with its value, that values can be replaced, and that keys that were
+ * never cached miss.
+ */
+int test_get_put(uint8_t num_bits) {
+  int success = 1;
+  lookup_cache *cache = new_lookup_cache(num_bits);
+  int n = (1 << num_bits) / 2;
+
+  for (int i = 0; i < n; i++) {
+    put_lookup_cache(cache, key_fingerprint(i), i);
+  }
+
+  // With half the entries used and four probes, a few results may have been
+  // evicted, but almost all should still be there
+  int hits = 0;
+  for (int i = 0; success && i < n; i++) {
+    int32_t value;
+    if (get_lookup_cache(cache, key_fingerprint(i), &value)) {
+      hits++;
+      if (value != i) {
+        printf("Expected cached value %d, got %d!\n", i, value);
+        success = 0;
+      }
+    }
+  }
+  if (success && hits < n * 9 / 10) {
+    printf("Only %d of %d cached results were found!\n", hits, n);
+    success = 0;
+  }
+
+  for (int i = n; success && i < 2 * n; i++) {
+    int32_t value;
+    if (get_lookup_cache(cache, key_fingerprint(i), &value)) {
+      printf("Found a result for key %d that was never cached!\n", i);
+      success = 0;
+    }
+  }
+
+  // Replacing a value must not leave the old one behind
+  put_lookup_cache(cache, key_fingerprint(0), -1);
+  int32_t value;
+  if (success && (!get_lookup_cache(cache, key_fingerprint(0), &value)
+        || value != -1)) {
+    puts("Cached value was not replaced!");
+    success = 0;
+  }
+
+  free_lookup_cache(cache);
+
+  return success;
+}
+
+
+/***
+ * Invalidating the cache must forget every result, including across the
+ * generation counter wrapping around.
+ */
+int test_invalidate() {
+  int success = 1;
+  lookup_cache *cache = new_lookup_cache(8);
+  int32_t value;
+
+  for (int round = 0; success && round < 3; round++) {
+    for (int i = 0; i < 64; i++) {
+      put_lookup_cache(cache, key_fingerprint(i), round);
+    }
+    invalidate_lookup_cache(cache);
+    for (int i = 0; success && i < 64; i++) {
+      if (get_lookup_cache(cache, key_fingerprint(i), &value)) {
+        printf("Result for key %d survived invalidation!\n", i);
+        success = 0;
+      }
+    }
+  }
+
+  put_lookup_cache(cache, key_fingerprint(0), 7);
+  cache->generation = 0xffffffffu;
+  put_lookup_cache(cache, key_fingerprint(1), 8);
+  invalidate_lookup_cache(cache);
+  if (success && (cache->generation == 0
+        || get_lookup_cache(cache, key_fingerprint(0), &value)
+        || get_lookup_cache(cache, key_fingerprint(1), &value))) {
+    puts("Results survived the generation wrapping around!");
+    success = 0;
+  }
+
+  free_lookup_cache(cache);
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing lookup cache library...\n");
+
+  if (new_lookup_cache(0) != NULL || new_lookup_cache(28) != NULL) {
+    puts("Invalid sizes should not allocate a cache!");
+    success = 0;
+  }
+
+  for (uint8_t i = 2; success && i < 16; i++) {
+    printf("Testing a lookup cache of size %d...\n", (int)i);
+    success = success && test_get_put(i);
+  }
+
+  success = success && test_invalidate();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
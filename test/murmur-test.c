@@ -31,6 +31,30 @@ int run_test(uint8_t *input, int length, uint32_t seed, uint32_t expected) {
 }
 
 
+/***
+ * Hash every prefix of input incrementally, the way prefix filters do, and
+ * check each against hashing the prefix all at once.
+ */
+int run_incremental_test(uint8_t *input, int length, uint32_t seed) {
+  murmur3_state state;
+  murmur3_init(&state, seed);
+  int hashed = 0;
+  for (int end = 0; end <= length; end++) {
+    murmur3_update(&state, input + hashed, (end & ~3) - hashed);
+    hashed = end & ~3;
+    uint32_t result = murmur3_final(&state, input + hashed, end - hashed);
+    uint32_t expected = murmur3(input, end, seed);
+    if (result != expected) {
+      printf("Prefix of length %d  |  Expected: 0x%08x  |  Got: 0x%08x\n",
+          end, expected, result);
+      return 0;
+    }
+  }
+  printf("Hashed all %d prefixes incrementally\n", length + 1);
+  return 1;
+}
+
+
 
 /*******************************************************************************
  * Main function
@@ -108,6 +132,10 @@ int main(int argc, char *argv[]) {
   uint8_t input13[] = "The quick brown fox jumps over the lazy dog";
   success = success && run_test((uint8_t *)&input13, 43, 0x9747b28c, 0x2fa826cd);
 
+  success = success && run_incremental_test((uint8_t *)&input13, 43, 0);
+  success = success && run_incremental_test((uint8_t *)&input10, 256,
+      0x9747b28c);
+
   puts("");
   puts(success ? "Succeeded!" : "Failed!");
   puts("");
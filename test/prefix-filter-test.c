@@ -0,0 +1,177 @@
+/* test/prefix-filter-test.c
+ *
+ * Run tests on the filter of URL path prefixes. Will print to standard output
+ * if run in a terminal, will print to the browser console if compiled using
+ * emscripten and loaded into the browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefix-filter.h"
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+#define PREFIX_BITS 18
+#define NUM_SITES 1000
+#define POSTS_PER_SITE 5
+
+
+
+/*******************************************************************************
+ * Test functions
+ ******************************************************************************/
+
+/***
+ * Prefixes must end after the host and before each / in the path, ignoring
+ * queries, fragments, and empty path segments.
+ */
+int test_url_prefixes() {
+  int success = 1;
+
+  struct { char *url; int count; uint32_t ends[PREFIX_MAX_DEPTH]; } cases[] = {
+    { "//example.com/blog/2021/post", 4, { 13, 18, 23, 28 } },
+    { "//example.com/blog/2021/post?a=1/2", 4, { 13, 18, 23, 28 } },
+    { "//example.com/blog#a/b", 2, { 13, 18 } },
+    { "//example.com/blog//post/", 3, { 13, 18, 24 } },
+    { "//example.com", 1, { 13 } },
+    { "//example.com?q=1", 1, { 13 } },
+    { "https://example.com/a", 2, { 19, 21 } },
+    { "//x.com/1/2/3/4/5/6/7/8/9/10", PREFIX_MAX_DEPTH,
+      { 7, 9, 11, 13, 15, 17, 19, 21 } },
+    { "//", 0, { 0 } },
+    { "", 0, { 0 } },
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    uint32_t ends[PREFIX_MAX_DEPTH];
+    int count = url_prefixes((byte *)cases[i].url, strlen(cases[i].url),
+        ends);
+    int matches = count == cases[i].count;
+    for (int j = 0; matches && j < count; j++) {
+      matches = ends[j] == cases[i].ends[j];
+    }
+    if (!matches) {
+      printf("Found %d prefixes of \"%s\", expected %d:\n", count,
+          cases[i].url, cases[i].count);
+      for (int j = 0; j < count; j++) {
+        printf("%.*s\n", (int)ends[j], cases[i].url);
+      }
+      success = 0;
+    }
+  }
+
+  return success;
+}
+
+
+/***
+ * Prefixes added in one pass with incremental hashes must be found when each
+ * prefix is hashed separately, and the other way around.
+ */
+int test_incremental() {
+  int success = 1;
+  char *url = "//example.com/a/bc/def/ghij/klmno/pqrstu";
+  uint32_t ends[PREFIX_MAX_DEPTH];
+  int count = url_prefixes((byte *)url, strlen(url), ends);
+
+  byte *prefixes = new_bloom(PREFIX_BITS);
+  add_url_prefixes(prefixes, PREFIX_BITS, (byte *)url, strlen(url));
+  for (int i = 0; i < count; i++) {
+    if (!in_prefix_filter(prefixes, PREFIX_BITS, (byte *)url, ends[i])) {
+      printf("Prefix %.*s not found!\n", (int)ends[i], url);
+      success = 0;
+    }
+  }
+  free_bloom(prefixes);
+
+  // Adding only some prefixes one at a time makes them the longest found
+  for (int i = 0; success && i < count; i++) {
+    prefixes = new_bloom(PREFIX_BITS);
+    for (int j = 0; j <= i; j++) {
+      add_prefix_filter(prefixes, PREFIX_BITS, (byte *)url, ends[j]);
+    }
+    uint32_t longest = longest_url_prefix(prefixes, PREFIX_BITS, (byte *)url,
+        strlen(url));
+    if (longest != ends[i]) {
+      printf("Longest prefix found was %.*s, expected %.*s!\n", (int)longest,
+          url, (int)ends[i], url);
+      success = 0;
+    }
+    free_bloom(prefixes);
+  }
+
+  return success;
+}
+
+
+/***
+ * Pages under sections with stories must find the section, and pages on sites
+ * that were never added must almost always find nothing.
+ */
+int test_lookups() {
+  int success = 1;
+  char url[128];
+
+  byte *prefixes = new_bloom(PREFIX_BITS);
+  for (int s = 0; s < NUM_SITES; s++) {
+    for (int i = 0; i < POSTS_PER_SITE; i++) {
+      int length = sprintf(url, "//site%d.example.com/blog/%d/post", s, i);
+      add_url_prefixes(prefixes, PREFIX_BITS, (byte *)url, length);
+    }
+  }
+
+  for (int s = 0; success && s < NUM_SITES; s++) {
+    // A new post in a year with stories finds the year
+    int length = sprintf(url, "//site%d.example.com/blog/0/new-post", s);
+    uint32_t longest = longest_url_prefix(prefixes, PREFIX_BITS, (byte *)url,
+        length);
+    uint32_t expected = sprintf(url, "//site%d.example.com/blog/0", s);
+    if (longest < expected) {
+      printf("Longest prefix of %s was only %.*s!\n", url, (int)longest, url);
+      success = 0;
+    }
+  }
+
+  int trials = 100000;
+  int positives = 0;
+  for (int s = NUM_SITES; s < NUM_SITES + trials; s++) {
+    int length = sprintf(url, "//site%d.example.com/blog/0/post", s);
+    positives += longest_url_prefix(prefixes, PREFIX_BITS, (byte *)url,
+        length) > 0;
+  }
+  printf("Prefix filter false positive rate %f\n", (double)positives / trials);
+  if (positives > trials / 100) {
+    puts("Prefix filter false positive rate is too high!");
+    success = 0;
+  }
+
+  free_bloom(prefixes);
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing prefix filter...\n");
+
+  success = success && test_url_prefixes();
+  success = success && test_incremental();
+  success = success && test_lookups();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
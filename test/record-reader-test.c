@@ -0,0 +1,230 @@
+/* test/record-reader-test.c
+ *
+ * Run tests on reading stories from CSV and JSON Lines input, and on parsing
+ * their scores and times.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record-reader.h"
+
+
+/*******************************************************************************
+ * Types and constants
+ ******************************************************************************/
+
+// Expected field values, where NULL means the field is missing
+struct expected {
+  char *url;
+  char *score;
+  char *time;
+};
+
+char *field_names[NUM_FIELDS] = { "url", "score", "time" };
+
+char *csv_input =
+  "title,url,score,descendants,time\n"
+  "Plain,https://example.com,10,2,1600000000\n"
+  "\"Quoted, with comma\",\"https://example.com/a,b\",\"5\",0,1600000001\r\n"
+  "\n"
+  "\"Doubled \"\"quotes\"\"\",\"https://example.com/?q=\"\"x\"\"\",,1,\n"
+  "\"Multi\n"
+  "line \"\"title\"\"\n"
+  "\",https://example.com/multi,7,0,1600000002\n"
+  "Short row,https://example.com/short\n"
+  "Broken,\"https://example.com/unclosed";
+
+struct expected csv_expected[] = {
+  { "https://example.com", "10", "1600000000" },
+  { "https://example.com/a,b", "5", "1600000001" },
+  { "https://example.com/?q=\"x\"", "", "" },
+  { "https://example.com/multi", "7", "1600000002" },
+  { "https://example.com/short", NULL, NULL },
+};
+
+char *jsonl_input =
+  "{\"url\": \"https://example.com\", \"score\": 10, \"time\": 1600000000}\n"
+  "  {\"time\":\"1600000001\",\"kids\":[1,{\"url\":\"}\"}],"
+    "\"url\":\"https:\\/\\/example.com\\/\\u00e9\\ud83d\\ude00\"}\n"
+  "{\"url\": \"first\", \"url\": \"https://example.com/last\", "
+    "\"score\": null}\n"
+  "\n"
+  "{\"url\": \"https://example.com/bad\\q\"}\n"
+  "{}\n"
+  "not json\n";
+
+struct expected jsonl_expected[] = {
+  { "https://example.com", "10", "1600000000" },
+  { "https://example.com/\xc3\xa9\xf0\x9f\x98\x80", NULL, "1600000001" },
+  { "https://example.com/last", NULL, NULL },
+  { NULL, NULL, NULL },
+};
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Compare one field of a record to its expected value.
+ */
+int check_field(record *r, int f, char *expected) {
+  if (expected == NULL) {
+    return r->fields[f] == NULL;
+  }
+  return r->fields[f] != NULL && r->lengths[f] == strlen(expected)
+    && memcmp(r->fields[f], expected, r->lengths[f]) == 0;
+}
+
+
+/***
+ * Write the input to a file, read it back, and compare the records to the
+ * expected ones. Malformed records are counted rather than compared.
+ */
+int test_format(record_format format, char *input, struct expected *expected,
+    int num_expected, int num_malformed, char *name) {
+  char *tempfilename = "/tmp/delete-record-reader.txt";
+  FILE *f = fopen(tempfilename, "wb");
+  fputs(input, f);
+  fclose(f);
+
+  int success = 1;
+  record_reader *reader = open_record_reader(tempfilename, format,
+      field_names);
+  if (reader == NULL) {
+    printf("Unable to open %s input!\n", name);
+    return 0;
+  }
+
+  record r;
+  int status, i = 0, malformed = 0;
+  while ((status = next_record(reader, &r)) != 0) {
+    if (status < 0) {
+      malformed++;
+      continue;
+    }
+    if (i >= num_expected || !check_field(&r, FIELD_URL, expected[i].url)
+        || !check_field(&r, FIELD_SCORE, expected[i].score)
+        || !check_field(&r, FIELD_TIME, expected[i].time)) {
+      printf("Record %d of %s input does not match!\n", i, name);
+      success = 0;
+    }
+    i++;
+  }
+  if (i != num_expected || malformed != num_malformed) {
+    printf("Expected %d records and %d malformed from %s input, got %d and "
+        "%d!\n", num_expected, num_malformed, name, i, malformed);
+    success = 0;
+  }
+
+  close_record_reader(reader);
+  remove(tempfilename);
+  return success;
+}
+
+
+/***
+ * A CSV file without a URL column cannot be read.
+ */
+int test_missing_column() {
+  char *tempfilename = "/tmp/delete-record-reader.txt";
+  FILE *f = fopen(tempfilename, "wb");
+  fputs("link,score\nhttps://example.com,1\n", f);
+  fclose(f);
+
+  record_reader *reader = open_record_reader(tempfilename, FORMAT_CSV,
+      field_names);
+  remove(tempfilename);
+  if (reader != NULL) {
+    puts("Opened CSV input without a URL column!");
+    close_record_reader(reader);
+    return 0;
+  }
+  return 1;
+}
+
+
+/***
+ * Scores and times must parse the way the generation workflow expects.
+ */
+int test_parsing() {
+  int success = 1;
+
+  struct { char *value; int valid; int64_t score; } scores[] = {
+    { "42", 1, 42 }, { " 7 ", 1, 7 }, { "-3", 1, -3 }, { "12.5", 1, 12 },
+    { "", 0, 0 }, { "abc", 0, 0 }, { "12abc", 0, 0 }, { "-", 0, 0 },
+  };
+  for (size_t i = 0; i < sizeof(scores) / sizeof(scores[0]); i++) {
+    int64_t score = 0;
+    int valid = parse_score(scores[i].value, strlen(scores[i].value), &score);
+    if (valid != scores[i].valid || (valid && score != scores[i].score)) {
+      printf("Parsed score \"%s\" incorrectly!\n", scores[i].value);
+      success = 0;
+    }
+  }
+
+  struct { char *value; int valid; int64_t time; } times[] = {
+    { "1600000000", 1, 1600000000 },
+    { "1600000000.75", 1, 1600000000 },
+    { "1970-01-01", 1, 0 },
+    { "2020-09-13T12:26:40Z", 1, 1600000000 },
+    { "2020-09-13 12:26:40 UTC", 1, 1600000000 },
+    { "2020-09-13 12:26", 1, 1599999960 },
+    { "2000-02-29", 1, 951782400 },
+    { "", 0, 0 },
+    { "yesterday", 0, 0 },
+    { "2020-13-01", 0, 0 },
+    { "2020-09-13T25:00", 0, 0 },
+  };
+  for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+    int64_t time = 0;
+    int valid = parse_time(times[i].value, strlen(times[i].value), &time);
+    if (valid != times[i].valid || (valid && time != times[i].time)) {
+      printf("Parsed time \"%s\" incorrectly!\n", times[i].value);
+      success = 0;
+    }
+  }
+
+  // Formatting a date must give back the start of the same day
+  for (int64_t time = -86400 * 800; time < 86400LL * 40000; time += 86399) {
+    char date[11];
+    int64_t parsed;
+    if (format_date(time, date) != 10 || !parse_time(date, 10, &parsed)
+        || parsed > time || time - parsed >= 86400) {
+      printf("Formatted time %lld incorrectly as %s!\n", (long long)time,
+          date);
+      success = 0;
+      break;
+    }
+  }
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing record reader...\n");
+
+  success = success && test_format(FORMAT_CSV, csv_input, csv_expected,
+      sizeof(csv_expected) / sizeof(csv_expected[0]), 1, "CSV");
+  success = success && test_format(FORMAT_JSONL, jsonl_input, jsonl_expected,
+      sizeof(jsonl_expected) / sizeof(jsonl_expected[0]), 2, "JSON Lines");
+  success = success && test_missing_column();
+  success = success && test_parsing();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
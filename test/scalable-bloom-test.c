@@ -0,0 +1,206 @@
+/* test/scalable-bloom-test.c
+ *
+ * Run tests on the scalable Bloom filter implementation. Will print to
+ * standard output if run in a terminal, will print to the browser console if
+ * compiled using emscripten and loaded into the browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "scalable-bloom.h"
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Write a distinct test key for index i into buffer, returning its length.
+ */
+int make_key(char *buffer, int i) {
+  return sprintf(buffer, "//news.example.com/item/%d", i);
+}
+
+
+/***
+ * Ensure that keys [0, n) are all in the filter.
+ */
+int test_in(scalable_bloom *filter, int n) {
+  char key[64];
+  for (int i = 0; i < n; i++) {
+    int length = make_key(key, i);
+    if (!in_scalable_bloom(filter, (byte *)key, length)) {
+      printf("False negative:\n%s\n", key);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+/***
+ * Measure the false positive rate on keys that were never added and make sure
+ * it stays under the bound of twice the first layer's rate (with some slack
+ * for randomness).
+ */
+int test_false_positives(scalable_bloom *filter, int n) {
+  char key[64];
+  int trials = 200000;
+  int false_positives = 0;
+  for (int i = n; i < n + trials; i++) {
+    int length = make_key(key, i);
+    false_positives += in_scalable_bloom(filter, (byte *)key, length);
+  }
+
+  double rate = (double)false_positives / trials;
+  double bound = 2.0 / (1 << filter->base_hashes);
+  printf("Observed false positive rate %f with %d layers (bound %f)\n", rate,
+      (int)filter->num_layers, bound);
+  return rate < 1.5 * bound;
+}
+
+
+/***
+ * Write the filter out and read it back, making sure it is identical.
+ */
+int test_compression(scalable_bloom *filter) {
+  char *tempfilename = "/tmp/delete-scalable.bloom";
+  write_compressed_scalable_bloom(tempfilename, filter);
+
+  FILE *tempfile;
+  if ((tempfile = fopen(tempfilename, "rb")) == NULL) {
+    puts("Failed to open compressed file!");
+    return 0;
+  }
+  fseek(tempfile, 0l, SEEK_END);
+  long length = ftell(tempfile);
+  rewind(tempfile);
+  byte *compressed = (byte *)malloc(length);
+  if (fread(compressed, 1, length, tempfile) != (size_t)length) {
+    puts("Could not read from compressed file!");
+    return 0;
+  }
+  fclose(tempfile);
+
+  scalable_bloom *copy = decompress_scalable_bloom(compressed, length);
+  size_t raw_size = decompressed_bloom_size(compressed, length);
+  byte *raw = (byte *)calloc(raw_size + 1, 1);
+  if (raw == NULL
+      || !decompress_bloom_into(compressed, length, raw, raw_size)) {
+    puts("Could not inflate the compressed file!");
+    return 0;
+  }
+  free(compressed);
+  if (copy == NULL) {
+    puts("Could not decompress the scalable Bloom filter!");
+    return 0;
+  }
+
+  int success = copy->num_layers == filter->num_layers
+    && copy->count == filter->count
+    && copy->base_bits == filter->base_bits
+    && copy->base_hashes == filter->base_hashes;
+  for (uint8_t i = 0; success && i < filter->num_layers; i++) {
+    success = memcmp(copy->layers[i], filter->layers[i],
+        (size_t)1 << (scalable_layer_bits(filter, i) - 3)) == 0;
+  }
+  if (!success) {
+    puts("Decompressed scalable Bloom filter does not match!");
+  }
+
+  free_scalable_bloom(copy);
+
+  // Bytes after the last layer must be rejected, not ignored
+  gzFile outfile = gzopen(tempfilename, "wb9");
+  if (outfile == NULL || gzwrite(outfile, raw, raw_size + 1) == 0) {
+    puts("Could not write a padded filter!");
+    return 0;
+  }
+  gzclose_w(outfile);
+  free(raw);
+  if ((tempfile = fopen(tempfilename, "rb")) == NULL) {
+    puts("Failed to open padded file!");
+    return 0;
+  }
+  fseek(tempfile, 0l, SEEK_END);
+  length = ftell(tempfile);
+  rewind(tempfile);
+  compressed = (byte *)malloc(length);
+  if (fread(compressed, 1, length, tempfile) != (size_t)length) {
+    puts("Could not read from padded file!");
+    return 0;
+  }
+  fclose(tempfile);
+  remove(tempfilename);
+  if ((copy = decompress_scalable_bloom(compressed, length)) != NULL) {
+    puts("Decompressed a scalable Bloom filter with trailing bytes!");
+    free_scalable_bloom(copy);
+    success = 0;
+  }
+  free(compressed);
+
+  // Garbage must be rejected rather than crash
+  byte garbage[] = "definitely not a gzip stream";
+  if (decompress_scalable_bloom(garbage, sizeof(garbage)) != NULL) {
+    puts("Decompressed garbage into a scalable Bloom filter!");
+    success = 0;
+  }
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+  char key[64];
+
+  puts("Testing scalable Bloom filter library...\n");
+
+  if (new_scalable_bloom(2, 8) != NULL || new_scalable_bloom(12, 0) != NULL
+      || new_scalable_bloom(12, SCALABLE_MAX_HASHES + 1) != NULL) {
+    puts("Invalid parameters should not allocate a filter!");
+    success = 0;
+  }
+
+  // Start small so that adding keys forces several new layers
+  scalable_bloom *filter = new_scalable_bloom(12, 8);
+  int n = 0;
+  for (int layers = 1; success && layers <= 6; layers++) {
+    while (filter->num_layers < layers) {
+      int length = make_key(key, n++);
+      success = success && add_scalable_bloom(filter, (byte *)key, length);
+    }
+    printf("Testing with %d layers and %d elements...\n", layers, n);
+    success = success && test_in(filter, n);
+  }
+
+  // Re-adding existing keys must not use up capacity
+  uint32_t count = filter->count;
+  for (int i = 0; success && i < n; i++) {
+    int length = make_key(key, i);
+    add_scalable_bloom(filter, (byte *)key, length);
+  }
+  if (success && filter->count != count) {
+    puts("Re-adding existing keys changed the count!");
+    success = 0;
+  }
+
+  success = success && test_false_positives(filter, n);
+  success = success && test_compression(filter);
+
+  free_scalable_bloom(filter);
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}
@@ -0,0 +1,251 @@
+/* test/sharded-bloom-test.c
+ *
+ * Run tests on the sharded Bloom filter implementation, including that
+ * lookups only load the shards they need. Will print to standard output if run
+ * in a terminal, will print to the browser console if compiled using
+ * emscripten and loaded into the browser.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sharded-bloom.h"
+
+
+/*******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+#define FILTER_BITS 20
+#define NUM_KEYS 5000
+
+
+
+/*******************************************************************************
+ * Helper functions
+ ******************************************************************************/
+
+/***
+ * Write a distinct test key for index i into buffer, returning its length.
+ */
+int make_key(char *buffer, int i) {
+  return sprintf(buffer, "//news.example.com/item/%d", i);
+}
+
+
+/***
+ * Read a whole file into a newly allocated buffer, storing its length.
+ */
+byte *read_file(char *filename, size_t *length) {
+  FILE *f;
+  if ((f = fopen(filename, "rb")) == NULL) {
+    return NULL;
+  }
+  fseek(f, 0l, SEEK_END);
+  *length = ftell(f);
+  rewind(f);
+  byte *buffer = (byte *)malloc(*length);
+  if (fread(buffer, 1, *length, f) != *length) {
+    free(buffer);
+    buffer = NULL;
+  }
+  fclose(f);
+  return buffer;
+}
+
+
+/***
+ * Build a sharded filter, write it out, and read it back in.
+ */
+byte *make_filter(char *tempfilename, int num_keys, size_t *length) {
+  char key[64];
+  byte *bloom = new_bloom(FILTER_BITS);
+  for (int i = 0; i < num_keys; i++) {
+    add_sharded_bloom(bloom, FILTER_BITS, (byte *)key, make_key(key, i));
+  }
+  write_sharded_bloom(tempfilename, bloom, FILTER_BITS);
+  free_bloom(bloom);
+  return read_file(tempfilename, length);
+}
+
+
+/***
+ * Every added key must be found, a lookup must load only its own shard, and
+ * the false positive rate must be close to that of a plain filter.
+ */
+int test_lookups() {
+  int success = 1;
+  char key[64];
+  char *tempfilename = "/tmp/delete-sharded.bloom";
+
+  size_t length = 0;
+  byte *data = make_filter(tempfilename, NUM_KEYS, &length);
+  sharded_bloom *filter = open_sharded_bloom(data, length, NULL);
+  if (filter == NULL) {
+    puts("Could not open sharded filter!");
+    return 0;
+  }
+
+  // One lookup loads exactly one shard, and does not need any others
+  int key_length = make_key(key, 0);
+  uint8_t shard = shard_index((byte *)key, key_length);
+  if (in_shard(filter, shard, (byte *)key, key_length) != -1) {
+    puts("Checked a shard that was not loaded!");
+    success = 0;
+  }
+  if (in_sharded_bloom(filter, (byte *)key, key_length) != 1
+      || filter->num_loaded != 1 || !shard_loaded(filter, shard)) {
+    printf("Expected 1 loaded shard, got %d!\n", filter->num_loaded);
+    success = 0;
+  }
+
+  for (int i = 0; i < NUM_KEYS; i++) {
+    key_length = make_key(key, i);
+    if (in_sharded_bloom(filter, (byte *)key, key_length) != 1) {
+      printf("False negative:\n%s\n", key);
+      success = 0;
+      break;
+    }
+  }
+
+  int trials = 100000;
+  int false_positives = 0;
+  for (int i = NUM_KEYS; i < NUM_KEYS + trials; i++) {
+    key_length = make_key(key, i);
+    false_positives += in_sharded_bloom(filter, (byte *)key, key_length);
+  }
+  printf("False positive rate %f with %d shards loaded\n",
+      (double)false_positives / trials, filter->num_loaded);
+  if (false_positives > trials / 1000) {
+    puts("False positive rate is too high!");
+    success = 0;
+  }
+
+  free_sharded_bloom(filter);
+  free(data);
+  remove(tempfilename);
+
+  return success;
+}
+
+
+/***
+ * Empty shards take no space in the file, and truncated or corrupted data
+ * must be rejected rather than read out of bounds.
+ */
+int test_format() {
+  int success = 1;
+  char key[64];
+  char *tempfilename = "/tmp/delete-sharded.bloom";
+
+  size_t length = 0;
+  byte *data = make_filter(tempfilename, 1, &length);
+  size_t expected_max = SHARDED_HEADER_SIZE + 1024;
+  if (length > expected_max) {
+    printf("Filter with one key is %d bytes, expected at most %d!\n",
+        (int)length, (int)expected_max);
+    success = 0;
+  }
+
+  sharded_bloom *filter = open_sharded_bloom(data, length, NULL);
+  int key_length = make_key(key, 1);
+  if (filter == NULL || in_sharded_bloom(filter, (byte *)key, key_length) != 0
+      || filter->shards[shard_index((byte *)key, key_length)] != NULL) {
+    puts("Empty shard was not handled correctly!");
+    success = 0;
+  }
+  free_sharded_bloom(filter);
+
+  if (open_sharded_bloom(data, length - 1, NULL) != NULL) {
+    puts("Opened a truncated filter!");
+    success = 0;
+  }
+  data[0] ^= 0xff;
+  if (open_sharded_bloom(data, length, NULL) != NULL) {
+    puts("Opened a filter with the wrong magic number!");
+    success = 0;
+  }
+
+  free(data);
+  remove(tempfilename);
+
+  return success;
+}
+
+
+
+/***
+ * A filter opened in a region allocates itself and its shards from it, and
+ * gives all of that memory back to the region when it is freed, so opening it
+ * again reserves nothing more.
+ */
+int test_region() {
+  int success = 1;
+  char key[64];
+  char *tempfilename = "/tmp/delete-sharded.bloom";
+
+  size_t length = 0;
+  byte *data = make_filter(tempfilename, NUM_KEYS, &length);
+  region *memory = new_region(1 << 12);
+  sharded_bloom *filter = open_sharded_bloom(data, length, memory);
+  if (filter == NULL) {
+    puts("Could not open sharded filter in a region!");
+    return 0;
+  }
+
+  for (int i = 0; i < NUM_KEYS; i += 100) {
+    int key_length = make_key(key, i);
+    if (in_sharded_bloom(filter, (byte *)key, key_length) != 1) {
+      printf("False negative:\n%s\n", key);
+      success = 0;
+      break;
+    }
+  }
+  size_t reserved = region_reserved(memory);
+  if (reserved == 0) {
+    puts("Shards were not allocated from the region!");
+    success = 0;
+  }
+
+  free_sharded_bloom(filter);
+  filter = open_sharded_bloom(data, length, memory);
+  for (int i = 0; filter != NULL && i < NUM_KEYS; i += 100) {
+    int key_length = make_key(key, i);
+    (void)in_sharded_bloom(filter, (byte *)key, key_length);
+  }
+  if (filter == NULL || region_reserved(memory) != reserved) {
+    printf("Region reserves %d bytes after reopening the filter, not %d!\n",
+        (int)region_reserved(memory), (int)reserved);
+    success = 0;
+  }
+  free_sharded_bloom(filter);
+
+  free_region(memory);
+  free(data);
+  remove(tempfilename);
+
+  return success;
+}
+
+
+
+/*******************************************************************************
+ * Main function
+ ******************************************************************************/
+
+int main(void) {
+  int success = 1;
+
+  puts("Testing sharded Bloom filter...\n");
+
+  success = success && test_lookups();
+  success = success && test_format();
+  success = success && test_region();
+
+  puts(success ? "Success!" : "Failure!");
+  puts("");
+
+  return !success;
+}